@@ -3,13 +3,35 @@ uniform sampler2DShadow shadowTex9;
 uniform samplerCube faceSelectionTex10;
 uniform samplerCube faceSelectionTex11;
 uniform usampler3D clusterTex12;
+uniform usampler2D lightIndexTex13;
+uniform sampler2D lightDataTex14;
 
+// Light data texture layout: 9 texels per light (position, direction, attenuation, color, shadow parameters, shadow matrix columns), 64 lights per row
+vec4 GetLightData(uint index, int texel)
+{
+    return texelFetch(lightDataTex14, ivec2(int(index % 64U) * 9 + texel, int(index / 64U)), 0);
+}
+
+mat4 GetLightShadowMatrix(uint index)
+{
+    return mat4(GetLightData(index, 5), GetLightData(index, 6), GetLightData(index, 7), GetLightData(index, 8));
+}
+
+// Light index texture layout: two 16-bit indices per texel, 1024 texels per row
+uint GetLightIndex(uint position)
+{
+    uint texel = position >> 1U;
+    uint indices = texelFetch(lightIndexTex13, ivec2(int(texel & 1023U), int(texel >> 10U)), 0).x;
+    return (position & 1U) != 0U ? (indices >> 16U) : (indices & 0xffffU);
+}
+
+// Cluster Z-slices are distributed quadratically over the view, or logarithmically over the visible geometry depth range if fitted
 vec3 CalculateClusterPos(vec2 screenPos, float depth)
 {
     return vec3(
         screenPos.x,
         screenPos.y,
-        sqrt(depth)
+        clusterParameters.x > 0.0 ? log(depth) * clusterParameters.y + clusterParameters.z : sqrt(depth)
     );
 }
 
@@ -79,8 +101,8 @@ void CalculateDirLight(vec4 worldPos, vec3 normal, vec4 matDiffColor, vec4 matSp
 
 vec4 GetPointShadowPos(uint index, vec3 lightVec)
 {
-    vec4 pointParameters = lights[index].shadowMatrix[0];
-    vec4 pointParameters2 = lights[index].shadowMatrix[1];
+    vec4 pointParameters = GetLightData(index, 5);
+    vec4 pointParameters2 = GetLightData(index, 6);
     float zoom = pointParameters2.x;
     float q = pointParameters2.y;
     float r = pointParameters2.z;
@@ -95,9 +117,8 @@ vec4 GetPointShadowPos(uint index, vec3 lightVec)
 
 void CalculateLight(uint index, vec4 worldPos, vec3 normal, vec4 matDiffColor, vec4 matSpecColor, inout vec3 diffuseLight, inout vec3 specularLight)
 {
-    vec3 lightPosition = lights[index].position.xyz;
-    vec4 lightAttenuation = lights[index].attenuation;
-    vec4 lightColor = lights[index].color;
+    vec3 lightPosition = GetLightData(index, 0).xyz;
+    vec4 lightAttenuation = GetLightData(index, 2);
 
     vec3 lightVec = lightPosition - worldPos.xyz;
     vec3 scaledLightVec = lightVec * lightAttenuation.x;
@@ -108,11 +129,12 @@ void CalculateLight(uint index, vec4 worldPos, vec3 normal, vec4 matDiffColor, v
     if (atten <= 0.0 || NdotL <= 0.0)
         return;
 
-    vec4 shadowParameters = lights[index].shadowParameters;
+    vec4 lightColor = GetLightData(index, 3);
+    vec4 shadowParameters = GetLightData(index, 4);
 
     if (lightAttenuation.y > 0.0)
     {
-        vec3 lightSpotDirection = lights[index].direction.xyz;
+        vec3 lightSpotDirection = GetLightData(index, 1).xyz;
         float spotEffect = dot(lightDir, lightSpotDirection);
         float spotAtten = (spotEffect - lightAttenuation.y) * lightAttenuation.z;
         if (spotAtten <= 0.0)
@@ -121,7 +143,7 @@ void CalculateLight(uint index, vec4 worldPos, vec3 normal, vec4 matDiffColor, v
         atten *= spotAtten;
 
         if (shadowParameters.z < 1.0)
-            atten *= clamp(shadowParameters.z + SampleShadowMap(shadowTex9, vec4(worldPos.xyz, 1.0) * lights[index].shadowMatrix, shadowParameters), 0.0, 1.0);
+            atten *= clamp(shadowParameters.z + SampleShadowMap(shadowTex9, vec4(worldPos.xyz, 1.0) * GetLightShadowMatrix(index), shadowParameters), 0.0, 1.0);
     }
     else if (shadowParameters.z < 1.0)
         atten *= clamp(shadowParameters.z + SampleShadowMap(shadowTex9, GetPointShadowPos(index, lightVec), shadowParameters), 0.0, 1.0);
@@ -144,26 +166,9 @@ void CalculateLighting(vec4 worldPos, vec3 normal, vec2 screenPos, vec4 matDiffC
 
     CalculateDirLight(worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
 
-    uvec4 lightClusterData = texture(clusterTex12, CalculateClusterPos(screenPos, worldPos.w));
+    uvec2 lightClusterData = texture(clusterTex12, CalculateClusterPos(screenPos, worldPos.w)).xy;
+    uint lightEnd = lightClusterData.x + lightClusterData.y;
 
-    while (lightClusterData.x > 0U)
-    {
-        CalculateLight((lightClusterData.x & 0xffU), worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
-        lightClusterData.x >>= 8U;
-    }
-    while (lightClusterData.y > 0U)
-    {
-        CalculateLight((lightClusterData.y & 0xffU), worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
-        lightClusterData.y >>= 8U;
-    }
-    while (lightClusterData.z > 0U)
-    {
-        CalculateLight((lightClusterData.z & 0xffU), worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
-        lightClusterData.z >>= 8U;
-    }
-    while (lightClusterData.w > 0U)
-    {
-        CalculateLight((lightClusterData.w & 0xffU), worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
-        lightClusterData.w >>= 8U;
-    }
+    for (uint i = lightClusterData.x; i < lightEnd; ++i)
+        CalculateLight(GetLightIndex(i), worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
 }
@@ -11,12 +11,61 @@ mat3x4 GetWorldMatrix()
 in vec4 blendWeights;
 in vec4 blendIndices;
 
+#ifdef DUALQUATERNION
+uniform mat3x4 worldMatrix;
+
+mat3x4 GetWorldMatrix()
+{
+    ivec4 indices = ivec4(blendIndices) * 2;
+    vec4 real0 = skinDualQuaternions[indices.x];
+    vec4 real1 = skinDualQuaternions[indices.y];
+    vec4 real2 = skinDualQuaternions[indices.z];
+    vec4 real3 = skinDualQuaternions[indices.w];
+
+    // Blend in the same hemisphere as the first bone's rotation to take the shortest path
+    vec3 signs = step(0.0, vec3(dot(real0, real1), dot(real0, real2), dot(real0, real3))) * 2.0 - 1.0;
+    vec4 weights = blendWeights * vec4(1.0, signs);
+
+    vec4 real = real0 * weights.x + real1 * weights.y + real2 * weights.z + real3 * weights.w;
+    vec4 dual = skinDualQuaternions[indices.x + 1] * weights.x + skinDualQuaternions[indices.y + 1] * weights.y +
+                skinDualQuaternions[indices.z + 1] * weights.z + skinDualQuaternions[indices.w + 1] * weights.w;
+
+    float invLength = 1.0 / length(real);
+    real *= invLength;
+    dual *= invLength;
+
+    // Convert to a model space matrix, rows stored in the columns like the engine's matrices
+    vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+    float xx = real.x * real.x;
+    float yy = real.y * real.y;
+    float zz = real.z * real.z;
+    float xy = real.x * real.y;
+    float xz = real.x * real.z;
+    float yz = real.y * real.z;
+    float wx = real.w * real.x;
+    float wy = real.w * real.y;
+    float wz = real.w * real.z;
+
+    mat3x4 skin = mat3x4(
+        vec4(1.0 - 2.0 * (yy + zz), 2.0 * (xy - wz), 2.0 * (xz + wy), translation.x),
+        vec4(2.0 * (xy + wz), 1.0 - 2.0 * (xx + zz), 2.0 * (yz - wx), translation.y),
+        vec4(2.0 * (xz - wy), 2.0 * (yz + wx), 1.0 - 2.0 * (xx + yy), translation.z)
+    );
+
+    return mat3x4(
+        worldMatrix[0].x * skin[0] + worldMatrix[0].y * skin[1] + worldMatrix[0].z * skin[2] + vec4(0.0, 0.0, 0.0, worldMatrix[0].w),
+        worldMatrix[1].x * skin[0] + worldMatrix[1].y * skin[1] + worldMatrix[1].z * skin[2] + vec4(0.0, 0.0, 0.0, worldMatrix[1].w),
+        worldMatrix[2].x * skin[0] + worldMatrix[2].y * skin[1] + worldMatrix[2].z * skin[2] + vec4(0.0, 0.0, 0.0, worldMatrix[2].w)
+    );
+}
+#else
 mat3x4 GetWorldMatrix()
 {
     ivec4 indices = ivec4(blendIndices);
     return skinMatrices[indices.x] * blendWeights.x + skinMatrices[indices.y] * blendWeights.y +
            skinMatrices[indices.z] * blendWeights.z + skinMatrices[indices.w] * blendWeights.w;
 }
+#endif
 #else
 uniform mat3x4 worldMatrix;
 
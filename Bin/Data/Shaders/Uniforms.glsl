@@ -8,6 +8,7 @@ layout(std140) uniform PerViewData0
     uniform vec4 ambientColor;
     uniform vec3 fogColor;
     uniform vec2 fogParameters;
+    uniform vec4 clusterParameters;
     uniform vec3 dirLightDirection;
     uniform vec4 dirLightColor;
     uniform vec4 dirLightShadowSplits;
@@ -15,25 +16,14 @@ layout(std140) uniform PerViewData0
     uniform mat4x4 dirLightShadowMatrices[2];
 };
 
-struct Light
-{
-    vec4 position;
-    vec4 direction;
-    vec4 attenuation;
-    vec4 color;
-    vec4 shadowParameters;
-    mat4 shadowMatrix;
-};
-
-layout(std140) uniform LightData1
-{
-    Light lights[256];
-};
-
 #ifdef SKINNED
 layout(std140) uniform PerObjectData2
 {
+#ifdef DUALQUATERNION
+    vec4 skinDualQuaternions[192];
+#else
     mat3x4 skinMatrices[96];
+#endif
 };
 #endif
 
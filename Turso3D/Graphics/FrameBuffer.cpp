@@ -12,11 +12,14 @@
 static FrameBuffer* boundDrawBuffer = nullptr;
 static FrameBuffer* boundReadBuffer = nullptr;
 
-FrameBuffer::FrameBuffer()
+FrameBuffer::FrameBuffer() :
+    buffer(0)
 {
-    assert(Object::Subsystem<Graphics>()->IsInitialized());
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    assert(graphics->IsInitialized());
 
-    glGenFramebuffers(1, &buffer);
+    if (!graphics->IsHeadless())
+        glGenFramebuffers(1, &buffer);
 }
 
 FrameBuffer::~FrameBuffer()
@@ -30,6 +33,9 @@ void FrameBuffer::Define(RenderBuffer* colorBuffer, RenderBuffer* depthStencilBu
 {
     ZoneScoped;
 
+    if (!buffer)
+        return;
+
     Bind();
 
     IntVector2 size = IntVector2::ZERO;
@@ -69,6 +75,9 @@ void FrameBuffer::Define(Texture* colorTexture, Texture* depthStencilTexture)
 {
     ZoneScoped;
 
+    if (!buffer)
+        return;
+
     Bind();
 
     IntVector2 size = IntVector2::ZERO;
@@ -108,6 +117,9 @@ void FrameBuffer::Define(Texture* colorTexture, size_t cubeMapFace, Texture* dep
 {
     ZoneScoped;
 
+    if (!buffer)
+        return;
+
     Bind();
 
     IntVector2 size = IntVector2::ZERO;
@@ -147,6 +159,9 @@ void FrameBuffer::Define(const std::vector<Texture*>& colorTextures, Texture* de
 {
     ZoneScoped;
 
+    if (!buffer)
+        return;
+
     Bind();
 
     IntVector2 size = IntVector2::ZERO;
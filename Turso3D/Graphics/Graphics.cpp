@@ -24,6 +24,9 @@ extern "C" {
 }
 #endif
 
+// Uniform buffer offset alignment in headless mode, or if the query fails. This is the largest value in common use
+static const size_t DEFAULT_UNIFORM_BUFFER_ALIGNMENT = 256;
+
 static const unsigned glPrimitiveTypes[] =
 {
     GL_LINES,
@@ -83,6 +86,20 @@ static const unsigned glBlendOp[] =
 
 unsigned occlusionQueryType = GL_SAMPLES_PASSED;
 
+GraphicsStatistics::GraphicsStatistics() :
+    numDraws(0),
+    numInstancedDraws(0),
+    numElements(0),
+    numInstances(0),
+    numStateChanges(0),
+    numFrameBufferChanges(0),
+    numViewportChanges(0),
+    numClears(0),
+    numBlits(0),
+    numOcclusionQueries(0)
+{
+}
+
 Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullScreenMode mode) :
     window(nullptr),
     context(nullptr),
@@ -94,8 +111,12 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullSc
     lastDepthBias(false),
     vsync(false),
     hasInstancing(false),
+    uniformBufferAlignment(DEFAULT_UNIFORM_BUFFER_ALIGNMENT),
     instancingEnabled(false),
-    lastFrameTime(0.0f)
+    lastFrameTime(0.0f),
+    headless(false),
+    headlessSize(IntVector2::ZERO),
+    nextHeadlessQuery(1)
 {
     RegisterSubsystem(this);
     RegisterGraphicsLibrary();
@@ -181,6 +202,11 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullSc
         glVertexAttribDivisorARB(ATTR_TEXCOORD5, 1);
     }
 
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment > 0)
+        uniformBufferAlignment = alignment;
+
     DefineQuadVertexBuffer();
 
     SetVSync(vsync);
@@ -188,6 +214,32 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullSc
 
 }
 
+Graphics::Graphics(const IntVector2& renderSize) :
+    window(nullptr),
+    context(nullptr),
+    lastBlendMode(MAX_BLEND_MODES),
+    lastCullMode(MAX_CULL_MODES),
+    lastDepthTest(MAX_COMPARE_MODES),
+    lastColorWrite(true),
+    lastDepthWrite(true),
+    lastDepthBias(false),
+    vsync(false),
+    hasInstancing(true),
+    uniformBufferAlignment(DEFAULT_UNIFORM_BUFFER_ALIGNMENT),
+    instancingEnabled(false),
+    lastFrameTime(0.0f),
+    headless(true),
+    headlessSize(renderSize),
+    nextHeadlessQuery(1)
+{
+    RegisterSubsystem(this);
+    RegisterGraphicsLibrary();
+
+    DefineQuadVertexBuffer();
+
+    frameTimer.Reset();
+}
+
 Graphics::~Graphics()
 {
     if (context)
@@ -202,12 +254,19 @@ Graphics::~Graphics()
         window = nullptr;
     }
 
-    SDL_Quit();
+    if (!headless)
+        SDL_Quit();
     RemoveSubsystem(this);
 }
 
 void Graphics::SetScreenMode(const IntVector2& size, FullScreenMode mode)
 {
+    if (headless)
+    {
+        headlessSize = size;
+        return;
+    }
+
     // No-op if same size and mode
     FullScreenMode lastMode = FullScreen();
     if (size == Size() && mode == lastMode)
@@ -239,6 +298,9 @@ void Graphics::Resize(const IntVector2& size)
 
 void Graphics::SetFullScreen(FullScreenMode mode)
 {
+    if (!window)
+        return;
+
     unsigned flags = 0;
     if (mode == FULLSCREEN)
         flags |= SDL_WINDOW_FULLSCREEN;
@@ -251,7 +313,7 @@ void Graphics::SetFullScreen(FullScreenMode mode)
 
 void Graphics::SetVSync(bool enable)
 {
-    if (IsInitialized())
+    if (context)
     {
         SDL_GL_SetSwapInterval(enable ? 1 : 0);
         vsync = enable;
@@ -262,7 +324,8 @@ void Graphics::Present()
 {
     ZoneScoped;
 
-    SDL_GL_SwapWindow(window);
+    if (window)
+        SDL_GL_SwapWindow(window);
 
     lastFrameTime = 0.000001f * frameTimer.ElapsedUSec();
     frameTimer.Reset();
@@ -270,6 +333,12 @@ void Graphics::Present()
 
 void Graphics::SetFrameBuffer(FrameBuffer* buffer)
 {
+    if (headless)
+    {
+        ++stats.numFrameBufferChanges;
+        return;
+    }
+
     if (buffer)
         buffer->Bind();
     else
@@ -278,6 +347,12 @@ void Graphics::SetFrameBuffer(FrameBuffer* buffer)
 
 void Graphics::SetViewport(const IntRect& viewRect)
 {
+    if (headless)
+    {
+        ++stats.numViewportChanges;
+        return;
+    }
+
     glViewport(viewRect.left, viewRect.top, viewRect.right - viewRect.left, viewRect.bottom - viewRect.top);
 }
 
@@ -450,6 +525,17 @@ void Graphics::SetIndexBuffer(IndexBuffer* buffer)
 
 void Graphics::SetRenderState(BlendMode blendMode, CullMode cullMode, CompareMode depthTest, bool colorWrite, bool depthWrite)
 {
+    if (headless)
+    {
+        stats.numStateChanges += (blendMode != lastBlendMode) + (cullMode != lastCullMode) + (depthTest != lastDepthTest) + (colorWrite != lastColorWrite) + (depthWrite != lastDepthWrite);
+        lastBlendMode = blendMode;
+        lastCullMode = cullMode;
+        lastDepthTest = depthTest;
+        lastColorWrite = colorWrite;
+        lastDepthWrite = depthWrite;
+        return;
+    }
+
     if (blendMode != lastBlendMode)
     {
         if (blendMode == BLEND_REPLACE)
@@ -501,6 +587,15 @@ void Graphics::SetRenderState(BlendMode blendMode, CullMode cullMode, CompareMod
 
 void Graphics::SetDepthBias(float constantBias, float slopeScaleBias)
 {
+    if (headless)
+    {
+        bool depthBias = constantBias > 0.0f || slopeScaleBias > 0.0f;
+        if (depthBias != lastDepthBias)
+            ++stats.numStateChanges;
+        lastDepthBias = depthBias;
+        return;
+    }
+
     if (constantBias <= 0.0f && slopeScaleBias <= 0.0f)
     {
         if (lastDepthBias)
@@ -523,6 +618,16 @@ void Graphics::SetDepthBias(float constantBias, float slopeScaleBias)
 
 void Graphics::Clear(bool clearColor, bool clearDepth, const IntRect& clearRect, const Color& backgroundColor)
 {
+    if (headless)
+    {
+        ++stats.numClears;
+        if (clearColor)
+            lastColorWrite = true;
+        if (clearDepth)
+            lastDepthWrite = true;
+        return;
+    }
+
     if (clearColor)
     {
         glClearColor(backgroundColor.r, backgroundColor.g, backgroundColor.b, backgroundColor.a);
@@ -554,6 +659,12 @@ void Graphics::Clear(bool clearColor, bool clearDepth, const IntRect& clearRect,
 
 void Graphics::Blit(FrameBuffer* dest, const IntRect& destRect, FrameBuffer* src, const IntRect& srcRect, bool blitColor, bool blitDepth, TextureFilterMode filter)
 {
+    if (headless)
+    {
+        ++stats.numBlits;
+        return;
+    }
+
     FrameBuffer::Bind(dest, src);
 
     GLenum glBlitBits = 0;
@@ -567,6 +678,13 @@ void Graphics::Blit(FrameBuffer* dest, const IntRect& destRect, FrameBuffer* src
 
 void Graphics::Draw(PrimitiveType type, size_t drawStart, size_t drawCount)
 {
+    if (headless)
+    {
+        ++stats.numDraws;
+        stats.numElements += drawCount;
+        return;
+    }
+
     if (instancingEnabled)
     {
         glDisableVertexAttribArray(ATTR_TEXCOORD3);
@@ -580,6 +698,13 @@ void Graphics::Draw(PrimitiveType type, size_t drawStart, size_t drawCount)
 
 void Graphics::DrawIndexed(PrimitiveType type, size_t drawStart, size_t drawCount)
 {
+    if (headless)
+    {
+        ++stats.numDraws;
+        stats.numElements += drawCount;
+        return;
+    }
+
     if (instancingEnabled)
     {
         glDisableVertexAttribArray(ATTR_TEXCOORD3);
@@ -598,6 +723,15 @@ void Graphics::DrawInstanced(PrimitiveType type, size_t drawStart, size_t drawCo
     if (!hasInstancing || !instanceVertexBuffer)
         return;
 
+    if (headless)
+    {
+        ++stats.numDraws;
+        ++stats.numInstancedDraws;
+        stats.numElements += drawCount * instanceCount;
+        stats.numInstances += instanceCount;
+        return;
+    }
+
     if (!instancingEnabled)
     {
         glEnableVertexAttribArray(ATTR_TEXCOORD3);
@@ -617,6 +751,18 @@ void Graphics::DrawInstanced(PrimitiveType type, size_t drawStart, size_t drawCo
 
 void Graphics::DrawIndexedInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, VertexBuffer* instanceVertexBuffer, size_t instanceStart, size_t instanceCount)
 {
+    if (headless)
+    {
+        if (hasInstancing && instanceVertexBuffer)
+        {
+            ++stats.numDraws;
+            ++stats.numInstancedDraws;
+            stats.numElements += drawCount * instanceCount;
+            stats.numInstances += instanceCount;
+        }
+        return;
+    }
+
     unsigned indexSize = (unsigned)IndexBuffer::BoundIndexSize();
 
     if (!hasInstancing || !instanceVertexBuffer || !indexSize)
@@ -647,6 +793,13 @@ void Graphics::DrawQuad()
 
 unsigned Graphics::BeginOcclusionQuery(void* object)
 {
+    if (headless)
+    {
+        ++stats.numOcclusionQueries;
+        pendingQueries.push_back(std::make_pair(nextHeadlessQuery, object));
+        return nextHeadlessQuery++;
+    }
+
     GLuint queryId;
 
     if (freeQueries.size())
@@ -665,6 +818,9 @@ unsigned Graphics::BeginOcclusionQuery(void* object)
 
 void Graphics::EndOcclusionQuery()
 {
+    if (headless)
+        return;
+
     glEndQuery(occlusionQueryType);
 }
 
@@ -683,14 +839,29 @@ void Graphics::FreeOcclusionQuery(unsigned queryId)
         }
     }
 
-    glDeleteQueries(1, &queryId);
+    if (!headless)
+        glDeleteQueries(1, &queryId);
 }
 
 void Graphics::CheckOcclusionQueryResults(std::vector<OcclusionQueryResult>& result)
 {
     ZoneScoped;
 
-    if (!vsync && lastFrameTime < 1.0f / 60.0f)
+    if (headless)
+    {
+        // No rendering to test against, so report everything visible
+        for (auto it = pendingQueries.begin(); it != pendingQueries.end(); ++it)
+        {
+            OcclusionQueryResult newResult;
+            newResult.id = it->first;
+            newResult.object = it->second;
+            newResult.visible = true;
+            result.push_back(newResult);
+        }
+
+        pendingQueries.clear();
+    }
+    else if (!vsync && lastFrameTime < 1.0f / 60.0f)
     {
         // Vsync off and low frametime: check for query result availability to avoid stalling. To save API calls, go through queries in reverse order
         // and assume that if a later query has its result available, then all earlier queries will have too
@@ -742,8 +913,16 @@ void Graphics::CheckOcclusionQueryResults(std::vector<OcclusionQueryResult>& res
 
 }
 
+void Graphics::ResetStatistics()
+{
+    stats = GraphicsStatistics();
+}
+
 IntVector2 Graphics::Size() const
 {
+    if (headless)
+        return headlessSize;
+
     IntVector2 size;
     SDL_GetWindowSize(window, &size.x, &size.y);
     return size;
@@ -751,6 +930,9 @@ IntVector2 Graphics::Size() const
 
 IntVector2 Graphics::RenderSize() const
 {
+    if (headless)
+        return headlessSize;
+
     IntVector2 size;
     SDL_GL_GetDrawableSize(window, &size.x, &size.y);
     
@@ -763,6 +945,9 @@ IntVector2 Graphics::RenderSize() const
 
 FullScreenMode Graphics::FullScreen() const
 {
+    if (!window)
+        return WINDOWED;
+
     unsigned flags = SDL_GetWindowFlags(window);
     if ((flags & SDL_WINDOW_FULLSCREEN_DESKTOP) == SDL_WINDOW_FULLSCREEN_DESKTOP)
         return BORDERLESS_FULLSCREEN;
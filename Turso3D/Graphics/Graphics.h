@@ -38,6 +38,34 @@ struct OcclusionQueryResult
     bool visible;
 };
 
+/// Draw calls and state changes recorded by headless graphics.
+struct GraphicsStatistics
+{
+    /// Construct with zero values.
+    GraphicsStatistics();
+
+    /// Number of draw calls, including instanced.
+    size_t numDraws;
+    /// Number of instanced draw calls.
+    size_t numInstancedDraws;
+    /// Number of vertices or indices drawn, multiplied by instance count.
+    size_t numElements;
+    /// Number of instances drawn.
+    size_t numInstances;
+    /// Number of changed render states.
+    size_t numStateChanges;
+    /// Number of framebuffer binds.
+    size_t numFrameBufferChanges;
+    /// Number of viewport changes.
+    size_t numViewportChanges;
+    /// Number of clears.
+    size_t numClears;
+    /// Number of framebuffer blits.
+    size_t numBlits;
+    /// Number of occlusion queries.
+    size_t numOcclusionQueries;
+};
+
 /// %Graphics rendering context and application window.
 class Graphics : public Object
 {
@@ -46,6 +74,8 @@ class Graphics : public Object
 public:
     /// Register subsystem object and create window with initial screen mode, and create OpenGL context. Use zero size (default) to use desktop resolution. Check success with IsInitialized() before using other functions.
     Graphics(const char* windowTitle, const IntVector2& windowSize = IntVector2::ZERO, FullScreenMode mode = WINDOWED);
+    /// Register subsystem object in headless mode without a window or OpenGL context, for running the CPU side of rendering without a GPU or display. GPU objects keep their definitions but create no OpenGL objects, draw calls and state changes are only recorded, and occlusion queries always report visible.
+    Graphics(const IntVector2& renderSize);
     /// Destruct. Closes the application window.
     ~Graphics();
 
@@ -130,10 +160,18 @@ public:
     /// Return number of pending occlusion queries.
     size_t PendingOcclusionQueries() const { return pendingQueries.size(); }
 
-    /// Return whether the window and OpenGL context are successfully initialized.
-    bool IsInitialized() const { return context != nullptr; }
+    /// Return whether the window and OpenGL context are successfully initialized, or is in headless mode.
+    bool IsInitialized() const { return context != nullptr || headless; }
+    /// Return whether is in headless mode.
+    bool IsHeadless() const { return headless; }
+    /// Return draw calls and state changes recorded in headless mode since the last reset.
+    const GraphicsStatistics& Statistics() const { return stats; }
+    /// Reset the recorded draw calls and state changes.
+    void ResetStatistics();
     /// Return whether has instancing support.
     bool HasInstancing() const { return hasInstancing; }
+    /// Return required alignment of uniform buffer offsets when binding a range.
+    size_t UniformBufferAlignment() const { return uniformBufferAlignment; }
     /// Return current window size.
     IntVector2 Size() const;
     /// Return current window width.
@@ -181,6 +219,8 @@ private:
     bool vsync;
     /// Instancing support flag.
     bool hasInstancing;
+    /// Uniform buffer range binding offset alignment.
+    size_t uniformBufferAlignment;
     /// Whether instance vertex elements are enabled.
     bool instancingEnabled;
     /// Pending occlusion queries.
@@ -191,6 +231,14 @@ private:
     HiresTimer frameTimer;
     /// Last frame interval in seconds.
     float lastFrameTime;
+    /// Headless mode flag.
+    bool headless;
+    /// Render size in headless mode.
+    IntVector2 headlessSize;
+    /// Next fake occlusion query ID in headless mode.
+    unsigned nextHeadlessQuery;
+    /// Recorded draw calls and state changes in headless mode.
+    GraphicsStatistics stats;
 };
 
 /// Register Graphics related object factories and attributes.
@@ -11,6 +11,9 @@ const size_t elementSizes[] =
     sizeof(Vector3),
     sizeof(Vector4),
     sizeof(unsigned),
+    2 * sizeof(unsigned short),
+    4 * sizeof(unsigned short),
+    sizeof(unsigned)
 };
 
 const char* elementSemanticNames[] =
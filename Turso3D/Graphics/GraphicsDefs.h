@@ -33,6 +33,9 @@ enum ElementType
     ELEM_VECTOR3,
     ELEM_VECTOR4,
     ELEM_UBYTE4,
+    ELEM_HALF2,
+    ELEM_HALF4,
+    ELEM_BYTE4_NORM,
     MAX_ELEMENT_TYPES
 };
 
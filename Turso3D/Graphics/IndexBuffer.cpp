@@ -100,6 +100,10 @@ size_t IndexBuffer::BoundIndexSize()
 
 bool IndexBuffer::Create(const void* data)
 {
+    // Headless graphics only stores the definition
+    if (Object::Subsystem<Graphics>()->IsHeadless())
+        return true;
+
     glGenBuffers(1, &buffer);
     if (!buffer)
     {
@@ -44,6 +44,15 @@ bool RenderBuffer::Define(const IntVector2& size_, ImageFormat format_, int mult
     if (multisample_ < 1)
         multisample_ = 1;
 
+    // Headless graphics only stores the definition
+    if (Object::Subsystem<Graphics>()->IsHeadless())
+    {
+        size = size_;
+        format = format_;
+        multisample = multisample_;
+        return true;
+    }
+
     glGenRenderbuffers(1, &buffer);
     if (!buffer)
     {
@@ -68,7 +68,9 @@ int NumberPostfix(const std::string& string)
 ShaderProgram::ShaderProgram(const std::string& sourceCode, const std::string& shaderName_, const std::string& vsDefines, const std::string& fsDefines) :
     program(0)
 {
-    assert(Object::Subsystem<Graphics>()->IsInitialized());
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    assert(graphics->IsInitialized());
+    headless = graphics->IsHeadless();
 
     shaderName = vsDefines.length() ? (shaderName_ + " " + vsDefines + " " + fsDefines) : (shaderName_ + " " + fsDefines);
 
@@ -101,7 +103,7 @@ int ShaderProgram::Uniform(StringHash name) const
 bool ShaderProgram::Bind()
 {
     if (!program)
-        return false;
+        return headless;
 
     if (boundProgram == this)
         return true;
@@ -115,6 +117,16 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
 {
     ZoneScoped;
 
+    // Headless graphics does not compile. Accept all vertex attributes and find no uniforms
+    if (headless)
+    {
+        attributes = (1 << MAX_VERTEX_ATTRIBUTES) - 1;
+        uniforms.clear();
+        for (size_t i = 0; i < MAX_PRESET_UNIFORMS; ++i)
+            presetUniforms[i] = -1;
+        return;
+    }
+
     std::string vsSourceCode;
     vsSourceCode += "#version 150\n";
     vsSourceCode += "#define COMPILEVS\n";
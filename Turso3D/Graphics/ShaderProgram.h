@@ -16,7 +16,7 @@ public:
     /// Destruct.
     ~ShaderProgram();
 
-    /// Bind for using. No-op if already bound. Return false if program is not successfully linked.
+    /// Bind for using. No-op if already bound. Return false if program is not successfully linked. Always succeeds with headless graphics.
     bool Bind();
 
     /// Return shader name concatenated from parent shader name and defines.
@@ -53,4 +53,6 @@ private:
     int presetUniforms[MAX_PRESET_UNIFORMS];
     /// Shader name.
     std::string shaderName;
+    /// Headless graphics flag. The program is not compiled, but binding succeeds.
+    bool headless;
 };
@@ -249,6 +249,16 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
 
     type = type_;
 
+    // Headless graphics only stores the definition
+    if (Object::Subsystem<Graphics>()->IsHeadless())
+    {
+        size = size_;
+        format = format_;
+        numLevels = numLevels_;
+        multisample = multisample_;
+        return true;
+    }
+
     glGenTextures(1, &texture);
     if (!texture)
     {
@@ -349,6 +359,9 @@ bool Texture::DefineSampler(TextureFilterMode filter_, TextureAddressMode u, Tex
     maxLod = maxLod_;
     borderColor = borderColor_;
 
+    if (!texture && Object::Subsystem<Graphics>()->IsHeadless())
+        return format != FMT_NONE;
+
     if (!texture)
     {
         LOGERROR("Texture must be defined before defining sampling parameters");
@@ -85,6 +85,16 @@ void UniformBuffer::Bind(size_t index)
     boundUniformBuffers[index] = this;
 }
 
+void UniformBuffer::BindRange(size_t index, size_t offset, size_t numBytes)
+{
+    if (!buffer)
+        return;
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, (GLuint)index, buffer, offset, numBytes);
+    // Mark the slot as not holding a whole buffer, so that the next Bind() is not skipped
+    boundUniformBuffers[index] = nullptr;
+}
+
 void UniformBuffer::Unbind(size_t index)
 {
     if (boundUniformBuffers[index])
@@ -96,6 +106,10 @@ void UniformBuffer::Unbind(size_t index)
 
 bool UniformBuffer::Create(const void* data)
 {
+    // Headless graphics only stores the definition
+    if (Object::Subsystem<Graphics>()->IsHeadless())
+        return true;
+
     glGenBuffers(1, &buffer);
     if (!buffer)
     {
@@ -30,6 +30,9 @@ static const unsigned elementGLSizes[] =
     2,
     3,
     4,
+    4,
+    2,
+    4,
     4
 };
 
@@ -41,6 +44,9 @@ static const unsigned elementGLTypes[] =
     GL_FLOAT,
     GL_FLOAT,
     GL_UNSIGNED_BYTE,
+    GL_HALF_FLOAT,
+    GL_HALF_FLOAT,
+    GL_BYTE
 };
 
 VertexBuffer::VertexBuffer() :
@@ -164,7 +170,7 @@ void VertexBuffer::Bind(unsigned attributeMask)
         if (!(boundAttributes & attributeBit))
             glEnableVertexAttribArray(attributeIdx);
 
-        glVertexAttribPointer(attributeIdx, elementGLSizes[element.type], elementGLTypes[element.type], element.semantic == SEM_COLOR ? GL_TRUE : GL_FALSE, 
+        glVertexAttribPointer(attributeIdx, elementGLSizes[element.type], elementGLTypes[element.type], (element.semantic == SEM_COLOR || element.type == ELEM_BYTE4_NORM) ? GL_TRUE : GL_FALSE,
             (GLsizei)vertexSize, reinterpret_cast<void*>(element.offset));
 
         usedAttributes |= attributeBit;
@@ -207,6 +213,10 @@ size_t VertexBuffer::VertexElementSize(const VertexElement& element)
 
 bool VertexBuffer::Create(const void* data)
 {
+    // Headless graphics only stores the definition
+    if (Object::Subsystem<Graphics>()->IsHeadless())
+        return true;
+
     glGenBuffers(1, &buffer);
     if (!buffer)
     {
@@ -4,6 +4,7 @@
 
 #include <cstdlib>
 #include <cmath>
+#include <cstring>
 #include <limits>
 
 #undef M_PI
@@ -118,3 +119,64 @@ inline unsigned NextPowerOfTwo(unsigned value)
         ret <<= 1;
     return ret;
 }
+
+/// Convert a float to half-precision float bits, rounding to nearest.
+inline unsigned short FloatToHalf(float value)
+{
+    unsigned bits;
+    memcpy(&bits, &value, sizeof bits);
+
+    unsigned sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    unsigned mantissa = bits & 0x7fffff;
+
+    // Infinity or NaN
+    if (((bits >> 23) & 0xff) == 0xff)
+        return (unsigned short)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    // Overflow to infinity
+    if (exponent >= 31)
+        return (unsigned short)(sign | 0x7c00);
+    // Denormal or zero
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return (unsigned short)sign;
+
+        mantissa |= 0x800000;
+        unsigned shift = (unsigned)(14 - exponent);
+        unsigned half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+            ++half;
+        return (unsigned short)(sign | half);
+    }
+
+    // Rounding may carry into the exponent, which is the correct result
+    unsigned half = sign | ((unsigned)exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+        ++half;
+    return (unsigned short)half;
+}
+
+/// Convert half-precision float bits to a float.
+inline float HalfToFloat(unsigned short value)
+{
+    unsigned sign = ((unsigned)value & 0x8000) << 16;
+    unsigned exponent = ((unsigned)value >> 10) & 0x1f;
+    unsigned mantissa = (unsigned)value & 0x3ff;
+    unsigned bits;
+
+    if (!exponent)
+    {
+        // Denormal or zero
+        float ret = mantissa * (1.0f / 16777216.0f);
+        return sign ? -ret : ret;
+    }
+    else if (exponent == 31)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+    float ret;
+    memcpy(&ret, &bits, sizeof ret);
+    return ret;
+}
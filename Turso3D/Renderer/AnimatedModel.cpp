@@ -1,21 +1,30 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
-#include "../Graphics/GraphicsDefs.h"
+#include "../Graphics/Graphics.h"
 #include "../Graphics/UniformBuffer.h"
 #include "../IO/Log.h"
 #include "../Math/Ray.h"
 #include "../Resource/ResourceCache.h"
 #include "AnimatedModel.h"
 #include "Animation.h"
+#include "AnimationBounds.h"
+#include "AnimationPoseCache.h"
 #include "AnimationState.h"
+#include "AnimationSystem.h"
+#include "Camera.h"
 #include "DebugRenderer.h"
 #include "Model.h"
 #include "Octree.h"
+#include "Renderer.h"
 
 #include <algorithm>
+#include <cstring>
 #include <tracy/Tracy.hpp>
 
 static Allocator<AnimatedModelDrawable> drawableAllocator;
+static Vector3 DOT_SCALE(1 / 3.0f, 1 / 3.0f, 1 / 3.0f);
+// Phase assigned to the next created drawable, for spreading reduced rate animation updates across frames
+static unsigned char nextAnimationUpdatePhase = 0;
 
 Bone::Bone() :
     drawable(nullptr),
@@ -61,9 +70,9 @@ void Bone::OnTransformChanged()
 {
     SpatialNode::OnTransformChanged();
 
-    // Avoid duplicate dirtying calls if model's skinning is already dirty. Do not signal changes either during animation update,
+    // Avoid duplicate dirtying calls if the pose is already dirty. Do not signal changes either during animation update,
     // as the model will set the hierarchy dirty when finished. This is also used to optimize when only the model node moves.
-    if (drawable && !(drawable->AnimatedModelFlags() & (AMF_IN_ANIMATION_UPDATE | AMF_SKINNING_DIRTY)))
+    if (drawable && !(drawable->AnimatedModelFlags() & (AMF_IN_ANIMATION_UPDATE | AMF_POSE_DIRTY)))
         drawable->OnBoneTransformChanged();
 }
 
@@ -72,11 +81,41 @@ static inline bool CompareAnimationStates(const SharedPtr<AnimationState>& lhs,
     return lhs->BlendLayer() < rhs->BlendLayer();
 }
 
+/// Fill bone indices ordered by depth in the skeleton, so that parents come before their children.
+static void SortBones(const std::vector<ModelBone>& modelBones, unsigned short* dest)
+{
+    size_t numBones = modelBones.size();
+    std::vector<size_t> depths(numBones);
+
+    for (size_t i = 0; i < numBones; ++i)
+    {
+        // Limit the walk to the number of bones in case of a malformed hierarchy
+        size_t index = i;
+        size_t depth = 0;
+        while (modelBones[index].parentIndex != index && modelBones[index].parentIndex < numBones && depth < numBones)
+        {
+            index = modelBones[index].parentIndex;
+            ++depth;
+        }
+        depths[i] = depth;
+        dest[i] = (unsigned short)i;
+    }
+
+    std::stable_sort(dest, dest + numBones, [&depths](unsigned short lhs, unsigned short rhs) { return depths[lhs] < depths[rhs]; });
+}
+
 AnimatedModelDrawable::AnimatedModelDrawable() :
     animatedModelFlags(0),
     numBones(0),
     octree(nullptr),
-    rootBone(nullptr)
+    rootBone(nullptr),
+    boneNodesEnabled(DEFAULT_BONE_NODES),
+    skinMatrixOffset(0),
+    skinMatrixFrameNumber(0),
+    animationLodDistance(DEFAULT_ANIMATION_LOD_DISTANCE),
+    animationUpdateInterval(1),
+    animationUpdatePhase(nextAnimationUpdatePhase++),
+    lastAnimationFrameNumber(0)
 {
     SetFlag(DF_SKINNED_GEOMETRY | DF_OCTREE_UPDATE_CALL, true);
 }
@@ -85,7 +124,7 @@ void AnimatedModelDrawable::OnWorldBoundingBoxUpdate() const
 {
     if (model && numBones)
     {
-        // Recalculate bounding box from bones only if they moved individually
+        // Recalculate the model space bounding box from bones only if the pose changed
         if (animatedModelFlags & AMF_BONE_BOUNDING_BOX_DIRTY)
         {
             const std::vector<ModelBone>& modelBones = model->Bones();
@@ -96,15 +135,14 @@ void AnimatedModelDrawable::OnWorldBoundingBoxUpdate() const
             for (size_t i = 0; i < numBones; ++i)
             {
                 if (modelBones[i].active)
-                    tempBox.Merge(modelBones[i].boundingBox.Transformed(bones[i]->WorldTransform()));
+                    tempBox.Merge(modelBones[i].boundingBox.Transformed(boneTransforms[i]));
             }
 
-            worldBoundingBox = tempBox;
-            boneBoundingBox = tempBox.Transformed(WorldTransform().Inverse());
+            boneBoundingBox = tempBox;
             animatedModelFlags &= ~AMF_BONE_BOUNDING_BOX_DIRTY;
         }
-        else
-            worldBoundingBox = boneBoundingBox.Transformed(WorldTransform());
+
+        worldBoundingBox = boneBoundingBox.Transformed(WorldTransform());
     }
     else
         Drawable::OnWorldBoundingBoxUpdate();
@@ -112,14 +150,22 @@ void AnimatedModelDrawable::OnWorldBoundingBoxUpdate() const
 
 void AnimatedModelDrawable::OnOctreeUpdate(unsigned short frameNumber)
 {
-    if (TestFlag(DF_UPDATE_INVISIBLE) || WasInView(frameNumber))
-    {
-        if (animatedModelFlags & AMF_ANIMATION_DIRTY)
-            UpdateAnimation();
+    bool update = TestFlag(DF_UPDATE_INVISIBLE) || WasInView(frameNumber);
 
-        if (animatedModelFlags & AMF_SKINNING_DIRTY)
-            UpdateSkinning();
+    if (update && (animatedModelFlags & AMF_ANIMATION_DIRTY) && AnimationUpdateDue(frameNumber))
+    {
+        UpdateAnimation();
+        lastAnimationFrameNumber = frameNumber;
     }
+    else if (!update && (animatedModelFlags & AMF_ANIMATION_DIRTY))
+        UpdateAnimationBounds();
+
+    // Read back bone scene nodes that were moved programmatically even if not visible, as the bounding box depends on them
+    if (animatedModelFlags & AMF_POSE_DIRTY)
+        UpdatePoseFromBoneNodes();
+
+    if (update && (animatedModelFlags & AMF_SKINNING_DIRTY))
+        UpdateSkinning();
 }
 
 bool AnimatedModelDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
@@ -127,24 +173,72 @@ bool AnimatedModelDrawable::OnPrepareRender(unsigned short frameNumber, Camera*
     if (!StaticModelDrawable::OnPrepareRender(frameNumber, camera))
         return false;
 
+    // Choose the animation update interval by distance. The interval doubles each time the distance doubles
+    animationUpdateInterval = 1;
+    if (animationLodDistance > 0.0f)
+    {
+        float lodDistance = camera->LodDistance(distance, WorldScale().DotProduct(DOT_SCALE), lodBias);
+        for (float threshold = animationLodDistance; lodDistance > threshold && animationUpdateInterval < MAX_ANIMATION_LOD_INTERVAL; threshold *= 2.0f)
+            animationUpdateInterval <<= 1;
+    }
+
     // Update animation here too if just came into view and animation / skinning is still dirty
-    if (animatedModelFlags & AMF_ANIMATION_DIRTY)
+    if ((animatedModelFlags & AMF_ANIMATION_DIRTY) && AnimationUpdateDue(frameNumber))
+    {
         UpdateAnimation();
+        lastAnimationFrameNumber = frameNumber;
+    }
+    else if (animatedModelFlags & AMF_POSE_DIRTY)
+        UpdatePoseFromBoneNodes();
 
     if (animatedModelFlags & AMF_SKINNING_DIRTY)
         UpdateSkinning();
 
+    // Copy the skinning data to the renderer's per-frame buffer on each frame the model is rendered, as the buffer slices are reused
+    if (numBones && skinMatrixFrameNumber != frameNumber)
+    {
+        Renderer* renderer = Object::Subsystem<Renderer>();
+        size_t dataSize = SkinDataSize();
+        void* dest = renderer ? renderer->AllocateSkinData(dataSize, skinMatrixOffset) : nullptr;
+        if (dest)
+        {
+            memcpy(dest, SkinData(), dataSize);
+            skinMatrixFrameNumber = frameNumber;
+        }
+        else
+            skinMatrixFrameNumber = 0;
+    }
+
     return true;
 }
 
-void AnimatedModelDrawable::OnRender(ShaderProgram*, size_t)
+void AnimatedModelDrawable::OnRender(ShaderProgram* program, size_t)
 {
-    if (!skinMatrixBuffer || !numBones)
+    if (!numBones)
         return;
 
+    // Dual quaternions are in model space, so the world transform is applied in the vertex shader
+    if (skinDualQuaternions)
+        Object::Subsystem<Graphics>()->SetUniform(program, U_WORLDMATRIX, WorldTransform());
+
+    Renderer* renderer = Object::Subsystem<Renderer>();
+    if (renderer && skinMatrixFrameNumber == renderer->FrameNumber())
+    {
+        renderer->BindSkinData(skinMatrixOffset, SkinDataSize());
+        return;
+    }
+
+    // The renderer's buffer was full this frame, use an own buffer
+    if (!skinMatrixBuffer)
+    {
+        skinMatrixBuffer = new UniformBuffer();
+        skinMatrixBuffer->Define(USAGE_DYNAMIC, SkinDataSize());
+        animatedModelFlags |= AMF_SKINNING_BUFFER_DIRTY;
+    }
+
     if (animatedModelFlags & AMF_SKINNING_BUFFER_DIRTY)
     {
-        skinMatrixBuffer->SetData(0, numBones * sizeof(Matrix3x4), skinMatrices);
+        skinMatrixBuffer->SetData(0, SkinDataSize(), SkinData());
         animatedModelFlags &= ~AMF_SKINNING_BUFFER_DIRTY;
     }
 
@@ -160,13 +254,14 @@ void AnimatedModelDrawable::OnRaycast(std::vector<RaycastResult>& dest, const Ra
 
         // Perform raycast against each bone in its local space
         const std::vector<ModelBone>& modelBones = model->Bones();
+        const Matrix3x4& worldTransform = WorldTransform();
 
         for (size_t i = 0; i < numBones; ++i)
         {
             if (!modelBones[i].active)
                 continue;
 
-            const Matrix3x4& transform = bones[i]->WorldTransform();
+            Matrix3x4 transform = worldTransform * boneTransforms[i];
             Ray localRay = ray.Transformed(transform.Inverse());
             float localDistance = localRay.HitDistance(modelBones[i].boundingBox);
 
@@ -197,12 +292,18 @@ void AnimatedModelDrawable::OnRenderDebug(DebugRenderer* debug)
 {
     debug->AddBoundingBox(WorldBoundingBox(), Color::GREEN, false);
 
+    if (!model)
+        return;
+
+    const std::vector<ModelBone>& modelBones = model->Bones();
+    const Matrix3x4& worldTransform = WorldTransform();
+
     for (size_t i = 0; i < numBones; ++i)
     {
         // Skip the root bone, as it has no sensible connection point
-        Bone* bone = bones[i];
-        if (bone != rootBone)
-            debug->AddLine(bone->WorldPosition(), bone->SpatialParent()->WorldPosition(), Color::WHITE, false);
+        size_t parentIndex = modelBones[i].parentIndex;
+        if (parentIndex != i)
+            debug->AddLine(worldTransform * boneTransforms[i].Translation(), worldTransform * boneTransforms[parentIndex].Translation(), Color::WHITE, false);
     }
 }
 
@@ -212,7 +313,6 @@ void AnimatedModelDrawable::CreateBones()
 
     if (!model)
     {
-        skinMatrixBuffer.Reset();
         RemoveBones();
         return;
     }
@@ -223,28 +323,92 @@ void AnimatedModelDrawable::CreateBones()
 
     numBones = (unsigned short)modelBones.size();
 
+    bonePoses = new BonePose[numBones];
+    boneTransforms = new Matrix3x4[numBones];
+    boneOrder = new unsigned short[numBones];
+    CreateSkinningData();
+
+    SortBones(modelBones, boneOrder);
+
+    for (size_t i = 0; i < numBones; ++i)
+    {
+        const ModelBone& modelBone = modelBones[i];
+        BonePose& pose = bonePoses[i];
+        pose.position = modelBone.initialPosition;
+        pose.rotation = modelBone.initialRotation;
+        pose.scale = modelBone.initialScale;
+    }
+
+    // Create bone scene nodes if enabled, or if the root bone exists in the scene hierarchy, for example from loading a scene
+    if (boneNodesEnabled || (numBones && owner->FindChild<Bone>(modelBones[RootBoneIndex()].nameHash, true)))
+        CreateBoneNodes();
+    else
+    {
+        RemoveBoneNodes();
+        UpdatePose();
+    }
+
+    // Set initial bone bounding box recalculation and skinning dirty. The pose is already up to date. Also calculate a valid bone bounding box immediately to ensure models can enter the view without updating animation first
+    OnBoneTransformChanged();
+    animatedModelFlags &= ~AMF_POSE_DIRTY;
+    OnWorldBoundingBoxUpdate();
+}
+
+void AnimatedModelDrawable::CreateSkinningData()
+{
+    if (TestFlag(DF_DUAL_QUATERNION_SKINNING))
+    {
+        skinMatrices.Reset();
+        skinDualQuaternions = numBones ? new SkinDualQuaternion[numBones] : nullptr;
+    }
+    else
+    {
+        skinDualQuaternions.Reset();
+        skinMatrices = numBones ? new Matrix3x4[numBones] : nullptr;
+    }
+
+    skinMatrixBuffer.Reset();
+    skinMatrixFrameNumber = 0;
+    animatedModelFlags |= AMF_SKINNING_DIRTY;
+}
+
+void AnimatedModelDrawable::CreateBoneNodes()
+{
+    ZoneScoped;
+
+    if (!model || !numBones)
+        return;
+
+    const std::vector<ModelBone>& modelBones = model->Bones();
+
     bones = new Bone*[numBones];
-    skinMatrices = new Matrix3x4[numBones];
 
-    for (size_t i = 0; i < modelBones.size(); ++i)
+    for (size_t i = 0; i < numBones; ++i)
     {
         const ModelBone& modelBone = modelBones[i];
+        BonePose& pose = bonePoses[i];
 
-        // Try to find existing bone from scene hierarchy, if not found create new
+        // Try to find existing bone from scene hierarchy and take its transform into use, if not found create new
         bones[i] = owner->FindChild<Bone>(modelBone.nameHash, true);
 
-        if (!bones[i])
+        if (bones[i])
+        {
+            pose.position = bones[i]->Position();
+            pose.rotation = bones[i]->Rotation();
+            pose.scale = bones[i]->Scale();
+        }
+        else
         {
             bones[i] = Object::Create<Bone>();
             bones[i]->SetName(modelBone.name);
-            bones[i]->SetTransform(modelBone.initialPosition, modelBone.initialRotation, modelBone.initialScale);
+            bones[i]->SetTransform(pose.position, pose.rotation, pose.scale);
         }
 
         bones[i]->SetDrawable(this);
     }
 
     // Loop through bones again to set the correct parents
-    for (size_t i = 0; i < modelBones.size(); ++i)
+    for (size_t i = 0; i < numBones; ++i)
     {
         const ModelBone& desc = modelBones[i];
         if (desc.parentIndex == i)
@@ -257,62 +421,157 @@ void AnimatedModelDrawable::CreateBones()
     }
 
     // Count child bones now for optimized transform dirtying
-    for (size_t i = 0; i < modelBones.size(); ++i)
+    for (size_t i = 0; i < numBones; ++i)
         bones[i]->CountChildBones();
 
-    if (!skinMatrixBuffer)
-        skinMatrixBuffer = new UniformBuffer();
-    skinMatrixBuffer->Define(USAGE_DYNAMIC, numBones * sizeof(Matrix3x4));
-
-    // Set initial bone bounding box recalculation and skinning dirty. Also calculate a valid bone bounding box immediately to ensure models can enter the view without updating animation first
-    OnBoneTransformChanged();
-    OnWorldBoundingBoxUpdate();
+    UpdatePose();
+    animatedModelFlags &= ~AMF_POSE_DIRTY;
 }
 
 void AnimatedModelDrawable::UpdateAnimation()
 {
     ZoneScoped;
 
+    SampleAnimation();
+    UpdatePose();
+    FinishAnimation();
+
+    // Update bounding box already here to take advantage of threaded update
+    OnWorldBoundingBoxUpdate();
+
+    // If updating only when visible, queue octree reinsertion for next frame. This also ensures shadowmap rendering happens correctly
+    // Else just dirty the skinning
+    if (!TestFlag(DF_UPDATE_INVISIBLE))
+    {
+        if (octree && octant && !TestFlag(DF_OCTREE_REINSERT_QUEUED))
+            octree->QueueUpdate(this);
+    }
+
+    animatedModelFlags |= AMF_SKINNING_DIRTY;
+}
+
+void AnimatedModelDrawable::SampleAnimation()
+{
     if (animatedModelFlags & AMF_ANIMATION_ORDER_DIRTY)
         std::sort(animationStates.begin(), animationStates.end(), CompareAnimationStates);
 
     animatedModelFlags |= AMF_IN_ANIMATION_UPDATE | AMF_BONE_BOUNDING_BOX_DIRTY;
 
-    // Reset bones to initial pose, then apply animations
-    const std::vector<ModelBone>& modelBones = model->Bones();
+    // Copy the pose from the pose cache if another model already evaluated it this frame. Bones with animation disabled would make the pose unique
+    AnimationPoseCache* poseCache = Object::Subsystem<AnimationPoseCache>();
+    AnimationPoseKey poseKey;
+    AnimationPoseCacheEntry* reservedPose = nullptr;
+    bool sharedPose = poseCache && numBones && poseCache->CreateKey(model, animationStates, poseKey);
+    bool poseFound = false;
 
-    for (size_t i = 0; i < numBones; ++i)
+    for (size_t i = 0; sharedPose && bones && i < numBones; ++i)
     {
-        Bone* bone = bones[i];
-        const ModelBone& modelBone = modelBones[i];
-        if (bone->AnimationEnabled())
-            bone->SetTransformSilent(modelBone.initialPosition, modelBone.initialRotation, modelBone.initialScale);
+        if (!bones[i]->AnimationEnabled())
+            sharedPose = false;
     }
 
-    for (auto it = animationStates.begin(); it != animationStates.end(); ++it)
+    if (sharedPose)
+        poseFound = poseCache->Fetch(poseKey, bonePoses.Get(), numBones, reservedPose);
+
+    if (!poseFound)
     {
-        AnimationState* state = *it;
-        if (state->Enabled())
-            state->Apply();
+        // Reset bones to initial pose, then apply animations. Bones with animation disabled keep the transform of their scene node
+        const std::vector<ModelBone>& modelBones = model->Bones();
+
+        for (size_t i = 0; i < numBones; ++i)
+        {
+            BonePose& pose = bonePoses[i];
+            Bone* bone = bones ? bones[i] : nullptr;
+
+            if (bone && !bone->AnimationEnabled())
+            {
+                pose.position = bone->Position();
+                pose.rotation = bone->Rotation();
+                pose.scale = bone->Scale();
+            }
+            else
+            {
+                const ModelBone& modelBone = modelBones[i];
+                pose.position = modelBone.initialPosition;
+                pose.rotation = modelBone.initialRotation;
+                pose.scale = modelBone.initialScale;
+            }
+        }
+
+        // Shared poses are evaluated at the quantized times and weights, so that each model sharing the pose gets the same result
+        for (auto it = animationStates.begin(); it != animationStates.end(); ++it)
+        {
+            AnimationState* state = *it;
+            if (!state->Enabled())
+                continue;
+
+            if (sharedPose)
+                state->Apply(poseCache->QuantizeTime(state->Time()), poseCache->QuantizeWeight(state->Weight()));
+            else
+                state->Apply();
+        }
+
+        if (reservedPose)
+            poseCache->Store(reservedPose, bonePoses.Get(), numBones);
     }
+}
+
+void AnimatedModelDrawable::FinishAnimation()
+{
+    // Copy the pose to the bone scene nodes and dirty the bone hierarchy now. This will also dirty and queue reinsertion for attached models
+    if (bones)
+    {
+        for (size_t i = 0; i < numBones; ++i)
+        {
+            Bone* bone = bones[i];
+            if (bone->AnimationEnabled())
+            {
+                const BonePose& pose = bonePoses[i];
+                bone->SetTransformSilent(pose.position, pose.rotation, pose.scale);
+            }
+        }
 
-    // Dirty the bone hierarchy now. This will also dirty and queue reinsertion for attached models
-    SetBoneTransformsDirty();
+        SetBoneTransformsDirty();
+    }
 
-    animatedModelFlags &= ~(AMF_ANIMATION_ORDER_DIRTY | AMF_ANIMATION_DIRTY | AMF_IN_ANIMATION_UPDATE);
+    animatedModelFlags &= ~(AMF_ANIMATION_ORDER_DIRTY | AMF_ANIMATION_DIRTY | AMF_IN_ANIMATION_UPDATE | AMF_POSE_DIRTY);
+}
 
-    // Update bounding box already here to take advantage of threaded update, and also to update bone world transforms for skinning
-    OnWorldBoundingBoxUpdate();
+void AnimatedModelDrawable::UpdatePose()
+{
+    const std::vector<ModelBone>& modelBones = model->Bones();
 
-    // If updating only when visible, queue octree reinsertion for next frame. This also ensures shadowmap rendering happens correctly
-    // Else just dirty the skinning
-    if (!TestFlag(DF_UPDATE_INVISIBLE))
+    for (size_t i = 0; i < numBones; ++i)
     {
-        if (octree && octant && !TestFlag(DF_OCTREE_REINSERT_QUEUED))
-            octree->QueueUpdate(this);
+        size_t index = boneOrder[i];
+        size_t parentIndex = modelBones[index].parentIndex;
+        const BonePose& pose = bonePoses[index];
+
+        if (parentIndex == index)
+            boneTransforms[index] = Matrix3x4(pose.position, pose.rotation, pose.scale);
+        else
+            boneTransforms[index] = boneTransforms[parentIndex] * Matrix3x4(pose.position, pose.rotation, pose.scale);
     }
+}
 
-    animatedModelFlags |= AMF_SKINNING_DIRTY;
+void AnimatedModelDrawable::UpdatePoseFromBoneNodes()
+{
+    ZoneScoped;
+
+    if (bones)
+    {
+        for (size_t i = 0; i < numBones; ++i)
+        {
+            BonePose& pose = bonePoses[i];
+            pose.position = bones[i]->Position();
+            pose.rotation = bones[i]->Rotation();
+            pose.scale = bones[i]->Scale();
+        }
+
+        UpdatePose();
+    }
+
+    animatedModelFlags &= ~AMF_POSE_DIRTY;
 }
 
 void AnimatedModelDrawable::UpdateSkinning()
@@ -321,15 +580,70 @@ void AnimatedModelDrawable::UpdateSkinning()
 
     const std::vector<ModelBone>& modelBones = model->Bones();
 
-    for (size_t i = 0; i < numBones; ++i)
-        skinMatrices[i] = bones[i]->WorldTransform() * modelBones[i].offsetMatrix;
+    if (skinDualQuaternions)
+    {
+        for (size_t i = 0; i < numBones; ++i)
+            skinDualQuaternions[i] = SkinDualQuaternion(boneTransforms[i] * modelBones[i].offsetMatrix);
+    }
+    else
+    {
+        const Matrix3x4& worldTransform = WorldTransform();
+
+        for (size_t i = 0; i < numBones; ++i)
+            skinMatrices[i] = worldTransform * boneTransforms[i] * modelBones[i].offsetMatrix;
+    }
 
     animatedModelFlags &= ~AMF_SKINNING_DIRTY;
     animatedModelFlags |= AMF_SKINNING_BUFFER_DIRTY;
 }
 
+bool AnimatedModelDrawable::UpdateAnimationBounds()
+{
+    if (bones || !numBones)
+        return false;
+
+    AnimationState* activeState = nullptr;
+    for (auto it = animationStates.begin(); it != animationStates.end(); ++it)
+    {
+        AnimationState* state = *it;
+        if (!state->Enabled())
+            continue;
+        if (activeState)
+            return false;
+        activeState = state;
+    }
+
+    // A partial weight would blend toward the current pose, which the bounds do not cover
+    if (!activeState || activeState->Weight() < 1.0f || activeState->StartBoneIndex() != RootBoneIndex() || activeState->HasBoneWeights())
+        return false;
+
+    AnimationBounds* bounds = activeState->Bounds();
+    if (!bounds || bounds->GetModel() != model)
+        return false;
+
+    boneBoundingBox = bounds->Bounds(activeState->Time());
+    animatedModelFlags &= ~AMF_BONE_BOUNDING_BOX_DIRTY;
+    OnWorldBoundingBoxUpdate();
+    return true;
+}
+
+void AnimatedModelDrawable::QueueAnimationUpdate()
+{
+    if (!octree || !octant || (animatedModelFlags & AMF_ANIMATION_QUEUED))
+        return;
+
+    AnimationSystem* animationSystem = Object::Subsystem<AnimationSystem>();
+    if (animationSystem)
+        animationSystem->QueueUpdate(this);
+    else if (!TestFlag(DF_OCTREE_REINSERT_QUEUED))
+        octree->QueueUpdate(this);
+}
+
 void AnimatedModelDrawable::SetBoneTransformsDirty()
 {
+    if (!bones)
+        return;
+
     for (size_t i = 0; i < numBones; ++i)
     {
         // If bone has only other bones as children, just set its world transform dirty without going through the hierarchy. The whole hierarchy will be eventually updated
@@ -340,9 +654,9 @@ void AnimatedModelDrawable::SetBoneTransformsDirty()
     }
 }
 
-void AnimatedModelDrawable::RemoveBones()
+void AnimatedModelDrawable::RemoveBoneNodes()
 {
-    if (!numBones)
+    if (!bones)
         return;
 
     // Do not signal transform changes back to the model during deletion
@@ -356,11 +670,45 @@ void AnimatedModelDrawable::RemoveBones()
     }
 
     bones.Reset();
+}
+
+void AnimatedModelDrawable::RemoveBones()
+{
+    if (!numBones)
+        return;
+
+    RemoveBoneNodes();
+
+    bonePoses.Reset();
+    boneTransforms.Reset();
+    boneOrder.Reset();
     skinMatrices.Reset();
+    skinDualQuaternions.Reset();
     skinMatrixBuffer.Reset();
     numBones = 0;
 }
 
+size_t AnimatedModelDrawable::FindBoneIndex(StringHash nameHash) const
+{
+    if (!model)
+        return M_MAX_UNSIGNED;
+
+    const std::vector<ModelBone>& modelBones = model->Bones();
+
+    for (size_t i = 0; i < numBones; ++i)
+    {
+        if (modelBones[i].nameHash == nameHash)
+            return i;
+    }
+
+    return M_MAX_UNSIGNED;
+}
+
+size_t AnimatedModelDrawable::BoneParentIndex(size_t index) const
+{
+    return model->Bones()[index].parentIndex;
+}
+
 AnimatedModel::AnimatedModel()
 {
     drawable = drawableAllocator.Allocate();
@@ -369,9 +717,14 @@ AnimatedModel::AnimatedModel()
 
 AnimatedModel::~AnimatedModel()
 {
-    static_cast<AnimatedModelDrawable*>(drawable)->RemoveBones();
+    AnimatedModelDrawable* modelDrawable = static_cast<AnimatedModelDrawable*>(drawable);
+    AnimationSystem* animationSystem = Subsystem<AnimationSystem>();
+    if (animationSystem && (modelDrawable->animatedModelFlags & AMF_ANIMATION_QUEUED))
+        animationSystem->RemoveDrawable(modelDrawable);
+
+    modelDrawable->RemoveBones();
     RemoveFromOctree();
-    drawableAllocator.Free(static_cast<AnimatedModelDrawable*>(drawable));
+    drawableAllocator.Free(modelDrawable);
     drawable = nullptr;
 }
 
@@ -383,6 +736,8 @@ void AnimatedModel::RegisterObject()
     RegisterMixedRefAttribute("model", &AnimatedModel::ModelAttr, &AnimatedModel::SetModelAttr, ResourceRef(Model::TypeStatic()));
     CopyBaseAttribute<AnimatedModel, StaticModel>("materials");
     CopyBaseAttribute<AnimatedModel, StaticModel>("lodBias");
+    RegisterAttribute("dualQuaternionSkinning", &AnimatedModel::DualQuaternionSkinning, &AnimatedModel::SetDualQuaternionSkinning, DEFAULT_DUAL_QUATERNION_SKINNING);
+    RegisterAttribute("animationLodDistance", &AnimatedModel::AnimationLodDistance, &AnimatedModel::SetAnimationLodDistance, DEFAULT_ANIMATION_LOD_DISTANCE);
     RegisterMixedRefAttribute("animationStates", &AnimatedModel::AnimationStatesAttr, &AnimatedModel::SetAnimationStatesAttr);
 }
 
@@ -394,6 +749,38 @@ void AnimatedModel::SetModel(Model* model_)
     static_cast<AnimatedModelDrawable*>(drawable)->CreateBones();
 }
 
+void AnimatedModel::SetBoneNodes(bool enable)
+{
+    AnimatedModelDrawable* modelDrawable = static_cast<AnimatedModelDrawable*>(drawable);
+
+    if (enable == modelDrawable->boneNodesEnabled)
+        return;
+
+    modelDrawable->boneNodesEnabled = enable;
+
+    if (enable)
+        modelDrawable->CreateBoneNodes();
+    else
+        modelDrawable->RemoveBoneNodes();
+}
+
+void AnimatedModel::SetDualQuaternionSkinning(bool enable)
+{
+    AnimatedModelDrawable* modelDrawable = static_cast<AnimatedModelDrawable*>(drawable);
+
+    if (enable == modelDrawable->TestFlag(DF_DUAL_QUATERNION_SKINNING))
+        return;
+
+    modelDrawable->SetFlag(DF_DUAL_QUATERNION_SKINNING, enable);
+    if (modelDrawable->numBones)
+        modelDrawable->CreateSkinningData();
+}
+
+void AnimatedModel::SetAnimationLodDistance(float distance)
+{
+    static_cast<AnimatedModelDrawable*>(drawable)->animationLodDistance = Max(distance, 0.0f);
+}
+
 AnimationState* AnimatedModel::AddAnimationState(Animation* animation)
 {
     AnimatedModelDrawable* modelDrawable = static_cast<AnimatedModelDrawable*>(drawable);
@@ -541,11 +928,14 @@ void AnimatedModel::OnTransformChanged()
 {
     AnimatedModelDrawable* modelDrawable = static_cast<AnimatedModelDrawable*>(drawable);
 
-    // To improve performance set skinning dirty now, so the bone nodes will not redundantly signal transform changes back
-    modelDrawable->animatedModelFlags |= AMF_SKINNING_DIRTY;
+    // Moving the model does not change the pose, so suppress the bone nodes signaling transform changes back while dirtying them.
+    // Model space dual quaternions do not need to be recalculated
+    if (!modelDrawable->skinDualQuaternions)
+        modelDrawable->animatedModelFlags |= AMF_SKINNING_DIRTY;
+    modelDrawable->animatedModelFlags |= AMF_IN_ANIMATION_UPDATE;
 
     // If have other children than the root bone, dirty the hierarchy normally. Otherwise optimize
-    if (children.size() > 1)
+    if (children.size() > (modelDrawable->rootBone ? 1 : 0))
         SpatialNode::OnTransformChanged();
     else
     {
@@ -554,6 +944,8 @@ void AnimatedModel::OnTransformChanged()
         SetFlag(NF_WORLD_TRANSFORM_DIRTY, true);
     }
 
+    modelDrawable->animatedModelFlags &= ~AMF_IN_ANIMATION_UPDATE;
+
     modelDrawable->SetFlag(DF_BOUNDING_BOX_DIRTY, true);
     if (octree && modelDrawable->octant && !modelDrawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
         octree->QueueUpdate(modelDrawable);
@@ -586,11 +978,13 @@ void AnimatedModel::SetAnimationStatesAttr(const JSONValue& value)
         if (!animState)
             continue;
 
-        animState->SetStartBone(FindChild<Bone>(state[1].GetString(), true));
+        animState->SetStartBoneIndex(static_cast<AnimatedModelDrawable*>(drawable)->FindBoneIndex(StringHash(state[1].GetString())));
         animState->SetLooped(state[2].GetBool());
         animState->SetWeight((float)state[3].GetNumber());
         animState->SetTime((float)state[4].GetNumber());
         animState->SetBlendLayer((unsigned char)(int)state[5].GetNumber());
+        if (state.Size() >= 7)
+            animState->SetNormalizedLerp(state[6].GetBool());
     }
 }
 
@@ -605,11 +999,13 @@ JSONValue AnimatedModel::AnimationStatesAttr() const
         AnimationState* animState = *it;
         JSONValue state;
         state.Push(animState->GetAnimation() ? animState->GetAnimation()->Name() : "");
-        state.Push(animState->StartBone() ? animState->StartBone()->Name() : "");
+        size_t startBoneIndex = animState->StartBoneIndex();
+        state.Push(startBoneIndex < modelDrawable->NumBones() ? GetModel()->Bones()[startBoneIndex].name : "");
         state.Push(animState->Looped());
         state.Push(animState->Weight());
         state.Push(animState->Time());
         state.Push((int)animState->BlendLayer());
+        state.Push(animState->NormalizedLerp());
         states.Push(state);
     }
 
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "../IO/JSONValue.h"
+#include "../Math/Vector4.h"
 #include "Octree.h"
 #include "StaticModel.h"
 
@@ -10,6 +11,7 @@ class AnimatedModel;
 class AnimatedModelDrawable;
 class Animation;
 class AnimationState;
+class AnimationSystem;
 class UniformBuffer;
 
 static const unsigned char AMF_ANIMATION_ORDER_DIRTY = 0x1;
@@ -18,6 +20,54 @@ static const unsigned char AMF_SKINNING_DIRTY = 0x4;
 static const unsigned char AMF_SKINNING_BUFFER_DIRTY = 0x8;
 static const unsigned char AMF_BONE_BOUNDING_BOX_DIRTY = 0x10;
 static const unsigned char AMF_IN_ANIMATION_UPDATE = 0x20;
+static const unsigned char AMF_POSE_DIRTY = 0x40;
+static const unsigned char AMF_ANIMATION_QUEUED = 0x80;
+
+static const bool DEFAULT_BONE_NODES = false;
+static const bool DEFAULT_DUAL_QUATERNION_SKINNING = false;
+static const float DEFAULT_ANIMATION_LOD_DISTANCE = 0.0f;
+static const unsigned char MAX_ANIMATION_LOD_INTERVAL = 8;
+
+/// Bone transform relative to its parent bone, or to the model for the root bone.
+struct BonePose
+{
+    /// Position.
+    Vector3 position;
+    /// Rotation.
+    Quaternion rotation;
+    /// Scale.
+    Vector3 scale;
+};
+
+/// Rigid model space skinning transform of a bone as a unit dual quaternion, in the layout uploaded for dual quaternion skinning.
+struct SkinDualQuaternion
+{
+    /// Construct undefined.
+    SkinDualQuaternion()
+    {
+    }
+
+    /// Construct from a skinning matrix. Scaling is discarded.
+    SkinDualQuaternion(const Matrix3x4& matrix)
+    {
+        Quaternion rotation(matrix.RotationMatrix());
+        Vector3 translation = matrix.Translation();
+
+        real = Vector4(rotation.x, rotation.y, rotation.z, rotation.w);
+        // Dual part is half the translation multiplied by the rotation
+        dual = Vector4(
+            0.5f * (rotation.w * translation.x + translation.y * rotation.z - translation.z * rotation.y),
+            0.5f * (rotation.w * translation.y + translation.z * rotation.x - translation.x * rotation.z),
+            0.5f * (rotation.w * translation.z + translation.x * rotation.y - translation.y * rotation.x),
+            -0.5f * (translation.x * rotation.x + translation.y * rotation.y + translation.z * rotation.z)
+        );
+    }
+
+    /// Rotation quaternion in xyzw order.
+    Vector4 real;
+    /// Translation part in xyzw order.
+    Vector4 dual;
+};
 
 /// %Bone scene node for AnimatedModel skinning.
 class Bone : public SpatialNode
@@ -70,10 +120,11 @@ private:
     size_t numChildBones;
 };
 
-/// Animated model drawable.
+/// Animated model drawable. Animation is evaluated into contiguous pose buffers: bone local transforms, and model space transforms calculated from them in one parent-first pass. Bone scene nodes are optional and only needed for attaching objects to bones or controlling bones programmatically; when they exist, the animated pose is copied to them and their transforms are read back when they are moved.
 class AnimatedModelDrawable : public StaticModelDrawable
 {
     friend class AnimatedModel;
+    friend class AnimationSystem;
 
 public:
     /// Construct.
@@ -85,62 +136,96 @@ public:
     void OnOctreeUpdate(unsigned short frameNumber) override;
     /// Prepare object for rendering. Reset framenumber and calculate distance from camera, check for LOD level changes, and update animation / skinning if necessary. Called by Renderer in worker threads. Return false if should not render.
     bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
-    /// Update GPU resources and set uniforms for rendering. Called by Renderer when geometry type is not static.
+    /// Bind the skinning matrices or dual quaternions for rendering. Called by Renderer when geometry type is not static.
     void OnRender(ShaderProgram* program, size_t geomIndex) override;
     /// Perform ray test on self and add possible hit to the result vector.
     void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance) override;
     /// Add debug geometry to be rendered.
     void OnRenderDebug(DebugRenderer* debug) override;
 
-    /// Set bounding box and skinning dirty and queue octree reinsertion when any of the bones move.
+    /// Set pose, bounding box and skinning dirty and queue octree reinsertion when any of the bone scene nodes move.
     void OnBoneTransformChanged()
     {
         SetFlag(DF_BOUNDING_BOX_DIRTY, true);
         if (octree && octant && !TestFlag(DF_OCTREE_REINSERT_QUEUED))
             octree->QueueUpdate(this);
 
-        animatedModelFlags |= AMF_SKINNING_DIRTY | AMF_BONE_BOUNDING_BOX_DIRTY;
+        animatedModelFlags |= AMF_POSE_DIRTY | AMF_SKINNING_DIRTY | AMF_BONE_BOUNDING_BOX_DIRTY;
     }
 
-    /// Set animation order dirty when animation state changes layer order and queue octree reinsertion. Note: bounding box will only be dirtied once animation actually updates.
+    /// Set animation order dirty when animation state changes layer order and queue animation update. Note: bounding box will only be dirtied once animation actually updates.
     void OnAnimationOrderChanged()
     {
-        if (octree && octant && !TestFlag(DF_OCTREE_REINSERT_QUEUED))
-            octree->QueueUpdate(this);
-
+        QueueAnimationUpdate();
         animatedModelFlags |= AMF_ANIMATION_DIRTY | AMF_ANIMATION_ORDER_DIRTY;
     }
 
-    /// Set animation dirty when animation state changes time position or weight and queue octree reinsertion. Note: bounding box will only be dirtied once animation actually updates.
+    /// Set animation dirty when animation state changes time position or weight and queue animation update. Note: bounding box will only be dirtied once animation actually updates.
     void OnAnimationChanged()
     {
-        if (octree && octant && !TestFlag(DF_OCTREE_REINSERT_QUEUED))
-            octree->QueueUpdate(this);
-
+        QueueAnimationUpdate();
         animatedModelFlags |= AMF_ANIMATION_DIRTY;
     }
 
-    /// Mark bone transforms dirty. Do in an optimized manner if bone has no attached objects.
+    /// Mark bone scene node transforms dirty. Do in an optimized manner if bone has no attached objects.
     void SetBoneTransformsDirty();
-    /// Apply animation states and recalculate bounding box.
+    /// Apply animation states to the pose and recalculate bounding box.
     void UpdateAnimation();
-    /// Update skin matrices for rendering.
+    /// Apply animation states to the bone local transforms. First step of the animation update.
+    void SampleAnimation();
+    /// Copy the pose to the bone scene nodes if they exist and end the animation update. Dirties the bone scene node hierarchy, so in worker threads may only be called during threaded octree update.
+    void FinishAnimation();
+    /// Calculate the bone model space transforms from the local transforms, parents first.
+    void UpdatePose();
+    /// Read the bone local transforms from the bone scene nodes after they were moved, and recalculate the model space transforms.
+    void UpdatePoseFromBoneNodes();
+    /// Update skin matrices, or model space dual quaternions if dual quaternion skinning is enabled, for rendering.
     void UpdateSkinning();
-    /// Create bone scene nodes based on the model. If compatible bones already exist in the scene hierarchy, they are taken into use instead of creating new.
+    /// Update the model space bounding box from the precalculated animation bounds without evaluating the skeleton. The animation stays dirty for a full update once the model is in view. Possible only with a single fully weighted animation state covering the whole skeleton and no bone scene nodes. Return true on success.
+    bool UpdateAnimationBounds();
+    /// Create the skinning matrix or dual quaternion buffer according to the skinning mode.
+    void CreateSkinningData();
+    /// Create the pose buffers based on the model, and bone scene nodes if enabled or if compatible bones already exist in the scene hierarchy.
     void CreateBones();
-    /// Remove existing bones.
+    /// Create bone scene nodes for the current pose. If compatible bones already exist in the scene hierarchy, they are taken into use instead of creating new, and the pose is read from them.
+    void CreateBoneNodes();
+    /// Remove bone scene nodes. The pose buffers remain.
+    void RemoveBoneNodes();
+    /// Remove the pose buffers and bone scene nodes.
     void RemoveBones();
     
-    /// Return the root bone.
+    /// Return the root bone scene node, or null if bone scene nodes are not created.
     Bone* RootBone() const { return rootBone; }
     /// Return number of bones.
     size_t NumBones() const { return numBones; }
-    /// Return all bone scene nodes.
+    /// Return all bone scene nodes. Null if bone scene nodes are not created.
     const AutoArrayPtr<Bone*>& Bones() const { return bones; }
+    /// Return bone local transforms, in the model's bone order.
+    BonePose* BonePoses() const { return bonePoses.Get(); }
+    /// Return bone model space transforms, in the model's bone order.
+    const Matrix3x4* BoneTransforms() const { return boneTransforms.Get(); }
+    /// Return world space skinning matrices, or null if dual quaternion skinning is enabled.
+    const Matrix3x4* SkinMatrices() const { return skinMatrices.Get(); }
+    /// Return model space skinning dual quaternions, or null if dual quaternion skinning is disabled.
+    const SkinDualQuaternion* SkinDualQuaternions() const { return skinDualQuaternions.Get(); }
+    /// Return whether uses dual quaternion skinning.
+    bool DualQuaternionSkinning() const { return TestFlag(DF_DUAL_QUATERNION_SKINNING); }
+    /// Return bone index by name hash, or M_MAX_UNSIGNED if not found.
+    size_t FindBoneIndex(StringHash nameHash) const;
+    /// Return root bone index, or M_MAX_UNSIGNED if no bones.
+    size_t RootBoneIndex() const { return numBones ? boneOrder[0] : M_MAX_UNSIGNED; }
+    /// Return parent bone index. The root bone returns its own index.
+    size_t BoneParentIndex(size_t index) const;
     /// Return all animation states.
     const std::vector<SharedPtr<AnimationState> >& AnimationStates() const { return animationStates; }
     /// Return the internal dirty status flags.
     unsigned char AnimatedModelFlags() { return animatedModelFlags; }
+    /// Return distance at which the animation update interval starts to double.
+    float AnimationLodDistance() const { return animationLodDistance; }
+    /// Return the current animation update interval in frames.
+    unsigned char AnimationUpdateInterval() const { return animationUpdateInterval; }
+    /// Return the frame number on which animation was last evaluated during view preparation.
+    unsigned short LastAnimationFrameNumber() const { return lastAnimationFrameNumber; }
 
 protected:
     /// Combined bounding box of the bones in model space, used for quick updates when only the node moves without animation
@@ -151,16 +236,52 @@ protected:
     unsigned short numBones;
     /// %Octree.
     Octree* octree;
-    /// Root bone.
+    /// Root bone scene node.
     Bone* rootBone;
-    /// Bone scene nodes.
+    /// Bone scene nodes, null if not created.
     AutoArrayPtr<Bone*> bones;
+    /// Bone local transforms.
+    AutoArrayPtr<BonePose> bonePoses;
+    /// Bone model space transforms.
+    AutoArrayPtr<Matrix3x4> boneTransforms;
+    /// Bone indices ordered so that parents come before their children.
+    AutoArrayPtr<unsigned short> boneOrder;
+    /// Bone scene nodes enabled flag.
+    bool boneNodesEnabled;
     /// Skinning matrices.
     AutoArrayPtr<Matrix3x4> skinMatrices;
-    /// Skinning uniform buffer.
+    /// Skinning dual quaternions.
+    AutoArrayPtr<SkinDualQuaternion> skinDualQuaternions;
+    /// Own skinning uniform buffer, used only if the renderer's skinning matrix buffer is full.
     AutoPtr<UniformBuffer> skinMatrixBuffer;
+    /// Byte offset of the skinning data in the renderer's skinning matrix buffer.
+    size_t skinMatrixOffset;
+    /// Frame number on which the skinning data was copied to the renderer's skinning matrix buffer, zero if not copied.
+    unsigned short skinMatrixFrameNumber;
     /// Animation states.
     std::vector<SharedPtr<AnimationState> > animationStates;
+    /// Distance at which the animation update interval starts to double, zero to update every frame.
+    float animationLodDistance;
+    /// Current animation update interval in frames.
+    unsigned char animationUpdateInterval;
+    /// Frame offset for spreading the updates of models with the same interval across frames.
+    unsigned char animationUpdatePhase;
+    /// Frame number on which animation was last evaluated during view preparation.
+    unsigned short lastAnimationFrameNumber;
+
+private:
+    /// Queue animation update to the animation system if it exists, otherwise queue octree reinsertion to update during the octree update.
+    void QueueAnimationUpdate();
+    /// Return the skinning data to upload.
+    const void* SkinData() const { return skinDualQuaternions ? (const void*)skinDualQuaternions.Get() : (const void*)skinMatrices.Get(); }
+    /// Return the byte size of the skinning data.
+    size_t SkinDataSize() const { return numBones * (skinDualQuaternions ? sizeof(SkinDualQuaternion) : sizeof(Matrix3x4)); }
+    /// Return whether animation should be evaluated on this frame according to the update interval. Models update on their phase within the interval, or immediately if the whole interval has passed, for example when coming into view.
+    bool AnimationUpdateDue(unsigned short frameNumber) const
+    {
+        return animationUpdateInterval <= 1 || !((frameNumber + animationUpdatePhase) & (animationUpdateInterval - 1)) ||
+            (unsigned short)(frameNumber - lastAnimationFrameNumber) >= animationUpdateInterval;
+    }
 };
 
 /// %Scene node that renders a skeletally animated (skinned) model.
@@ -177,8 +298,14 @@ public:
     /// Register factory and attributes.
     static void RegisterObject();
 
-    /// Set the model resource and create / acquire bone scene nodes.
+    /// Set the model resource and create the pose buffers, and bone scene nodes if enabled or found in the scene hierarchy.
     void SetModel(Model* model);
+    /// Set whether to create bone scene nodes, which are needed for attaching objects to bones or controlling bones programmatically. Without them the skeleton is animated only in the pose buffers, which is faster. Default false. Bone nodes already in the scene hierarchy, for example from loading a scene, are taken into use when setting the model regardless.
+    void SetBoneNodes(bool enable);
+    /// Set whether to skin with dual quaternions instead of matrices. Dual quaternions need only 32 bytes per bone instead of 48 and avoid the volume loss of blended matrices at twisting joints, but do not support bone scaling. The palette is in model space and does not need to be recalculated when only the model moves. Default false.
+    void SetDualQuaternionSkinning(bool enable);
+    /// Set distance at which the animation update interval starts to double, up to every 8 frames at 8 times the distance. In between updates the animated pose is held, while the model still follows its scene node every frame. The distance is affected by the camera and model LOD bias like geometry LOD distances. Zero updates every frame. Default 0.
+    void SetAnimationLodDistance(float distance);
     /// Add an animation and return the created animation state.
     AnimationState* AddAnimationState(Animation* animation);
     /// Remove an animation by animation pointer.
@@ -196,11 +323,17 @@ public:
     /// Remove all animations.
     void RemoveAllAnimationStates();
 
-    /// Return the root bone.
+    /// Return distance at which the animation update interval starts to double.
+    float AnimationLodDistance() const { return static_cast<AnimatedModelDrawable*>(drawable)->AnimationLodDistance(); }
+    /// Return whether uses dual quaternion skinning.
+    bool DualQuaternionSkinning() const { return drawable->TestFlag(DF_DUAL_QUATERNION_SKINNING); }
+    /// Return whether bone scene nodes are enabled.
+    bool BoneNodes() const { return static_cast<AnimatedModelDrawable*>(drawable)->boneNodesEnabled; }
+    /// Return the root bone scene node, or null if bone scene nodes are not created.
     Bone* RootBone() const { return static_cast<AnimatedModelDrawable*>(drawable)->RootBone(); }
     /// Return number of bones.
     size_t NumBones() const { return static_cast<AnimatedModelDrawable*>(drawable)->NumBones(); }
-    /// Return all bone scene nodes.
+    /// Return all bone scene nodes. Null if bone scene nodes are not created.
     const AutoArrayPtr<Bone*>& Bones() const { return static_cast<AnimatedModelDrawable*>(drawable)->Bones(); }
     /// Return all animation states.
     const std::vector<SharedPtr<AnimationState> >& AnimationStates() const { return static_cast<AnimatedModelDrawable*>(drawable)->AnimationStates(); }
@@ -2,27 +2,406 @@
 
 #include "../IO/Log.h"
 #include "../IO/Stream.h"
+#include "../Math/Matrix3x4.h"
 #include "Animation.h"
+#include "AnimationBounds.h"
+#include "Model.h"
 
 #include <tracy/Tracy.hpp>
 
+// Native animation format identifier and version
+static const std::string NATIVE_ANIMATION_ID("TANI");
+static const unsigned NATIVE_ANIMATION_VERSION = 1;
+
+// Maximum error for compressed animations: position in model units, rotation in degrees, scale
+static const float ANIMATION_POSITION_TOLERANCE = 0.001f;
+static const float ANIMATION_ROTATION_TOLERANCE = 0.1f;
+static const float ANIMATION_SCALE_TOLERANCE = 0.001f;
+
+// Tracks with more keyframes than this do not get a time bucket index
+static const size_t MAX_INDEXED_KEYFRAMES = 65536;
+
+// Range of the three smallest quaternion components
+static const float ROTATION_COMPONENT_RANGE = 0.70710678f;
+// Largest value of a quantized rotation component
+static const float ROTATION_COMPONENT_MAX = 32767.0f;
+// Largest value of a quantized position or scale component
+static const float VECTOR_COMPONENT_MAX = 65535.0f;
+
+bool Animation::compression = false;
+
+/// Quantize vectors to 16 bits per component relative to their bounds. Return the minimum and the change per quantization step.
+static void QuantizeVectors(const std::vector<Vector3>& values, std::vector<unsigned short>& dest, Vector3& min, Vector3& step)
+{
+    min = Vector3(M_MAX_FLOAT, M_MAX_FLOAT, M_MAX_FLOAT);
+    Vector3 max(-M_MAX_FLOAT, -M_MAX_FLOAT, -M_MAX_FLOAT);
+
+    for (auto it = values.begin(); it != values.end(); ++it)
+    {
+        min = Vector3(Min(min.x, it->x), Min(min.y, it->y), Min(min.z, it->z));
+        max = Vector3(Max(max.x, it->x), Max(max.y, it->y), Max(max.z, it->z));
+    }
+
+    step = (max - min) / VECTOR_COMPONENT_MAX;
+    dest.resize(values.size() * 3);
+
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        const Vector3& value = values[i];
+        dest[i * 3] = step.x > 0.0f ? (unsigned short)roundf((value.x - min.x) / step.x) : 0;
+        dest[i * 3 + 1] = step.y > 0.0f ? (unsigned short)roundf((value.y - min.y) / step.y) : 0;
+        dest[i * 3 + 2] = step.z > 0.0f ? (unsigned short)roundf((value.z - min.z) / step.z) : 0;
+    }
+}
+
+/// Return the angle between two rotations in degrees.
+static float RotationError(const Quaternion& lhs, const Quaternion& rhs)
+{
+    return 2.0f * Acos(Abs(lhs.DotProduct(rhs)));
+}
+
+/// Return the interpolated rotation between two keyframes.
+static Quaternion InterpolateRotation(const Quaternion& lhs, const Quaternion& rhs, float t)
+{
+    // Avoid slerp between identical rotations, which may produce NaN due to rounding
+    return lhs == rhs ? lhs : lhs.Slerp(rhs, t);
+}
+
+/// Return whether the keyframes between two keyframes can be interpolated from them within the error tolerances.
+static bool CanInterpolate(const AnimationTrack& track, size_t first, size_t last, float positionTolerance, float rotationTolerance, float scaleTolerance)
+{
+    float timeInterval = track.keyTimes[last] - track.keyTimes[first];
+
+    for (size_t i = first + 1; i < last; ++i)
+    {
+        float t = timeInterval > 0.0f ? (track.keyTimes[i] - track.keyTimes[first]) / timeInterval : 0.0f;
+
+        if ((track.channelMask & CHANNEL_POSITION) && (track.positions[first].Lerp(track.positions[last], t) - track.positions[i]).Length() > positionTolerance)
+            return false;
+        if ((track.channelMask & CHANNEL_ROTATION) && RotationError(InterpolateRotation(track.rotations[first], track.rotations[last], t), track.rotations[i]) > rotationTolerance)
+            return false;
+        if ((track.channelMask & CHANNEL_SCALE) && (track.scales[first].Lerp(track.scales[last], t) - track.scales[i]).Length() > scaleTolerance)
+            return false;
+    }
+
+    return true;
+}
+
+/// Sample a track at a time position without wrapping.
+static AnimationKeyFrame SampleTrack(const AnimationTrack& track, float time, size_t& index)
+{
+    track.FindKeyFrameIndex(time, index);
+    size_t nextIndex = Min(index + 1, track.NumKeyFrames() - 1);
+
+    AnimationKeyFrame keyFrame = track.KeyFrame(index);
+    AnimationKeyFrame nextKeyFrame = track.KeyFrame(nextIndex);
+    float timeInterval = nextKeyFrame.time - keyFrame.time;
+    float t = timeInterval > 0.0f ? Clamp((time - keyFrame.time) / timeInterval, 0.0f, 1.0f) : 0.0f;
+
+    AnimationKeyFrame ret;
+    ret.time = time;
+    ret.position = keyFrame.position.Lerp(nextKeyFrame.position, t);
+    ret.rotation = InterpolateRotation(keyFrame.rotation, nextKeyFrame.rotation, t);
+    ret.scale = keyFrame.scale.Lerp(nextKeyFrame.scale, t);
+    return ret;
+}
+
+AnimationCompressionStatistics::AnimationCompressionStatistics() :
+    numKeyFrames(0),
+    numKeptKeyFrames(0),
+    originalSize(0),
+    compressedSize(0),
+    maxPositionError(0.0f),
+    maxRotationError(0.0f),
+    maxScaleError(0.0f)
+{
+}
+
+AnimationTrack::AnimationTrack() :
+    channelMask(0),
+    compressed(false),
+    bucketScale(0.0f)
+{
+}
+
+void AnimationTrack::SetNumKeyFrames(size_t num)
+{
+    keyFrameBuckets.clear();
+    keyTimes.resize(num);
+    positions.resize((channelMask & CHANNEL_POSITION) ? num : 0);
+    rotations.resize((channelMask & CHANNEL_ROTATION) ? num : 0);
+    scales.resize((channelMask & CHANNEL_SCALE) ? num : 0, Vector3::ONE);
+}
+
+void AnimationTrack::AddKeyFrame(const AnimationKeyFrame& keyFrame)
+{
+    keyFrameBuckets.clear();
+    keyTimes.push_back(keyFrame.time);
+    if (channelMask & CHANNEL_POSITION)
+        positions.push_back(keyFrame.position);
+    if (channelMask & CHANNEL_ROTATION)
+        rotations.push_back(keyFrame.rotation);
+    if (channelMask & CHANNEL_SCALE)
+        scales.push_back(keyFrame.scale);
+}
+
+AnimationCompressionStatistics AnimationTrack::Compress(float positionTolerance, float rotationTolerance, float scaleTolerance)
+{
+    AnimationCompressionStatistics ret;
+    size_t numKeyFrames = keyTimes.size();
+    ret.numKeyFrames = numKeyFrames;
+    ret.numKeptKeyFrames = numKeyFrames;
+    ret.originalSize = KeyFrameDataSize();
+
+    if (compressed || !numKeyFrames)
+    {
+        ret.compressedSize = ret.originalSize;
+        return ret;
+    }
+
+    AnimationTrack original(*this);
+
+    // Keep the first and last keyframe, and greedily extend each span between kept keyframes as far as the keyframes in between can be interpolated
+    std::vector<size_t> kept;
+    kept.push_back(0);
+    size_t first = 0;
+    for (size_t i = 2; i < numKeyFrames; ++i)
+    {
+        if (!CanInterpolate(original, first, i, positionTolerance, rotationTolerance, scaleTolerance))
+        {
+            first = i - 1;
+            kept.push_back(first);
+        }
+    }
+    if (numKeyFrames > 1)
+        kept.push_back(numKeyFrames - 1);
+
+    keyTimes.resize(kept.size());
+    for (size_t i = 0; i < kept.size(); ++i)
+    {
+        keyTimes[i] = original.keyTimes[kept[i]];
+        if (channelMask & CHANNEL_POSITION)
+            positions[i] = original.positions[kept[i]];
+        if (channelMask & CHANNEL_ROTATION)
+            rotations[i] = original.rotations[kept[i]];
+        if (channelMask & CHANNEL_SCALE)
+            scales[i] = original.scales[kept[i]];
+    }
+
+    if (channelMask & CHANNEL_POSITION)
+    {
+        positions.resize(kept.size());
+        QuantizeVectors(positions, packedPositions, positionMin, positionStep);
+    }
+    if (channelMask & CHANNEL_ROTATION)
+    {
+        packedRotations.resize(kept.size() * 3);
+        for (size_t i = 0; i < kept.size(); ++i)
+            PackRotation(rotations[i], &packedRotations[i * 3]);
+    }
+    if (channelMask & CHANNEL_SCALE)
+    {
+        scales.resize(kept.size());
+        QuantizeVectors(scales, packedScales, scaleMin, scaleStep);
+    }
+
+    std::vector<Vector3>().swap(positions);
+    std::vector<Quaternion>().swap(rotations);
+    std::vector<Vector3>().swap(scales);
+    compressed = true;
+    BuildKeyFrameIndex();
+
+    // Measure the error of the compressed track at the original keyframes
+    size_t index = 0;
+    for (size_t i = 0; i < numKeyFrames; ++i)
+    {
+        AnimationKeyFrame sample = SampleTrack(*this, original.keyTimes[i], index);
+
+        if (channelMask & CHANNEL_POSITION)
+            ret.maxPositionError = Max(ret.maxPositionError, (sample.position - original.positions[i]).Length());
+        if (channelMask & CHANNEL_ROTATION)
+            ret.maxRotationError = Max(ret.maxRotationError, RotationError(sample.rotation, original.rotations[i]));
+        if (channelMask & CHANNEL_SCALE)
+            ret.maxScaleError = Max(ret.maxScaleError, (sample.scale - original.scales[i]).Length());
+    }
+
+    ret.numKeptKeyFrames = kept.size();
+    ret.compressedSize = KeyFrameDataSize();
+    return ret;
+}
+
+void AnimationTrack::BuildKeyFrameIndex()
+{
+    keyFrameBuckets.clear();
+    bucketScale = 0.0f;
+
+    size_t numKeyFrames = keyTimes.size();
+    if (numKeyFrames < 2 || numKeyFrames > MAX_INDEXED_KEYFRAMES)
+        return;
+
+    float duration = keyTimes[numKeyFrames - 1] - keyTimes[0];
+    if (duration <= 0.0f)
+        return;
+
+    // Use as many buckets as keyframes, so that evenly spaced keyframes need at most one step after the bucket lookup
+    keyFrameBuckets.resize(numKeyFrames);
+    bucketScale = numKeyFrames / duration;
+
+    size_t index = 0;
+    for (size_t i = 0; i < numKeyFrames; ++i)
+    {
+        float bucketStart = keyTimes[0] + i / bucketScale;
+        while (index < numKeyFrames - 1 && keyTimes[index + 1] <= bucketStart)
+            ++index;
+        keyFrameBuckets[i] = (unsigned short)index;
+    }
+}
+
 void AnimationTrack::FindKeyFrameIndex(float time, size_t& index) const
 {
     if (time < 0.0f)
         time = 0.0f;
 
-    if (index >= keyFrames.size())
-        index = keyFrames.size() - 1;
+    if (!keyFrameBuckets.empty())
+    {
+        float bucket = (time - keyTimes[0]) * bucketScale;
+        index = keyFrameBuckets[bucket > 0.0f ? Min((size_t)bucket, keyFrameBuckets.size() - 1) : 0];
+    }
+    else if (index >= keyTimes.size())
+        index = keyTimes.size() - 1;
 
     // Check for being too far ahead
-    while (index && time < keyFrames[index].time)
+    while (index && time < keyTimes[index])
         --index;
 
     // Check for being too far behind
-    while (index < keyFrames.size() - 1 && time >= keyFrames[index + 1].time)
+    while (index < keyTimes.size() - 1 && time >= keyTimes[index + 1])
         ++index;
 }
 
+float AnimationTrack::FindKeyFrames(float time, float length, bool looped, size_t& keyFrame, size_t& nextFrame) const
+{
+    FindKeyFrameIndex(time, keyFrame);
+
+    // Check if next frame to interpolate to is valid, or if wrapping is needed (looping animation only)
+    nextFrame = keyFrame + 1;
+    if (nextFrame >= keyTimes.size())
+    {
+        if (!looped)
+        {
+            nextFrame = keyFrame;
+            return 0.0f;
+        }
+        else
+            nextFrame = 0;
+    }
+
+    float timeInterval = keyTimes[nextFrame] - keyTimes[keyFrame];
+    if (timeInterval < 0.0f)
+        timeInterval += length;
+    return timeInterval > 0.0f ? (time - keyTimes[keyFrame]) / timeInterval : 1.0f;
+}
+
+void AnimationTrack::Sample(float time, float length, bool looped, size_t& keyFrame, Vector3& position, Quaternion& rotation, Vector3& scale) const
+{
+    if (keyTimes.empty())
+        return;
+
+    size_t nextFrame;
+    float t = FindKeyFrames(time, length, looped, keyFrame, nextFrame);
+
+    if (channelMask & CHANNEL_POSITION)
+        position = Position(keyFrame).Lerp(Position(nextFrame), t);
+    if (channelMask & CHANNEL_ROTATION)
+        rotation = Rotation(keyFrame).Slerp(Rotation(nextFrame), t);
+    if (channelMask & CHANNEL_SCALE)
+        scale = Scale(keyFrame).Lerp(Scale(nextFrame), t);
+}
+
+AnimationKeyFrame AnimationTrack::KeyFrame(size_t index) const
+{
+    AnimationKeyFrame ret;
+    if (index >= keyTimes.size())
+        return ret;
+
+    ret.time = keyTimes[index];
+    if (channelMask & CHANNEL_POSITION)
+        ret.position = Position(index);
+    if (channelMask & CHANNEL_ROTATION)
+        ret.rotation = Rotation(index);
+    if (channelMask & CHANNEL_SCALE)
+        ret.scale = Scale(index);
+    return ret;
+}
+
+size_t AnimationTrack::KeyFrameDataSize() const
+{
+    size_t ret = keyTimes.size() * sizeof(float) + keyFrameBuckets.size() * sizeof(unsigned short);
+
+    if (compressed)
+    {
+        ret += (packedPositions.size() + packedRotations.size() + packedScales.size()) * sizeof(unsigned short);
+        if (channelMask & CHANNEL_POSITION)
+            ret += 2 * sizeof(Vector3);
+        if (channelMask & CHANNEL_SCALE)
+            ret += 2 * sizeof(Vector3);
+    }
+    else
+        ret += positions.size() * sizeof(Vector3) + rotations.size() * sizeof(Quaternion) + scales.size() * sizeof(Vector3);
+
+    return ret;
+}
+
+void AnimationTrack::PackRotation(const Quaternion& rotation, unsigned short* dest)
+{
+    Quaternion normalized = rotation.Normalized();
+    float components[4] = { normalized.w, normalized.x, normalized.y, normalized.z };
+
+    size_t largest = 0;
+    for (size_t i = 1; i < 4; ++i)
+    {
+        if (Abs(components[i]) > Abs(components[largest]))
+            largest = i;
+    }
+
+    // The negated quaternion is the same rotation, so make the largest component positive. Then it can be restored from the others
+    float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+    size_t j = 0;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        if (i == largest)
+            continue;
+
+        float value = Clamp(components[i] * sign / ROTATION_COMPONENT_RANGE, -1.0f, 1.0f);
+        dest[j++] = (unsigned short)roundf((value * 0.5f + 0.5f) * ROTATION_COMPONENT_MAX);
+    }
+
+    // Store the largest component index in the high bits of the first two values
+    dest[0] |= (unsigned short)((largest & 1) << 15);
+    dest[1] |= (unsigned short)((largest >> 1) << 15);
+}
+
+Quaternion AnimationTrack::UnpackRotation(const unsigned short* packed)
+{
+    size_t largest = (packed[0] >> 15) | ((packed[1] >> 15) << 1);
+    float components[4];
+    float sumSquares = 0.0f;
+    size_t j = 0;
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        if (i == largest)
+            continue;
+
+        float value = ((packed[j++] & 0x7fff) * (2.0f / ROTATION_COMPONENT_MAX) - 1.0f) * ROTATION_COMPONENT_RANGE;
+        components[i] = value;
+        sumSquares += value * value;
+    }
+
+    components[largest] = sqrtf(Max(1.0f - sumSquares, 0.0f));
+    return Quaternion(components[0], components[1], components[2], components[3]);
+}
+
 Animation::Animation() :
     length(0.0f)
 {
@@ -41,8 +420,14 @@ bool Animation::BeginLoad(Stream& source)
 {
     ZoneScoped;
 
-    /// \todo Develop own format for Turso3D
-    if (source.ReadFileID() != "UANI")
+    tracks.clear();
+    modelBounds.clear();
+
+    std::string fileID = source.ReadFileID();
+    if (fileID == NATIVE_ANIMATION_ID)
+        return BeginLoadNative(source);
+
+    if (fileID != "UANI")
     {
         LOGERROR(source.Name() + " is not a valid animation file");
         return false;
@@ -52,7 +437,6 @@ bool Animation::BeginLoad(Stream& source)
     animationName = source.Read<std::string>();
     animationNameHash = animationName;
     length = source.Read<float>();
-    tracks.clear();
 
     size_t numTracks = source.Read<unsigned>();
 
@@ -63,25 +447,105 @@ bool Animation::BeginLoad(Stream& source)
         newTrack->channelMask = source.Read<unsigned char>();
 
         size_t numKeyFrames = source.Read<unsigned>();
-        newTrack->keyFrames.resize(numKeyFrames);
+        newTrack->SetNumKeyFrames(numKeyFrames);
 
-        // Read keyframes of the track
+        // Read keyframes of the track, deinterleaving them to the channel streams
         for (size_t j = 0; j < numKeyFrames; ++j)
         {
-            AnimationKeyFrame& newKeyFrame = newTrack->keyFrames[j];
-            newKeyFrame.time = source.Read<float>();
+            newTrack->keyTimes[j] = source.Read<float>();
             if (newTrack->channelMask & CHANNEL_POSITION)
-                newKeyFrame.position = source.Read<Vector3>();
+                newTrack->positions[j] = source.Read<Vector3>();
             if (newTrack->channelMask & CHANNEL_ROTATION)
-                newKeyFrame.rotation = source.Read<Quaternion>();
+                newTrack->rotations[j] = source.Read<Quaternion>();
             if (newTrack->channelMask & CHANNEL_SCALE)
-                newKeyFrame.scale = source.Read<Vector3>();
+                newTrack->scales[j] = source.Read<Vector3>();
         }
+
+        newTrack->BuildKeyFrameIndex();
     }
 
+    if (compression)
+        Compress();
+
     return true;
 }
 
+bool Animation::Save(Stream& dest)
+{
+    ZoneScoped;
+
+    for (auto it = tracks.begin(); it != tracks.end(); ++it)
+    {
+        if (!it->second.compressed)
+        {
+            Compress();
+            break;
+        }
+    }
+
+    dest.WriteFileID(NATIVE_ANIMATION_ID);
+    dest.Write(NATIVE_ANIMATION_VERSION);
+    dest.Write(animationName);
+    dest.Write(length);
+
+    dest.Write((unsigned)tracks.size());
+    for (auto it = tracks.begin(); it != tracks.end(); ++it)
+    {
+        const AnimationTrack& track = it->second;
+        size_t numKeyFrames = track.NumKeyFrames();
+
+        dest.Write(track.name);
+        dest.Write(track.channelMask);
+        dest.Write((unsigned)numKeyFrames);
+        if (!numKeyFrames)
+            continue;
+
+        dest.Write(&track.keyTimes[0], numKeyFrames * sizeof(float));
+        if (track.channelMask & CHANNEL_POSITION)
+        {
+            dest.Write(track.positionMin);
+            dest.Write(track.positionStep);
+            dest.Write(&track.packedPositions[0], numKeyFrames * 3 * sizeof(unsigned short));
+        }
+        if (track.channelMask & CHANNEL_ROTATION)
+            dest.Write(&track.packedRotations[0], numKeyFrames * 3 * sizeof(unsigned short));
+        if (track.channelMask & CHANNEL_SCALE)
+        {
+            dest.Write(track.scaleMin);
+            dest.Write(track.scaleStep);
+            dest.Write(&track.packedScales[0], numKeyFrames * 3 * sizeof(unsigned short));
+        }
+    }
+
+    return true;
+}
+
+AnimationCompressionStatistics Animation::Compress()
+{
+    ZoneScoped;
+
+    AnimationCompressionStatistics ret;
+    modelBounds.clear();
+
+    for (auto it = tracks.begin(); it != tracks.end(); ++it)
+    {
+        AnimationCompressionStatistics trackStats = it->second.Compress(ANIMATION_POSITION_TOLERANCE, ANIMATION_ROTATION_TOLERANCE, ANIMATION_SCALE_TOLERANCE);
+        ret.numKeyFrames += trackStats.numKeyFrames;
+        ret.numKeptKeyFrames += trackStats.numKeptKeyFrames;
+        ret.originalSize += trackStats.originalSize;
+        ret.compressedSize += trackStats.compressedSize;
+        ret.maxPositionError = Max(ret.maxPositionError, trackStats.maxPositionError);
+        ret.maxRotationError = Max(ret.maxRotationError, trackStats.maxRotationError);
+        ret.maxScaleError = Max(ret.maxScaleError, trackStats.maxScaleError);
+    }
+
+    LOGINFOF("Animation %s keyframe data %d bytes, compressed to %d bytes, %d of %d keyframes kept, max error position %.5f rotation %.4f degrees scale %.5f",
+        Name().c_str(), (int)ret.originalSize, (int)ret.compressedSize, (int)ret.numKeptKeyFrames, (int)ret.numKeyFrames, ret.maxPositionError,
+        ret.maxRotationError, ret.maxScaleError);
+
+    return ret;
+}
+
 void Animation::SetAnimationName(const std::string& name_)
 {
     animationName = name_;
@@ -91,6 +555,7 @@ void Animation::SetAnimationName(const std::string& name_)
 void Animation::SetLength(float length_)
 {
     length = Max(length_, 0.0f);
+    modelBounds.clear();
 }
 
 AnimationTrack* Animation::CreateTrack(const std::string& name_)
@@ -100,6 +565,8 @@ AnimationTrack* Animation::CreateTrack(const std::string& name_)
     if (oldTrack)
         return oldTrack;
 
+    modelBounds.clear();
+
     AnimationTrack& newTrack = tracks[nameHash_];
     newTrack.name = name_;
     newTrack.nameHash = nameHash_;
@@ -110,12 +577,16 @@ void Animation::RemoveTrack(const std::string& name_)
 {
     auto it = tracks.find(StringHash(name_));
     if (it != tracks.end())
+    {
         tracks.erase(it);
+        modelBounds.clear();
+    }
 }
 
 void Animation::RemoveAllTracks()
 {
     tracks.clear();
+    modelBounds.clear();
 }
 
 AnimationTrack* Animation::Track(size_t index) const
@@ -145,3 +616,90 @@ AnimationTrack* Animation::FindTrack(StringHash nameHash_) const
     auto it = tracks.find(nameHash_);
     return it != tracks.end() ? const_cast<AnimationTrack*>(&(it->second)) : nullptr;
 }
+
+size_t Animation::KeyFrameDataSize() const
+{
+    size_t ret = 0;
+    for (auto it = tracks.begin(); it != tracks.end(); ++it)
+        ret += it->second.KeyFrameDataSize();
+    return ret;
+}
+
+AnimationBounds* Animation::ModelBounds(Model* model)
+{
+    if (!model)
+        return nullptr;
+
+    for (auto it = modelBounds.begin(); it != modelBounds.end();)
+    {
+        // Purge bounds of models that have been destroyed, as a new model could reuse the address
+        if (it->first.IsExpired())
+            it = modelBounds.erase(it);
+        else if (it->first == model)
+            return it->second;
+        else
+            ++it;
+    }
+
+    AnimationBounds* newBounds = new AnimationBounds(model, this);
+    modelBounds.push_back(std::make_pair(WeakPtr<Model>(model), SharedPtr<AnimationBounds>(newBounds)));
+    return newBounds;
+}
+
+void Animation::SetCompression(bool enable)
+{
+    compression = enable;
+}
+
+bool Animation::BeginLoadNative(Stream& source)
+{
+    unsigned version = source.Read<unsigned>();
+    if (version != NATIVE_ANIMATION_VERSION)
+    {
+        LOGERRORF("Animation %s has unsupported native format version %d", source.Name().c_str(), version);
+        return false;
+    }
+
+    animationName = source.Read<std::string>();
+    animationNameHash = animationName;
+    length = source.Read<float>();
+
+    size_t numTracks = source.Read<unsigned>();
+
+    for (size_t i = 0; i < numTracks; ++i)
+    {
+        AnimationTrack* newTrack = CreateTrack(source.Read<std::string>());
+        newTrack->channelMask = source.Read<unsigned char>();
+        newTrack->compressed = true;
+
+        size_t numKeyFrames = source.Read<unsigned>();
+        if (!numKeyFrames)
+            continue;
+
+        newTrack->keyTimes.resize(numKeyFrames);
+        source.Read(&newTrack->keyTimes[0], numKeyFrames * sizeof(float));
+        if (newTrack->channelMask & CHANNEL_POSITION)
+        {
+            newTrack->positionMin = source.Read<Vector3>();
+            newTrack->positionStep = source.Read<Vector3>();
+            newTrack->packedPositions.resize(numKeyFrames * 3);
+            source.Read(&newTrack->packedPositions[0], numKeyFrames * 3 * sizeof(unsigned short));
+        }
+        if (newTrack->channelMask & CHANNEL_ROTATION)
+        {
+            newTrack->packedRotations.resize(numKeyFrames * 3);
+            source.Read(&newTrack->packedRotations[0], numKeyFrames * 3 * sizeof(unsigned short));
+        }
+        if (newTrack->channelMask & CHANNEL_SCALE)
+        {
+            newTrack->scaleMin = source.Read<Vector3>();
+            newTrack->scaleStep = source.Read<Vector3>();
+            newTrack->packedScales.resize(numKeyFrames * 3);
+            source.Read(&newTrack->packedScales[0], numKeyFrames * 3 * sizeof(unsigned short));
+        }
+
+        newTrack->BuildKeyFrameIndex();
+    }
+
+    return true;
+}
@@ -5,11 +5,14 @@
 #include "../Math/Quaternion.h"
 #include "../Resource/Resource.h"
 
+class AnimationBounds;
+class Model;
+
 static const unsigned char CHANNEL_POSITION = 1;
 static const unsigned char CHANNEL_ROTATION = 2;
 static const unsigned char CHANNEL_SCALE = 4;
 
-/// Skeletal animation keyframe.
+/// Skeletal animation keyframe. Used for adding and reading back single keyframes, while tracks store them as separate streams.
 struct AnimationKeyFrame
 {
     /// Construct.
@@ -29,11 +32,80 @@ struct AnimationKeyFrame
     Vector3 scale;
 };
 
-/// Skeletal animation track, stores keyframes of a single bone.
+/// Compression results of an animation track or clip.
+struct AnimationCompressionStatistics
+{
+    /// Construct with zero values.
+    AnimationCompressionStatistics();
+
+    /// Number of keyframes before compression.
+    size_t numKeyFrames;
+    /// Number of keyframes kept.
+    size_t numKeptKeyFrames;
+    /// Keyframe data size in bytes before compression.
+    size_t originalSize;
+    /// Keyframe data size in bytes after compression.
+    size_t compressedSize;
+    /// Maximum position error.
+    float maxPositionError;
+    /// Maximum rotation error in degrees.
+    float maxRotationError;
+    /// Maximum scale error.
+    float maxScaleError;
+};
+
+/// Skeletal animation track, stores keyframes of a single bone as structure-of-arrays streams: keyframe times, and values of the included channels. When compressed, the channel values are quantized to 16 bits per component: positions and scales relative to their bounds, and rotations in smallest three format.
 struct AnimationTrack
 {
-    /// Adjust keyframe index by time.
+    /// Construct.
+    AnimationTrack();
+
+    /// Set number of keyframes and resize the streams of the included channels. Only for uncompressed tracks.
+    void SetNumKeyFrames(size_t num);
+    /// Append a keyframe. Only the included channels are stored. Only for uncompressed tracks.
+    void AddKeyFrame(const AnimationKeyFrame& keyFrame);
+    /// Remove keyframes that can be interpolated from their neighbours within the error tolerances, then quantize the channel values. Return the results.
+    AnimationCompressionStatistics Compress(float positionTolerance, float rotationTolerance, float scaleTolerance);
+    /// Build the time bucket index for constant time keyframe lookup. Needs to be called after adding keyframes manually, otherwise lookup falls back to searching from the previous index.
+    void BuildKeyFrameIndex();
+    /// Adjust keyframe index by time. When the time bucket index exists, the previous index is not needed.
     void FindKeyFrameIndex(float time, size_t& index) const;
+    /// Find the keyframes to interpolate between at a time position and return the interpolation factor. The keyframe index is adjusted as in FindKeyFrameIndex(). When there is no next keyframe to interpolate to, return the same keyframe for both.
+    float FindKeyFrames(float time, float length, bool looped, size_t& keyFrame, size_t& nextFrame) const;
+    /// Sample the included channels at a time position, using spherical interpolation for rotations. Channels not included are left unchanged.
+    void Sample(float time, float length, bool looped, size_t& keyFrame, Vector3& position, Quaternion& rotation, Vector3& scale) const;
+
+    /// Return number of keyframes.
+    size_t NumKeyFrames() const { return keyTimes.size(); }
+    /// Return a keyframe by index. Channels not included use identity values.
+    AnimationKeyFrame KeyFrame(size_t index) const;
+    /// Return keyframe position by index. The position channel must be included.
+    Vector3 Position(size_t index) const
+    {
+        if (!compressed)
+            return positions[index];
+
+        const unsigned short* packed = &packedPositions[index * 3];
+        return Vector3(positionMin.x + positionStep.x * packed[0], positionMin.y + positionStep.y * packed[1], positionMin.z + positionStep.z * packed[2]);
+    }
+    /// Return keyframe rotation by index. The rotation channel must be included.
+    Quaternion Rotation(size_t index) const { return compressed ? UnpackRotation(&packedRotations[index * 3]) : rotations[index]; }
+    /// Return keyframe scale by index. The scale channel must be included.
+    Vector3 Scale(size_t index) const
+    {
+        if (!compressed)
+            return scales[index];
+
+        const unsigned short* packed = &packedScales[index * 3];
+        return Vector3(scaleMin.x + scaleStep.x * packed[0], scaleMin.y + scaleStep.y * packed[1], scaleMin.z + scaleStep.z * packed[2]);
+    }
+    /// Return keyframe data size in bytes.
+    size_t KeyFrameDataSize() const;
+
+    /// Quantize a rotation to 48 bits: index of the largest component, and the other three components at 15 bits each.
+    static void PackRotation(const Quaternion& rotation, unsigned short* dest);
+    /// Restore a rotation quantized to 48 bits.
+    static Quaternion UnpackRotation(const unsigned short* packed);
 
     /// Bone or scene node name.
     std::string name;
@@ -41,8 +113,34 @@ struct AnimationTrack
     StringHash nameHash;
     /// Bitmask of included data (position, rotation, scale.)
     unsigned char channelMask;
-    /// Keyframes.
-    std::vector<AnimationKeyFrame> keyFrames;
+    /// Keyframe times.
+    std::vector<float> keyTimes;
+    /// Keyframe positions, empty if not included.
+    std::vector<Vector3> positions;
+    /// Keyframe rotations, empty if not included.
+    std::vector<Quaternion> rotations;
+    /// Keyframe scales, empty if not included.
+    std::vector<Vector3> scales;
+    /// Compressed flag. When set, the quantized streams are used instead of the float value streams.
+    bool compressed;
+    /// Quantized keyframe positions, three values per keyframe.
+    std::vector<unsigned short> packedPositions;
+    /// Quantized keyframe rotations, three values per keyframe.
+    std::vector<unsigned short> packedRotations;
+    /// Quantized keyframe scales, three values per keyframe.
+    std::vector<unsigned short> packedScales;
+    /// Minimum of quantized positions.
+    Vector3 positionMin;
+    /// Position change per quantization step.
+    Vector3 positionStep;
+    /// Minimum of quantized scales.
+    Vector3 scaleMin;
+    /// Scale change per quantization step.
+    Vector3 scaleStep;
+    /// Time bucket index: last keyframe at or before the start of each equally long time bucket. Empty if not built.
+    std::vector<unsigned short> keyFrameBuckets;
+    /// Number of time buckets per second.
+    float bucketScale;
 };
 
 /// Skeletal animation resource.
@@ -59,8 +157,13 @@ public:
     /// Register object factory.
     static void RegisterObject();
 
-    /// Load animation from a stream. Return true on success.
+    /// Load animation from a stream. Both the native compressed format and the Urho3D format are supported. Return true on success.
     bool BeginLoad(Stream& source) override;
+    /// Save the animation in the native compressed format, compressing it first if necessary. Used to convert animations. Return true on success.
+    bool Save(Stream& dest) override;
+
+    /// Compress all tracks by removing keyframes that can be interpolated within the error tolerances and quantizing the channel values. Log the memory use and maximum error, and return the results.
+    AnimationCompressionStatistics Compress();
     
     /// Set animation name.
     void SetAnimationName(const std::string& name);
@@ -89,8 +192,20 @@ public:
     AnimationTrack* FindTrack(const std::string& name) const;
     /// Return animation track by name hash.
     AnimationTrack* FindTrack(StringHash nameHash) const;
+    /// Return keyframe data size in bytes.
+    size_t KeyFrameDataSize() const;
+    /// Return conservative bone bounds of a model playing the animation, calculated on first use and cached per model. Changing the length or tracks through the animation invalidates the cache, but animation states already created keep their bounds. Not thread-safe.
+    AnimationBounds* ModelBounds(Model* model);
+
+    /// Set whether to compress animations loaded from the Urho3D format. Reduces memory use with a small error, see Compress(). Animations in the native format are always compressed.
+    static void SetCompression(bool enable);
+    /// Return whether animation compression on load is enabled.
+    static bool Compression() { return compression; }
 
 private:
+    /// Load the native format after the file ID. Return true on success.
+    bool BeginLoadNative(Stream& source);
+
     /// Animation name.
     std::string animationName;
     /// Animation name hash.
@@ -99,4 +214,9 @@ private:
     float length;
     /// Animation tracks.
     std::map<StringHash, AnimationTrack> tracks;
+    /// Cached bone bounds per model.
+    std::vector<std::pair<WeakPtr<Model>, SharedPtr<AnimationBounds> > > modelBounds;
+
+    /// Animation compression on load flag.
+    static bool compression;
 };
@@ -0,0 +1,98 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Matrix3x4.h"
+#include "Animation.h"
+#include "AnimationBounds.h"
+#include "Model.h"
+
+#include <tracy/Tracy.hpp>
+
+/// Calculate the model space transform of a bone, calculating first the parents that are not calculated yet.
+static void CalculateBoneTransform(size_t index, const std::vector<ModelBone>& bones, const std::vector<Matrix3x4>& localTransforms, std::vector<Matrix3x4>& transforms, std::vector<bool>& calculated)
+{
+    if (calculated[index])
+        return;
+
+    // Mark first to guard against a malformed hierarchy with loops
+    calculated[index] = true;
+
+    size_t parentIndex = bones[index].parentIndex;
+    if (parentIndex != index && parentIndex < bones.size())
+    {
+        CalculateBoneTransform(parentIndex, bones, localTransforms, transforms, calculated);
+        transforms[index] = transforms[parentIndex] * localTransforms[index];
+    }
+    else
+        transforms[index] = localTransforms[index];
+}
+
+AnimationBounds::AnimationBounds(const Model* model_, const Animation* animation) :
+    model(model_),
+    segmentLength(0.0f)
+{
+    ZoneScoped;
+
+    const std::vector<ModelBone>& bones = model->Bones();
+    size_t numBones = bones.size();
+    float length = animation->Length();
+
+    size_t numSegments = length > 0.0f ? Max((size_t)ceilf(length / ANIMATION_BOUNDS_SEGMENT_LENGTH), (size_t)1) : 1;
+    segmentLength = length / numSegments;
+    segments.resize(numSegments);
+
+    std::vector<const AnimationTrack*> tracks(numBones);
+    std::vector<size_t> keyFrames(numBones, 0);
+    std::vector<Matrix3x4> localTransforms(numBones);
+    std::vector<Matrix3x4> transforms(numBones, Matrix3x4::IDENTITY);
+    std::vector<bool> calculated(numBones);
+
+    for (size_t i = 0; i < numBones; ++i)
+    {
+        const AnimationTrack* track = animation->FindTrack(bones[i].nameHash);
+        tracks[i] = (track && !track->keyTimes.empty()) ? track : nullptr;
+    }
+
+    for (size_t i = 0; i < numSegments; ++i)
+    {
+        BoundingBox& box = segments[i];
+
+        for (size_t j = 0; j <= ANIMATION_BOUNDS_SAMPLES; ++j)
+        {
+            float time = Min((i + (float)j / ANIMATION_BOUNDS_SAMPLES) * segmentLength, length);
+
+            // Non-looped playback holds the last keyframes, while looped playback interpolates toward the first
+            for (size_t k = 0; k < 2; ++k)
+            {
+                bool looped = k != 0;
+
+                for (size_t l = 0; l < numBones; ++l)
+                {
+                    const ModelBone& bone = bones[l];
+                    Vector3 position = bone.initialPosition;
+                    Quaternion rotation = bone.initialRotation;
+                    Vector3 scale = bone.initialScale;
+
+                    if (tracks[l])
+                        tracks[l]->Sample(time, length, looped, keyFrames[l], position, rotation, scale);
+
+                    localTransforms[l] = Matrix3x4(position, rotation, scale);
+                    calculated[l] = false;
+                }
+
+                for (size_t l = 0; l < numBones; ++l)
+                {
+                    CalculateBoneTransform(l, bones, localTransforms, transforms, calculated);
+                    if (bones[l].active)
+                        box.Merge(bones[l].boundingBox.Transformed(transforms[l]));
+                }
+            }
+        }
+
+        if (box.IsDefined())
+        {
+            Vector3 margin = box.Size() * ANIMATION_BOUNDS_MARGIN;
+            box.min -= margin;
+            box.max += margin;
+        }
+    }
+}
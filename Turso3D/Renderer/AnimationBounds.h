@@ -0,0 +1,44 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/BoundingBox.h"
+#include "../Object/Ptr.h"
+
+#include <vector>
+
+class Animation;
+class Model;
+
+static const float ANIMATION_BOUNDS_SEGMENT_LENGTH = 0.25f; // Time segment length in seconds, shortened to divide the animation evenly
+static const size_t ANIMATION_BOUNDS_SAMPLES = 4; // Poses sampled per segment in addition to the segment end
+static const float ANIMATION_BOUNDS_MARGIN = 0.05f; // Relative enlargement of each segment to cover motion between the samples
+
+/// Conservative model space bone bounds of a model playing an animation, precalculated for short time segments. Allows updating the bounds of an animated model that is not visible without evaluating its skeleton.
+class AnimationBounds : public RefCounted
+{
+public:
+    /// Construct and calculate the bounds by sampling the animation on the model's skeleton. The animation is evaluated both looped and non-looped.
+    AnimationBounds(const Model* model, const Animation* animation);
+
+    /// Return the model the bounds were calculated for.
+    const Model* GetModel() const { return model; }
+    /// Return number of time segments.
+    size_t NumSegments() const { return segments.size(); }
+    /// Return time segment length.
+    float SegmentLength() const { return segmentLength; }
+    /// Return the bounds of the time segment containing a time position.
+    const BoundingBox& Bounds(float time) const
+    {
+        size_t index = (time > 0.0f && segmentLength > 0.0f) ? Min((size_t)(time / segmentLength), segments.size() - 1) : 0;
+        return segments[index];
+    }
+
+private:
+    /// Model the bounds were calculated for. Only used for identification.
+    const Model* model;
+    /// Time segment length.
+    float segmentLength;
+    /// Bounds of each time segment.
+    std::vector<BoundingBox> segments;
+};
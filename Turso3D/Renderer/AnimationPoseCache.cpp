@@ -0,0 +1,135 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "AnimationPoseCache.h"
+#include "AnimationState.h"
+#include "Model.h"
+
+#include <algorithm>
+#include <cstring>
+#include <tracy/Tracy.hpp>
+
+AnimationPoseCacheStatistics::AnimationPoseCacheStatistics() :
+    numLookups(0),
+    numHits(0),
+    numPoses(0)
+{
+}
+
+AnimationPoseKey::AnimationPoseKey() :
+    model(nullptr),
+    numStates(0)
+{
+    // Clear also the padding bytes of the states
+    memset(states, 0, sizeof states);
+}
+
+bool AnimationPoseKey::operator < (const AnimationPoseKey& rhs) const
+{
+    return memcmp(this, &rhs, sizeof(AnimationPoseKey)) < 0;
+}
+
+AnimationPoseCacheEntry::AnimationPoseCacheEntry() :
+    ready(false)
+{
+}
+
+AnimationPoseCache::AnimationPoseCache() :
+    numUsedEntries(0),
+    timeStep(DEFAULT_POSE_CACHE_TIME_STEP),
+    enabled(true)
+{
+    RegisterSubsystem(this);
+}
+
+AnimationPoseCache::~AnimationPoseCache()
+{
+    RemoveSubsystem(this);
+}
+
+void AnimationPoseCache::SetEnabled(bool enable)
+{
+    enabled = enable;
+}
+
+void AnimationPoseCache::SetTimeStep(float step)
+{
+    timeStep = Max(step, M_EPSILON);
+}
+
+void AnimationPoseCache::BeginFrame()
+{
+    ZoneScoped;
+
+    entries.clear();
+    numUsedEntries = 0;
+    lastStats = stats;
+    stats = AnimationPoseCacheStatistics();
+}
+
+bool AnimationPoseCache::CreateKey(const Model* model, const std::vector<SharedPtr<AnimationState> >& states, AnimationPoseKey& key) const
+{
+    if (!enabled || !model)
+        return false;
+
+    key.model = model;
+
+    for (auto it = states.begin(); it != states.end(); ++it)
+    {
+        AnimationState* state = *it;
+        if (!state->Enabled())
+            continue;
+        if (key.numStates >= MAX_POSE_CACHE_STATES || state->HasBoneWeights())
+            return false;
+
+        AnimationPoseKey::State& dest = key.states[key.numStates++];
+        dest.animation = state->GetAnimation();
+        dest.time = (unsigned)(state->Time() / timeStep + 0.5f);
+        dest.weight = (unsigned short)(state->Weight() * 255.0f + 0.5f);
+        dest.startBoneIndex = (unsigned short)state->StartBoneIndex();
+        dest.looped = state->Looped();
+        dest.normalizedLerp = state->NormalizedLerp();
+    }
+
+    return true;
+}
+
+bool AnimationPoseCache::Fetch(const AnimationPoseKey& key, BonePose* dest, size_t numBones, AnimationPoseCacheEntry*& reserved)
+{
+    AnimationPoseCacheEntry* entry;
+    reserved = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        ++stats.numLookups;
+        auto it = entries.find(key);
+        if (it == entries.end())
+        {
+            // Not evaluated yet, reserve an entry for the caller
+            if (numUsedEntries >= entryPool.size())
+                entryPool.push_back(new AnimationPoseCacheEntry());
+
+            reserved = entryPool[numUsedEntries++];
+            reserved->ready.store(false, std::memory_order_relaxed);
+            entries[key] = reserved;
+            ++stats.numPoses;
+            return false;
+        }
+
+        entry = it->second;
+        // If another thread is still evaluating the pose, evaluate it again rather than wait
+        if (!entry->ready.load(std::memory_order_acquire) || entry->poses.size() != numBones)
+            return false;
+
+        ++stats.numHits;
+    }
+
+    std::copy(entry->poses.begin(), entry->poses.end(), dest);
+    return true;
+}
+
+void AnimationPoseCache::Store(AnimationPoseCacheEntry* entry, const BonePose* poses, size_t numBones)
+{
+    entry->poses.assign(poses, poses + numBones);
+    entry->ready.store(true, std::memory_order_release);
+}
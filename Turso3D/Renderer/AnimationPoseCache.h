@@ -0,0 +1,130 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/Object.h"
+#include "AnimatedModel.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class Model;
+
+static const float DEFAULT_POSE_CACHE_TIME_STEP = 1.0f / 60.0f;
+static const size_t MAX_POSE_CACHE_STATES = 4; // Models with more enabled animation states are evaluated without the cache
+
+/// Pose cache statistics of one frame.
+struct AnimationPoseCacheStatistics
+{
+    /// Construct with zero values.
+    AnimationPoseCacheStatistics();
+
+    /// Pose lookups from animated models.
+    size_t numLookups;
+    /// Lookups that copied a pose evaluated by another model.
+    size_t numHits;
+    /// Distinct poses evaluated into the cache.
+    size_t numPoses;
+};
+
+/// Identifies a pose: the skeleton, and the animation states applied in order with quantized time and weight.
+struct AnimationPoseKey
+{
+    /// Quantized animation state.
+    struct State
+    {
+        /// %Animation resource.
+        const Animation* animation;
+        /// Time position in time steps.
+        unsigned time;
+        /// Blending weight in 1/255 steps.
+        unsigned short weight;
+        /// Start bone index.
+        unsigned short startBoneIndex;
+        /// Looped flag.
+        bool looped;
+        /// Normalized linear interpolation flag.
+        bool normalizedLerp;
+    };
+
+    /// Construct with all bytes zeroed, so that keys can be compared bytewise.
+    AnimationPoseKey();
+
+    /// Test for less than with another key.
+    bool operator < (const AnimationPoseKey& rhs) const;
+
+    /// %Model resource that defines the skeleton.
+    const Model* model;
+    /// Number of enabled animation states.
+    size_t numStates;
+    /// Enabled animation states.
+    State states[MAX_POSE_CACHE_STATES];
+};
+
+/// Evaluated pose shared between animated models.
+struct AnimationPoseCacheEntry
+{
+    /// Construct.
+    AnimationPoseCacheEntry();
+
+    /// Bone local transforms.
+    std::vector<BonePose> poses;
+    /// Whether the pose has been stored and can be copied.
+    std::atomic<bool> ready;
+};
+
+/// Shared pose evaluation subsystem. Animated models that play the same animations at the same quantized time positions and weights, as is typical for crowds, evaluate the pose once per frame and copy the local space result to each other. When the subsystem exists, animated models that qualify evaluate their animation states at the quantized times and weights, so that the result does not depend on which model evaluated the pose first. Models with per-bone weights or bones with animation disabled do not use the cache.
+class AnimationPoseCache : public Object
+{
+    OBJECT(AnimationPoseCache);
+
+public:
+    /// Construct and register subsystem.
+    AnimationPoseCache();
+    /// Destruct and unregister subsystem.
+    ~AnimationPoseCache();
+
+    /// Set whether animated models use the cache. Default true.
+    void SetEnabled(bool enable);
+    /// Set the time quantization step in seconds. Larger steps give more sharing, but step the animation visibly. Default 1/60.
+    void SetTimeStep(float step);
+    /// Begin a new frame. Clear the cached poses and store the statistics of the previous frame. Called by Renderer when preparing a view.
+    void BeginFrame();
+
+    /// Create the key of a model's pose from its enabled animation states. Return false if the states cannot be shared.
+    bool CreateKey(const Model* model, const std::vector<SharedPtr<AnimationState> >& states, AnimationPoseKey& key) const;
+    /// Copy the pose to the destination and return true if it has already been evaluated this frame. Otherwise return false, and if no other thread is evaluating the same pose, return an entry to store the evaluated pose into. Called by animated models in worker threads.
+    bool Fetch(const AnimationPoseKey& key, BonePose* dest, size_t numBones, AnimationPoseCacheEntry*& reserved);
+    /// Store an evaluated pose into a reserved entry, so that other animated models can copy it.
+    void Store(AnimationPoseCacheEntry* entry, const BonePose* poses, size_t numBones);
+    /// Return time position quantized to the time step.
+    float QuantizeTime(float time) const { return (unsigned)(time / timeStep + 0.5f) * timeStep; }
+    /// Return blending weight quantized to 1/255 steps.
+    float QuantizeWeight(float weight) const { return (unsigned)(weight * 255.0f + 0.5f) / 255.0f; }
+
+    /// Return whether animated models use the cache.
+    bool IsEnabled() const { return enabled; }
+    /// Return the time quantization step.
+    float TimeStep() const { return timeStep; }
+    /// Return the statistics of the previous frame.
+    const AnimationPoseCacheStatistics& Statistics() const { return lastStats; }
+
+private:
+    /// Entries by key for the current frame.
+    std::map<AnimationPoseKey, AnimationPoseCacheEntry*> entries;
+    /// Allocated entries, reused between frames.
+    std::vector<AutoPtr<AnimationPoseCacheEntry> > entryPool;
+    /// Number of pool entries in use this frame.
+    size_t numUsedEntries;
+    /// Mutex for lookups from worker threads.
+    std::mutex cacheMutex;
+    /// Statistics of the current frame.
+    AnimationPoseCacheStatistics stats;
+    /// Statistics of the previous frame.
+    AnimationPoseCacheStatistics lastStats;
+    /// Time quantization step.
+    float timeStep;
+    /// Enabled flag.
+    bool enabled;
+};
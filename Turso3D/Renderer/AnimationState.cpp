@@ -3,13 +3,188 @@
 #include "../IO/Log.h"
 #include "AnimatedModel.h"
 #include "Animation.h"
+#include "AnimationBounds.h"
 #include "AnimationState.h"
 
+// Number of bones sampled and blended at once
+static const size_t BLEND_BATCH_SIZE = 8;
+// Channel offsets in a blend batch: position xyz, rotation wxyz, scale xyz
+static const size_t BATCH_POSITION = 0;
+static const size_t BATCH_ROTATION = 3;
+static const size_t BATCH_SCALE = 7;
+static const size_t NUM_BATCH_CHANNELS = 10;
+
+/// Bone channel values in structure-of-arrays layout, so that the blending loops process several bones at once and can be vectorized by the compiler.
+struct BlendBatch
+{
+    /// Pose bone indices.
+    size_t boneIndices[BLEND_BATCH_SIZE];
+    /// Interpolation factors between the keyframes.
+    float t[BLEND_BATCH_SIZE];
+    /// Blending weights.
+    float weights[BLEND_BATCH_SIZE];
+    /// Current pose values, which also receive the result.
+    float pose[NUM_BATCH_CHANNELS][BLEND_BATCH_SIZE];
+    /// Keyframe values to interpolate from.
+    float from[NUM_BATCH_CHANNELS][BLEND_BATCH_SIZE];
+    /// Keyframe values to interpolate to.
+    float to[NUM_BATCH_CHANNELS][BLEND_BATCH_SIZE];
+};
+
+/// Store a vector to a blend batch lane.
+static inline void SetBatchValue(float (*channels)[BLEND_BATCH_SIZE], size_t lane, const Vector3& value)
+{
+    channels[0][lane] = value.x;
+    channels[1][lane] = value.y;
+    channels[2][lane] = value.z;
+}
+
+/// Store a quaternion to a blend batch lane.
+static inline void SetBatchValue(float (*channels)[BLEND_BATCH_SIZE], size_t lane, const Quaternion& value)
+{
+    channels[0][lane] = value.w;
+    channels[1][lane] = value.x;
+    channels[2][lane] = value.y;
+    channels[3][lane] = value.z;
+}
+
+/// Interpolate one linearly blended channel between the keyframes and blend the current pose toward it.
+static void BlendLinear(float* pose, const float* from, const float* to, const float* t, const float* weights, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        float sample = from[i] + (to[i] - from[i]) * t[i];
+        pose[i] += (sample - pose[i]) * weights[i];
+    }
+}
+
+/// Interpolate rotations between the keyframes and blend the current pose toward them with normalized linear interpolation along the shortest path.
+static void BlendRotationsNlerp(BlendBatch& batch, size_t count)
+{
+    float* pw = batch.pose[BATCH_ROTATION];
+    float* px = batch.pose[BATCH_ROTATION + 1];
+    float* py = batch.pose[BATCH_ROTATION + 2];
+    float* pz = batch.pose[BATCH_ROTATION + 3];
+    const float* fw = batch.from[BATCH_ROTATION];
+    const float* fx = batch.from[BATCH_ROTATION + 1];
+    const float* fy = batch.from[BATCH_ROTATION + 2];
+    const float* fz = batch.from[BATCH_ROTATION + 3];
+    const float* tw = batch.to[BATCH_ROTATION];
+    const float* tx = batch.to[BATCH_ROTATION + 1];
+    const float* ty = batch.to[BATCH_ROTATION + 2];
+    const float* tz = batch.to[BATCH_ROTATION + 3];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        float t = batch.t[i];
+        float sign = fw[i] * tw[i] + fx[i] * tx[i] + fy[i] * ty[i] + fz[i] * tz[i] < 0.0f ? -1.0f : 1.0f;
+        float sw = fw[i] + (tw[i] * sign - fw[i]) * t;
+        float sx = fx[i] + (tx[i] * sign - fx[i]) * t;
+        float sy = fy[i] + (ty[i] * sign - fy[i]) * t;
+        float sz = fz[i] + (tz[i] * sign - fz[i]) * t;
+
+        float weight = batch.weights[i];
+        sign = pw[i] * sw + px[i] * sx + py[i] * sy + pz[i] * sz < 0.0f ? -1.0f : 1.0f;
+        float rw = pw[i] + (sw * sign - pw[i]) * weight;
+        float rx = px[i] + (sx * sign - px[i]) * weight;
+        float ry = py[i] + (sy * sign - py[i]) * weight;
+        float rz = pz[i] + (sz * sign - pz[i]) * weight;
+
+        // Normalizing the sample before blending is unnecessary, as normalization at the end takes care of both
+        float invLength = 1.0f / sqrtf(rw * rw + rx * rx + ry * ry + rz * rz);
+        pw[i] = rw * invLength;
+        px[i] = rx * invLength;
+        py[i] = ry * invLength;
+        pz[i] = rz * invLength;
+    }
+}
+
+/// Correct a normalized linear interpolation factor so that the interpolated rotation follows the constant angular velocity of spherical linear interpolation. The cosine is the absolute dot product of the rotations. Stays within 0.1 degrees of an exact slerp.
+static inline float SlerpFactor(float t, float cosine)
+{
+    float a = 1.0904f + cosine * (-3.2452f + cosine * (3.55645f - cosine * 1.43519f));
+    float b = 0.848013f + cosine * (-1.06021f + cosine * 0.215638f);
+    float k = a * (t - 0.5f) * (t - 0.5f) + b;
+    return t + t * (t - 0.5f) * (t - 1.0f) * k;
+}
+
+/// Interpolate rotations between the keyframes and blend the current pose toward them with approximated spherical linear interpolation.
+static void BlendRotationsSlerp(BlendBatch& batch, size_t count)
+{
+    float* pw = batch.pose[BATCH_ROTATION];
+    float* px = batch.pose[BATCH_ROTATION + 1];
+    float* py = batch.pose[BATCH_ROTATION + 2];
+    float* pz = batch.pose[BATCH_ROTATION + 3];
+    const float* fw = batch.from[BATCH_ROTATION];
+    const float* fx = batch.from[BATCH_ROTATION + 1];
+    const float* fy = batch.from[BATCH_ROTATION + 2];
+    const float* fz = batch.from[BATCH_ROTATION + 3];
+    const float* tw = batch.to[BATCH_ROTATION];
+    const float* tx = batch.to[BATCH_ROTATION + 1];
+    const float* ty = batch.to[BATCH_ROTATION + 2];
+    const float* tz = batch.to[BATCH_ROTATION + 3];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        float cosine = fw[i] * tw[i] + fx[i] * tx[i] + fy[i] * ty[i] + fz[i] * tz[i];
+        float sign = cosine < 0.0f ? -1.0f : 1.0f;
+        float t = SlerpFactor(batch.t[i], cosine * sign);
+        float sw = fw[i] + (tw[i] * sign - fw[i]) * t;
+        float sx = fx[i] + (tx[i] * sign - fx[i]) * t;
+        float sy = fy[i] + (ty[i] * sign - fy[i]) * t;
+        float sz = fz[i] + (tz[i] * sign - fz[i]) * t;
+
+        // The sample must be normalized here, as the factor correction of the pose blend depends on its dot product with the pose
+        float invLength = 1.0f / sqrtf(sw * sw + sx * sx + sy * sy + sz * sz);
+        sw *= invLength;
+        sx *= invLength;
+        sy *= invLength;
+        sz *= invLength;
+
+        cosine = pw[i] * sw + px[i] * sx + py[i] * sy + pz[i] * sz;
+        sign = cosine < 0.0f ? -1.0f : 1.0f;
+        float weight = SlerpFactor(batch.weights[i], cosine * sign);
+        float rw = pw[i] + (sw * sign - pw[i]) * weight;
+        float rx = px[i] + (sx * sign - px[i]) * weight;
+        float ry = py[i] + (sy * sign - py[i]) * weight;
+        float rz = pz[i] + (sz * sign - pz[i]) * weight;
+
+        invLength = 1.0f / sqrtf(rw * rw + rx * rx + ry * ry + rz * rz);
+        pw[i] = rw * invLength;
+        px[i] = rx * invLength;
+        py[i] = ry * invLength;
+        pz[i] = rz * invLength;
+    }
+}
+
+/// Blend a batch of sampled bones into the pose buffer.
+static void BlendBones(BlendBatch& batch, size_t count, bool normalizedLerp, BonePose* poses)
+{
+    for (size_t c = 0; c < 3; ++c)
+    {
+        BlendLinear(batch.pose[BATCH_POSITION + c], batch.from[BATCH_POSITION + c], batch.to[BATCH_POSITION + c], batch.t, batch.weights, count);
+        BlendLinear(batch.pose[BATCH_SCALE + c], batch.from[BATCH_SCALE + c], batch.to[BATCH_SCALE + c], batch.t, batch.weights, count);
+    }
+
+    if (normalizedLerp)
+        BlendRotationsNlerp(batch, count);
+    else
+        BlendRotationsSlerp(batch, count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        BonePose& pose = poses[batch.boneIndices[i]];
+        pose.position = Vector3(batch.pose[BATCH_POSITION][i], batch.pose[BATCH_POSITION + 1][i], batch.pose[BATCH_POSITION + 2][i]);
+        pose.rotation = Quaternion(batch.pose[BATCH_ROTATION][i], batch.pose[BATCH_ROTATION + 1][i], batch.pose[BATCH_ROTATION + 2][i], batch.pose[BATCH_ROTATION + 3][i]);
+        pose.scale = Vector3(batch.pose[BATCH_SCALE][i], batch.pose[BATCH_SCALE + 1][i], batch.pose[BATCH_SCALE + 2][i]);
+    }
+}
+
 AnimationStateTrack::AnimationStateTrack() :
     track(nullptr),
     node(nullptr),
-    weight(1.0f),
-    keyFrame(0)
+    boneIndex(0),
+    weight(1.0f)
 {
 }
 
@@ -20,7 +195,9 @@ AnimationStateTrack::~AnimationStateTrack()
 AnimationState::AnimationState(AnimatedModelDrawable* drawable_, Animation* animation_) :
     drawable(drawable_),
     animation(animation_),
+    startBoneIndex(M_MAX_UNSIGNED),
     looped(false),
+    normalizedLerp(DEFAULT_NORMALIZED_LERP),
     weight(0.0f),
     time(0.0f),
     blendLayer(0)
@@ -28,15 +205,19 @@ AnimationState::AnimationState(AnimatedModelDrawable* drawable_, Animation* anim
     assert(drawable);
     assert(animation);
 
+    bounds = animation->ModelBounds(drawable->GetModel());
+
     // Set default start bone (use all tracks.)
     SetStartBone(nullptr);
 }
 
 AnimationState::AnimationState(SpatialNode* node, Animation* animation_) :
+    drawable(nullptr),
     rootNode(node),
     animation(animation_),
-    startBone(nullptr),
+    startBoneIndex(M_MAX_UNSIGNED),
     looped(false),
+    normalizedLerp(DEFAULT_NORMALIZED_LERP),
     weight(1.0f),
     time(0.0f),
     blendLayer(0)
@@ -49,7 +230,7 @@ AnimationState::AnimationState(SpatialNode* node, Animation* animation_) :
 
     for (auto it = tracks.begin(); it != tracks.end(); ++it)
     {
-        if (it->second.keyFrames.empty())
+        if (it->second.keyTimes.empty())
             continue;
 
         AnimationStateTrack stateTrack;
@@ -69,6 +250,9 @@ AnimationState::AnimationState(SpatialNode* node, Animation* animation_) :
         if (stateTrack.node)
             stateTracks.push_back(stateTrack);
     }
+
+    keyFrameIndices.clear();
+    keyFrameIndices.resize(stateTracks.size());
 }
 
 AnimationState::~AnimationState()
@@ -80,38 +264,55 @@ void AnimationState::SetStartBone(Bone* startBone_)
     if (!drawable)
         return;
 
-    if (!startBone_)
-        startBone_ = drawable->RootBone();
+    SetStartBoneIndex(startBone_ ? drawable->FindBoneIndex(startBone_->NameHash()) : M_MAX_UNSIGNED);
+}
+
+void AnimationState::SetStartBoneIndex(size_t index)
+{
+    if (!drawable)
+        return;
+
+    size_t numBones = drawable->NumBones();
+    if (index >= numBones)
+        index = drawable->RootBoneIndex();
 
-    // Do not reassign if the start bone did not actually change, and we already have valid bone nodes
-    if (startBone_ == startBone && !stateTracks.empty())
+    // Do not reassign if the start bone did not actually change, and we already have valid tracks
+    if (index == startBoneIndex && !stateTracks.empty())
         return;
 
-    startBone = startBone_;
+    startBoneIndex = index;
 
     const std::map<StringHash, AnimationTrack>& tracks = animation->Tracks();
     stateTracks.clear();
 
     for (auto it  = tracks.begin(); it != tracks.end(); ++it)
     {
-        if (it->second.keyFrames.empty())
+        if (it->second.keyTimes.empty())
             continue;
 
         AnimationStateTrack stateTrack;
         stateTrack.track = &it->second;
+        stateTrack.boneIndex = drawable->FindBoneIndex(it->second.nameHash);
+        if (stateTrack.boneIndex >= numBones)
+            continue;
 
         // Include those tracks that are either the start bone itself, or its children
-        const StringHash& nameHash = it->second.nameHash;
-
-        if (nameHash == startBone->NameHash())
-            stateTrack.node = startBone;
-        else
-            stateTrack.node = startBone->FindChild<Bone>(nameHash, true);
+        size_t boneIndex = stateTrack.boneIndex;
+        for (size_t depth = 0; boneIndex != startBoneIndex && depth < numBones; ++depth)
+        {
+            size_t parentIndex = drawable->BoneParentIndex(boneIndex);
+            if (parentIndex == boneIndex)
+                break;
+            boneIndex = parentIndex;
+        }
 
-        if (stateTrack.node)
+        if (boneIndex == startBoneIndex)
             stateTracks.push_back(stateTrack);
     }
 
+    keyFrameIndices.clear();
+    keyFrameIndices.resize(stateTracks.size());
+
     drawable->OnAnimationOrderChanged();
 }
 
@@ -120,6 +321,16 @@ void AnimationState::SetLooped(bool looped_)
     looped = looped_;
 }
 
+void AnimationState::SetNormalizedLerp(bool enable)
+{
+    if (enable != normalizedLerp)
+    {
+        normalizedLerp = enable;
+        if (drawable && weight > 0.0f)
+            drawable->OnAnimationChanged();
+    }
+}
+
 void AnimationState::SetWeight(float weight_)
 {
     // Weight can only be set in model mode. In node animation it is hardcoded to full
@@ -159,17 +370,27 @@ void AnimationState::SetBoneWeight(size_t index, float weight_, bool recursive)
             drawable->OnAnimationChanged();
     }
 
-    if (recursive && stateTracks[index].node)
+    if (recursive && drawable)
+    {
+        size_t boneIndex = stateTracks[index].boneIndex;
+        for (size_t i = 0; i < stateTracks.size(); ++i)
+        {
+            size_t childBoneIndex = stateTracks[i].boneIndex;
+            if (childBoneIndex != boneIndex && drawable->BoneParentIndex(childBoneIndex) == boneIndex)
+                SetBoneWeight(i, weight_, true);
+        }
+    }
+    else if (recursive && stateTracks[index].node)
     {
         const std::vector<SharedPtr<Node> >& children = stateTracks[index].node->Children();
         for (auto it = children.begin(); it != children.end(); ++it)
         {
             Node* node = *it;
-            if (node->Type() == Bone::TypeStatic())
+            if (node->TestFlag(NF_SPATIAL))
             {
-                size_t childTrackIndex = FindTrackIndex(static_cast<Bone*>(node));
+                size_t childTrackIndex = FindTrackIndex(static_cast<SpatialNode*>(node));
                 if (childTrackIndex < stateTracks.size())
-                    SetBoneWeight(childTrackIndex, weight, true);
+                    SetBoneWeight(childTrackIndex, weight_, true);
             }
         }
     }
@@ -220,6 +441,11 @@ void AnimationState::SetBlendLayer(unsigned char layer)
     }
 }
 
+Bone* AnimationState::StartBone() const
+{
+    return drawable && drawable->Bones() && startBoneIndex < drawable->NumBones() ? drawable->Bones()[startBoneIndex] : nullptr;
+}
+
 float AnimationState::BoneWeight(size_t index) const
 {
     return index < stateTracks.size() ? stateTracks[index].weight : 0.0f;
@@ -235,8 +461,26 @@ float AnimationState::BoneWeight(StringHash nameHash) const
     return BoneWeight(FindTrackIndex(nameHash));
 }
 
+bool AnimationState::HasBoneWeights() const
+{
+    for (auto it = stateTracks.begin(); it != stateTracks.end(); ++it)
+    {
+        if (it->weight != 1.0f)
+            return true;
+    }
+
+    return false;
+}
+
 size_t AnimationState::FindTrackIndex(SpatialNode* node) const
 {
+    if (!node)
+        return M_MAX_UNSIGNED;
+
+    // In model mode the bone scene nodes are not stored, so compare by name
+    if (drawable)
+        return FindTrackIndex(node->NameHash());
+
     for (unsigned i = 0; i < stateTracks.size(); ++i)
     {
         if (stateTracks[i].node == node)
@@ -248,22 +492,14 @@ size_t AnimationState::FindTrackIndex(SpatialNode* node) const
 
 size_t AnimationState::FindTrackIndex(const std::string& name) const
 {
-    for (size_t i = 0; i < stateTracks.size(); ++i)
-    {
-        SpatialNode* node = stateTracks[i].node;
-        if (node && node->Name() == name)
-            return i;
-    }
-
-    return M_MAX_UNSIGNED;
+    return FindTrackIndex(StringHash(name));
 }
 
 size_t AnimationState::FindTrackIndex(StringHash nameHash) const
 {
     for (unsigned i = 0; i < stateTracks.size(); ++i)
     {
-        Node* node = stateTracks[i].node;
-        if (node && node->NameHash() == nameHash)
+        if (stateTracks[i].track->nameHash == nameHash)
             return i;
     }
 
@@ -278,139 +514,103 @@ float AnimationState::Length() const
 void AnimationState::Apply()
 {
     if (drawable)
-        ApplyToModel();
+        ApplyToModel(time, weight);
     else
         ApplyToNodes();
 }
 
-void AnimationState::ApplyToModel()
+void AnimationState::Apply(float time_, float weight_)
 {
-    for (auto it = stateTracks.begin(); it != stateTracks.end(); ++it)
+    if (drawable)
+        ApplyToModel(Clamp(time_, 0.0f, animation->Length()), Clamp(weight_, 0.0f, 1.0f));
+}
+
+void AnimationState::ApplyToModel(float time_, float weight_)
+{
+    BonePose* poses = drawable->BonePoses();
+    Bone** bones = drawable->Bones();
+    float length = animation->Length();
+    BlendBatch batch;
+    size_t count = 0;
+
+    for (size_t i = 0; i < stateTracks.size(); ++i)
     {
-        AnimationStateTrack& stateTrack = *it;
+        const AnimationStateTrack& stateTrack = stateTracks[i];
         const AnimationTrack* track = stateTrack.track;
-        float finalWeight = weight * stateTrack.weight;
-        Bone* bone = static_cast<Bone*>(stateTrack.node);
+        float finalWeight = weight_ * stateTrack.weight;
 
         // Do not apply if zero effective weight or the bone has animation disabled
-        if (Equals(finalWeight, 0.0f) || !bone->AnimationEnabled())
+        if (Equals(finalWeight, 0.0f) || (bones && !bones[stateTrack.boneIndex]->AnimationEnabled()))
             continue;
 
-        track->FindKeyFrameIndex(time, stateTrack.keyFrame);
-        const AnimationKeyFrame& keyFrame = track->keyFrames[stateTrack.keyFrame];
-
-        // Check if next frame to interpolate to is valid, or if wrapping is needed (looping animation only)
-        size_t nextFrame = stateTrack.keyFrame + 1;
-        bool interpolate = true;
-        if (nextFrame >= track->keyFrames.size())
-        {
-            if (!looped)
-            {
-                nextFrame = stateTrack.keyFrame;
-                interpolate = false;
-            }
-            else
-                nextFrame = 0;
-        }
-
-        Vector3 newPosition = bone->Position();
-        Quaternion newRotation = bone->Rotation();
-        Vector3 newScale = bone->Scale();
-
-        if (interpolate)
+        size_t keyFrame = keyFrameIndices[i];
+        size_t nextFrame;
+        batch.t[count] = track->FindKeyFrames(time_, length, looped, keyFrame, nextFrame);
+        batch.weights[count] = finalWeight;
+        batch.boneIndices[count] = stateTrack.boneIndex;
+        keyFrameIndices[i] = (unsigned)keyFrame;
+
+        // Channels not included in the track interpolate from the current pose to itself, so that blending needs no per-channel checks
+        const BonePose& pose = poses[stateTrack.boneIndex];
+        bool hasPosition = (track->channelMask & CHANNEL_POSITION) != 0;
+        bool hasRotation = (track->channelMask & CHANNEL_ROTATION) != 0;
+        bool hasScale = (track->channelMask & CHANNEL_SCALE) != 0;
+
+        SetBatchValue(batch.pose + BATCH_POSITION, count, pose.position);
+        SetBatchValue(batch.from + BATCH_POSITION, count, hasPosition ? track->Position(keyFrame) : pose.position);
+        SetBatchValue(batch.to + BATCH_POSITION, count, hasPosition ? track->Position(nextFrame) : pose.position);
+        SetBatchValue(batch.pose + BATCH_ROTATION, count, pose.rotation);
+        SetBatchValue(batch.from + BATCH_ROTATION, count, hasRotation ? track->Rotation(keyFrame) : pose.rotation);
+        SetBatchValue(batch.to + BATCH_ROTATION, count, hasRotation ? track->Rotation(nextFrame) : pose.rotation);
+        SetBatchValue(batch.pose + BATCH_SCALE, count, pose.scale);
+        SetBatchValue(batch.from + BATCH_SCALE, count, hasScale ? track->Scale(keyFrame) : pose.scale);
+        SetBatchValue(batch.to + BATCH_SCALE, count, hasScale ? track->Scale(nextFrame) : pose.scale);
+
+        if (++count == BLEND_BATCH_SIZE)
         {
-            const AnimationKeyFrame& nextKeyFrame = track->keyFrames[nextFrame];
-            float timeInterval = nextKeyFrame.time - keyFrame.time;
-            if (timeInterval < 0.0f)
-                timeInterval += animation->Length();
-            float t = timeInterval > 0.0f ? (time - keyFrame.time) / timeInterval : 1.0f;
-
-            if (track->channelMask & CHANNEL_POSITION)
-                newPosition = keyFrame.position.Lerp(nextKeyFrame.position, t);
-            if (track->channelMask & CHANNEL_ROTATION)
-                newRotation = keyFrame.rotation.Slerp(nextKeyFrame.rotation, t);
-            if (track->channelMask & CHANNEL_SCALE)
-                newScale = keyFrame.scale.Lerp(nextKeyFrame.scale, t);
+            BlendBones(batch, count, normalizedLerp, poses);
+            count = 0;
         }
-        else
-        {
-            if (track->channelMask & CHANNEL_POSITION)
-                newPosition = keyFrame.position;
-            if (track->channelMask & CHANNEL_ROTATION)
-                newRotation = keyFrame.rotation;
-            if (track->channelMask & CHANNEL_SCALE)
-                newScale = keyFrame.scale;
-        }
-
-        // If not full weight, blend
-        if (weight < 1.0f)
-        {
-            if (track->channelMask & CHANNEL_POSITION)
-                newPosition = bone->Position().Lerp(newPosition, weight);
-            if (track->channelMask & CHANNEL_ROTATION)
-                newRotation = bone->Rotation().Slerp(newRotation, weight);
-            if (track->channelMask & CHANNEL_SCALE)
-                newScale = bone->Scale().Lerp(newScale, weight);
-        }
-
-        bone->SetTransformSilent(newPosition, newRotation, newScale);
     }
+
+    if (count)
+        BlendBones(batch, count, normalizedLerp, poses);
 }
 
 void AnimationState::ApplyToNodes()
 {
+    float length = animation->Length();
+
     // When applying to a node hierarchy, can only use full weight (nothing to blend to)
-    for (auto it = stateTracks.begin(); it != stateTracks.end(); ++it)
+    for (size_t i = 0; i < stateTracks.size(); ++i)
     {
-        AnimationStateTrack& stateTrack = *it;
+        const AnimationStateTrack& stateTrack = stateTracks[i];
         const AnimationTrack* track = stateTrack.track;
         SpatialNode* node = stateTrack.node;
 
-        track->FindKeyFrameIndex(time, stateTrack.keyFrame);
-        const AnimationKeyFrame& keyFrame = track->keyFrames[stateTrack.keyFrame];
-
-        // Check if next frame to interpolate to is valid, or if wrapping is needed (looping animation only)
-        size_t nextFrame = stateTrack.keyFrame + 1;
-        bool interpolate = true;
-        if (nextFrame >= track->keyFrames.size())
-        {
-            if (!looped)
-            {
-                nextFrame = stateTrack.keyFrame;
-                interpolate = false;
-            }
-            else
-                nextFrame = 0;
-        }
+        size_t keyFrame = keyFrameIndices[i];
+        size_t nextFrame;
+        float t = track->FindKeyFrames(time, length, looped, keyFrame, nextFrame);
+        keyFrameIndices[i] = (unsigned)keyFrame;
+        bool interpolate = nextFrame != keyFrame;
 
         Vector3 newPosition = node->Position();
         Quaternion newRotation = node->Rotation();
         Vector3 newScale = node->Scale();
 
-        if (interpolate)
+        if (track->channelMask & CHANNEL_POSITION)
+            newPosition = interpolate ? track->Position(keyFrame).Lerp(track->Position(nextFrame), t) : track->Position(keyFrame);
+        if (track->channelMask & CHANNEL_ROTATION)
         {
-            const AnimationKeyFrame& nextKeyFrame = track->keyFrames[nextFrame];
-            float timeInterval = nextKeyFrame.time - keyFrame.time;
-            if (timeInterval < 0.0f)
-                timeInterval += animation->Length();
-            float t = timeInterval > 0.0f ? (time - keyFrame.time) / timeInterval : 1.0f;
-
-            if (track->channelMask & CHANNEL_POSITION)
-                newPosition = keyFrame.position.Lerp(nextKeyFrame.position, t);
-            if (track->channelMask & CHANNEL_ROTATION)
-                newRotation = keyFrame.rotation.Slerp(nextKeyFrame.rotation, t);
-            if (track->channelMask & CHANNEL_SCALE)
-                newScale = keyFrame.scale.Lerp(nextKeyFrame.scale, t);
-        }
-        else
-        {
-            if (track->channelMask & CHANNEL_POSITION)
-                newPosition = keyFrame.position;
-            if (track->channelMask & CHANNEL_ROTATION)
-                newRotation = keyFrame.rotation;
-            if (track->channelMask & CHANNEL_SCALE)
-                newScale = keyFrame.scale;
+            if (!interpolate)
+                newRotation = track->Rotation(keyFrame);
+            else if (normalizedLerp)
+                newRotation = track->Rotation(keyFrame).Nlerp(track->Rotation(nextFrame), t, true);
+            else
+                newRotation = track->Rotation(keyFrame).Slerp(track->Rotation(nextFrame), t);
         }
+        if (track->channelMask & CHANNEL_SCALE)
+            newScale = interpolate ? track->Scale(keyFrame).Lerp(track->Scale(nextFrame), t) : track->Scale(keyFrame);
 
         node->SetTransform(newPosition, newRotation, newScale);
     }
@@ -8,11 +8,14 @@
 #include <vector>
 
 class Animation;
+class AnimationBounds;
 class AnimatedModelDrawable;
 class Bone;
 class SpatialNode;
 struct AnimationTrack;
 
+static const bool DEFAULT_NORMALIZED_LERP = false;
+
 /// %Animation instance per-track data.
 struct AnimationStateTrack
 {
@@ -23,12 +26,12 @@ struct AnimationStateTrack
 
     /// Animation track.
     const AnimationTrack* track;
-    /// %Scene node. May be a model's bone or a plain scene node.
+    /// %Scene node (node hierarchy mode.)
     SpatialNode* node;
+    /// Bone index (model mode.)
+    size_t boneIndex;
     /// Blending weight.
     float weight;
-    /// Last key frame.
-    size_t keyFrame;
 };
 
 /// %Animation instance.
@@ -44,8 +47,12 @@ public:
 
     /// Set start bone. Not supported in node animation mode. Resets any assigned per-bone weights.
     void SetStartBone(Bone* startBone);
+    /// Set start bone by the model's bone index. Out of range index uses the root bone. Not supported in node animation mode. Resets any assigned per-bone weights.
+    void SetStartBoneIndex(size_t index);
     /// Set looping enabled/disabled.
     void SetLooped(bool looped);
+    /// Set normalized linear interpolation for rotations instead of spherical. This is faster and accurate enough for densely sampled animations. Default false.
+    void SetNormalizedLerp(bool enable);
     /// Set blending weight.
     void SetWeight(float weight);
     /// Set time position.
@@ -65,14 +72,20 @@ public:
 
     /// Return animation.
     Animation* GetAnimation() const { return animation; }
-    /// Return start bone.
-    Bone* StartBone() const { return startBone; }
+    /// Return the precalculated bone bounds of the model playing the animation, or null in node animation mode.
+    AnimationBounds* Bounds() const { return bounds; }
+    /// Return start bone scene node, or null if the model has no bone scene nodes.
+    Bone* StartBone() const;
+    /// Return start bone index in the model.
+    size_t StartBoneIndex() const { return startBoneIndex; }
     /// Return per-bone blending weight by track index.
     float BoneWeight(size_t index) const;
     /// Return per-bone blending weight by name.
     float BoneWeight(const std::string& name) const;
     /// Return per-bone blending weight by name.
     float BoneWeight(StringHash nameHash) const;
+    /// Return whether any per-bone blending weight differs from full.
+    bool HasBoneWeights() const;
     /// Return track index with matching bone node, or M_MAX_UNSIGNED if not found.
     size_t FindTrackIndex(SpatialNode* node) const;
     /// Return track index by bone name, or M_MAX_UNSIGNED if not found.
@@ -83,6 +96,8 @@ public:
     bool Enabled() const { return weight > 0.0f; }
     /// Return whether is looped.
     bool Looped() const { return looped; }
+    /// Return whether rotations use normalized linear interpolation.
+    bool NormalizedLerp() const { return normalizedLerp; }
     /// Return blending weight.
     float Weight() const { return weight; }
     /// Return time position.
@@ -94,10 +109,12 @@ public:
 
     /// Apply the animation at the current time position. Called by AnimatedModel. Needs to be called manually for node hierarchies.
     void Apply();
+    /// Apply the animation at a given time position and blending weight instead of the state's own. Used for evaluating quantized shared poses. Model mode only.
+    void Apply(float time, float weight);
 
 private:
-    /// Apply animation to a skeleton. Transform changes are applied silently, so the model needs to dirty its root model afterward.
-    void ApplyToModel();
+    /// Apply animation to the model's pose buffer at a time position and blending weight.
+    void ApplyToModel(float time, float weight);
     /// Apply animation to a scene node hierarchy.
     void ApplyToNodes();
 
@@ -107,12 +124,18 @@ private:
     WeakPtr<SpatialNode> rootNode;
     /// %Animation resource.
     SharedPtr<Animation> animation;
-    /// Start bone.
-    Bone* startBone;
+    /// Precalculated bone bounds of the model playing the animation (model mode.)
+    SharedPtr<AnimationBounds> bounds;
+    /// Start bone index (model mode.)
+    size_t startBoneIndex;
     /// Per-track data.
     std::vector<AnimationStateTrack> stateTracks;
+    /// Last keyframe index per track. Kept separate from the per-track data to keep it compact.
+    std::vector<unsigned> keyFrameIndices;
     /// Looped flag.
     bool looped;
+    /// Normalized linear interpolation for rotations flag.
+    bool normalizedLerp;
     /// Blending weight.
     float weight;
     /// Time position.
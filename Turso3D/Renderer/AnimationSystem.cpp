@@ -0,0 +1,195 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "AnimatedModel.h"
+#include "AnimationSystem.h"
+
+#include <cassert>
+#include <tracy/Tracy.hpp>
+
+static const size_t MIN_ANIMATION_TASK_SIZE = 8;
+
+/// %Task for running an animation update step over a range of animated models.
+struct AnimationTask : public MemberFunctionTask<AnimationSystem>
+{
+    /// Construct.
+    AnimationTask(AnimationSystem* object_, MemberWorkFunctionPtr function_) :
+        MemberFunctionTask<AnimationSystem>(object_, function_)
+    {
+    }
+
+    /// Start pointer.
+    AnimatedModelDrawable** start;
+    /// End pointer.
+    AnimatedModelDrawable** end;
+};
+
+AnimationSystem::AnimationSystem() :
+    workQueue(Subsystem<WorkQueue>()),
+    numBoundsUpdates(0),
+    frameNumber(0)
+{
+    assert(workQueue);
+
+    RegisterSubsystem(this);
+}
+
+AnimationSystem::~AnimationSystem()
+{
+    for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+    {
+        if (*it)
+            (*it)->animatedModelFlags &= ~AMF_ANIMATION_QUEUED;
+    }
+
+    RemoveSubsystem(this);
+}
+
+void AnimationSystem::QueueUpdate(AnimatedModelDrawable* drawable)
+{
+    assert(drawable);
+
+    updateQueue.push_back(drawable);
+    drawable->animatedModelFlags |= AMF_ANIMATION_QUEUED;
+}
+
+void AnimationSystem::RemoveDrawable(AnimatedModelDrawable* drawable)
+{
+    if (!drawable || !(drawable->animatedModelFlags & AMF_ANIMATION_QUEUED))
+        return;
+
+    // Leave a null pointer in place of the model, as the queue may be long
+    for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+    {
+        if (*it == drawable)
+        {
+            *it = nullptr;
+            break;
+        }
+    }
+
+    drawable->animatedModelFlags &= ~AMF_ANIMATION_QUEUED;
+}
+
+void AnimationSystem::Update(unsigned short frameNumber_)
+{
+    ZoneScoped;
+
+    frameNumber = frameNumber_;
+    updates.clear();
+    numBoundsUpdates = 0;
+
+    for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+    {
+        AnimatedModelDrawable* drawable = *it;
+        if (!drawable)
+            continue;
+
+        drawable->animatedModelFlags &= ~AMF_ANIMATION_QUEUED;
+
+        if (!drawable->numBones || !drawable->octant || !(drawable->animatedModelFlags & AMF_ANIMATION_DIRTY))
+            continue;
+
+        if (drawable->TestFlag(DF_UPDATE_INVISIBLE) || drawable->WasInView(frameNumber))
+        {
+            if (drawable->AnimationUpdateDue(frameNumber))
+                updates.push_back(drawable);
+        }
+        // Keep the bounding box of a model out of view up to date for culling from the precalculated animation bounds
+        else if (drawable->UpdateAnimationBounds())
+        {
+            ++numBoundsUpdates;
+            Octree* octree = drawable->octree;
+            if (octree && !drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+                octree->QueueUpdate(drawable);
+        }
+    }
+
+    updateQueue.clear();
+
+    if (updates.empty())
+        return;
+
+    RunStep(&AnimationSystem::SampleAnimationWork);
+    RunStep(&AnimationSystem::UpdatePoseWork);
+    RunStep(&AnimationSystem::UpdateSkinningWork);
+
+    // Bone scene nodes may have attached nodes that queue octree reinsertion when dirtied, so finish in the main thread
+    for (auto it = updates.begin(); it != updates.end(); ++it)
+    {
+        AnimatedModelDrawable* drawable = *it;
+        drawable->FinishAnimation();
+
+        Octree* octree = drawable->octree;
+        if (octree && drawable->octant && !drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+            octree->QueueUpdate(drawable);
+    }
+}
+
+void AnimationSystem::RunStep(MemberFunctionTask<AnimationSystem>::MemberWorkFunctionPtr function)
+{
+    // Split into smaller tasks to encourage work stealing in case some thread is slower
+    size_t drawablesPerTask = Max(MIN_ANIMATION_TASK_SIZE, updates.size() / workQueue->NumThreads() / 4);
+    size_t taskIdx = 0;
+
+    for (size_t start = 0; start < updates.size(); start += drawablesPerTask)
+    {
+        size_t end = Min(start + drawablesPerTask, updates.size());
+
+        if (tasks.size() <= taskIdx)
+            tasks.push_back(new AnimationTask(this, function));
+        tasks[taskIdx]->function = function;
+        tasks[taskIdx]->start = &updates[0] + start;
+        tasks[taskIdx]->end = &updates[0] + end;
+        ++taskIdx;
+    }
+
+    numPendingTasks.store((int)taskIdx);
+    workQueue->QueueTasks(taskIdx, reinterpret_cast<Task**>(&tasks[0]));
+
+    while (numPendingTasks.load() > 0)
+        workQueue->TryComplete();
+}
+
+void AnimationSystem::SampleAnimationWork(Task* task_, unsigned)
+{
+    ZoneScoped;
+
+    AnimationTask* task = static_cast<AnimationTask*>(task_);
+
+    for (AnimatedModelDrawable** it = task->start; it != task->end; ++it)
+    {
+        AnimatedModelDrawable* drawable = *it;
+        drawable->SampleAnimation();
+        drawable->lastAnimationFrameNumber = frameNumber;
+    }
+
+    numPendingTasks.fetch_add(-1);
+}
+
+void AnimationSystem::UpdatePoseWork(Task* task_, unsigned)
+{
+    ZoneScoped;
+
+    AnimationTask* task = static_cast<AnimationTask*>(task_);
+
+    for (AnimatedModelDrawable** it = task->start; it != task->end; ++it)
+        (*it)->UpdatePose();
+
+    numPendingTasks.fetch_add(-1);
+}
+
+void AnimationSystem::UpdateSkinningWork(Task* task_, unsigned)
+{
+    ZoneScoped;
+
+    AnimationTask* task = static_cast<AnimationTask*>(task_);
+
+    for (AnimatedModelDrawable** it = task->start; it != task->end; ++it)
+    {
+        AnimatedModelDrawable* drawable = *it;
+        drawable->OnWorldBoundingBoxUpdate();
+        drawable->UpdateSkinning();
+    }
+
+    numPendingTasks.fetch_add(-1);
+}
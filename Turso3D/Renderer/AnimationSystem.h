@@ -0,0 +1,61 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "../Thread/WorkQueue.h"
+
+#include <atomic>
+#include <vector>
+
+class AnimatedModelDrawable;
+struct AnimationTask;
+
+/// Animation update subsystem. Animated models queue themselves when their animation changes, and the renderer updates them at the start of view preparation, before the octree update. The models due to update are gathered into a contiguous list, and each step of the update runs over the whole list in worker thread tasks before the next begins: animation sampling and blending, bone model space transforms, and finally skinning and bounding boxes. The bone scene nodes are then updated in the main thread, and the models are queued for octree reinsertion with their new bounding boxes. Without the subsystem, animated models update during the octree reinsertion checks instead.
+class AnimationSystem : public Object
+{
+    OBJECT(AnimationSystem);
+
+public:
+    /// Construct and register subsystem. The work queue subsystem must have been created.
+    AnimationSystem();
+    /// Destruct and unregister subsystem.
+    ~AnimationSystem();
+
+    /// Queue an animated model for update. Called by animated models when their animation changes. Must not be called in worker threads.
+    void QueueUpdate(AnimatedModelDrawable* drawable);
+    /// Remove an animated model from the update queue. Called by animated models on destruction.
+    void RemoveDrawable(AnimatedModelDrawable* drawable);
+    /// Update the queued animated models that were in view on the previous frame or update when not visible, and are due to update according to their animation LOD. Queue their octree reinsertions. Models not updated are left dirty, to update when rendered. Models out of view update only their bounding boxes from the precalculated animation bounds when possible. Called by Renderer when preparing a view.
+    void Update(unsigned short frameNumber);
+
+    /// Return number of animated models updated in the last update.
+    size_t NumUpdates() const { return updates.size(); }
+    /// Return number of animated models out of view that updated only their bounding boxes in the last update.
+    size_t NumBoundsUpdates() const { return numBoundsUpdates; }
+
+private:
+    /// Run an update step over the animated models to update in worker thread tasks and wait for its completion.
+    void RunStep(MemberFunctionTask<AnimationSystem>::MemberWorkFunctionPtr function);
+    /// Work function to apply the animation states to the bone local transforms.
+    void SampleAnimationWork(Task* task, unsigned threadIndex);
+    /// Work function to calculate the bone model space transforms.
+    void UpdatePoseWork(Task* task, unsigned threadIndex);
+    /// Work function to calculate the skinning matrices and bounding boxes.
+    void UpdateSkinningWork(Task* task, unsigned threadIndex);
+
+    /// Work queue subsystem.
+    WorkQueue* workQueue;
+    /// Animated models queued for update.
+    std::vector<AnimatedModelDrawable*> updateQueue;
+    /// Animated models being updated.
+    std::vector<AnimatedModelDrawable*> updates;
+    /// Tasks for running the update steps.
+    std::vector<AutoPtr<AnimationTask> > tasks;
+    /// Remaining tasks of the current update step.
+    std::atomic<int> numPendingTasks;
+    /// Number of bounding box only updates in the last update.
+    size_t numBoundsUpdates;
+    /// Frame number of the update.
+    unsigned short frameNumber;
+};
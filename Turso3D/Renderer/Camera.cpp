@@ -7,6 +7,7 @@ static const float DEFAULT_NEAR_CLIP = 0.1f;
 static const float DEFAULT_FAR_CLIP = 1000.0f;
 static const float DEFAULT_FOV = 45.0f;
 static const float DEFAULT_ORTHO_SIZE = 20.0f;
+static const float DEFAULT_LOD_HYSTERESIS = 0.1f;
 
 static const Matrix4 flipMatrix(
     1.0f, 0.0f, 0.0f, 0.0f,
@@ -27,6 +28,8 @@ Camera::Camera() :
     aspectRatio(1.0f),
     zoom(1.0f),
     lodBias(1.0f),
+    lodHysteresis(DEFAULT_LOD_HYSTERESIS),
+    autoLodBias(1.0f),
     viewMask(M_MAX_UNSIGNED),
     reflectionPlane(Plane::UP),
     clipPlane(Plane::UP),
@@ -50,6 +53,7 @@ void Camera::RegisterObject()
     RegisterAttribute("orthoSize", &Camera::OrthoSize, &Camera::SetOrthoSize, DEFAULT_ORTHO_SIZE);
     RegisterAttribute("zoom", &Camera::Zoom, &Camera::SetZoom, 1.0f);
     RegisterAttribute("lodBias", &Camera::LodBias, &Camera::SetLodBias, 1.0f);
+    RegisterAttribute("lodHysteresis", &Camera::LodHysteresis, &Camera::SetLodHysteresis, DEFAULT_LOD_HYSTERESIS);
     RegisterAttribute("viewMask", &Camera::ViewMask, &Camera::SetViewMask, M_MAX_UNSIGNED);
     RegisterMixedRefAttribute("reflectionPlane", &Camera::ReflectionPlaneAttr, &Camera::SetReflectionPlaneAttr, Vector4(0.0f, 1.0f, 0.0f, 0.0f));
     RegisterMixedRefAttribute("clipPlane", &Camera::ClipPlaneAttr, &Camera::SetClipPlaneAttr, Vector4(0.0f, 1.0f, 0.0f, 0.0f));
@@ -45,6 +45,10 @@ class Camera : public SpatialNode
     void SetZoom(float level) { zoom = Max(level, M_EPSILON); }
     /// Set LOD bias. Values higher than 1 uses higher quality LOD (acts if distance is smaller.)
     void SetLodBias(float bias) { lodBias = Max(bias, M_EPSILON); }
+    /// Set LOD hysteresis as a fraction of the LOD transition distance, to avoid popping back and forth at the transition. Default 0.1.
+    void SetLodHysteresis(float hysteresis) { lodHysteresis = Clamp(hysteresis, 0.0f, 0.5f); }
+    /// Set automatic LOD bias multiplier. Set by Renderer to keep the view within the LOD budget.
+    void SetAutoLodBias(float bias) { autoLodBias = Max(bias, M_EPSILON); }
     /// Set view layer mask. Will be checked against scene objects' layers to see what to render.
     void SetViewMask(unsigned mask) { viewMask = mask; }
     /// Set orthographic projection mode.
@@ -74,6 +78,10 @@ class Camera : public SpatialNode
     float Zoom() const { return zoom; }
     /// Return LOD bias.
     float LodBias() const { return lodBias; }
+    /// Return LOD hysteresis.
+    float LodHysteresis() const { return lodHysteresis; }
+    /// Return automatic LOD bias multiplier.
+    float AutoLodBias() const { return autoLodBias; }
     /// Return view layer mask.
     unsigned ViewMask() const { return viewMask; }
     /// Return whether is orthographic.
@@ -115,7 +123,7 @@ class Camera : public SpatialNode
     /// Return distance to position.
     float Distance(const Vector3& worldPos) const { return (worldPos - WorldPosition()).Length(); }
     /// Return a scene node's LOD scaled distance.
-    float LodDistance(float distance, float nodeScale, float bias) const { float d = Max(lodBias * zoom * bias * nodeScale, M_EPSILON); return !orthographic ? distance / d : orthoSize / d; }
+    float LodDistance(float distance, float nodeScale, float bias) const { float d = Max(lodBias * autoLodBias * zoom * bias * nodeScale, M_EPSILON); return !orthographic ? distance / d : orthoSize / d; }
     /// Return a world rotation for facing a camera on certain axes based on the existing world rotation.
     Quaternion FaceCameraRotation(const Vector3& position, const Quaternion& rotation, FaceCameraMode mode);
     /// Return effective world transform for matrix and frustum calculations including reflection but excluding node scaling.
@@ -159,6 +167,10 @@ private:
     float zoom;
     /// LOD bias.
     float lodBias;
+    /// LOD hysteresis.
+    float lodHysteresis;
+    /// Automatic LOD bias multiplier.
+    float autoLodBias;
     /// View layer mask.
     unsigned viewMask;
     /// Reflection plane.
@@ -39,6 +39,8 @@ struct Geometry : public RefCounted
     float lodDistance;
     /// Optional CPU-side position data.
     SharedArrayPtr<Vector3> cpuPositionData;
+    /// Optional CPU-side full vertex data, in the vertex buffer's format. Used for static batching, only kept if enabled with Model::SetRetainVertexData().
+    SharedArrayPtr<unsigned char> cpuVertexData;
     /// Optional CPU-side index data.
     SharedArrayPtr<unsigned char> cpuIndexData;
     /// Optional index size for the CPU data. May be different in case combined vertex and index buffers are in use.
@@ -19,6 +19,7 @@ static const float DEFAULT_RANGE = 10.0f;
 static const float DEFAULT_SPOT_FOV = 30.0f;
 static const int DEFAULT_SHADOWMAP_SIZE = 512;
 static const float DEFAULT_SHADOW_CASCADE_SPLIT = 0.25f;
+static const bool DEFAULT_SHADOW_CASCADE_FIT = false;
 static const float DEFAULT_FADE_START = 0.9f;
 static const float DEFAULT_SHADOW_MAX_DISTANCE = 250.0f;
 static const float DEFAULT_SHADOW_MAX_STRENGTH = 0.0f;
@@ -26,6 +27,8 @@ static const float DEFAULT_SHADOW_QUANTIZE = 0.5f;
 static const float DEFAULT_SHADOW_MIN_VIEW = 10.0f;
 static const float DEFAULT_DEPTH_BIAS = 2.0f;
 static const float DEFAULT_SLOPESCALE_BIAS = 1.5f;
+static const float CASCADE_FIT_LOG_WEIGHT = 0.75f; // Weight of the logarithmic split versus the even split when fitting cascades
+static const float CASCADE_FIT_SPLIT_STEPS = 8.0f; // Fitted split distance quantization steps per doubling of distance
 
 static const Quaternion pointLightFaceRotations[] = 
 {
@@ -56,19 +59,27 @@ LightDrawable::LightDrawable() :
     shadowMapSize(DEFAULT_SHADOWMAP_SIZE),
     shadowFadeStart(DEFAULT_FADE_START),
     shadowCascadeSplit(DEFAULT_SHADOW_CASCADE_SPLIT),
+    shadowCascadeFit(DEFAULT_SHADOW_CASCADE_FIT),
+    fittedCascadeSplit(0.0f),
+    fittedMinZ(0.0f),
+    fittedMaxZ(0.0f),
     shadowMaxDistance(DEFAULT_SHADOW_MAX_DISTANCE),
     shadowMaxStrength(DEFAULT_SHADOW_MAX_STRENGTH),
     shadowQuantize(DEFAULT_SHADOW_QUANTIZE),
     shadowMinView(DEFAULT_SHADOW_MIN_VIEW),
     depthBias(DEFAULT_DEPTH_BIAS),
     slopeScaleBias(DEFAULT_SLOPESCALE_BIAS),
-    shadowMap(nullptr)
+    shadowMap(nullptr),
+    cachedShadowCastersUpdate(0)
 {
     SetFlag(DF_LIGHT, true);
 }
 
 void LightDrawable::OnWorldBoundingBoxUpdate() const
 {
+    // Cached shadow casters were queried with the old light volume
+    cachedShadowCastersUpdate = 0;
+
     switch (lightType)
     {
     case LIGHT_DIRECTIONAL:
@@ -197,7 +208,7 @@ float LightDrawable::ShadowStrength() const
 
 Vector2 LightDrawable::ShadowCascadeSplits() const
 {
-    return Vector2(shadowCascadeSplit * shadowMaxDistance, shadowMaxDistance);
+    return Vector2(fittedCascadeSplit > 0.0f ? fittedCascadeSplit : shadowCascadeSplit * shadowMaxDistance, shadowMaxDistance);
 }
 
 size_t LightDrawable::NumShadowViews() const
@@ -256,6 +267,29 @@ void LightDrawable::InitShadowViews()
     shadowParameters = Vector4(0.5f / (float)shadowMap->Width(), 0.5f / (float)shadowMap->Height(), ShadowStrength(), 0.0f);
 }
 
+void LightDrawable::FitShadowCascades(Camera* mainCamera, float minZ, float maxZ)
+{
+    fittedCascadeSplit = 0.0f;
+    if (!shadowCascadeFit || lightType != LIGHT_DIRECTIONAL)
+        return;
+
+    // If there is no visible geometry within shadow distance, use the fixed split
+    float nearZ = Max(minZ, mainCamera->NearClip());
+    float farZ = Min(maxZ, Min(mainCamera->FarClip(), shadowMaxDistance));
+    if (nearZ >= farZ)
+        return;
+
+    // Blend between the even and logarithmic split of the visible depth range. The logarithmic split gives the most even screen space shadow resolution
+    float split = Lerp(0.5f * (nearZ + farZ), sqrtf(nearZ * farZ), CASCADE_FIT_LOG_WEIGHT);
+
+    // Quantize the split logarithmically so that small changes of the depth range do not move it on every frame
+    split = powf(2.0f, roundf(log2f(split) * CASCADE_FIT_SPLIT_STEPS) / CASCADE_FIT_SPLIT_STEPS);
+
+    fittedCascadeSplit = Clamp(split, nearZ, farZ);
+    fittedMinZ = nearZ;
+    fittedMaxZ = farZ;
+}
+
 bool LightDrawable::SetupShadowView(size_t viewIndex, Camera* mainCamera, const BoundingBox* geometryBounds)
 {
     ZoneScoped;
@@ -281,8 +315,19 @@ bool LightDrawable::SetupShadowView(size_t viewIndex, Camera* mainCamera, const
         // Calculate initial position & rotation
         shadowCamera->SetTransform(mainCamera->WorldPosition() - extrusionDistance * WorldDirection(), WorldRotation());
 
+        // When cascades are fitted, the shadowed frustum only needs to cover the visible depth range
+        float frustumMinZ = view.splitMinZ;
+        float frustumMaxZ = view.splitMaxZ;
+        if (fittedCascadeSplit > 0.0f)
+        {
+            frustumMinZ = Max(frustumMinZ, fittedMinZ);
+            frustumMaxZ = Min(frustumMaxZ, fittedMaxZ);
+            if (frustumMinZ >= frustumMaxZ)
+                return false;
+        }
+
         // Calculate main camera shadowed frustum in light's view space. Then convert to polyhedron and clip with visible geometry, and transform to shadow camera's space
-        Frustum splitFrustum = mainCamera->WorldSplitFrustum(view.splitMinZ, view.splitMaxZ);
+        Frustum splitFrustum = mainCamera->WorldSplitFrustum(frustumMinZ, frustumMaxZ);
         BoundingBox shadowBox;
 
         if (geometryBounds)
@@ -325,6 +370,11 @@ bool LightDrawable::SetupShadowView(size_t viewIndex, Camera* mainCamera, const
         Vector3 center = shadowBox.Center();
         Vector3 size = shadowBox.Size();
 
+        // Snapping to whole texels below moves the view by less than one snap step of 4 texels in either direction, so reserve the step on both sides
+        float snapPadding = 1.0f / (1.0f - 8.0f / Max(actualShadowMapSize, 16));
+        size.x *= snapPadding;
+        size.y *= snapPadding;
+
         size.x = ceilf(sqrtf(size.x / shadowQuantize));
         size.y = ceilf(sqrtf(size.y / shadowQuantize));
         size.x = Max(size.x * size.x * shadowQuantize, shadowMinView);
@@ -445,6 +495,8 @@ Light::Light()
 Light::~Light()
 {
     RemoveFromOctree();
+    // Free the shadow map rectangle before the drawable is returned to the allocator, as a new light may reuse it
+    FreeShadowMap();
     drawableAllocator.Free(static_cast<LightDrawable*>(drawable));
     drawable = nullptr;
 }
@@ -463,6 +515,7 @@ void Light::RegisterObject()
     RegisterAttribute("shadowMapSize", &Light::ShadowMapSize, &Light::SetShadowMapSize, DEFAULT_SHADOWMAP_SIZE);
     RegisterAttribute("shadowFadeStart", &Light::ShadowFadeStart, &Light::SetShadowFadeStart, DEFAULT_FADE_START);
     RegisterAttribute("shadowCascadeSplit", &Light::ShadowCascadeSplit, &Light::SetShadowCascadeSplit, DEFAULT_SHADOW_CASCADE_SPLIT);
+    RegisterAttribute("shadowCascadeFit", &Light::ShadowCascadeFit, &Light::SetShadowCascadeFit, DEFAULT_SHADOW_CASCADE_FIT);
     RegisterAttribute("shadowMaxDistance", &Light::ShadowMaxDistance, &Light::SetShadowMaxDistance, DEFAULT_SHADOW_MAX_DISTANCE);
     RegisterAttribute("shadowMaxStrength", &Light::ShadowMaxStrength, &Light::SetShadowMaxStrength, DEFAULT_SHADOW_MAX_STRENGTH);
     RegisterAttribute("shadowQuantize", &Light::ShadowQuantize, &Light::SetShadowQuantize, DEFAULT_SHADOW_QUANTIZE);
@@ -471,6 +524,26 @@ void Light::RegisterObject()
     RegisterAttribute("slopeScaleBias", &Light::SlopeScaleBias, &Light::SetSlopeScaleBias, DEFAULT_SLOPESCALE_BIAS);
 }
 
+void Light::OnSceneSet(Scene* newScene, Scene* oldScene)
+{
+    OctreeNode::OnSceneSet(newScene, oldScene);
+    FreeShadowMap();
+}
+
+void Light::OnEnabledChanged(bool newEnabled)
+{
+    OctreeNode::OnEnabledChanged(newEnabled);
+    if (!newEnabled)
+        FreeShadowMap();
+}
+
+void Light::FreeShadowMap()
+{
+    Renderer* renderer = Subsystem<Renderer>();
+    if (renderer)
+        renderer->FreeShadowMap(static_cast<LightDrawable*>(drawable));
+}
+
 void Light::SetLightType(LightType type)
 {
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
@@ -536,6 +609,12 @@ void Light::SetShadowCascadeSplit(float split)
     lightDrawable->shadowCascadeSplit = Clamp(split, M_EPSILON, 1.0f - M_EPSILON);
 }
 
+void Light::SetShadowCascadeFit(bool enable)
+{
+    LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
+    lightDrawable->shadowCascadeFit = enable;
+}
+
 void Light::SetShadowMaxDistance(float distance_)
 {
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
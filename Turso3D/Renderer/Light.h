@@ -37,7 +37,11 @@ struct ShadowView
 {
     /// Default construct.
     ShadowView() :
-        lastViewport(IntRect::ZERO)
+        lastViewport(IntRect::ZERO),
+        lastSplitMinZ(0.0f),
+        lastSplitMaxZ(0.0f),
+        pendingRenderMode(RENDER_STATIC_LIGHT_CACHED),
+        pendingFrames(0)
     {
     }
 
@@ -63,12 +67,26 @@ struct ShadowView
     size_t dynamicQueueIdx;
     /// Shadow caster list index in the shadowmap.
     size_t casterListIdx;
+    /// Index of the first shadow batch collection task.
+    size_t batchTaskIdx;
+    /// Number of shadow batch collection tasks.
+    size_t numBatchTasks;
     /// Last viewport used in shadow map render.
     IntRect lastViewport;
     /// Last shadow projection matrix.
     Matrix4 lastShadowMatrix;
+    /// Directional light split near Z of the last render.
+    float lastSplitMinZ;
+    /// Directional light split far Z of the last render.
+    float lastSplitMaxZ;
     /// Last amount of geometries passed in for shadow map render.
     size_t lastNumGeometries;
+    /// Amount of geometries collected for the current frame.
+    size_t numGeometries;
+    /// Render mode of an update that was deferred by the shadow update scheduling.
+    ShadowRenderMode pendingRenderMode;
+    /// Number of consecutive frames the update has been deferred.
+    int pendingFrames;
 };
 
 /// %Light drawable.
@@ -109,6 +127,8 @@ public:
     float ShadowFadeStart() const { return shadowFadeStart; }
     /// Return directional light cascade split distance as a function of max shadow distance.
     float ShadowCascadeSplit() const { return shadowCascadeSplit; }
+    /// Return whether directional light cascades are fitted to the visible depth range.
+    bool ShadowCascadeFit() const { return shadowCascadeFit; }
     /// Return maximum distance for shadow rendering.
     float ShadowMaxDistance() const { return shadowMaxDistance; }
     /// Return maximum shadow strength.
@@ -138,6 +158,8 @@ public:
     void SetShadowMap(Texture* shadowMap, const IntRect& shadowRect = IntRect::ZERO);
     /// Init the correct number of shadow views but do not setup them yet. Called by Renderer. Must be called from the same thread for all lights because new Camera nodes are allocated on first call, which uses the non-threadsafe NodeImpl allocator.
     void InitShadowViews();
+    /// Fit directional light cascade split and cascade depth ranges to the visible geometry depth range. No-op if cascade fitting is disabled. Called by Renderer before setting up the shadow views.
+    void FitShadowCascades(Camera* mainCamera, float minZ, float maxZ);
     /// Setup the camera and parameters for a shadow view. Directional light shadow view should be supplied the scene bounds for focusing. Return false if the view is empty and should not render. Called by Renderer.
     bool SetupShadowView(size_t viewIndex, Camera* mainCamera, const BoundingBox* geometryBounds = nullptr);
     /// Return shadow map.
@@ -148,6 +170,12 @@ public:
     const IntRect& ShadowRect() const { return shadowRect; }
     /// Return shadow map offset and depth parameters.
     const Vector4& ShadowParameters() const { return shadowParameters; }
+    /// Return cached shadow casters. Used by Renderer for static lights.
+    std::vector<Drawable*>& CachedShadowCasters() { return cachedShadowCasters; }
+    /// Set the octree update number the cached shadow casters were last valid on. Called by Renderer.
+    void SetCachedShadowCastersUpdate(unsigned updateNumber) { cachedShadowCastersUpdate = updateNumber; }
+    /// Return the octree update number the cached shadow casters were last valid on, or 0 if not cached since the light last changed.
+    unsigned CachedShadowCastersUpdate() const { return cachedShadowCastersUpdate; }
 
 private:
     /// %Light type.
@@ -166,6 +194,14 @@ private:
     float shadowFadeStart;
     /// Directional light shadow cascade split as a function of max distance.
     float shadowCascadeSplit;
+    /// Directional light cascade fitting flag.
+    bool shadowCascadeFit;
+    /// Fitted cascade split distance. Zero if not fitted.
+    float fittedCascadeSplit;
+    /// Fitted visible depth range near Z.
+    float fittedMinZ;
+    /// Fitted visible depth range far Z.
+    float fittedMaxZ;
     /// Shadow rendering max distance.
     float shadowMaxDistance;
     /// Shadow max strength when not faded.
@@ -186,6 +222,10 @@ private:
     std::vector<ShadowView> shadowViews;
     /// Shadow mapping parameters.
     Vector4 shadowParameters;
+    /// Cached shadow casters.
+    std::vector<Drawable*> cachedShadowCasters;
+    /// Octree update number the cached shadow casters were last valid on.
+    mutable unsigned cachedShadowCastersUpdate;
 };
 
 /// Dynamic light scene node.
@@ -218,6 +258,8 @@ public:
     void SetShadowFadeStart(float start);
     /// Set the directional light cascade split distance, where 1 represents shadow max distance.
     void SetShadowCascadeSplit(float split);
+    /// Set whether to fit directional light cascades to the visible geometry depth range. When enabled, the cascade split is chosen automatically from the depth range and the cascade split setting is ignored. Default false.
+    void SetShadowCascadeFit(bool enable);
     /// Set maximum distance for shadow rendering.
     void SetShadowMaxDistance(float distance);
     /// Set maximum (when not faded) shadow strength (default 0 = fully dark).
@@ -249,6 +291,8 @@ public:
     float ShadowFadeStart() const { return static_cast<LightDrawable*>(drawable)->shadowFadeStart; }
     /// Return directional light cascade split distance as a function of max shadow distance.
     float ShadowCascadeSplit() const { return static_cast<LightDrawable*>(drawable)->shadowCascadeSplit; }
+    /// Return whether directional light cascades are fitted to the visible depth range.
+    bool ShadowCascadeFit() const { return static_cast<LightDrawable*>(drawable)->shadowCascadeFit; }
     /// Return maximum distance for shadow rendering.
     float ShadowMaxDistance() const { return static_cast<LightDrawable*>(drawable)->shadowMaxDistance; }
     /// Return maximum shadow strength.
@@ -266,7 +310,15 @@ public:
     /// Return point light world space sphere.
     Sphere WorldSphere() const { return static_cast<LightDrawable*>(drawable)->WorldSphere(); }
 
+protected:
+    /// Search for an octree from the scene root and add self to it. Free the shadow map rectangle, as it may not be valid in the new scene.
+    void OnSceneSet(Scene* newScene, Scene* oldScene) override;
+    /// Handle the enabled status changing. Free the shadow map rectangle when disabled.
+    void OnEnabledChanged(bool newEnabled) override;
+
 private:
+    /// Free the shadow map rectangle from the renderer's shadow atlas.
+    void FreeShadowMap();
     /// Set light type as int. Used in serialization.
     void SetLightTypeAttr(int lightType);
     /// Return light type as int. Used in serialization.
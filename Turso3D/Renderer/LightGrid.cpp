@@ -0,0 +1,421 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "LightGrid.h"
+
+#include <cstring>
+#include <tracy/Tracy.hpp>
+
+// Depth fit range rounding steps per doubling of distance
+static const float DEPTH_FIT_STEPS = 4.0f;
+// Minimum ratio of far and near end of the fitted depth range
+static const float DEPTH_FIT_MIN_RATIO = 1.1f;
+
+/// Return whether a light's bounds are completely on the negative side of a plane.
+static inline bool IsOutside(const Plane& plane, const LightCullBounds& light)
+{
+    if (light.point)
+        return plane.Distance(light.sphere.center) < -light.sphere.radius;
+    else
+    {
+        Vector3 center = light.box.Center();
+        Vector3 edge = center - light.box.min;
+        return plane.Distance(center) < -plane.absNormal.DotProduct(edge);
+    }
+}
+
+LightGrid::LightGrid() :
+    numClusterX(0),
+    numClusterY(0),
+    numClusterZ(0),
+    numClusters(0),
+    lastNearClip(0.0f),
+    lastFarClip(0.0f),
+    fitMinZ(0.0f),
+    fitMaxZ(0.0f),
+    shaderParameters(Vector4::ZERO),
+    depthFit(false),
+    dirty(true)
+{
+    SetSize(IntVector3(DEFAULT_CLUSTER_X, DEFAULT_CLUSTER_Y, DEFAULT_CLUSTER_Z));
+}
+
+void LightGrid::SetSize(const IntVector3& size)
+{
+    size_t newClusterX = (size_t)Max(size.x, 1);
+    size_t newClusterY = (size_t)Max(size.y, 1);
+    size_t newClusterZ = (size_t)Max(size.z, 1);
+    if (newClusterX == numClusterX && newClusterY == numClusterY && newClusterZ == numClusterZ)
+        return;
+
+    numClusterX = newClusterX;
+    numClusterY = newClusterY;
+    numClusterZ = newClusterZ;
+    numClusters = numClusterX * numClusterY * numClusterZ;
+
+    frustums.resize(numClusters);
+    boxes.resize(numClusters);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        boxMin[i].resize(numClusters);
+        boxMax[i].resize(numClusters);
+        boxCenter[i].resize(numClusters);
+        boxEdge[i].resize(numClusters);
+        planeNormal[i].resize(NUM_FRUSTUM_PLANES * numClusters);
+    }
+    planeD.resize(NUM_FRUSTUM_PLANES * numClusters);
+
+    columnLeftPlanes.resize(numClusterX);
+    columnRightPlanes.resize(numClusterX);
+    rowUpPlanes.resize(numClusterY);
+    rowDownPlanes.resize(numClusterY);
+    sliceNearZ.resize(numClusterZ);
+    sliceFarZ.resize(numClusterZ);
+
+    numLights.clear();
+    numLights.resize(numClusters, 0);
+    slices.resize(numClusterZ);
+    for (auto it = slices.begin(); it != slices.end(); ++it)
+    {
+        it->lightIndices.clear();
+        it->rowHits.resize(numClusterX);
+        it->offsets.resize(numClusterX * numClusterY);
+    }
+
+    dirty = true;
+}
+
+void LightGrid::SetDepthFit(bool enable)
+{
+    if (enable != depthFit)
+    {
+        depthFit = enable;
+        dirty = true;
+    }
+}
+
+bool LightGrid::Define(const Matrix4& projection, float nearClip, float farClip, float minZ, float maxZ)
+{
+    float newMinZ = 0.0f;
+    float newMaxZ = 0.0f;
+
+    if (depthFit)
+    {
+        // Round the range outward to steps on a logarithmic scale. If there is no visible geometry, use the whole view
+        if (maxZ <= minZ)
+        {
+            minZ = nearClip;
+            maxZ = farClip;
+        }
+        newMinZ = Max(exp2f(floorf(log2f(Max(minZ, nearClip)) * DEPTH_FIT_STEPS) / DEPTH_FIT_STEPS), nearClip);
+        newMaxZ = Min(exp2f(ceilf(log2f(Max(maxZ, nearClip)) * DEPTH_FIT_STEPS) / DEPTH_FIT_STEPS), farClip);
+        newMaxZ = Max(newMaxZ, newMinZ * DEPTH_FIT_MIN_RATIO);
+    }
+
+    if (!dirty && projection == lastProjection && nearClip == lastNearClip && farClip == lastFarClip && newMinZ == fitMinZ && newMaxZ == fitMaxZ)
+        return false;
+
+    ZoneScoped;
+
+    lastNearClip = nearClip;
+    lastFarClip = farClip;
+    fitMinZ = newMinZ;
+    fitMaxZ = newMaxZ;
+
+    // The shader gets depth divided by far clip. When fitting, the slice coordinate is log(depth * farClip / fitMinZ) / log(fitMaxZ / fitMinZ)
+    if (depthFit)
+    {
+        float scale = 1.0f / logf(fitMaxZ / fitMinZ);
+        shaderParameters = Vector4(1.0f, scale, logf(farClip / fitMinZ) * scale, 0.0f);
+    }
+    else
+        shaderParameters = Vector4::ZERO;
+
+    Matrix4 projectionInverse = projection.Inverse();
+    size_t idx = 0;
+
+    float xStep = 2.0f / numClusterX;
+    float yStep = 2.0f / numClusterY;
+
+    for (size_t z = 0; z < numClusterZ; ++z)
+    {
+        Vector4 nearVec = projection * Vector4(0.0f, 0.0f, SliceBoundaryZ(z), 1.0f);
+        Vector4 farVec = projection * Vector4(0.0f, 0.0f, SliceBoundaryZ(z + 1), 1.0f);
+        float near = nearVec.z / nearVec.w;
+        float far = farVec.z / farVec.w;
+
+        for (size_t y = 0; y < numClusterY; ++y)
+        {
+            for (size_t x = 0; x < numClusterX; ++x)
+            {
+                Frustum& clusterFrustum = frustums[idx];
+                BoundingBox& clusterBox = boxes[idx];
+
+                clusterFrustum.vertices[0] = projectionInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * y, near);
+                clusterFrustum.vertices[1] = projectionInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * (y + 1), near);
+                clusterFrustum.vertices[2] = projectionInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * (y + 1), near);
+                clusterFrustum.vertices[3] = projectionInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * y, near);
+                clusterFrustum.vertices[4] = projectionInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * y, far);
+                clusterFrustum.vertices[5] = projectionInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * (y + 1), far);
+                clusterFrustum.vertices[6] = projectionInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * (y + 1), far);
+                clusterFrustum.vertices[7] = projectionInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * y, far);
+                clusterFrustum.UpdatePlanes();
+                clusterBox.Define(clusterFrustum);
+
+                // Copy to the structure-of-arrays data used in culling
+                Vector3 center = clusterBox.Center();
+                Vector3 edge = center - clusterBox.min;
+                for (size_t i = 0; i < 3; ++i)
+                {
+                    boxMin[i][idx] = clusterBox.min.Data()[i];
+                    boxMax[i][idx] = clusterBox.max.Data()[i];
+                    boxCenter[i][idx] = center.Data()[i];
+                    boxEdge[i][idx] = edge.Data()[i];
+                }
+                for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+                {
+                    const Plane& plane = clusterFrustum.planes[i];
+                    size_t planeIdx = i * numClusters + idx;
+                    planeNormal[0][planeIdx] = plane.normal.x;
+                    planeNormal[1][planeIdx] = plane.normal.y;
+                    planeNormal[2][planeIdx] = plane.normal.z;
+                    planeD[planeIdx] = plane.d;
+                }
+
+                // The column and row side planes are shared by all slices, so take them from the first
+                if (z == 0)
+                {
+                    if (y == 0)
+                    {
+                        columnLeftPlanes[x] = clusterFrustum.planes[PLANE_LEFT];
+                        columnRightPlanes[x] = clusterFrustum.planes[PLANE_RIGHT];
+                    }
+                    if (x == 0)
+                    {
+                        rowUpPlanes[y] = clusterFrustum.planes[PLANE_UP];
+                        rowDownPlanes[y] = clusterFrustum.planes[PLANE_DOWN];
+                    }
+                }
+
+                ++idx;
+            }
+        }
+
+        const Frustum& sliceFrustum = frustums[z * numClusterX * numClusterY];
+        sliceNearZ[z] = sliceFrustum.vertices[0].z;
+        sliceFarZ[z] = sliceFrustum.vertices[4].z;
+    }
+
+    lastProjection = projection;
+    dirty = false;
+    return true;
+}
+
+bool LightGrid::CalculateClusterRange(LightCullBounds& light) const
+{
+    // Skip columns and rows from both edges of the grid while the light is completely outside them
+    size_t minX = 0;
+    size_t maxX = numClusterX - 1;
+    while (minX < numClusterX && IsOutside(columnRightPlanes[minX], light))
+        ++minX;
+    if (minX == numClusterX)
+        return false;
+    while (maxX > minX && IsOutside(columnLeftPlanes[maxX], light))
+        --maxX;
+
+    size_t minY = 0;
+    size_t maxY = numClusterY - 1;
+    while (minY < numClusterY && IsOutside(rowDownPlanes[minY], light))
+        ++minY;
+    if (minY == numClusterY)
+        return false;
+    while (maxY > minY && IsOutside(rowUpPlanes[maxY], light))
+        --maxY;
+
+    light.minX = (unsigned short)minX;
+    light.maxX = (unsigned short)maxX;
+    light.minY = (unsigned short)minY;
+    light.maxY = (unsigned short)maxY;
+    return true;
+}
+
+void LightGrid::CullSlice(size_t z, const std::vector<LightCullBounds>& lights)
+{
+    ZoneScoped;
+
+    SliceResult& slice = slices[z];
+    size_t sliceSize = numClusterX * numClusterY;
+    size_t sliceStart = z * sliceSize;
+    float nearZ = sliceNearZ[z];
+    float farZ = sliceFarZ[z];
+    unsigned* sliceNumLights = &numLights[sliceStart];
+    unsigned char* rowHits = &slice.rowHits[0];
+
+    memset(sliceNumLights, 0, sliceSize * sizeof(unsigned));
+    slice.hits.clear();
+
+    // Test light-major: each light only against the rows and columns its screen space extent covers. Do culling checks both ways to reduce false positives
+    for (auto it = lights.begin(); it != lights.end(); ++it)
+    {
+        const LightCullBounds& light = *it;
+        if (light.box.min.z > farZ || light.box.max.z < nearZ)
+            continue;
+
+        size_t count = light.maxX - light.minX + 1;
+
+        for (size_t y = light.minY; y <= light.maxY; ++y)
+        {
+            size_t rowStart = y * numClusterX + light.minX;
+
+            if (light.point)
+                TestPointLight(light, sliceStart + rowStart, count, rowHits);
+            else
+                TestSpotLight(light, sliceStart + rowStart, count, rowHits);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (rowHits[i])
+                {
+                    slice.hits.push_back(std::make_pair((unsigned)(rowStart + i), light.index));
+                    ++sliceNumLights[rowStart + i];
+                }
+            }
+        }
+    }
+
+    // Sort the hits to cluster order with a counting sort, which keeps the light order within each cluster
+    unsigned offset = 0;
+    for (size_t i = 0; i < sliceSize; ++i)
+    {
+        slice.offsets[i] = offset;
+        offset += sliceNumLights[i];
+    }
+
+    slice.lightIndices.resize(slice.hits.size());
+    for (auto it = slice.hits.begin(); it != slice.hits.end(); ++it)
+        slice.lightIndices[slice.offsets[it->first]++] = it->second;
+}
+
+void LightGrid::ClearSlice(size_t z)
+{
+    size_t sliceSize = numClusterX * numClusterY;
+    memset(&numLights[z * sliceSize], 0, sliceSize * sizeof(unsigned));
+    slices[z].lightIndices.clear();
+}
+
+void LightGrid::Combine(std::vector<unsigned>& clusterData, std::vector<unsigned short>& lightIndices) const
+{
+    ZoneScoped;
+
+    clusterData.resize(numClusters * 2);
+    lightIndices.clear();
+    size_t idx = 0;
+
+    for (size_t z = 0; z < numClusterZ; ++z)
+    {
+        unsigned offset = (unsigned)lightIndices.size();
+        for (size_t i = 0; i < numClusterX * numClusterY; ++i)
+        {
+            clusterData[idx * 2] = offset;
+            clusterData[idx * 2 + 1] = numLights[idx];
+            offset += numLights[idx];
+            ++idx;
+        }
+
+        const std::vector<unsigned short>& sliceIndices = slices[z].lightIndices;
+        lightIndices.insert(lightIndices.end(), sliceIndices.begin(), sliceIndices.end());
+    }
+}
+
+float LightGrid::SliceBoundaryZ(size_t z) const
+{
+    float fraction = (float)z / (float)numClusterZ;
+
+    if (depthFit)
+        return fitMinZ * powf(fitMaxZ / fitMinZ, fraction);
+    else
+        return z > 0 ? fraction * fraction * lastFarClip : lastNearClip;
+}
+
+void LightGrid::TestPointLight(const LightCullBounds& light, size_t start, size_t count, unsigned char* dest) const
+{
+    const Vector3& center = light.sphere.center;
+    float radius = light.sphere.radius;
+    float radiusSquared = radius * radius;
+    const float* minX = &boxMin[0][start];
+    const float* minY = &boxMin[1][start];
+    const float* minZ = &boxMin[2][start];
+    const float* maxX = &boxMax[0][start];
+    const float* maxY = &boxMax[1][start];
+    const float* maxZ = &boxMax[2][start];
+
+    // Sphere against cluster bounding boxes
+    for (size_t i = 0; i < count; ++i)
+    {
+        float dx = Max(minX[i], Min(center.x, maxX[i])) - center.x;
+        float dy = Max(minY[i], Min(center.y, maxY[i])) - center.y;
+        float dz = Max(minZ[i], Min(center.z, maxZ[i])) - center.z;
+        dest[i] = (dx * dx + dy * dy + dz * dz) < radiusSquared;
+    }
+
+    // Cluster frustums against sphere
+    for (size_t p = 0; p < NUM_FRUSTUM_PLANES; ++p)
+    {
+        size_t planeStart = p * numClusters + start;
+        const float* nx = &planeNormal[0][planeStart];
+        const float* ny = &planeNormal[1][planeStart];
+        const float* nz = &planeNormal[2][planeStart];
+        const float* d = &planeD[planeStart];
+
+        for (size_t i = 0; i < count; ++i)
+            dest[i] &= (nx[i] * center.x + ny[i] * center.y + nz[i] * center.z + d[i]) >= -radius;
+    }
+}
+
+void LightGrid::TestSpotLight(const LightCullBounds& light, size_t start, size_t count, unsigned char* dest) const
+{
+    const float* centerX = &boxCenter[0][start];
+    const float* centerY = &boxCenter[1][start];
+    const float* centerZ = &boxCenter[2][start];
+    const float* edgeX = &boxEdge[0][start];
+    const float* edgeY = &boxEdge[1][start];
+    const float* edgeZ = &boxEdge[2][start];
+
+    for (size_t i = 0; i < count; ++i)
+        dest[i] = 1;
+
+    // Spot light frustum against cluster bounding boxes
+    for (size_t p = 0; p < NUM_FRUSTUM_PLANES; ++p)
+    {
+        const Plane& plane = light.frustum.planes[p];
+        Vector3 normal = plane.normal;
+        Vector3 absNormal = plane.absNormal;
+        float d = plane.d;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            float dist = normal.x * centerX[i] + normal.y * centerY[i] + normal.z * centerZ[i] + d;
+            float absDist = absNormal.x * edgeX[i] + absNormal.y * edgeY[i] + absNormal.z * edgeZ[i];
+            dest[i] &= dist >= -absDist;
+        }
+    }
+
+    // Cluster frustums against spot light bounding box
+    Vector3 center = light.box.Center();
+    Vector3 edge = center - light.box.min;
+
+    for (size_t p = 0; p < NUM_FRUSTUM_PLANES; ++p)
+    {
+        size_t planeStart = p * numClusters + start;
+        const float* nx = &planeNormal[0][planeStart];
+        const float* ny = &planeNormal[1][planeStart];
+        const float* nz = &planeNormal[2][planeStart];
+        const float* d = &planeD[planeStart];
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            float dist = nx[i] * center.x + ny[i] * center.y + nz[i] * center.z + d[i];
+            float absDist = Abs(nx[i]) * edge.x + Abs(ny[i]) * edge.y + Abs(nz[i]) * edge.z;
+            dest[i] &= dist >= -absDist;
+        }
+    }
+}
@@ -0,0 +1,157 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Frustum.h"
+#include "../Math/IntVector3.h"
+#include "../Math/Matrix4.h"
+#include "../Math/Vector4.h"
+
+#include <vector>
+
+static const size_t DEFAULT_CLUSTER_X = 16;
+static const size_t DEFAULT_CLUSTER_Y = 8;
+static const size_t DEFAULT_CLUSTER_Z = 8;
+
+/// View space bounds of a point or spot light for culling against light clusters.
+struct LightCullBounds
+{
+    /// %Light index.
+    unsigned short index;
+    /// Point light flag. If true, the sphere is used, otherwise the frustum and its bounding box.
+    bool point;
+    /// Point light bounding sphere.
+    Sphere sphere;
+    /// Spot light frustum.
+    Frustum frustum;
+    /// Spot light frustum bounding box. For point lights, the sphere's bounding box.
+    BoundingBox box;
+    /// First cluster column the light may affect.
+    unsigned short minX;
+    /// Last cluster column the light may affect.
+    unsigned short maxX;
+    /// First cluster row the light may affect.
+    unsigned short minY;
+    /// Last cluster row the light may affect.
+    unsigned short maxY;
+};
+
+/// View space light cluster grid. Culls lights to clusters and produces a compact light index list with an offset and count per cluster. Cluster planes and bounding boxes are stored as structure-of-arrays so that a light can be tested against a row of clusters in one loop. Does not use the GPU.
+class LightGrid
+{
+public:
+    /// Construct with the default grid size.
+    LightGrid();
+
+    /// Set grid dimensions. Clusters are split evenly in screen X and Y, and quadratically in depth. Clusters must be defined again after changing.
+    void SetSize(const IntVector3& size);
+    /// Set whether to fit the Z-slices logarithmically to the visible geometry depth range instead of the quadratic distribution over the whole view. Default false.
+    void SetDepthFit(bool enable);
+    /// Define cluster frustums and bounding boxes from a camera projection, and the visible geometry depth range if depth fitting is enabled. The depth range is rounded outward to avoid redefining on every small change. Return true if clusters were redefined.
+    bool Define(const Matrix4& projection, float nearClip, float farClip, float minZ = 0.0f, float maxZ = 0.0f);
+    /// Calculate the range of cluster columns and rows a light may affect from its view space bounds. Return false if the light is outside all clusters.
+    bool CalculateClusterRange(LightCullBounds& light) const;
+    /// Cull lights to the clusters of a Z-slice. The lights' cluster ranges must have been calculated. Slices can be culled from different threads simultaneously.
+    void CullSlice(size_t z, const std::vector<LightCullBounds>& lights);
+    /// Clear a Z-slice's lights without culling.
+    void ClearSlice(size_t z);
+    /// Combine the Z-slices' light index lists. Store each cluster's offset into the combined list and light count into the cluster data.
+    void Combine(std::vector<unsigned>& clusterData, std::vector<unsigned short>& lightIndices) const;
+
+    /// Return grid dimensions.
+    IntVector3 Size() const { return IntVector3((int)numClusterX, (int)numClusterY, (int)numClusterZ); }
+    /// Return whether depth fitting is enabled.
+    bool DepthFit() const { return depthFit; }
+    /// Return parameters for the shader's cluster Z lookup from depth divided by the far clip distance: depth fitting flag, and scale and offset to apply to the logarithm of depth when fitting.
+    const Vector4& ShaderParameters() const { return shaderParameters; }
+    /// Return total number of clusters.
+    size_t NumClusters() const { return numClusters; }
+    /// Return view space near Z of a slice.
+    float SliceNearZ(size_t z) const { return sliceNearZ[z]; }
+    /// Return view space far Z of a slice.
+    float SliceFarZ(size_t z) const { return sliceFarZ[z]; }
+    /// Return cluster frustum by index.
+    const Frustum& ClusterFrustum(size_t index) const { return frustums[index]; }
+    /// Return cluster bounding box by index.
+    const BoundingBox& ClusterBoundingBox(size_t index) const { return boxes[index]; }
+    /// Return number of lights found in a cluster by index.
+    unsigned NumClusterLights(size_t index) const { return numLights[index]; }
+
+private:
+    /// Return view space Z of a slice boundary.
+    float SliceBoundaryZ(size_t z) const;
+    /// Test a point light against a row of clusters and write a hit flag per cluster.
+    void TestPointLight(const LightCullBounds& light, size_t start, size_t count, unsigned char* dest) const;
+    /// Test a spot light against a row of clusters and write a hit flag per cluster.
+    void TestSpotLight(const LightCullBounds& light, size_t start, size_t count, unsigned char* dest) const;
+
+    /// Per-slice culling results.
+    struct SliceResult
+    {
+        /// Found lights as cluster and light index pairs in light order.
+        std::vector<std::pair<unsigned, unsigned short> > hits;
+        /// Light indices in cluster order.
+        std::vector<unsigned short> lightIndices;
+        /// Hit flags of a cluster row.
+        std::vector<unsigned char> rowHits;
+        /// Write offsets per cluster for sorting the hits.
+        std::vector<unsigned> offsets;
+    };
+
+    /// Grid X dimension.
+    size_t numClusterX;
+    /// Grid Y dimension.
+    size_t numClusterY;
+    /// Grid Z dimension.
+    size_t numClusterZ;
+    /// Total number of clusters.
+    size_t numClusters;
+    /// Last projection matrix used to define the clusters.
+    Matrix4 lastProjection;
+    /// Last near clip distance used to define the clusters.
+    float lastNearClip;
+    /// Last far clip distance used to define the clusters.
+    float lastFarClip;
+    /// Near end of the fitted depth range.
+    float fitMinZ;
+    /// Far end of the fitted depth range.
+    float fitMaxZ;
+    /// Shader cluster Z lookup parameters.
+    Vector4 shaderParameters;
+    /// Depth fitting flag.
+    bool depthFit;
+    /// Clusters dirty flag.
+    bool dirty;
+    /// Cluster frustums.
+    std::vector<Frustum> frustums;
+    /// Cluster bounding boxes.
+    std::vector<BoundingBox> boxes;
+    /// Cluster bounding box minimum X, Y and Z.
+    std::vector<float> boxMin[3];
+    /// Cluster bounding box maximum X, Y and Z.
+    std::vector<float> boxMax[3];
+    /// Cluster bounding box center X, Y and Z.
+    std::vector<float> boxCenter[3];
+    /// Cluster bounding box half size X, Y and Z.
+    std::vector<float> boxEdge[3];
+    /// Cluster frustum plane normal X, Y and Z. Indexed by plane * numClusters + cluster.
+    std::vector<float> planeNormal[3];
+    /// Cluster frustum plane constants. Indexed by plane * numClusters + cluster.
+    std::vector<float> planeD;
+    /// Left planes of the cluster columns.
+    std::vector<Plane> columnLeftPlanes;
+    /// Right planes of the cluster columns.
+    std::vector<Plane> columnRightPlanes;
+    /// Top planes of the cluster rows.
+    std::vector<Plane> rowUpPlanes;
+    /// Bottom planes of the cluster rows.
+    std::vector<Plane> rowDownPlanes;
+    /// View space near Z per slice.
+    std::vector<float> sliceNearZ;
+    /// View space far Z per slice.
+    std::vector<float> sliceFarZ;
+    /// Number of lights found per cluster.
+    std::vector<unsigned> numLights;
+    /// Per-slice culling results.
+    std::vector<SliceResult> slices;
+};
@@ -31,8 +31,9 @@ static const unsigned SP_SKINNED = 0x1;
 static const unsigned SP_INSTANCED = 0x2;
 static const unsigned SP_CUSTOMGEOM = 0x3;
 static const unsigned SP_GEOMETRYBITS = 0x3;
+static const unsigned SP_DUALQUATERNION = 0x4;
 
-static const size_t MAX_SHADER_VARIATIONS = 4;
+static const size_t MAX_SHADER_VARIATIONS = 8;
 
 /// Render pass, which defines render state and shaders. A material may define several of these.
 class Pass : public RefCounted
@@ -224,7 +225,7 @@ inline ShaderProgram* Pass::GetShaderProgram(unsigned char programBits)
         unsigned char geomBits = programBits & SP_GEOMETRYBITS;
 
         ShaderProgram* newShaderProgram = shader->CreateProgram(
-            Material::GlobalVSDefines() + parent->VSDefines() + vsDefines + geometryDefines[geomBits],
+            Material::GlobalVSDefines() + parent->VSDefines() + vsDefines + geometryDefines[geomBits] + ((programBits & SP_DUALQUATERNION) ? "DUALQUATERNION " : ""),
             Material::GlobalFSDefines() + parent->FSDefines() + fsDefines
         );
 
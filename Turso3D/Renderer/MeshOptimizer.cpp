@@ -0,0 +1,304 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Vector3.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <tracy/Tracy.hpp>
+
+// FIFO cache size used for statistics and overdraw cluster splitting
+static const size_t ANALYZE_CACHE_SIZE = 16;
+// LRU cache size modeled by the vertex cache optimization
+static const size_t OPTIMIZE_CACHE_SIZE = 32;
+// Vertex score parameters for the vertex cache optimization
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+/// Return vertex score for the vertex cache optimization based on LRU cache position (-1 if not in cache) and number of remaining triangles.
+static float VertexScore(int cachePosition, unsigned remainingTriangles)
+{
+    if (!remainingTriangles)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // The vertices of the last triangle get a fixed score so that the algorithm does not prefer the triangle just emitted
+        if (cachePosition < 3)
+            score = LAST_TRIANGLE_SCORE;
+        else
+            score = powf(1.0f - (float)(cachePosition - 3) / (float)(OPTIMIZE_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+    }
+
+    // Boost vertices with few remaining triangles to get rid of them quickly
+    score += VALENCE_BOOST_SCALE * powf((float)remainingTriangles, -VALENCE_BOOST_POWER);
+    return score;
+}
+
+VertexCacheStatistics AnalyzeVertexCache(const unsigned* indices, size_t numIndices, size_t numVertices)
+{
+    VertexCacheStatistics ret;
+    ret.numTriangles = numIndices / 3;
+
+    // A vertex is in the FIFO cache if it was inserted within the last cache size insertions
+    std::vector<unsigned> timestamps(numVertices, 0);
+    std::vector<bool> used(numVertices, false);
+    unsigned time = ANALYZE_CACHE_SIZE + 1;
+
+    for (size_t i = 0; i < numIndices; ++i)
+    {
+        unsigned vertex = indices[i];
+        if (time - timestamps[vertex] > ANALYZE_CACHE_SIZE)
+        {
+            timestamps[vertex] = time++;
+            ++ret.numTransformed;
+        }
+        if (!used[vertex])
+        {
+            used[vertex] = true;
+            ++ret.numVertices;
+        }
+    }
+
+    return ret;
+}
+
+void OptimizeVertexCache(unsigned* indices, size_t numIndices, size_t numVertices)
+{
+    ZoneScoped;
+
+    size_t numTriangles = numIndices / 3;
+    if (numTriangles < 2)
+        return;
+
+    // Build vertex to triangle adjacency
+    std::vector<unsigned> remainingTriangles(numVertices, 0);
+    std::vector<unsigned> adjacencyOffsets(numVertices, 0);
+    std::vector<unsigned> adjacency(numTriangles * 3);
+
+    for (size_t i = 0; i < numTriangles * 3; ++i)
+        ++remainingTriangles[indices[i]];
+
+    unsigned offset = 0;
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        adjacencyOffsets[i] = offset;
+        offset += remainingTriangles[i];
+    }
+
+    std::vector<unsigned> fillCounts(numVertices, 0);
+    for (size_t i = 0; i < numTriangles * 3; ++i)
+    {
+        unsigned vertex = indices[i];
+        adjacency[adjacencyOffsets[vertex] + fillCounts[vertex]++] = (unsigned)(i / 3);
+    }
+
+    std::vector<float> vertexScores(numVertices);
+    for (size_t i = 0; i < numVertices; ++i)
+        vertexScores[i] = VertexScore(-1, remainingTriangles[i]);
+
+    std::vector<bool> emitted(numTriangles, false);
+    std::vector<unsigned> newIndices;
+    newIndices.reserve(numTriangles * 3);
+
+    unsigned cache[OPTIMIZE_CACHE_SIZE + 3];
+    unsigned newCache[OPTIMIZE_CACHE_SIZE + 3];
+    size_t cacheCount = 0;
+    size_t cursor = 0;
+    int bestTriangle = -1;
+
+    for (size_t n = 0; n < numTriangles; ++n)
+    {
+        // When no cached vertex has triangles left, continue from the next unemitted triangle in original order
+        if (bestTriangle < 0)
+        {
+            while (emitted[cursor])
+                ++cursor;
+            bestTriangle = (int)cursor;
+        }
+
+        const unsigned* triangle = indices + bestTriangle * 3;
+        emitted[bestTriangle] = true;
+        newIndices.push_back(triangle[0]);
+        newIndices.push_back(triangle[1]);
+        newIndices.push_back(triangle[2]);
+
+        // Move the triangle's vertices to the front of the LRU cache
+        size_t newCount = 0;
+        for (size_t i = 0; i < 3; ++i)
+        {
+            if (std::find(newCache, newCache + newCount, triangle[i]) == newCache + newCount)
+                newCache[newCount++] = triangle[i];
+        }
+        for (size_t i = 0; i < cacheCount; ++i)
+        {
+            if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+                newCache[newCount++] = cache[i];
+        }
+
+        // Remove the triangle from its vertices' adjacency
+        for (size_t i = 0; i < 3; ++i)
+        {
+            unsigned vertex = triangle[i];
+            unsigned* vertexTriangles = &adjacency[adjacencyOffsets[vertex]];
+            unsigned count = remainingTriangles[vertex];
+            for (unsigned j = 0; j < count; ++j)
+            {
+                if (vertexTriangles[j] == (unsigned)bestTriangle)
+                {
+                    vertexTriangles[j] = vertexTriangles[count - 1];
+                    break;
+                }
+            }
+            --remainingTriangles[vertex];
+        }
+
+        // Rescore the vertices that were in the cache, including those just evicted
+        for (size_t i = 0; i < newCount; ++i)
+        {
+            unsigned vertex = newCache[i];
+            vertexScores[vertex] = VertexScore(i < OPTIMIZE_CACHE_SIZE ? (int)i : -1, remainingTriangles[vertex]);
+        }
+
+        cacheCount = newCount < OPTIMIZE_CACHE_SIZE ? newCount : OPTIMIZE_CACHE_SIZE;
+        memcpy(cache, newCache, cacheCount * sizeof(unsigned));
+
+        // Pick the best scoring triangle touching the cache
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < cacheCount; ++i)
+        {
+            unsigned vertex = cache[i];
+            const unsigned* vertexTriangles = &adjacency[adjacencyOffsets[vertex]];
+            for (unsigned j = 0; j < remainingTriangles[vertex]; ++j)
+            {
+                const unsigned* candidate = indices + vertexTriangles[j] * 3;
+                float score = vertexScores[candidate[0]] + vertexScores[candidate[1]] + vertexScores[candidate[2]];
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    bestTriangle = (int)vertexTriangles[j];
+                }
+            }
+        }
+    }
+
+    memcpy(indices, &newIndices[0], numTriangles * 3 * sizeof(unsigned));
+}
+
+void OptimizeOverdraw(unsigned* indices, size_t numIndices, const Vector3* positions, size_t numVertices, float threshold)
+{
+    ZoneScoped;
+
+    size_t numTriangles = numIndices / 3;
+    if (numTriangles < 2)
+        return;
+
+    // Split into clusters at triangles where all vertices miss the cache. Reordering whole clusters keeps most of the cache efficiency
+    std::vector<size_t> clusterStarts;
+    std::vector<unsigned> timestamps(numVertices, 0);
+    unsigned time = ANALYZE_CACHE_SIZE + 1;
+
+    for (size_t i = 0; i < numTriangles; ++i)
+    {
+        size_t misses = 0;
+        for (size_t j = 0; j < 3; ++j)
+        {
+            unsigned vertex = indices[i * 3 + j];
+            if (time - timestamps[vertex] > ANALYZE_CACHE_SIZE)
+            {
+                timestamps[vertex] = time++;
+                ++misses;
+            }
+        }
+        if (!i || misses == 3)
+            clusterStarts.push_back(i);
+    }
+
+    if (clusterStarts.size() < 2)
+        return;
+
+    Vector3 meshCentroid = Vector3::ZERO;
+    for (size_t i = 0; i < numTriangles * 3; ++i)
+        meshCentroid += positions[indices[i]];
+    meshCentroid /= (float)(numTriangles * 3);
+
+    // Sort clusters so that those facing outward from the mesh center, which are likely to occlude the rest, are drawn first
+    std::vector<std::pair<float, size_t> > clusterKeys;
+    clusterKeys.reserve(clusterStarts.size());
+
+    for (size_t i = 0; i < clusterStarts.size(); ++i)
+    {
+        size_t start = clusterStarts[i];
+        size_t end = i + 1 < clusterStarts.size() ? clusterStarts[i + 1] : numTriangles;
+
+        Vector3 centroid = Vector3::ZERO;
+        Vector3 normal = Vector3::ZERO;
+        float area = 0.0f;
+
+        for (size_t j = start; j < end; ++j)
+        {
+            const Vector3& v0 = positions[indices[j * 3]];
+            const Vector3& v1 = positions[indices[j * 3 + 1]];
+            const Vector3& v2 = positions[indices[j * 3 + 2]];
+            Vector3 triangleNormal = (v1 - v0).CrossProduct(v2 - v0);
+            float triangleArea = triangleNormal.Length();
+
+            centroid += (v0 + v1 + v2) * (triangleArea / 3.0f);
+            normal += triangleNormal;
+            area += triangleArea;
+        }
+
+        if (area > 0.0f)
+            centroid /= area;
+        else
+            centroid = positions[indices[start * 3]];
+        normal.Normalize();
+
+        clusterKeys.push_back(std::make_pair(-(centroid - meshCentroid).DotProduct(normal), i));
+    }
+
+    std::stable_sort(clusterKeys.begin(), clusterKeys.end());
+
+    std::vector<unsigned> newIndices;
+    newIndices.reserve(numTriangles * 3);
+
+    for (auto it = clusterKeys.begin(); it != clusterKeys.end(); ++it)
+    {
+        size_t start = clusterStarts[it->second];
+        size_t end = it->second + 1 < clusterStarts.size() ? clusterStarts[it->second + 1] : numTriangles;
+        newIndices.insert(newIndices.end(), indices + start * 3, indices + end * 3);
+    }
+
+    size_t oldTransformed = AnalyzeVertexCache(indices, numTriangles * 3, numVertices).numTransformed;
+    size_t newTransformed = AnalyzeVertexCache(&newIndices[0], numTriangles * 3, numVertices).numTransformed;
+    if ((float)newTransformed <= (float)oldTransformed * threshold)
+        memcpy(indices, &newIndices[0], numTriangles * 3 * sizeof(unsigned));
+}
+
+void OptimizeVertexFetchRemap(unsigned* remap, const unsigned* indices, size_t numIndices, size_t numVertices)
+{
+    ZoneScoped;
+
+    const unsigned unassigned = 0xffffffff;
+    for (size_t i = 0; i < numVertices; ++i)
+        remap[i] = unassigned;
+
+    unsigned nextVertex = 0;
+    for (size_t i = 0; i < numIndices; ++i)
+    {
+        unsigned vertex = indices[i];
+        if (remap[vertex] == unassigned)
+            remap[vertex] = nextVertex++;
+    }
+
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        if (remap[i] == unassigned)
+            remap[i] = nextVertex++;
+    }
+}
@@ -0,0 +1,48 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <cstddef>
+
+class Vector3;
+
+/// Post-transform vertex cache statistics of a triangle list.
+struct VertexCacheStatistics
+{
+    /// Construct with zero values.
+    VertexCacheStatistics() :
+        numTriangles(0),
+        numVertices(0),
+        numTransformed(0)
+    {
+    }
+
+    /// Add another index list's statistics.
+    void Add(const VertexCacheStatistics& other)
+    {
+        numTriangles += other.numTriangles;
+        numVertices += other.numVertices;
+        numTransformed += other.numTransformed;
+    }
+
+    /// Return average cache miss ratio, ie. transformed vertices per triangle. 0.5 is the theoretical best and 3 the worst.
+    float Acmr() const { return numTriangles ? (float)numTransformed / (float)numTriangles : 0.0f; }
+    /// Return average transform to vertex ratio, ie. transformed vertices per referenced vertex. 1 is the best.
+    float Atvr() const { return numVertices ? (float)numTransformed / (float)numVertices : 0.0f; }
+
+    /// Number of triangles.
+    size_t numTriangles;
+    /// Number of unique vertices referenced.
+    size_t numVertices;
+    /// Number of vertex shader invocations, ie. cache misses.
+    size_t numTransformed;
+};
+
+/// Simulate a FIFO post-transform vertex cache on a triangle list and return the statistics.
+VertexCacheStatistics AnalyzeVertexCache(const unsigned* indices, size_t numIndices, size_t numVertices);
+/// Reorder triangles for post-transform vertex cache efficiency, using Forsyth's linear-speed algorithm.
+void OptimizeVertexCache(unsigned* indices, size_t numIndices, size_t numVertices);
+/// Reorder vertex cache optimized triangles to reduce overdraw. Splits the triangles into clusters at cache discontinuities and sorts the clusters so that outward-facing ones come first. The reordering is discarded if the ACMR would grow more than the threshold ratio.
+void OptimizeOverdraw(unsigned* indices, size_t numIndices, const Vector3* positions, size_t numVertices, float threshold = 1.05f);
+/// Build a vertex remap table for fetch locality: vertices are numbered in order of first use in the index list. Unreferenced vertices are placed last. The remap table holds the new index for each old vertex and must have room for numVertices entries.
+void OptimizeVertexFetchRemap(unsigned* remap, const unsigned* indices, size_t numIndices, size_t numVertices);
@@ -6,6 +6,7 @@
 #include "../Scene/Node.h"
 #include "GeometryNode.h"
 #include "Material.h"
+#include "MeshOptimizer.h"
 #include "Model.h"
 
 #include <tracy/Tracy.hpp>
@@ -17,7 +18,113 @@ static const size_t COMBINEDBUFFER_INDICES = 1024 * 1024;
 // Bone bounding box size required to contribute to bounding box recalculation
 static const float BONE_SIZE_THRESHOLD = 0.05f;
 
-std::map<unsigned, std::vector<WeakPtr<CombinedBuffer> > > CombinedBuffer::buffers;
+// Native model format identifier and version
+static const std::string NATIVE_MODEL_ID("TMDL");
+static const unsigned NATIVE_MODEL_VERSION = 1;
+// Alignment of bulk data blocks in the native model format, relative to the file start
+static const size_t NATIVE_MODEL_ALIGNMENT = 16;
+
+// Maximum error for reduced precision positions, relative to the vertex buffer bounding box size
+static const float POSITION_COMPRESSION_TOLERANCE = 0.001f;
+// Maximum error for reduced precision texture coordinates
+static const float TEXCOORD_COMPRESSION_TOLERANCE = 0.001f;
+
+std::map<unsigned long long, std::vector<WeakPtr<CombinedBuffer> > > CombinedBuffer::buffers;
+bool Model::vertexCompression = false;
+bool Model::meshOptimization = false;
+bool Model::retainVertexData = false;
+
+/// Return a key identifying the vertex layout, including element types.
+static unsigned long long VertexLayoutKey(const std::vector<VertexElement>& elements)
+{
+    unsigned long long key = VertexBuffer::CalculateAttributeMask(elements);
+    for (auto it = elements.begin(); it != elements.end(); ++it)
+        key = key * MAX_ELEMENT_TYPES + it->type;
+    return key;
+}
+
+/// Return the maximum error when converting float vertex element components to half-precision.
+static float MaxHalfError(const unsigned char* data, size_t numVertices, size_t vertexSize, size_t numComponents)
+{
+    float maxError = 0.0f;
+
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        const float* src = reinterpret_cast<const float*>(data + i * vertexSize);
+        for (size_t j = 0; j < numComponents; ++j)
+            maxError = Max(maxError, Abs(HalfToFloat(FloatToHalf(src[j])) - src[j]));
+    }
+
+    return maxError;
+}
+
+/// Pack a vector with components in the -1 to 1 range to normalized signed bytes.
+static unsigned PackSignedNormalized(float x, float y, float z, float w)
+{
+    signed char packed[4] = {
+        (signed char)Clamp((int)roundf(x * 127.0f), -127, 127),
+        (signed char)Clamp((int)roundf(y * 127.0f), -127, 127),
+        (signed char)Clamp((int)roundf(z * 127.0f), -127, 127),
+        (signed char)Clamp((int)roundf(w * 127.0f), -127, 127)
+    };
+
+    unsigned ret;
+    memcpy(&ret, packed, sizeof ret);
+    return ret;
+}
+
+/// Write zero padding up to the native model format block alignment.
+static void WritePadding(Stream& dest)
+{
+    static const unsigned char zeros[NATIVE_MODEL_ALIGNMENT] = { 0 };
+    size_t padding = (NATIVE_MODEL_ALIGNMENT - dest.Position() % NATIVE_MODEL_ALIGNMENT) % NATIVE_MODEL_ALIGNMENT;
+    if (padding)
+        dest.Write(zeros, padding);
+}
+
+/// Skip padding up to the native model format block alignment.
+static void SkipPadding(Stream& source)
+{
+    size_t padding = (NATIVE_MODEL_ALIGNMENT - source.Position() % NATIVE_MODEL_ALIGNMENT) % NATIVE_MODEL_ALIGNMENT;
+    if (padding)
+        source.Seek(source.Position() + padding);
+}
+
+/// Read a range of 16- or 32-bit indices as 32-bit.
+static void ReadIndices(std::vector<unsigned>& dest, const IndexBufferDesc& ibDesc, size_t start, size_t count)
+{
+    dest.resize(count);
+
+    if (ibDesc.indexSize == sizeof(unsigned short))
+    {
+        const unsigned short* src = reinterpret_cast<const unsigned short*>(ibDesc.indexData.Get()) + start;
+        for (size_t i = 0; i < count; ++i)
+            dest[i] = src[i];
+    }
+    else
+    {
+        const unsigned* src = reinterpret_cast<const unsigned*>(ibDesc.indexData.Get()) + start;
+        for (size_t i = 0; i < count; ++i)
+            dest[i] = src[i];
+    }
+}
+
+/// Write 32-bit indices to a range of 16- or 32-bit indices.
+static void WriteIndices(IndexBufferDesc& ibDesc, size_t start, const std::vector<unsigned>& src)
+{
+    if (ibDesc.indexSize == sizeof(unsigned short))
+    {
+        unsigned short* dest = reinterpret_cast<unsigned short*>(ibDesc.indexData.Get()) + start;
+        for (size_t i = 0; i < src.size(); ++i)
+            dest[i] = (unsigned short)src[i];
+    }
+    else
+    {
+        unsigned* dest = reinterpret_cast<unsigned*>(ibDesc.indexData.Get()) + start;
+        for (size_t i = 0; i < src.size(); ++i)
+            dest[i] = src[i];
+    }
+}
 
 CombinedBuffer::CombinedBuffer(const std::vector<VertexElement>& elements) :
     usedVertices(0),
@@ -51,7 +158,8 @@ bool CombinedBuffer::FillIndices(size_t numIndices, const void* data)
 
 CombinedBuffer* CombinedBuffer::Allocate(const std::vector<VertexElement>& elements, size_t numVertices, size_t numIndices)
 {
-    unsigned key = VertexBuffer::CalculateAttributeMask(elements);
+    // Reduced precision formats may share the attribute mask with full precision, so also the element types must match
+    unsigned long long key = VertexLayoutKey(elements);
     auto it = buffers.find(key);
     if (it != buffers.end())
     {
@@ -75,7 +183,7 @@ CombinedBuffer* CombinedBuffer::Allocate(const std::vector<VertexElement>& eleme
     }
 
     // No existing buffer, make new
-    LOGDEBUGF("Creating new combined buffer for attribute mask %d", key);
+    LOGDEBUGF("Creating new combined buffer for attribute mask %d", VertexBuffer::CalculateAttributeMask(elements));
     CombinedBuffer* buffer = new CombinedBuffer(elements);
 
 #ifdef _DEBUG
@@ -109,7 +217,8 @@ ModelBone::~ModelBone()
 {
 }
 
-Model::Model()
+Model::Model() :
+    vertexDataSize(0)
 {
 }
 
@@ -126,17 +235,26 @@ bool Model::BeginLoad(Stream& source)
 {
     ZoneScoped;
 
-    /// \todo Develop own format for Turso3D
-    if (source.ReadFileID() != "UMDL")
+    vbDescs.clear();
+    ibDescs.clear();
+    geomDescs.clear();
+
+    std::string fileID = source.ReadFileID();
+    if (fileID == NATIVE_MODEL_ID)
+    {
+        if (!BeginLoadNative(source))
+            return false;
+
+        ProcessVertexData(source.Name());
+        return true;
+    }
+
+    if (fileID != "UMDL")
     {
         LOGERROR(source.Name() + " is not a valid model file");
         return false;
     }
 
-    vbDescs.clear();
-    ibDescs.clear();
-    geomDescs.clear();
-
     size_t numVertexBuffers = source.Read<unsigned>();
     vbDescs.resize(numVertexBuffers);
     for (size_t i = 0; i < numVertexBuffers; ++i)
@@ -300,9 +418,507 @@ bool Model::BeginLoad(Stream& source)
     // Read bounding box
     boundingBox = source.Read<BoundingBox>();
 
+    ProcessVertexData(source.Name());
+    return true;
+}
+
+bool Model::BeginLoadNative(Stream& source)
+{
+    ZoneScoped;
+
+    unsigned version = source.Read<unsigned>();
+    if (version != NATIVE_MODEL_VERSION)
+    {
+        LOGERRORF("Model %s has unsupported native format version %d", source.Name().c_str(), version);
+        return false;
+    }
+
+    // Vertex, index and position data are stored as aligned blocks in their final layout, and are read in one operation each
+    size_t numVertexBuffers = source.Read<unsigned>();
+    vbDescs.resize(numVertexBuffers);
+    for (size_t i = 0; i < numVertexBuffers; ++i)
+    {
+        VertexBufferDesc& vbDesc = vbDescs[i];
+
+        vbDesc.numVertices = source.Read<unsigned>();
+        size_t numElements = source.Read<unsigned>();
+        bool hasPositions = source.Read<bool>();
+
+        vbDesc.vertexSize = 0;
+        for (size_t j = 0; j < numElements; ++j)
+        {
+            unsigned char type = source.Read<unsigned char>();
+            unsigned char semantic = source.Read<unsigned char>();
+            unsigned char index = source.Read<unsigned char>();
+            if (type >= MAX_ELEMENT_TYPES || semantic >= MAX_ELEMENT_SEMANTICS)
+            {
+                LOGERROR("Model " + source.Name() + " has invalid vertex elements");
+                return false;
+            }
+
+            VertexElement element((ElementType)type, (ElementSemantic)semantic, index);
+            vbDesc.vertexSize += VertexBuffer::VertexElementSize(element);
+            vbDesc.vertexElements.push_back(element);
+        }
+
+        size_t dataSize = vbDesc.numVertices * vbDesc.vertexSize;
+        vbDesc.vertexData = new unsigned char[dataSize];
+        SkipPadding(source);
+        if (source.Read(vbDesc.vertexData.Get(), dataSize) != dataSize)
+        {
+            LOGERROR("Model " + source.Name() + " vertex data is truncated");
+            return false;
+        }
+
+        if (hasPositions)
+        {
+            size_t positionSize = vbDesc.numVertices * sizeof(Vector3);
+            vbDesc.cpuPositionData = new Vector3[vbDesc.numVertices];
+            SkipPadding(source);
+            if (source.Read(vbDesc.cpuPositionData.Get(), positionSize) != positionSize)
+            {
+                LOGERROR("Model " + source.Name() + " position data is truncated");
+                return false;
+            }
+        }
+    }
+
+    size_t numIndexBuffers = source.Read<unsigned>();
+    ibDescs.resize(numIndexBuffers);
+    for (size_t i = 0; i < numIndexBuffers; ++i)
+    {
+        IndexBufferDesc& ibDesc = ibDescs[i];
+
+        ibDesc.numIndices = source.Read<unsigned>();
+        ibDesc.indexSize = source.Read<unsigned>();
+        if (ibDesc.indexSize != sizeof(unsigned short) && ibDesc.indexSize != sizeof(unsigned))
+        {
+            LOGERROR("Model " + source.Name() + " has invalid index size");
+            return false;
+        }
+
+        size_t dataSize = ibDesc.numIndices * ibDesc.indexSize;
+        ibDesc.indexData = new unsigned char[dataSize];
+        SkipPadding(source);
+        if (source.Read(ibDesc.indexData.Get(), dataSize) != dataSize)
+        {
+            LOGERROR("Model " + source.Name() + " index data is truncated");
+            return false;
+        }
+    }
+
+    size_t numGeometries = source.Read<unsigned>();
+    geomDescs.resize(numGeometries);
+    for (size_t i = 0; i < numGeometries; ++i)
+    {
+        size_t numLodLevels = source.Read<unsigned>();
+        geomDescs[i].resize(numLodLevels);
+
+        for (size_t j = 0; j < numLodLevels; ++j)
+        {
+            GeometryDesc& geomDesc = geomDescs[i][j];
+
+            geomDesc.lodDistance = source.Read<float>();
+            geomDesc.vbRef = source.Read<unsigned>();
+            geomDesc.ibRef = source.Read<unsigned>();
+            geomDesc.drawStart = source.Read<unsigned>();
+            geomDesc.drawCount = source.Read<unsigned>();
+
+            if (geomDesc.vbRef >= vbDescs.size() || geomDesc.ibRef >= ibDescs.size())
+            {
+                LOGERROR("Model " + source.Name() + " has invalid buffer references");
+                return false;
+            }
+        }
+    }
+
+    size_t numBones = source.Read<unsigned>();
+    bones.resize(numBones);
+    for (size_t i = 0; i < numBones; ++i)
+    {
+        ModelBone& bone = bones[i];
+        bone.name = source.Read<std::string>();
+        bone.nameHash = StringHash(bone.name);
+        bone.parentIndex = source.Read<unsigned>();
+        bone.initialPosition = source.Read<Vector3>();
+        bone.initialRotation = source.Read<Quaternion>();
+        bone.initialScale = source.Read<Vector3>();
+        bone.offsetMatrix = source.Read<Matrix3x4>();
+        bone.radius = source.Read<float>();
+        bone.boundingBox = source.Read<BoundingBox>();
+        bone.active = source.Read<bool>();
+    }
+
+    boundingBox = source.Read<BoundingBox>();
+    return true;
+}
+
+bool Model::Save(Stream& dest)
+{
+    ZoneScoped;
+
+    if (vbDescs.empty() && !geometries.empty())
+    {
+        LOGERROR("Can not save model " + Name() + " after its data has been uploaded");
+        return false;
+    }
+
+    dest.WriteFileID(NATIVE_MODEL_ID);
+    dest.Write(NATIVE_MODEL_VERSION);
+
+    dest.Write((unsigned)vbDescs.size());
+    for (auto it = vbDescs.begin(); it != vbDescs.end(); ++it)
+    {
+        dest.Write((unsigned)it->numVertices);
+        dest.Write((unsigned)it->vertexElements.size());
+        dest.Write(it->cpuPositionData.Get() != nullptr);
+
+        for (auto eIt = it->vertexElements.begin(); eIt != it->vertexElements.end(); ++eIt)
+        {
+            dest.Write((unsigned char)eIt->type);
+            dest.Write((unsigned char)eIt->semantic);
+            dest.Write(eIt->index);
+        }
+
+        WritePadding(dest);
+        dest.Write(it->vertexData.Get(), it->numVertices * it->vertexSize);
+        if (it->cpuPositionData)
+        {
+            WritePadding(dest);
+            dest.Write(it->cpuPositionData.Get(), it->numVertices * sizeof(Vector3));
+        }
+    }
+
+    dest.Write((unsigned)ibDescs.size());
+    for (auto it = ibDescs.begin(); it != ibDescs.end(); ++it)
+    {
+        dest.Write((unsigned)it->numIndices);
+        dest.Write((unsigned)it->indexSize);
+        WritePadding(dest);
+        dest.Write(it->indexData.Get(), it->numIndices * it->indexSize);
+    }
+
+    dest.Write((unsigned)geomDescs.size());
+    for (auto it = geomDescs.begin(); it != geomDescs.end(); ++it)
+    {
+        dest.Write((unsigned)it->size());
+        for (auto lodIt = it->begin(); lodIt != it->end(); ++lodIt)
+        {
+            dest.Write(lodIt->lodDistance);
+            dest.Write(lodIt->vbRef);
+            dest.Write(lodIt->ibRef);
+            dest.Write(lodIt->drawStart);
+            dest.Write(lodIt->drawCount);
+        }
+    }
+
+    dest.Write((unsigned)bones.size());
+    for (auto it = bones.begin(); it != bones.end(); ++it)
+    {
+        dest.Write(it->name);
+        dest.Write((unsigned)it->parentIndex);
+        dest.Write(it->initialPosition);
+        dest.Write(it->initialRotation);
+        dest.Write(it->initialScale);
+        dest.Write(it->offsetMatrix);
+        dest.Write(it->radius);
+        dest.Write(it->boundingBox);
+        dest.Write(it->active);
+    }
+
+    dest.Write(boundingBox);
     return true;
 }
 
+void Model::ProcessVertexData(const std::string& name)
+{
+    // Optimize index and vertex order before vertex compression, as the compressed data is no longer float
+    if (meshOptimization)
+        OptimizeMeshes(name);
+
+    // Convert vertex data to reduced precision formats if enabled, and report the byte counts
+    size_t originalSize = 0;
+    vertexDataSize = 0;
+
+    for (auto it = vbDescs.begin(); it != vbDescs.end(); ++it)
+    {
+        originalSize += it->numVertices * it->vertexSize;
+        if (vertexCompression)
+            CompressVertexData(*it);
+        vertexDataSize += it->numVertices * it->vertexSize;
+    }
+
+    if (vertexCompression)
+        LOGINFOF("Model %s vertex data %d bytes, compressed to %d bytes", name.c_str(), (int)originalSize, (int)vertexDataSize);
+}
+
+void Model::SetVertexCompression(bool enable)
+{
+    vertexCompression = enable;
+}
+
+void Model::SetRetainVertexData(bool enable)
+{
+    retainVertexData = enable;
+}
+
+void Model::SetMeshOptimization(bool enable)
+{
+    meshOptimization = enable;
+}
+
+void Model::OptimizeMeshes(const std::string& name)
+{
+    ZoneScoped;
+
+    // Collect unique triangle list ranges. Ranges shared by several geometries or LOD levels are optimized once
+    std::vector<GeometryDesc> ranges;
+    std::vector<int> ibVertexBuffers(ibDescs.size(), -1);
+    std::vector<bool> vbOptimizable(vbDescs.size(), true);
+
+    for (auto it = geomDescs.begin(); it != geomDescs.end(); ++it)
+    {
+        for (auto lodIt = it->begin(); lodIt != it->end(); ++lodIt)
+        {
+            const GeometryDesc& geomDesc = *lodIt;
+            if (geomDesc.vbRef >= vbDescs.size() || geomDesc.ibRef >= ibDescs.size() || geomDesc.drawStart + geomDesc.drawCount > ibDescs[geomDesc.ibRef].numIndices)
+                return;
+
+            // Vertices can only be reordered if their index buffer is not also used with other vertex buffers
+            int& ibVertexBuffer = ibVertexBuffers[geomDesc.ibRef];
+            if (ibVertexBuffer >= 0 && ibVertexBuffer != (int)geomDesc.vbRef)
+            {
+                vbOptimizable[ibVertexBuffer] = false;
+                vbOptimizable[geomDesc.vbRef] = false;
+            }
+            ibVertexBuffer = geomDesc.vbRef;
+
+            bool duplicate = false;
+            for (auto rIt = ranges.begin(); rIt != ranges.end(); ++rIt)
+            {
+                if (rIt->ibRef == geomDesc.ibRef && rIt->drawStart == geomDesc.drawStart && rIt->drawCount == geomDesc.drawCount)
+                {
+                    duplicate = true;
+                    break;
+                }
+            }
+            if (!duplicate)
+                ranges.push_back(geomDesc);
+        }
+    }
+
+    VertexCacheStatistics oldStats;
+    VertexCacheStatistics newStats;
+    std::vector<unsigned> indices;
+
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        const GeometryDesc& range = ranges[i];
+        IndexBufferDesc& ibDesc = ibDescs[range.ibRef];
+        const VertexBufferDesc& vbDesc = vbDescs[range.vbRef];
+
+        // Partially overlapping ranges can not be reordered independently
+        bool overlap = false;
+        for (size_t j = 0; j < ranges.size(); ++j)
+        {
+            if (j != i && ranges[j].ibRef == range.ibRef && ranges[j].drawStart < range.drawStart + range.drawCount && range.drawStart < ranges[j].drawStart + ranges[j].drawCount)
+            {
+                overlap = true;
+                break;
+            }
+        }
+        if (overlap || range.drawCount < 3 || range.drawCount % 3)
+            continue;
+
+        ReadIndices(indices, ibDesc, range.drawStart, range.drawCount);
+        bool valid = true;
+        for (auto iIt = indices.begin(); iIt != indices.end(); ++iIt)
+        {
+            if (*iIt >= vbDesc.numVertices)
+            {
+                valid = false;
+                break;
+            }
+        }
+        if (!valid)
+        {
+            vbOptimizable[range.vbRef] = false;
+            continue;
+        }
+
+        oldStats.Add(AnalyzeVertexCache(&indices[0], indices.size(), vbDesc.numVertices));
+        OptimizeVertexCache(&indices[0], indices.size(), vbDesc.numVertices);
+        if (vbDesc.cpuPositionData)
+            OptimizeOverdraw(&indices[0], indices.size(), vbDesc.cpuPositionData.Get(), vbDesc.numVertices);
+        newStats.Add(AnalyzeVertexCache(&indices[0], indices.size(), vbDesc.numVertices));
+
+        WriteIndices(ibDesc, range.drawStart, indices);
+    }
+
+    // Renumber vertices in order of first use
+    std::vector<unsigned> remap;
+
+    for (size_t i = 0; i < vbDescs.size(); ++i)
+    {
+        VertexBufferDesc& vbDesc = vbDescs[i];
+        if (!vbOptimizable[i] || !vbDesc.numVertices)
+            continue;
+
+        std::vector<unsigned> allIndices;
+        for (auto it = ranges.begin(); it != ranges.end(); ++it)
+        {
+            if (it->vbRef == i)
+            {
+                ReadIndices(indices, ibDescs[it->ibRef], it->drawStart, it->drawCount);
+                allIndices.insert(allIndices.end(), indices.begin(), indices.end());
+            }
+        }
+
+        // Check all indices, also outside the draw ranges, as they are renumbered too
+        bool valid = true;
+        for (size_t j = 0; j < ibDescs.size() && valid; ++j)
+        {
+            if (ibVertexBuffers[j] != (int)i)
+                continue;
+            ReadIndices(indices, ibDescs[j], 0, ibDescs[j].numIndices);
+            for (auto iIt = indices.begin(); iIt != indices.end(); ++iIt)
+            {
+                if (*iIt >= vbDesc.numVertices)
+                {
+                    valid = false;
+                    break;
+                }
+            }
+        }
+        if (!valid)
+            continue;
+
+        remap.resize(vbDesc.numVertices);
+        OptimizeVertexFetchRemap(&remap[0], allIndices.size() ? &allIndices[0] : nullptr, allIndices.size(), vbDesc.numVertices);
+
+        SharedArrayPtr<unsigned char> newData(new unsigned char[vbDesc.numVertices * vbDesc.vertexSize]);
+        for (size_t j = 0; j < vbDesc.numVertices; ++j)
+            memcpy(newData.Get() + remap[j] * vbDesc.vertexSize, vbDesc.vertexData.Get() + j * vbDesc.vertexSize, vbDesc.vertexSize);
+        vbDesc.vertexData = newData;
+
+        if (vbDesc.cpuPositionData)
+        {
+            SharedArrayPtr<Vector3> newPositions(new Vector3[vbDesc.numVertices]);
+            for (size_t j = 0; j < vbDesc.numVertices; ++j)
+                newPositions[remap[j]] = vbDesc.cpuPositionData[j];
+            vbDesc.cpuPositionData = newPositions;
+        }
+
+        for (size_t j = 0; j < ibDescs.size(); ++j)
+        {
+            if (ibVertexBuffers[j] != (int)i)
+                continue;
+            ReadIndices(indices, ibDescs[j], 0, ibDescs[j].numIndices);
+            for (auto iIt = indices.begin(); iIt != indices.end(); ++iIt)
+                *iIt = remap[*iIt];
+            WriteIndices(ibDescs[j], 0, indices);
+        }
+    }
+
+    LOGINFOF("Model %s vertex cache ACMR %.3f, ATVR %.3f, optimized to ACMR %.3f, ATVR %.3f", name.c_str(), oldStats.Acmr(), oldStats.Atvr(), newStats.Acmr(), newStats.Atvr());
+}
+
+void Model::CompressVertexData(VertexBufferDesc& vbDesc)
+{
+    ZoneScoped;
+
+    if (!vbDesc.numVertices)
+        return;
+
+    const std::vector<VertexElement>& oldElements = vbDesc.vertexElements;
+    const unsigned char* oldData = vbDesc.vertexData.Get();
+    size_t oldVertexSize = vbDesc.vertexSize;
+
+    float positionTolerance = POSITION_COMPRESSION_TOLERANCE;
+    if (vbDesc.cpuPositionData)
+        positionTolerance *= BoundingBox(vbDesc.cpuPositionData.Get(), vbDesc.numVertices).Size().Length();
+
+    // Choose new element types. Keep full precision if the error would be too large
+    std::vector<VertexElement> newElements;
+    std::vector<size_t> oldOffsets;
+    size_t oldOffset = 0;
+    size_t newVertexSize = 0;
+    bool changed = false;
+
+    for (auto it = oldElements.begin(); it != oldElements.end(); ++it)
+    {
+        VertexElement newElement(it->type, it->semantic, it->index);
+
+        if (it->semantic == SEM_POSITION && it->type == ELEM_VECTOR3)
+        {
+            if (MaxHalfError(oldData + oldOffset, vbDesc.numVertices, oldVertexSize, 3) <= positionTolerance)
+                newElement.type = ELEM_HALF4;
+        }
+        else if (it->semantic == SEM_TEXCOORD && it->type == ELEM_VECTOR2)
+        {
+            if (MaxHalfError(oldData + oldOffset, vbDesc.numVertices, oldVertexSize, 2) <= TEXCOORD_COMPRESSION_TOLERANCE)
+                newElement.type = ELEM_HALF2;
+        }
+        else if ((it->semantic == SEM_NORMAL && it->type == ELEM_VECTOR3) || (it->semantic == SEM_TANGENT && it->type == ELEM_VECTOR4))
+            newElement.type = ELEM_BYTE4_NORM;
+
+        if (newElement.type != it->type)
+            changed = true;
+
+        oldOffsets.push_back(oldOffset);
+        oldOffset += VertexBuffer::VertexElementSize(*it);
+        newVertexSize += VertexBuffer::VertexElementSize(newElement);
+        newElements.push_back(newElement);
+    }
+
+    if (!changed)
+        return;
+
+    SharedArrayPtr<unsigned char> newData(new unsigned char[vbDesc.numVertices * newVertexSize]);
+    unsigned char* dest = newData.Get();
+
+    for (size_t i = 0; i < vbDesc.numVertices; ++i)
+    {
+        const unsigned char* src = oldData + i * oldVertexSize;
+
+        for (size_t j = 0; j < newElements.size(); ++j)
+        {
+            const VertexElement& oldElement = oldElements[j];
+            const VertexElement& newElement = newElements[j];
+            const float* srcFloats = reinterpret_cast<const float*>(src + oldOffsets[j]);
+
+            if (newElement.type == oldElement.type)
+                memcpy(dest, src + oldOffsets[j], VertexBuffer::VertexElementSize(oldElement));
+            else if (newElement.type == ELEM_HALF4)
+            {
+                unsigned short* destHalfs = reinterpret_cast<unsigned short*>(dest);
+                destHalfs[0] = FloatToHalf(srcFloats[0]);
+                destHalfs[1] = FloatToHalf(srcFloats[1]);
+                destHalfs[2] = FloatToHalf(srcFloats[2]);
+                destHalfs[3] = FloatToHalf(1.0f);
+            }
+            else if (newElement.type == ELEM_HALF2)
+            {
+                unsigned short* destHalfs = reinterpret_cast<unsigned short*>(dest);
+                destHalfs[0] = FloatToHalf(srcFloats[0]);
+                destHalfs[1] = FloatToHalf(srcFloats[1]);
+            }
+            else if (newElement.type == ELEM_BYTE4_NORM)
+            {
+                unsigned packed = oldElement.type == ELEM_VECTOR4 ? PackSignedNormalized(srcFloats[0], srcFloats[1], srcFloats[2], srcFloats[3]) :
+                    PackSignedNormalized(srcFloats[0], srcFloats[1], srcFloats[2], 0.0f);
+                memcpy(dest, &packed, sizeof packed);
+            }
+
+            dest += VertexBuffer::VertexElementSize(newElement);
+        }
+    }
+
+    vbDesc.vertexElements = newElements;
+    vbDesc.vertexSize = newVertexSize;
+    vbDesc.vertexData = newData;
+}
+
 void Model::ApplyBoneMappings(const GeometryDesc& geomDesc, const std::vector<unsigned>& boneMappings, std::set<std::pair<unsigned, unsigned> >& processedVertices)
 {
     ZoneScoped;
@@ -409,6 +1025,9 @@ bool Model::EndLoad()
             geom->drawStart = geomDesc.drawStart;
             geom->drawCount = geomDesc.drawCount;
             geom->cpuPositionData = vbDescs[geomDesc.vbRef].cpuPositionData;
+            // Static batching skips skinned geometries and geometries with LOD levels, so do not keep their vertex data
+            if (retainVertexData && !hasWeights && geomDescs[i].size() == 1)
+                geom->cpuVertexData = vbDescs[geomDesc.vbRef].vertexData;
             geom->cpuIndexData = ibDescs[geomDesc.ibRef].indexData;
             geom->cpuIndexSize = ibDescs[geomDesc.ibRef].indexSize;
             geom->cpuDrawStart = geomDesc.drawStart;
@@ -440,9 +1059,14 @@ bool Model::EndLoad()
             }
             else
             {
-                unsigned* indexData = (unsigned*)&ibDesc.indexData[0];
+                // Copy instead of modifying in place, as the original indices are retained as CPU-side data
+                unsigned* oldIndexData = (unsigned*)&ibDesc.indexData[0];
+                SharedArrayPtr<unsigned char> newIndices(new unsigned char[sizeof(unsigned) * ibDesc.numIndices]);
+                unsigned* newIndexData = (unsigned*)newIndices.Get();
                 for (size_t j = 0; j < ibDescs[i].numIndices; ++j)
-                    indexData[j] += vertexStart;
+                    newIndexData[j] = oldIndexData[j] + vertexStart;
+
+                ibDesc.indexData = newIndices;
             }
         }
 
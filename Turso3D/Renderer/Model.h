@@ -115,8 +115,8 @@ private:
     /// Index buffer use count so far.
     size_t usedIndices;
 
-    /// Current buffers.
-    static std::map<unsigned, std::vector<WeakPtr<CombinedBuffer> > > buffers;
+    /// Current buffers by vertex layout key.
+    static std::map<unsigned long long, std::vector<WeakPtr<CombinedBuffer> > > buffers;
 };
 
 /// 3D model resource.
@@ -133,10 +133,12 @@ public:
     /// Register object factory.
     static void RegisterObject();
 
-    /// Load model from a stream. Return true on success.
+    /// Load model from a stream. Both the native format and the Urho3D format are supported. Return true on success.
     bool BeginLoad(Stream& source) override;
     /// Finalize model loading in the main thread. Return true on success.
     bool EndLoad() override;
+    /// Save the model in the native format. Possible only between BeginLoad() and EndLoad(), as the load-time data is released after upload. Used to convert models. Return true on success.
+    bool Save(Stream& dest) override;
 
     /// Set number of geometries.
     void SetNumGeometries(size_t num);
@@ -159,8 +161,32 @@ public:
     const BoundingBox& LocalBoundingBox() const { return boundingBox; }
     /// Return the model's bone descriptions.
     const std::vector<ModelBone>& Bones() const { return bones; }
+    /// Return total vertex data size in bytes as uploaded to the GPU.
+    size_t VertexDataSize() const { return vertexDataSize; }
+
+    /// Set whether to convert vertex data to reduced precision formats on load: half-float positions and texcoords, and normalized byte normals and tangents. Elements are only converted when within precision tolerance. Default false.
+    static void SetVertexCompression(bool enable);
+    /// Return whether vertex data is converted to reduced precision formats on load.
+    static bool VertexCompression() { return vertexCompression; }
+    /// Set whether to optimize meshes on load: reorder triangles for vertex cache efficiency and less overdraw, and reorder vertices for fetch locality. Vertex cache statistics are logged before and after. Default false.
+    static void SetMeshOptimization(bool enable);
+    /// Return whether meshes are optimized on load.
+    static bool MeshOptimization() { return meshOptimization; }
+    /// Set whether to keep a CPU-side copy of the full vertex data in geometries that static batching can merge, see StaticBatch::MergeStaticModels(). Affects models loaded afterward. Default false.
+    static void SetRetainVertexData(bool enable);
+    /// Return whether CPU-side vertex data is kept for static batching.
+    static bool RetainVertexData() { return retainVertexData; }
 
 private:
+    /// Load the native format after the file ID. Return true on success.
+    bool BeginLoadNative(Stream& source);
+    /// Optimize and compress the loaded vertex data as enabled.
+    void ProcessVertexData(const std::string& name);
+    /// Optimize index and vertex order of the loaded buffers.
+    void OptimizeMeshes(const std::string& name);
+    /// Convert a vertex buffer's data to reduced precision formats.
+    void CompressVertexData(VertexBufferDesc& vbDesc);
+
     /// Apply per-geometry bone mappings (legacy feature, not needed anymore.)
     void ApplyBoneMappings(const GeometryDesc& geomDesc, const std::vector<unsigned>& boneMappings, std::set<std::pair<unsigned, unsigned> >& processedVertices);
 
@@ -178,4 +204,13 @@ private:
     std::vector<IndexBufferDesc> ibDescs;
     /// Geometry descriptions for loading.
     std::vector<std::vector<GeometryDesc> > geomDescs;
+    /// Total vertex data size in bytes.
+    size_t vertexDataSize;
+
+    /// Vertex compression flag.
+    static bool vertexCompression;
+    /// Mesh optimization flag.
+    static bool meshOptimization;
+    /// CPU-side vertex data retention flag.
+    static bool retainVertexData;
 };
@@ -175,7 +175,8 @@ const BoundingBox& Octant::CullingBox() const
 Octree::Octree() :
     threadedUpdate(false),
     frameNumber(0),
-    workQueue(Subsystem<WorkQueue>())
+    workQueue(Subsystem<WorkQueue>()),
+    numUpdates(0)
 {
     assert(workQueue);
 
@@ -184,6 +185,7 @@ Octree::Octree() :
     // Have at least 1 task for reinsert processing
     reinsertTasks.push_back(new ReinsertDrawablesTask(this, &Octree::CheckReinsertWork));
     reinsertQueues = new std::vector<Drawable*>[workQueue->NumThreads()];
+    threadChangedBoxes = new std::vector<BoundingBox>[workQueue->NumThreads()];
 }
 
 Octree::~Octree()
@@ -258,12 +260,35 @@ void Octree::FinishUpdate()
 
     SetThreadedUpdate(false);
 
+    // Append the changed shadowcaster boxes to the history, including those recorded from drawables removed since the previous update
+    shadowCasterHistoryStarts.push_back(changedShadowCasterBoxes.size());
+    for (size_t i = 0; i < workQueue->NumThreads(); ++i)
+    {
+        changedShadowCasterBoxes.insert(changedShadowCasterBoxes.end(), threadChangedBoxes[i].begin(), threadChangedBoxes[i].end());
+        threadChangedBoxes[i].clear();
+    }
+
+    // Drop the oldest updates from the history until it is small enough. Cached results older than the history must be queried again
+    while (shadowCasterHistoryStarts.size() && (shadowCasterHistoryStarts.size() > MAX_SHADOW_CASTER_HISTORY_UPDATES ||
+        changedShadowCasterBoxes.size() > MAX_SHADOW_CASTER_HISTORY_BOXES))
+    {
+        size_t dropCount = shadowCasterHistoryStarts.size() > 1 ? shadowCasterHistoryStarts[1] : changedShadowCasterBoxes.size();
+        changedShadowCasterBoxes.erase(changedShadowCasterBoxes.begin(), changedShadowCasterBoxes.begin() + dropCount);
+        shadowCasterHistoryStarts.erase(shadowCasterHistoryStarts.begin());
+        for (auto it = shadowCasterHistoryStarts.begin(); it != shadowCasterHistoryStarts.end(); ++it)
+            *it -= dropCount;
+    }
+
     // Now reinsert drawables that actually need reinsertion into a different octant
     for (size_t i = 0; i < workQueue->NumThreads(); ++i)
         ReinsertDrawables(reinsertQueues[i]);
 
     updateQueue.clear();
 
+    // Skip zero, which means no update
+    if (!++numUpdates)
+        ++numUpdates;
+
     // Sort octants' drawables by address and put lights first
     for (auto it = sortDirtyOctants.begin(); it != sortDirtyOctants.end(); ++it)
     {
@@ -345,6 +370,20 @@ RaycastResult Octree::RaycastSingle(const Ray& ray, unsigned short nodeFlags, fl
     }
 }
 
+bool Octree::ChangedShadowCastersSince(unsigned updateNumber, size_t& start) const
+{
+    if (!updateNumber || updateNumber > numUpdates)
+        return false;
+
+    // The history holds the changes of the latest updates, one entry per update
+    size_t numNewerUpdates = numUpdates - updateNumber;
+    if (numNewerUpdates > shadowCasterHistoryStarts.size())
+        return false;
+
+    start = numNewerUpdates ? shadowCasterHistoryStarts[shadowCasterHistoryStarts.size() - numNewerUpdates] : changedShadowCasterBoxes.size();
+    return true;
+}
+
 void Octree::FindDrawablesMasked(std::vector<Drawable*>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask) const
 {
     ZoneScoped;
@@ -371,6 +410,7 @@ void Octree::QueueUpdate(Drawable* drawable)
         // Do nothing if still fits the current octant
         const BoundingBox& box = drawable->WorldBoundingBox();
         Octant* oldOctant = drawable->GetOctant();
+        AddChangedShadowCaster(drawable, threadChangedBoxes[WorkQueue::ThreadIndex()]);
         if (!oldOctant || oldOctant->fittingBox.IsInside(box) != INSIDE)
         {
             reinsertQueues[WorkQueue::ThreadIndex()].push_back(drawable);
@@ -384,6 +424,7 @@ void Octree::RemoveDrawable(Drawable* drawable)
     if (!drawable)
         return;
 
+    AddChangedShadowCaster(drawable, threadChangedBoxes[WorkQueue::ThreadIndex()], true);
     RemoveDrawable(drawable, drawable->GetOctant());
     if (drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
     {
@@ -635,6 +676,7 @@ void Octree::CheckReinsertWork(Task* task_, unsigned threadIndex_)
     Drawable** start = task->start;
     Drawable** end = task->end;
     std::vector<Drawable*>& reinsertQueue = reinsertQueues[threadIndex_];
+    std::vector<BoundingBox>& threadBoxes = threadChangedBoxes[threadIndex_];
 
     for (; start != end; ++start)
     {
@@ -651,6 +693,7 @@ void Octree::CheckReinsertWork(Task* task_, unsigned threadIndex_)
         // Do nothing if still fits the current octant
         const BoundingBox& box = drawable->WorldBoundingBox();
         Octant* oldOctant = drawable->GetOctant();
+        AddChangedShadowCaster(drawable, threadBoxes);
         if (!oldOctant || oldOctant->fittingBox.IsInside(box) != INSIDE)
             reinsertQueue.push_back(drawable);
         else
@@ -12,6 +12,8 @@ static const size_t NUM_OCTANTS = 8;
 static const unsigned char OF_DRAWABLES_SORT_DIRTY = 0x1;
 static const unsigned char OF_CULLING_BOX_DIRTY = 0x2;
 static const float OCCLUSION_QUERY_INTERVAL = 0.133333f; // About 8 frame stagger at 60fps
+static const size_t MAX_SHADOW_CASTER_HISTORY_BOXES = 1024; // Larger changes make a fresh query cheaper than testing them
+static const size_t MAX_SHADOW_CASTER_HISTORY_UPDATES = 64;
 
 class Ray;
 class WorkQueue;
@@ -230,6 +232,12 @@ public:
     bool ThreadedUpdate() const { return threadedUpdate; }
     /// Return the root octant.
     Octant* Root() const { return const_cast<Octant*>(&root); }
+    /// Return number of finished updates.
+    unsigned NumUpdates() const { return numUpdates; }
+    /// Return world bounding boxes of shadowcasters that were added, moved or removed during the recent updates. A moved shadowcaster has both its old and new bounds. Used to invalidate cached shadowcaster query results.
+    const std::vector<BoundingBox>& ChangedShadowCasterBoxes() const { return changedShadowCasterBoxes; }
+    /// Return the index of the first changed shadowcaster box recorded after the given update. Return false if the history no longer reaches back to it.
+    bool ChangedShadowCastersSince(unsigned updateNumber, size_t& start) const;
 
 private:
     /// Set bounding box. Used in serialization.
@@ -244,6 +252,26 @@ private:
     void ReinsertDrawables(std::vector<Drawable*>& drawables);
     /// Remove a drawable from a reinsert queue.
     void RemoveDrawableFromQueue(Drawable* drawable, std::vector<Drawable*>& drawables);
+    /// Record the old and new bounds of a shadowcaster if they changed. A removed drawable or one that stopped casting shadows records only its old bounds.
+    void AddChangedShadowCaster(Drawable* drawable, std::vector<BoundingBox>& boxes, bool removed = false)
+    {
+        BoundingBox& oldBox = drawable->shadowCasterBox;
+        if (!removed && (drawable->Flags() & (DF_GEOMETRY | DF_CAST_SHADOWS)) == (DF_GEOMETRY | DF_CAST_SHADOWS))
+        {
+            const BoundingBox& box = drawable->WorldBoundingBox();
+            if (oldBox.min == box.min && oldBox.max == box.max)
+                return;
+            if (oldBox.IsDefined())
+                boxes.push_back(oldBox);
+            boxes.push_back(box);
+            oldBox = box;
+        }
+        else if (oldBox.IsDefined())
+        {
+            boxes.push_back(oldBox);
+            oldBox.Undefine();
+        }
+    }
     
     /// Add drawable to a specific octant.
     void AddDrawable(Drawable* drawable, Octant* octant)
@@ -385,6 +413,14 @@ private:
     std::vector<AutoPtr<ReinsertDrawablesTask> > reinsertTasks;
     /// Intermediate reinsert queues for threaded execution.
     AutoArrayPtr<std::vector<Drawable*> > reinsertQueues;
+    /// Intermediate changed shadowcaster boxes for threaded execution.
+    AutoArrayPtr<std::vector<BoundingBox> > threadChangedBoxes;
+    /// Changed shadowcaster boxes of the recent updates.
+    std::vector<BoundingBox> changedShadowCasterBoxes;
+    /// Index of the first changed shadowcaster box of each recent update, oldest first.
+    std::vector<size_t> shadowCasterHistoryStarts;
+    /// Number of finished updates.
+    unsigned numUpdates;
     /// RaycastSingle initial coarse result.
     mutable std::vector<std::pair<Drawable*, float> > initialRayResult;
     /// RaycastSingle final result.
@@ -23,6 +23,7 @@ Drawable::Drawable() :
     octant(nullptr),
     flags(0),
     layer(LAYER_DEFAULT),
+    lodLevel(0),
     lastFrameNumber(0),
     lastUpdateFrameNumber(0),
     distance(0.0f),
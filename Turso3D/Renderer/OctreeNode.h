@@ -28,6 +28,7 @@ static const unsigned short DF_OCTREE_UPDATE_CALL = 0x100;
 static const unsigned short DF_WORLD_TRANSFORM_DIRTY = 0x200;
 static const unsigned short DF_BOUNDING_BOX_DIRTY = 0x400;
 static const unsigned short DF_OCTREE_REINSERT_QUEUED = 0x800;
+static const unsigned short DF_DUAL_QUATERNION_SKINNING = 0x1000;
 
 /// Common base class for renderable scene objects and occluders.
 class OctreeNodeBase : public SpatialNode
@@ -88,6 +89,8 @@ public:
     float Distance() const { return distance; }
     /// Return max distance for rendering, or 0 for unlimited.
     float MaxDistance() const { return maxDistance; }
+    /// Return highest LOD level in use in the current view.
+    unsigned char LodLevel() const { return lodLevel; }
     /// Return whether is static.
     bool IsStatic() const { return TestFlag(DF_STATIC); }
     /// Return last frame number when was visible. The frames are counted by Renderer internally and have no significance outside it.
@@ -154,6 +157,8 @@ protected:
     mutable unsigned short flags;
     /// Layer number. Copy of the node layer.
     unsigned char layer;
+    /// Highest LOD level in use in the current view.
+    unsigned char lodLevel;
     /// Last frame number when was visible.
     unsigned short lastFrameNumber;
     /// Last frame number when was reinserted to octree or other change (LOD etc.) happened.
@@ -164,6 +169,8 @@ protected:
     float maxDistance;
     /// Owner scene node.
     OctreeNodeBase* owner;
+    /// World bounding box last recorded by the octree for shadowcaster change tracking. Undefined if not recorded as a shadowcaster.
+    BoundingBox shadowCasterBox;
 };
 
 /// Base class for scene nodes that insert drawables to the octree for rendering.
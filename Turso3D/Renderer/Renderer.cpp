@@ -15,6 +15,8 @@
 #include "../Scene/Scene.h"
 #include "AnimatedModel.h"
 #include "Animation.h"
+#include "AnimationPoseCache.h"
+#include "AnimationSystem.h"
 #include "Batch.h"
 #include "Camera.h"
 #include "DebugRenderer.h"
@@ -24,6 +26,7 @@
 #include "Model.h"
 #include "Octree.h"
 #include "Renderer.h"
+#include "StaticBatch.h"
 #include "StaticModel.h"
 
 #include <algorithm>
@@ -31,12 +34,157 @@
 #include <tracy/Tracy.hpp>
 
 static const size_t DRAWABLES_PER_BATCH_TASK = 128;
+static const size_t SHADOWCASTERS_PER_BATCH_TASK = 128;
 static const size_t NUM_BOX_INDICES = 36;
 static const float OCCLUSION_MARGIN = 0.1f;
+static const float LOD_BUDGET_DECREASE = 0.9f;
+static const float LOD_BUDGET_INCREASE = 1.02f;
+static const float LOD_BUDGET_RESTORE_THRESHOLD = 0.8f;
+static const float LOD_BUDGET_MIN_BIAS = 0.1f;
 
-static inline bool CompareDrawableDistances(Drawable* lhs, Drawable* rhs)
+static inline bool CompareLightImportances(const std::pair<float, LightDrawable*>& lhs, const std::pair<float, LightDrawable*>& rhs)
 {
-    return lhs->Distance() < rhs->Distance();
+    return lhs.first > rhs.first;
+}
+
+static inline bool CompareShadowUpdateGroups(const ShadowUpdateGroup& lhs, const ShadowUpdateGroup& rhs)
+{
+    return lhs.score > rhs.score;
+}
+
+/// Copy a static light's cached shadow casters to the result if no shadowcasters were added, moved or removed within the query volume since the result was stored. Return true on success.
+template <class T> static bool GetCachedShadowCasters(LightDrawable* light, Octree* octree, const T& volume, std::vector<Drawable*>& result)
+{
+    if (!light->IsStatic())
+        return false;
+
+    unsigned lastUpdate = light->CachedShadowCastersUpdate();
+    unsigned update = octree->NumUpdates();
+
+    if (lastUpdate != update)
+    {
+        // If the octree no longer has the changes since the cached result, it must be queried again
+        size_t start;
+        if (!octree->ChangedShadowCastersSince(lastUpdate, start))
+            return false;
+
+        const std::vector<BoundingBox>& changedBoxes = octree->ChangedShadowCasterBoxes();
+        for (size_t i = start; i < changedBoxes.size(); ++i)
+        {
+            if (volume.IsInsideFast(changedBoxes[i]) != OUTSIDE)
+                return false;
+        }
+
+        light->SetCachedShadowCastersUpdate(update);
+    }
+
+    result = light->CachedShadowCasters();
+    return true;
+}
+
+/// Return the estimated fraction of a camera's view height covered by a point or spot light's range, clamped to 1.
+static float LightScreenCoverage(LightDrawable* light, Camera* camera)
+{
+    // Spot light distance is measured to the middle of its range
+    float radius = light->GetLightType() == LIGHT_SPOT ? 0.5f * light->Range() : light->Range();
+    float distance = light->Distance();
+    if (distance <= radius)
+        return 1.0f;
+
+    float viewSize = camera->IsOrthographic() ? 0.5f * camera->OrthoSize() : distance * tanf(camera->Fov() * 0.5f * M_DEGTORAD);
+    return Min(radius / Max(viewSize, M_EPSILON), 1.0f);
+}
+
+/// Return whether a light has rendered shadow map content in any of its views.
+static bool HasShadowContent(LightDrawable* light)
+{
+    const std::vector<ShadowView>& shadowViews = light->ShadowViews();
+    for (auto it = shadowViews.begin(); it != shadowViews.end(); ++it)
+    {
+        if (it->lastViewport != IntRect::ZERO)
+            return true;
+    }
+
+    return false;
+}
+
+/// Return whether a light uses a separate static object batch queue in its shadow views.
+static bool HasStaticShadowQueue(LightDrawable* light)
+{
+    return light->GetLightType() != LIGHT_DIRECTIONAL && light->IsStatic();
+}
+
+/// Combine a shadow view's render mode with a deferred one, so that the result covers both updates.
+static ShadowRenderMode CombineShadowRenderModes(ShadowRenderMode mode, ShadowRenderMode pendingMode)
+{
+    if (mode == RENDER_STATIC_LIGHT_STORE_STATIC || pendingMode == RENDER_STATIC_LIGHT_STORE_STATIC)
+        return RENDER_STATIC_LIGHT_STORE_STATIC;
+    if (mode == RENDER_STATIC_LIGHT_RESTORE_STATIC || pendingMode == RENDER_STATIC_LIGHT_RESTORE_STATIC)
+        return RENDER_STATIC_LIGHT_RESTORE_STATIC;
+    if (mode == RENDER_DYNAMIC_LIGHT || pendingMode == RENDER_DYNAMIC_LIGHT)
+        return RENDER_DYNAMIC_LIGHT;
+    return RENDER_STATIC_LIGHT_CACHED;
+}
+
+/// Return number of shadowcaster batches a shadow view renders with its current render mode.
+static size_t NumShadowBatches(const ShadowMap& shadowMap, const ShadowView& view)
+{
+    if (view.renderMode == RENDER_STATIC_LIGHT_CACHED)
+        return 0;
+
+    size_t ret = shadowMap.shadowBatches[view.dynamicQueueIdx].batches.size();
+    if (view.renderMode == RENDER_STATIC_LIGHT_STORE_STATIC)
+        ret += shadowMap.shadowBatches[view.staticQueueIdx].batches.size();
+    return ret;
+}
+
+/// Return the point light cube face index of a shadow camera direction: positive and negative X, Y and Z in this order.
+static size_t CubeFaceIndex(const Vector3& direction)
+{
+    Vector3 absDirection = direction.Abs();
+    size_t axis = absDirection.x >= absDirection.y ? (absDirection.x >= absDirection.z ? 0 : 2) : (absDirection.y >= absDirection.z ? 1 : 2);
+    return axis * 2 + (direction.Data()[axis] < 0.0f ? 1 : 0);
+}
+
+/// Return a bit mask of the point light cube faces a world bounding box may be visible in, with bits in cube face index order. The face frustums are pyramids with the given half-angle tangent.
+static unsigned PointLightFaceMask(const BoundingBox& box, const Vector3& lightPosition, float faceTan)
+{
+    Vector3 min = box.min - lightPosition;
+    Vector3 max = box.max - lightPosition;
+    const float* minData = min.Data();
+    const float* maxData = max.Data();
+
+    // Distance of the box from the light on each axis, zero if straddling it
+    float nearest[3];
+    for (size_t i = 0; i < 3; ++i)
+        nearest[i] = minData[i] > 0.0f ? minData[i] : (maxData[i] < 0.0f ? -maxData[i] : 0.0f);
+
+    unsigned ret = 0;
+    for (size_t i = 0; i < 3; ++i)
+    {
+        float nearestU = nearest[(i + 1) % 3];
+        float nearestV = nearest[(i + 2) % 3];
+
+        // The face pyramid is widest at the box's farthest extent along the face axis
+        float positiveLimit = maxData[i] * faceTan;
+        if (maxData[i] > 0.0f && nearestU <= positiveLimit && nearestV <= positiveLimit)
+            ret |= 1 << (i * 2);
+        float negativeLimit = -minData[i] * faceTan;
+        if (minData[i] < 0.0f && nearestU <= negativeLimit && nearestV <= negativeLimit)
+            ret |= 2 << (i * 2);
+    }
+
+    return ret;
+}
+
+/// Store a static light's shadow casters for reuse on later frames.
+static void StoreCachedShadowCasters(LightDrawable* light, Octree* octree, const std::vector<Drawable*>& shadowCasters)
+{
+    if (light->IsStatic())
+    {
+        light->CachedShadowCasters() = shadowCasters;
+        light->SetCachedShadowCastersUpdate(octree->NumUpdates());
+    }
 }
 
 /// %Task for collecting octants.
@@ -78,9 +226,11 @@ struct CollectShadowCastersTask : public MemberFunctionTask<Renderer>
 
     /// %Light.
     LightDrawable* light;
+    /// Shadowcaster list index for the query result. Point lights sort the result into per-face lists.
+    size_t casterListIdx;
 };
 
-/// %Task for collecting shadow batches of a specific shadow view.
+/// %Task for collecting shadow batches of a range of a shadow view's shadowcasters.
 struct CollectShadowBatchesTask : public MemberFunctionTask<Renderer>
 {
     /// Construct.
@@ -93,6 +243,22 @@ struct CollectShadowBatchesTask : public MemberFunctionTask<Renderer>
     size_t shadowMapIdx;
     /// Shadow view index within shadow map.
     size_t viewIdx;
+    /// Start index in the shadowcaster list.
+    size_t start;
+    /// End index in the shadowcaster list.
+    size_t end;
+    /// Collected static object batches.
+    std::vector<Batch> staticBatches;
+    /// Collected dynamic object batches, or all batches if the view has no static queue.
+    std::vector<Batch> dynamicBatches;
+    /// Number of accepted shadowcasters.
+    size_t numShadowCasters;
+    /// Number of accepted static shadowcasters.
+    size_t numStaticShadowCasters;
+    /// Static shadowcasters moved flag.
+    bool staticCastersMoved;
+    /// Dynamic shadowcasters moved flag.
+    bool dynamicCastersMoved;
 };
 
 /// %Task for culling lights to a specific Z-slice of the frustum grid.
@@ -125,6 +291,53 @@ void ThreadBatchResult::Clear()
     geometryBounds.Undefine();
     opaqueBatches.clear();
     alphaBatches.clear();
+    numTriangles = 0;
+    for (size_t i = 0; i < NUM_LOD_STATS_LEVELS; ++i)
+        lodLevels[i] = 0;
+    for (size_t i = 0; i < NUM_ANIMATION_LOD_STATS_LEVELS; ++i)
+        animationLodLevels[i] = 0;
+    numAnimationUpdates = 0;
+}
+
+LodStatistics::LodStatistics() :
+    numTriangles(0),
+    numBatches(0),
+    numAnimationUpdates(0),
+    autoLodBias(1.0f)
+{
+    for (size_t i = 0; i < NUM_LOD_STATS_LEVELS; ++i)
+        lodLevels[i] = 0;
+    for (size_t i = 0; i < NUM_ANIMATION_LOD_STATS_LEVELS; ++i)
+        animationLodLevels[i] = 0;
+}
+
+LightImportanceSettings::LightImportanceSettings() :
+    maxLights(0),
+    maxShadowedLights(0),
+    minImportance(0.0f),
+    fadeImportance(0.0f),
+    shadowImportance(0.0f),
+    fullShadowImportance(0.0f)
+{
+}
+
+PrepareViewStatistics::PrepareViewStatistics() :
+    animationUpdate(0.0f),
+    octreeUpdate(0.0f),
+    octantsCollected(0.0f),
+    lightsProcessed(0.0f),
+    mainBatchesSorted(0.0f),
+    total(0.0f)
+{
+    for (size_t i = 0; i < NUM_SHADOW_MAPS; ++i)
+        shadowBatchesSorted[i] = 0.0f;
+}
+
+ShadowUpdateStatistics::ShadowUpdateStatistics() :
+    numUpdated(0),
+    numDeferred(0),
+    numBatches(0)
+{
 }
 
 ShadowMap::ShadowMap()
@@ -142,9 +355,10 @@ void ShadowMap::Clear()
 {
     freeQueueIdx = 0;
     freeCasterListIdx = 0;
-    allocator.Reset(texture->Width(), texture->Height(), 0, 0, false);
+    atlas.BeginFrame();
     shadowViews.clear();
     instanceTransforms.clear();
+    updateStats = ShadowUpdateStatistics();
 
     for (auto it = shadowBatches.begin(); it != shadowBatches.end(); ++it)
         it->Clear();
@@ -156,9 +370,20 @@ Renderer::Renderer() :
     graphics(Subsystem<Graphics>()),
     workQueue(Subsystem<WorkQueue>()),
     frameNumber(0),
-    clusterFrustumsDirty(true),
+    numShadowedLights(0),
     depthBiasMul(1.0f),
-    slopeScaleBiasMul(1.0f)
+    slopeScaleBiasMul(1.0f),
+    maxTriangles(0),
+    maxBatches(0),
+    maxShadowBatches(0),
+    shadowLightInterval(1),
+    shadowPriorityThreshold(0.0f),
+    shadowCascadeInterval(1),
+    numLightIndices(0),
+    skinMatrixBytes(0),
+    skinMatrixSliceSize(INITIAL_SKIN_MATRIX_SLICE_SIZE),
+    skinMatrixSlice(0),
+    skinMatricesUploaded(false)
 {
     assert(graphics && graphics->IsInitialized());
     assert(workQueue);
@@ -176,19 +401,16 @@ Renderer::Renderer() :
     }
 
     clusterTexture = new Texture();
-    clusterTexture->Define(TEX_3D, IntVector3(NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), FMT_RGBA32U, 1);
-    clusterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
-
-    clusterCullData = new ClusterCullData[NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
-    clusterData = new unsigned char[MAX_LIGHTS_CLUSTER * NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
-    lightData = new LightData[MAX_LIGHTS + 1];
-    memset(lightData, 0, (MAX_LIGHTS + 1) * sizeof(LightData));
+    lightIndexTexture = new Texture();
+    lightDataTexture = new Texture();
+    SetClusterGrid(IntVector3(DEFAULT_CLUSTER_X, DEFAULT_CLUSTER_Y, DEFAULT_CLUSTER_Z));
 
     perViewDataBuffer = new UniformBuffer();
     perViewDataBuffer->Define(USAGE_DYNAMIC, sizeof(PerViewUniforms));
 
-    lightDataBuffer = new UniformBuffer();
-    lightDataBuffer->Define(USAGE_DYNAMIC, MAX_LIGHTS * sizeof(LightData));
+    skinMatrixBuffer = new UniformBuffer();
+    skinMatrixBuffer->Define(USAGE_DYNAMIC, NUM_SKIN_MATRIX_SLICES * skinMatrixSliceSize);
+    skinMatrixData = new unsigned char[skinMatrixSliceSize];
 
     octantResults = new ThreadOctantResult[NUM_OCTANT_TASKS];
     batchResults = new ThreadBatchResult[workQueue->NumThreads()];
@@ -199,12 +421,6 @@ Renderer::Renderer() :
         collectOctantsTasks[i]->resultIdx = i;
     }
 
-    for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
-    {
-        cullLightsTasks[z] = new CullLightsTask(this, &Renderer::CullLightsToFrustumWork);
-        cullLightsTasks[z]->z = z;
-    }
-
     processLightsTask = new MemberFunctionTask<Renderer>(this, &Renderer::ProcessLightsWork);
     batchesReadyTask = new MemberFunctionTask<Renderer>(this, &Renderer::BatchesReadyWork);
     processShadowCastersTask = new MemberFunctionTask<Renderer>(this, &Renderer::ProcessShadowCastersWork);
@@ -229,6 +445,7 @@ void Renderer::SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat
         shadowMap.texture->Define(TEX_2D, i == 0 ? IntVector2(dirLightSize * 2, dirLightSize) : IntVector2(lightAtlasSize, lightAtlasSize), format);
         shadowMap.texture->DefineSampler(COMPARE_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP, 1);
         shadowMap.fbo->Define(nullptr, shadowMap.texture);
+        shadowMap.atlas.Reset(shadowMap.texture->Size2D());
     }
 
     if (!staticObjectShadowBuffer)
@@ -253,6 +470,49 @@ void Renderer::SetShadowDepthBiasMul(float depthBiasMul_, float slopeScaleBiasMu
     shadowMapsDirty = true;
 }
 
+void Renderer::SetClusterGrid(const IntVector3& size)
+{
+    lightGrid.SetSize(size);
+    IntVector3 gridSize = lightGrid.Size();
+    size_t numClusterZ = (size_t)gridSize.z;
+
+    clusterTexture->Define(TEX_3D, gridSize, FMT_RG32U, 1);
+    clusterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+
+    // One light culling task per Z-slice
+    while (cullLightsTasks.size() < numClusterZ)
+    {
+        cullLightsTasks.push_back(new CullLightsTask(this, &Renderer::CullLightsToFrustumWork));
+        cullLightsTasks.back()->z = cullLightsTasks.size() - 1;
+    }
+    if (cullLightsTasks.size() > numClusterZ)
+        cullLightsTasks.erase(cullLightsTasks.begin() + numClusterZ, cullLightsTasks.end());
+}
+
+void Renderer::SetClusterDepthFit(bool enable)
+{
+    lightGrid.SetDepthFit(enable);
+}
+
+void Renderer::SetLodBudget(size_t maxTriangles_, size_t maxBatches_)
+{
+    maxTriangles = maxTriangles_;
+    maxBatches = maxBatches_;
+}
+
+void Renderer::SetLightImportance(const LightImportanceSettings& settings)
+{
+    lightImportance = settings;
+}
+
+void Renderer::SetShadowUpdateBudget(size_t maxBatches_, int lightInterval, float priorityThreshold, int cascadeInterval)
+{
+    maxShadowBatches = maxBatches_;
+    shadowLightInterval = Max(lightInterval, 1);
+    shadowPriorityThreshold = priorityThreshold;
+    shadowCascadeInterval = Max(cascadeInterval, 1);
+}
+
 void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bool useOcclusion_)
 {
     ZoneScoped;
@@ -267,6 +527,9 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
     if (!octree)
         return;
 
+    prepareViewTimer.Reset();
+    prepareViewStats = PrepareViewStatistics();
+
     // Framenumber is never 0
     ++frameNumber;
     if (!frameNumber)
@@ -284,6 +547,9 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
     opaqueBatches.Clear();
     alphaBatches.Clear();
     lights.clear();
+    lightImportances.clear();
+    lightShadowSizes.clear();
+    numShadowedLights = 0;
     instanceTransforms.clear();
     
     minZ = M_MAX_FLOAT;
@@ -304,6 +570,19 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
             shadowMaps[i].Clear();
     }
 
+    BeginSkinMatrixFrame();
+
+    // Begin a new frame of shared animation poses, if the pose cache is in use
+    AnimationPoseCache* poseCache = Subsystem<AnimationPoseCache>();
+    if (poseCache)
+        poseCache->BeginFrame();
+
+    // Update the animated models queued since the last frame, if the animation system is in use. This queues their octree reinsertions
+    AnimationSystem* animationSystem = Subsystem<AnimationSystem>();
+    if (animationSystem)
+        animationSystem->Update(frameNumber);
+    prepareViewStats.animationUpdate = PrepareViewTime();
+
     // Process moved / animated objects' octree reinsertions
     octree->Update(frameNumber);
 
@@ -314,6 +593,7 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
     // Check arrived occlusion query results while octree update goes on, then finish octree update
     CheckOcclusionQueries();
     octree->FinishUpdate();
+    prepareViewStats.octreeUpdate = PrepareViewTime();
 
     // Find the starting points for octree traversal. Include the root if it contains drawables that didn't fit elsewhere
     Octant* rootOctant = octree->Root();
@@ -328,7 +608,10 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
 
     // If no root level octants, must early-out the view preparation; there is nothing to render and task dependencies would not complete
     if (rootLevelOctants.empty())
+    {
+        prepareViewStats.total = PrepareViewTime();
         return;
+    }
 
     // Enable threaded update during geometry / light gathering in case nodes' OnPrepareRender() causes further reinsertion queuing
     octree->SetThreadedUpdate(workQueue->NumThreads() > 1);
@@ -358,9 +641,11 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
         workQueue->TryComplete();
 
     SortMainBatches();
+    prepareViewStats.mainBatchesSorted = PrepareViewTime();
 
     // Finish remaining view preparation tasks (shadowcaster batches, light culling to frustum grid)
     workQueue->Complete();
+    prepareViewStats.total = PrepareViewTime();
 
     // No more threaded reinsertion will take place
     octree->SetThreadedUpdate(false);
@@ -469,7 +754,8 @@ void Renderer::RenderOpaque(bool clear)
     }
 
     clusterTexture->Bind(TU_LIGHTCLUSTERDATA);
-    lightDataBuffer->Bind(UB_LIGHTDATA);
+    lightIndexTexture->Bind(TU_LIGHTINDICES);
+    lightDataTexture->Bind(TU_LIGHTDATA);
 
     if (clear)
         graphics->Clear(true, true, IntRect::ZERO, lightEnvironment ? lightEnvironment->FogColor() : DEFAULT_FOG_COLOR);
@@ -494,7 +780,8 @@ void Renderer::RenderAlpha()
     }
 
     clusterTexture->Bind(TU_LIGHTCLUSTERDATA);
-    lightDataBuffer->Bind(UB_LIGHTDATA);
+    lightIndexTexture->Bind(TU_LIGHTINDICES);
+    lightDataTexture->Bind(TU_LIGHTDATA);
 
     RenderBatches(camera, alphaBatches);
 }
@@ -656,43 +943,89 @@ void Renderer::AddOcclusionQuery(Octant* octant, ThreadOctantResult& result, uns
         result.occlusionQueries.push_back(octant);
 }
 
-bool Renderer::AllocateShadowMap(LightDrawable* light)
+bool Renderer::AllocateShadowMap(LightDrawable* light, const IntVector2& size, float priority)
 {
     size_t index = light->GetLightType() == LIGHT_DIRECTIONAL ? 0 : 1;
     ShadowMap& shadowMap = shadowMaps[index];
 
-    IntVector2 request = light->TotalShadowMapSize();
+    // If the light already has a rectangle of the same size from earlier frames, it is kept for shadow map caching when possible
+    bool kept;
+    evictedLights.clear();
+    IntRect shadowRect = shadowMap.atlas.Allocate(light, size, priority, kept, evictedLights);
 
-    // If light already has its preferred shadow rect from the previous frame, try to reallocate it for shadow map caching
-    IntRect oldRect = light->ShadowRect();
-    if (request.x == oldRect.Width() && request.y == oldRect.Height())
+    // Lights that lost their rectangle to a higher priority light will try to allocate again when processed
+    for (auto it = evictedLights.begin(); it != evictedLights.end(); ++it)
+        (*it)->SetShadowMap(nullptr);
+
+    if (shadowRect == IntRect::ZERO)
     {
-        if (shadowMap.allocator.AllocateSpecific(oldRect))
-        {
-            light->SetShadowMap(shadowMaps[index].texture, light->ShadowRect());
-            return true;
-        }
+        // No room in atlas
+        light->SetShadowMap(nullptr);
+        return false;
     }
 
-    IntRect shadowRect;
-    size_t retries = 3;
+    // A new rectangle may contain another light's shadow map, so any cached content must be rerendered
+    if (!kept)
+    {
+        std::vector<ShadowView>& shadowViews = light->ShadowViews();
+        for (auto it = shadowViews.begin(); it != shadowViews.end(); ++it)
+            it->lastViewport = IntRect::ZERO;
+    }
+
+    light->SetShadowMap(shadowMap.texture, shadowRect);
+    return true;
+}
+
+float Renderer::CalculateLightImportance(LightDrawable* light) const
+{
+    float intensity = light->EffectiveColor().Average();
+    if (!camera || light->GetLightType() == LIGHT_DIRECTIONAL)
+        return intensity;
+
+    float coverage = LightScreenCoverage(light, camera);
+    return coverage * coverage * intensity;
+}
+
+float Renderer::ShadowUpdatePriority(LightDrawable* light) const
+{
+    if (!camera || light->GetLightType() == LIGHT_DIRECTIONAL)
+        return 1.0f;
+
+    // Shadows that fade out by distance are less important
+    float coverage = LightScreenCoverage(light, camera);
+    return coverage * coverage * (1.0f - light->ShadowStrength());
+}
 
-    while (retries--)
+ShadowUpdateStatistics Renderer::ShadowUpdateStats() const
+{
+    ShadowUpdateStatistics ret;
+    if (shadowMaps)
     {
-        int x, y;
-        if (shadowMap.allocator.Allocate(request.x, request.y, x, y))
+        for (size_t i = 0; i < NUM_SHADOW_MAPS; ++i)
         {
-            light->SetShadowMap(shadowMaps[index].texture, IntRect(x, y, x + request.x, y + request.y));
-            return true;
+            const ShadowUpdateStatistics& stats = shadowMaps[i].updateStats;
+            ret.numUpdated += stats.numUpdated;
+            ret.numDeferred += stats.numDeferred;
+            ret.numBatches += stats.numBatches;
         }
-
-        request.x /= 2;
-        request.y /= 2;
     }
 
-    // No room in atlas
+    return ret;
+}
+
+ShadowAtlasStatistics Renderer::ShadowAtlasStats() const
+{
+    return shadowMaps ? shadowMaps[1].atlas.Statistics() : ShadowAtlasStatistics();
+}
+
+void Renderer::FreeShadowMap(LightDrawable* light)
+{
+    if (!shadowMaps)
+        return;
+
+    for (size_t i = 0; i < NUM_SHADOW_MAPS; ++i)
+        shadowMaps[i].atlas.Free(light);
     light->SetShadowMap(nullptr);
-    return false;
 }
 
 void Renderer::SortMainBatches()
@@ -724,21 +1057,352 @@ void Renderer::SortMainBatches()
             alphaBatches.batches.insert(alphaBatches.batches.end(), res.alphaBatches.begin(), res.alphaBatches.end());
     }
 
+    UpdateLodBudget();
+
     opaqueBatches.Sort(instanceTransforms, SORT_STATE_AND_DISTANCE, hasInstancing);
     alphaBatches.Sort(instanceTransforms, SORT_DISTANCE, hasInstancing);
 }
 
+void Renderer::BeginSkinMatrixFrame()
+{
+    size_t requested = skinMatrixBytes.load();
+    if (requested > skinMatrixSliceSize)
+    {
+        while (skinMatrixSliceSize < requested)
+            skinMatrixSliceSize <<= 1;
+
+        skinMatrixBuffer->Define(USAGE_DYNAMIC, NUM_SKIN_MATRIX_SLICES * skinMatrixSliceSize);
+        skinMatrixData = new unsigned char[skinMatrixSliceSize];
+        LOGDEBUGF("Resized skinning matrix buffer slices to %d bytes", (int)skinMatrixSliceSize);
+    }
+
+    skinMatrixSlice = (skinMatrixSlice + 1) % NUM_SKIN_MATRIX_SLICES;
+    skinMatrixBytes.store(0);
+    skinMatricesUploaded = false;
+}
+
+void Renderer::UpdateLodBudget()
+{
+    lodStats.numTriangles = 0;
+    lodStats.numBatches = opaqueBatches.batches.size() + alphaBatches.batches.size();
+    lodStats.numAnimationUpdates = 0;
+    for (size_t i = 0; i < NUM_LOD_STATS_LEVELS; ++i)
+        lodStats.lodLevels[i] = 0;
+    for (size_t i = 0; i < NUM_ANIMATION_LOD_STATS_LEVELS; ++i)
+        lodStats.animationLodLevels[i] = 0;
+
+    for (size_t i = 0; i < workQueue->NumThreads(); ++i)
+    {
+        ThreadBatchResult& res = batchResults[i];
+        lodStats.numTriangles += res.numTriangles;
+        lodStats.numAnimationUpdates += res.numAnimationUpdates;
+        for (size_t j = 0; j < NUM_LOD_STATS_LEVELS; ++j)
+            lodStats.lodLevels[j] += res.lodLevels[j];
+        for (size_t j = 0; j < NUM_ANIMATION_LOD_STATS_LEVELS; ++j)
+            lodStats.animationLodLevels[j] += res.animationLodLevels[j];
+    }
+
+    // LOD levels have already been chosen for this frame, so the adjusted bias takes effect on the next
+    float autoLodBias = camera->AutoLodBias();
+
+    if (!maxTriangles && !maxBatches)
+        autoLodBias = 1.0f;
+    else
+    {
+        bool overBudget = (maxTriangles && lodStats.numTriangles > maxTriangles) || (maxBatches && lodStats.numBatches > maxBatches);
+        bool underBudget = (!maxTriangles || lodStats.numTriangles < maxTriangles * LOD_BUDGET_RESTORE_THRESHOLD) &&
+            (!maxBatches || lodStats.numBatches < maxBatches * LOD_BUDGET_RESTORE_THRESHOLD);
+
+        if (overBudget)
+            autoLodBias = Max(autoLodBias * LOD_BUDGET_DECREASE, LOD_BUDGET_MIN_BIAS);
+        else if (underBudget)
+            autoLodBias = Min(autoLodBias * LOD_BUDGET_INCREASE, 1.0f);
+    }
+
+    camera->SetAutoLodBias(autoLodBias);
+    lodStats.autoLodBias = autoLodBias;
+}
+
+void Renderer::FinishShadowViews(ShadowMap& shadowMap)
+{
+    std::vector<AutoPtr<CollectShadowBatchesTask> >& tasks = collectShadowBatchesTasks[&shadowMap - shadowMaps.Get()];
+
+    for (size_t i = 0; i < shadowMap.shadowViews.size(); ++i)
+    {
+        ShadowView& view = *shadowMap.shadowViews[i];
+        LightDrawable* light = view.light;
+
+        // Skip view? (no geometry, out of range or point light face not in view)
+        if (view.viewport == IntRect::ZERO)
+        {
+            view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+            view.lastViewport = IntRect::ZERO;
+            continue;
+        }
+
+        bool dynamicOrDirLight = !HasStaticShadowQueue(light);
+        bool dynamicCastersMoved = false;
+        bool staticCastersMoved = false;
+
+        size_t totalShadowCasters = 0;
+        size_t staticShadowCasters = 0;
+
+        // Combine the task results in order, so that the batches are the same as if collected by one task
+        std::vector<Batch>& destDynamic = shadowMap.shadowBatches[view.dynamicQueueIdx].batches;
+        for (size_t j = view.batchTaskIdx; j < view.batchTaskIdx + view.numBatchTasks; ++j)
+        {
+            CollectShadowBatchesTask* task = tasks[j];
+            totalShadowCasters += task->numShadowCasters;
+            staticShadowCasters += task->numStaticShadowCasters;
+            staticCastersMoved |= task->staticCastersMoved;
+            dynamicCastersMoved |= task->dynamicCastersMoved;
+
+            if (destDynamic.empty())
+                destDynamic.swap(task->dynamicBatches);
+            else
+                destDynamic.insert(destDynamic.end(), task->dynamicBatches.begin(), task->dynamicBatches.end());
+
+            if (!dynamicOrDirLight)
+            {
+                std::vector<Batch>& destStatic = shadowMap.shadowBatches[view.staticQueueIdx].batches;
+                if (destStatic.empty())
+                    destStatic.swap(task->staticBatches);
+                else
+                    destStatic.insert(destStatic.end(), task->staticBatches.begin(), task->staticBatches.end());
+            }
+        }
+
+        // Now determine which kind of caching can be used for the shadow map
+        // Dynamic or directional lights
+        if (dynamicOrDirLight)
+        {
+            // If light atlas allocation changed, light moved, or amount of objects in view changed, render an optimized shadow map
+            if (view.lastViewport != view.viewport || !view.lastShadowMatrix.Equals(view.shadowMatrix, 0.0001f) || view.lastNumGeometries != totalShadowCasters || dynamicCastersMoved || staticCastersMoved)
+                view.renderMode = RENDER_DYNAMIC_LIGHT;
+            else
+                view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+        }
+        // Static lights
+        else
+        {
+            // If light atlas allocation has changed, or the static light changed, render a full shadow map now that can be cached next frame
+            if (view.lastViewport != view.viewport || !view.lastShadowMatrix.Equals(view.shadowMatrix, 0.0001f))
+                view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
+            else
+            {
+                view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+
+                // If static shadowcasters updated themselves (e.g. LOD change), render shadow map fully
+                // If dynamic casters moved, need to restore shadowmap and rerender
+                if (staticCastersMoved)
+                    view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
+                else
+                {
+                    if (dynamicCastersMoved || view.lastNumGeometries != totalShadowCasters)
+                        view.renderMode = staticShadowCasters > 0 ? RENDER_STATIC_LIGHT_RESTORE_STATIC : RENDER_DYNAMIC_LIGHT;
+                }
+            }
+        }
+
+        // The update is committed or deferred when all views of the shadow map are known
+        view.numGeometries = totalShadowCasters;
+    }
+}
+
+void Renderer::ScheduleShadowViews(ShadowMap& shadowMap)
+{
+    ZoneScoped;
+
+    std::vector<ShadowView*>& shadowViews = shadowMap.shadowViews;
+    std::vector<ShadowUpdateGroup>& groups = shadowMap.updateGroups;
+    size_t usedBatches = 0;
+
+    groups.clear();
+
+    for (size_t i = 0; i < shadowViews.size();)
+    {
+        LightDrawable* light = shadowViews[i]->light;
+        LightType lightType = light ? light->GetLightType() : LIGHT_DIRECTIONAL;
+
+        // Point light faces are updated together to avoid seams, directional light cascades separately
+        ShadowUpdateGroup group;
+        group.start = i;
+        group.end = i + 1;
+        group.numBatches = 0;
+        group.score = 0.0f;
+        if (lightType == LIGHT_POINT)
+        {
+            while (group.end < shadowViews.size() && shadowViews[group.end]->light == light)
+                ++group.end;
+        }
+        i = group.end;
+
+        // Check if view was discarded during shadowcaster collecting
+        if (!light)
+            continue;
+
+        bool needUpdate = false;
+        bool hasContent = false;
+        bool missingContent = false;
+        int pendingFrames = 0;
+
+        for (size_t j = group.start; j < group.end; ++j)
+        {
+            ShadowView& view = *shadowViews[j];
+
+            if (view.viewport == IntRect::ZERO)
+            {
+                view.pendingRenderMode = RENDER_STATIC_LIGHT_CACHED;
+                view.pendingFrames = 0;
+                continue;
+            }
+
+            // Include an update that was deferred on earlier frames, if the content it was deferred against is still there. A moved directional light cascade split invalidates the content, as the shader selects the cascades by the current split
+            bool valid = view.lastViewport == view.viewport && (lightType != LIGHT_DIRECTIONAL || (view.lastSplitMinZ == view.splitMinZ && view.lastSplitMaxZ == view.splitMaxZ));
+            if (valid)
+            {
+                hasContent = true;
+                view.renderMode = CombineShadowRenderModes(view.renderMode, view.pendingRenderMode);
+            }
+
+            if (view.renderMode != RENDER_STATIC_LIGHT_CACHED)
+            {
+                needUpdate = true;
+                if (!valid)
+                    missingContent = true;
+                group.numBatches += NumShadowBatches(shadowMap, view);
+                pendingFrames = Max(pendingFrames, view.pendingFrames);
+            }
+        }
+
+        if (!needUpdate)
+        {
+            CommitShadowViews(shadowMap, group);
+            continue;
+        }
+
+        // Views without content next to views with content, or a directional light without content, can not wait. Other lights without content stay unshadowed while waiting
+        if (missingContent && (hasContent || lightType == LIGHT_DIRECTIONAL))
+        {
+            usedBatches += group.numBatches;
+            CommitShadowViews(shadowMap, group);
+            continue;
+        }
+
+        // Rate-limit low priority lights and the directional light's later cascades
+        float priority = ShadowUpdatePriority(light);
+        int interval = 1;
+        if (lightType == LIGHT_DIRECTIONAL)
+        {
+            if (shadowViews[group.start] != &light->ShadowViews()[0])
+                interval = shadowCascadeInterval;
+        }
+        else if (priority < shadowPriorityThreshold)
+            interval = shadowLightInterval;
+
+        if (pendingFrames + 1 < interval)
+        {
+            DeferShadowViews(shadowMap, group);
+            continue;
+        }
+
+        // Deferred updates gain score each frame so that they can not be starved
+        group.score = priority * (float)(pendingFrames + 1);
+        groups.push_back(group);
+    }
+
+    // Render the remaining updates in score order until the budget is used. Render at least one to guarantee progress
+    std::sort(groups.begin(), groups.end(), CompareShadowUpdateGroups);
+
+    for (size_t i = 0; i < groups.size(); ++i)
+    {
+        const ShadowUpdateGroup& group = groups[i];
+
+        if (!maxShadowBatches || !i || usedBatches + group.numBatches <= maxShadowBatches)
+        {
+            usedBatches += group.numBatches;
+            CommitShadowViews(shadowMap, group);
+        }
+        else
+            DeferShadowViews(shadowMap, group);
+    }
+}
+
+void Renderer::CommitShadowViews(ShadowMap& shadowMap, const ShadowUpdateGroup& group)
+{
+    ShadowUpdateStatistics& stats = shadowMap.updateStats;
+
+    for (size_t i = group.start; i < group.end; ++i)
+    {
+        ShadowView& view = *shadowMap.shadowViews[i];
+
+        if (view.renderMode == RENDER_STATIC_LIGHT_CACHED)
+        {
+            // If no rendering to be done, use the last rendered shadow projection matrix to avoid artifacts when rotating camera
+            if (view.viewport != IntRect::ZERO)
+                view.shadowMatrix = view.lastShadowMatrix;
+            view.pendingFrames = 0;
+            continue;
+        }
+
+        ++stats.numUpdated;
+        stats.numBatches += NumShadowBatches(shadowMap, view);
+
+        view.lastViewport = view.viewport;
+        view.lastNumGeometries = view.numGeometries;
+        view.lastShadowMatrix = view.shadowMatrix;
+        view.lastSplitMinZ = view.splitMinZ;
+        view.lastSplitMaxZ = view.splitMaxZ;
+        view.pendingRenderMode = RENDER_STATIC_LIGHT_CACHED;
+        view.pendingFrames = 0;
+
+        // Clear static batch queue if not needed
+        if (HasStaticShadowQueue(view.light) && view.renderMode != RENDER_STATIC_LIGHT_STORE_STATIC)
+            shadowMap.shadowBatches[view.staticQueueIdx].Clear();
+    }
+}
+
+void Renderer::DeferShadowViews(ShadowMap& shadowMap, const ShadowUpdateGroup& group)
+{
+    ShadowUpdateStatistics& stats = shadowMap.updateStats;
+
+    for (size_t i = group.start; i < group.end; ++i)
+    {
+        ShadowView& view = *shadowMap.shadowViews[i];
+        if (view.viewport == IntRect::ZERO)
+            continue;
+
+        if (view.renderMode != RENDER_STATIC_LIGHT_CACHED)
+        {
+            ++stats.numDeferred;
+            ++view.pendingFrames;
+            view.pendingRenderMode = view.lastViewport == view.viewport ? view.renderMode : RENDER_STATIC_LIGHT_CACHED;
+            view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+
+            shadowMap.shadowBatches[view.dynamicQueueIdx].Clear();
+            if (HasStaticShadowQueue(view.light))
+                shadowMap.shadowBatches[view.staticQueueIdx].Clear();
+        }
+
+        // Keep showing the last rendered content
+        view.shadowMatrix = view.lastShadowMatrix;
+    }
+}
+
 void Renderer::SortShadowBatches(ShadowMap& shadowMap)
 {
     ZoneScoped;
 
+    FinishShadowViews(shadowMap);
+    ScheduleShadowViews(shadowMap);
+
     for (size_t i = 0; i < shadowMap.shadowViews.size(); ++i)
     {
         ShadowView& view = *shadowMap.shadowViews[i];
         LightDrawable* light = view.light;
 
-        // Check if view was discarded during shadowcaster collecting
-        if (!light)
+        // Check if view was discarded during shadowcaster collecting, or does not render this frame
+        if (!light || view.renderMode == RENDER_STATIC_LIGHT_CACHED)
             continue;
 
         BatchQueue* destStatic = (view.renderMode == RENDER_STATIC_LIGHT_STORE_STATIC) ? &shadowMap.shadowBatches[view.staticQueueIdx] : nullptr;
@@ -750,6 +1414,8 @@ void Renderer::SortShadowBatches(ShadowMap& shadowMap)
         if (destDynamic->HasBatches())
             destDynamic->Sort(shadowMap.instanceTransforms, SORT_STATE, hasInstancing);
     }
+
+    prepareViewStats.shadowBatchesSorted[&shadowMap - shadowMaps.Get()] = PrepareViewTime();
 }
 
 void Renderer::UpdateInstanceTransforms(const std::vector<Matrix3x4>& transforms)
@@ -769,9 +1435,52 @@ void Renderer::UpdateLightData()
 {
     ZoneScoped;
 
-    ImageLevel clusterLevel(IntVector3(NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), FMT_RG32U, clusterData);
-    clusterTexture->SetData(0, IntBox(0, 0, 0, NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), clusterLevel);
-    lightDataBuffer->SetData(0, (lights.size() + 1) * sizeof(LightData), lightData);
+    // Combine the Z-slices' light index lists, and store each cluster's offset and count into the combined list
+    lightGrid.Combine(clusterData, lightIndices);
+    numLightIndices = lightIndices.size();
+
+    IntVector3 gridSize = lightGrid.Size();
+    ImageLevel clusterLevel(gridSize, FMT_RG32U, &clusterData[0]);
+    clusterTexture->SetData(0, IntBox(0, 0, 0, gridSize.x, gridSize.y, gridSize.z), clusterLevel);
+
+    // Pad the index list and light data to whole texture rows, and grow the textures if necessary
+    size_t indicesPerRow = LIGHT_INDEX_TEXTURE_WIDTH * 2;
+    size_t indexRows = Max((lightIndices.size() + indicesPerRow - 1) / indicesPerRow, (size_t)1);
+    lightIndices.resize(indexRows * indicesPerRow);
+
+    if (lightIndexTexture->Height() < (int)indexRows)
+    {
+        lightIndexTexture->Define(TEX_2D, IntVector2((int)LIGHT_INDEX_TEXTURE_WIDTH, (int)NextPowerOfTwo((unsigned)indexRows)), FMT_R32U);
+        lightIndexTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    }
+
+    ImageLevel indexLevel(IntVector2((int)LIGHT_INDEX_TEXTURE_WIDTH, (int)indexRows), FMT_R32U, &lightIndices[0]);
+    lightIndexTexture->SetData(0, IntRect(0, 0, (int)LIGHT_INDEX_TEXTURE_WIDTH, (int)indexRows), indexLevel);
+
+    // Copy shadow matrices now that shadow update scheduling is done. Lights whose first shadow map update was deferred stay unshadowed
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        LightDrawable* light = lights[i];
+
+        if (light->ShadowMap() && HasShadowContent(light))
+        {
+            lightData[i].shadowParameters = light->ShadowParameters();
+            lightData[i].shadowMatrix = light->ShadowViews()[0].shadowMatrix;
+        }
+    }
+
+    size_t lightRows = Max((lightData.size() + LIGHT_DATA_LIGHTS_PER_ROW - 1) / LIGHT_DATA_LIGHTS_PER_ROW, (size_t)1);
+    size_t lightDataWidth = LIGHT_DATA_TEXELS * LIGHT_DATA_LIGHTS_PER_ROW;
+    lightData.resize(lightRows * LIGHT_DATA_LIGHTS_PER_ROW);
+
+    if (lightDataTexture->Height() < (int)lightRows)
+    {
+        lightDataTexture->Define(TEX_2D, IntVector2((int)lightDataWidth, (int)NextPowerOfTwo((unsigned)lightRows)), FMT_RGBA32F);
+        lightDataTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    }
+
+    ImageLevel lightDataLevel(IntVector2((int)lightDataWidth, (int)lightRows), FMT_RGBA32F, &lightData[0]);
+    lightDataTexture->SetData(0, IntRect(0, 0, (int)lightDataWidth, (int)lightRows), lightDataLevel);
 }
 
 void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
@@ -804,6 +1513,7 @@ void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
             float fogEnd = lightEnvironment ? lightEnvironment->FogEnd() : DEFAULT_FOG_END;
             float fogRange = Max(fogEnd - fogStart, M_EPSILON);
             perViewData.fogParameters = Vector4(fogEnd / farClip, farClip / fogRange, 0.0f, 0.0f);
+            perViewData.clusterParameters = lightGrid.ShaderParameters();
         }
 
         // Set directional light data if exists and is the main view
@@ -920,6 +1630,32 @@ void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
     }
 }
 
+void* Renderer::AllocateSkinData(size_t numBytes, size_t& offset)
+{
+    size_t alignment = graphics->UniformBufferAlignment();
+    size_t alignedBytes = (numBytes + alignment - 1) / alignment * alignment;
+
+    offset = skinMatrixBytes.fetch_add(alignedBytes);
+    if (offset + alignedBytes > skinMatrixSliceSize)
+        return nullptr;
+
+    return skinMatrixData.Get() + offset;
+}
+
+void Renderer::BindSkinData(size_t offset, size_t numBytes)
+{
+    size_t sliceOffset = skinMatrixSlice * skinMatrixSliceSize;
+
+    // Upload all models' matrices at once
+    if (!skinMatricesUploaded)
+    {
+        skinMatrixBuffer->SetData(sliceOffset, Min(skinMatrixBytes.load(), skinMatrixSliceSize), skinMatrixData.Get());
+        skinMatricesUploaded = true;
+    }
+
+    skinMatrixBuffer->BindRange(UB_OBJECTDATA, sliceOffset + offset, numBytes);
+}
+
 void Renderer::CheckOcclusionQueries()
 {
     static std::vector<OcclusionQueryResult> results;
@@ -1081,59 +1817,6 @@ void Renderer::DefineBoundingBoxGeometry()
     boundingBoxShaderProgram = graphics->CreateProgram("Shaders/BoundingBox.glsl");
 }
 
-void Renderer::DefineClusterFrustums()
-{
-    Matrix4 cameraProj = camera->ProjectionMatrix(false);
-    if (lastClusterFrustumProj != cameraProj)
-        clusterFrustumsDirty = true;
-
-    if (clusterFrustumsDirty)
-    {
-        ZoneScoped;
-
-        Matrix4 cameraProjInverse = cameraProj.Inverse();
-        float cameraNearClip = camera->NearClip();
-        float cameraFarClip = camera->FarClip();
-        size_t idx = 0;
-
-        float xStep = 2.0f / NUM_CLUSTER_X;
-        float yStep = 2.0f / NUM_CLUSTER_Y;
-        float zStep = 1.0f / NUM_CLUSTER_Z;
-
-        for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
-        {
-            Vector4 nearVec = cameraProj * Vector4(0.0f, 0.0f, z > 0 ? powf(z * zStep, 2.0f) * cameraFarClip : cameraNearClip, 1.0f);
-            Vector4 farVec = cameraProj * Vector4(0.0f, 0.0f, powf((z + 1) * zStep, 2.0f) * cameraFarClip, 1.0f);
-            float near = nearVec.z / nearVec.w;
-            float far = farVec.z / farVec.w;
-
-            for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
-            {
-                for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
-                {
-                    Frustum& clusterFrustum = clusterCullData[idx].frustum;
-                    BoundingBox& clusterBox = clusterCullData[idx].boundingBox;
-
-                    clusterFrustum.vertices[0] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * y, near);
-                    clusterFrustum.vertices[1] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * (y + 1), near);
-                    clusterFrustum.vertices[2] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * (y + 1), near);
-                    clusterFrustum.vertices[3] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * y, near);
-                    clusterFrustum.vertices[4] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * y, far);
-                    clusterFrustum.vertices[5] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * (y + 1), far);
-                    clusterFrustum.vertices[6] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * (y + 1), far);
-                    clusterFrustum.vertices[7] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * y, far);
-                    clusterFrustum.UpdatePlanes();
-                    clusterBox.Define(clusterFrustum);
-                    ++idx;
-                }
-            }
-        }
-
-        lastClusterFrustumProj = cameraProj;
-        clusterFrustumsDirty = false;
-    }
-}
-
 void Renderer::CollectOctantsWork(Task* task_, unsigned)
 {
     ZoneScoped;
@@ -1166,6 +1849,8 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
 {
     ZoneScoped;
 
+    prepareViewStats.octantsCollected = PrepareViewTime();
+
     // Merge the light collection results
     for (size_t i = 0; i < rootLevelOctants.size(); ++i)
         lights.insert(lights.end(), octantResults[i].lights.begin(), octantResults[i].lights.end());
@@ -1184,22 +1869,56 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
             ++it;
     }
 
-    // Sort localized lights by increasing distance
-    std::sort(lights.begin(), lights.end(), CompareDrawableDistances);
+    // Sort localized lights by decreasing importance and drop the unimportant ones
+    sortedLights.clear();
+    for (auto it = lights.begin(); it != lights.end(); ++it)
+    {
+        float importance = CalculateLightImportance(*it);
+        if (importance >= lightImportance.minImportance)
+            sortedLights.push_back(std::make_pair(importance, *it));
+    }
+
+    std::sort(sortedLights.begin(), sortedLights.end(), CompareLightImportances);
 
     // Clamp to maximum supported
-    if (lights.size() > MAX_LIGHTS)
-        lights.resize(MAX_LIGHTS);
+    size_t maxLights = lightImportance.maxLights ? Min(lightImportance.maxLights, MAX_LIGHTS) : MAX_LIGHTS;
+    if (sortedLights.size() > maxLights)
+        sortedLights.resize(maxLights);
 
-    // Pre-step for shadow map caching: reallocate all lights' shadow map rectangles which are non-zero at this point.
-    // If shadow maps were dirtied (size or bias change) reset all allocations instead
-    for (auto it = lights.begin(); it != lights.end(); ++it)
+    // Choose the shadowed lights in importance order, and their shadow map sizes
+    size_t numShadowRequests = 0;
+    lights.resize(sortedLights.size());
+    lightImportances.resize(sortedLights.size());
+    lightShadowSizes.resize(sortedLights.size());
+
+    for (size_t i = 0; i < sortedLights.size(); ++i)
     {
-        LightDrawable* light = *it;
+        LightDrawable* light = sortedLights[i].second;
+        float importance = sortedLights[i].first;
+
+        lights[i] = light;
+        lightImportances[i] = importance;
+        lightShadowSizes[i] = IntVector2::ZERO;
+
+        if (drawShadows && light->ShadowStrength() < 1.0f && importance >= lightImportance.shadowImportance &&
+            (!lightImportance.maxShadowedLights || numShadowRequests < lightImportance.maxShadowedLights))
+        {
+            lightShadowSizes[i] = light->TotalShadowMapSize();
+            if (importance < lightImportance.fullShadowImportance)
+                lightShadowSizes[i] /= 2;
+            ++numShadowRequests;
+        }
+    }
+
+    // Pre-step for shadow map caching: request again the atlas rectangles of lights which had one, so that they are kept before new lights are allocated.
+    // If shadow maps were dirtied (size or bias change) reset all shadow views instead
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        LightDrawable* light = lights[i];
         if (shadowMapsDirty)
             light->SetShadowMap(nullptr);
-        else if (drawShadows && light->ShadowStrength() < 1.0f && light->ShadowRect() != IntRect::ZERO)
-            AllocateShadowMap(light);
+        else if (lightShadowSizes[i] != IntVector2::ZERO && light->ShadowRect() != IntRect::ZERO)
+            AllocateShadowMap(light, lightShadowSizes[i], lightImportances[i]);
     }
 
     // Check if directional light needs shadows
@@ -1208,13 +1927,14 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         if (shadowMapsDirty)
             dirLight->SetShadowMap(nullptr);
 
-        if (!drawShadows || dirLight->ShadowStrength() >= 1.0f || !AllocateShadowMap(dirLight))
+        if (!drawShadows || dirLight->ShadowStrength() >= 1.0f || !AllocateShadowMap(dirLight, dirLight->TotalShadowMapSize(), 1.0f))
             dirLight->SetShadowMap(nullptr);
     }
     
     shadowMapsDirty = false;
 
     size_t lightTaskIdx = 0;
+    lightData.resize(lights.size());
 
     // Go through lights and setup shadowcaster collection tasks
     for (size_t i = 0; i < lights.size(); ++i)
@@ -1222,15 +1942,22 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         LightDrawable* light = lights[i];
         float cutoff = light->GetLightType() == LIGHT_SPOT ? cosf(light->Fov() * 0.5f * M_DEGTORAD) : 0.0f;
 
-        // Light indexing starts at 1 as 0 is "no light"
-        lightData[i + 1].position = Vector4(light->WorldPosition(), 1.0f);
-        lightData[i + 1].direction = Vector4(-light->WorldDirection(), 0.0f);
-        lightData[i + 1].attenuation = Vector4(1.0f / Max(light->Range(), M_EPSILON), cutoff, 1.0f / (1.0f - cutoff), 1.0f);
-        lightData[i + 1].color = light->EffectiveColor();
-        lightData[i + 1].shadowParameters = Vector4::ONE; // Assume unshadowed
+        lightData[i].position = Vector4(light->WorldPosition(), 1.0f);
+        lightData[i].direction = Vector4(-light->WorldDirection(), 0.0f);
+        lightData[i].attenuation = Vector4(1.0f / Max(light->Range(), M_EPSILON), cutoff, 1.0f / (1.0f - cutoff), 1.0f);
+        lightData[i].color = light->EffectiveColor();
+        lightData[i].shadowParameters = Vector4::ONE; // Assume unshadowed
 
-        // Check if not shadowcasting or beyond shadow range
-        if (!drawShadows || light->ShadowStrength() >= 1.0f)
+        // Fade out lights approaching the minimum importance
+        float importance = lightImportances[i];
+        if (importance < lightImportance.fadeImportance)
+        {
+            float fadeRange = lightImportance.fadeImportance - lightImportance.minImportance;
+            lightData[i].color = lightData[i].color * Clamp((importance - lightImportance.minImportance) / Max(fadeRange, M_EPSILON), 0.0f, 1.0f);
+        }
+
+        // Check if not shadowcasting, beyond shadow range or not important enough
+        if (lightShadowSizes[i] == IntVector2::ZERO)
         {
             light->SetShadowMap(nullptr);
             continue;
@@ -1239,25 +1966,25 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         // Now retry shadow map allocation if necessary. If it's a new allocation, must rerender the shadow map
         if (!light->ShadowMap())
         {
-            if (!AllocateShadowMap(light))
+            if (!AllocateShadowMap(light, lightShadowSizes[i], importance))
                 continue;
         }
 
+        ++numShadowedLights;
+
         light->InitShadowViews();
         std::vector<ShadowView>& shadowViews = light->ShadowViews();
 
-        // Preallocate shadowcaster list
+        // Preallocate shadowcaster lists. Point lights need also a list per cube face, into which the query result is culled
         ShadowMap& shadowMap = shadowMaps[1];
         size_t casterListIdx = shadowMap.freeCasterListIdx++;
-        if (shadowMap.shadowCasters.size() < shadowMap.freeCasterListIdx)
-            shadowMap.shadowCasters.resize(shadowMap.freeCasterListIdx);
 
         for (size_t j = 0; j < shadowViews.size(); ++j)
         {
             ShadowView& view = shadowViews[j];
+            view.casterListIdx = light->GetLightType() == LIGHT_POINT ? shadowMap.freeCasterListIdx++ : casterListIdx;
 
             // Preallocate shadow batch queues
-            view.casterListIdx = casterListIdx;
 
             if (light->IsStatic())
             {
@@ -1273,10 +2000,14 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
             shadowMap.shadowViews.push_back(&view);
         }
 
+        if (shadowMap.shadowCasters.size() < shadowMap.freeCasterListIdx)
+            shadowMap.shadowCasters.resize(shadowMap.freeCasterListIdx);
+
         if (collectShadowCastersTasks.size() <= lightTaskIdx)
             collectShadowCastersTasks.push_back(new CollectShadowCastersTask(this, &Renderer::CollectShadowCastersWork));
 
         collectShadowCastersTasks[lightTaskIdx]->light = light;
+        collectShadowCastersTasks[lightTaskIdx]->casterListIdx = casterListIdx;
         workQueue->AddDependency(processShadowCastersTask, collectShadowCastersTasks[lightTaskIdx]);
         ++lightTaskIdx;
     }
@@ -1306,6 +2037,8 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         }
     }
 
+    prepareViewStats.lightsProcessed = PrepareViewTime();
+
     // Now queue all shadowcaster collection tasks
     if (lightTaskIdx > 0)
         workQueue->QueueTasks(lightTaskIdx, reinterpret_cast<Task**>(&collectShadowCastersTasks[0]));
@@ -1348,6 +2081,18 @@ void Renderer::CollectBatchesWork(Task* task_, unsigned threadIndex)
                 if ((!planeMask || frustum.IsInsideMaskedFast(geometryBox, planeMask)) && drawable->OnPrepareRender(frameNumber, camera))
                 {
                     result.geometryBounds.Merge(geometryBox);
+                    if (drawable->TestFlag(DF_HAS_LOD_LEVELS))
+                        ++result.lodLevels[Min((size_t)drawable->LodLevel(), NUM_LOD_STATS_LEVELS - 1)];
+                    if ((drawable->Flags() & DF_GEOMETRY_TYPE_BITS) == DF_SKINNED_GEOMETRY)
+                    {
+                        AnimatedModelDrawable* modelDrawable = static_cast<AnimatedModelDrawable*>(drawable);
+                        size_t level = 0;
+                        for (unsigned interval = modelDrawable->AnimationUpdateInterval(); interval > 1 && level < NUM_ANIMATION_LOD_STATS_LEVELS - 1; interval >>= 1)
+                            ++level;
+                        ++result.animationLodLevels[level];
+                        if (modelDrawable->LastAnimationFrameNumber() == frameNumber)
+                            ++result.numAnimationUpdates;
+                    }
 
                     Vector3 center = geometryBox.Center();
                     Vector3 edge = geometryBox.Size() * 0.5f;
@@ -1371,6 +2116,8 @@ void Renderer::CollectBatchesWork(Task* task_, unsigned threadIndex)
                         newBatch.pass = material->GetPass(PASS_OPAQUE);
                         newBatch.geometry = batches.GetGeometry(j);
                         newBatch.programBits = (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
+                        if (drawable->TestFlag(DF_DUAL_QUATERNION_SKINNING))
+                            newBatch.programBits |= SP_DUALQUATERNION;
                         newBatch.geomIndex = (unsigned char)j;
 
                         if (!newBatch.programBits)
@@ -1393,6 +2140,7 @@ void Renderer::CollectBatchesWork(Task* task_, unsigned threadIndex)
                             }
 
                             opaqueQueue.push_back(newBatch);
+                            result.numTriangles += newBatch.geometry->drawCount / 3;
                         }
                         else
                         {
@@ -1403,6 +2151,7 @@ void Renderer::CollectBatchesWork(Task* task_, unsigned threadIndex)
 
                             newBatch.distance = drawable->Distance();
                             alphaQueue.push_back(newBatch);
+                            result.numTriangles += newBatch.geometry->drawCount / 3;
                         }
                     }
                 }
@@ -1427,6 +2176,9 @@ void Renderer::CollectShadowCastersWork(Task* task, unsigned)
     if (lightType == LIGHT_POINT)
     {
         // Point light: perform only one sphere query, then check which of the point light sides are visible
+        size_t faceViews[MAX_CUBE_FACES];
+        unsigned visibleFaces = 0;
+
         for (size_t i = 0; i < shadowViews.size(); ++i)
         {
             // Check if each of the sides is in view. Do not process if isn't. Rendering will be no-op this frame, but cached contents are discarded once comes into view again
@@ -1439,10 +2191,45 @@ void Renderer::CollectShadowCastersWork(Task* task, unsigned)
                 view.viewport = IntRect::ZERO;
                 view.lastViewport = IntRect::ZERO;
             }
+            else
+            {
+                size_t face = CubeFaceIndex(view.shadowCamera->WorldDirection());
+                faceViews[face] = i;
+                visibleFaces |= 1 << face;
+            }
         }
 
-        std::vector<Drawable*>& shadowCasters = shadowMap.shadowCasters[shadowViews[0].casterListIdx];
-        octree->FindDrawables(shadowCasters, light->WorldSphere(), DF_GEOMETRY | DF_CAST_SHADOWS);
+        // Reuse the previous query result of a static light if nothing changed within its range
+        std::vector<Drawable*>& shadowCasters = shadowMap.shadowCasters[static_cast<CollectShadowCastersTask*>(task)->casterListIdx];
+        Sphere lightSphere = light->WorldSphere();
+        if (!GetCachedShadowCasters(light, octree, lightSphere, shadowCasters))
+        {
+            octree->FindDrawables(shadowCasters, lightSphere, DF_GEOMETRY | DF_CAST_SHADOWS);
+            StoreCachedShadowCasters(light, octree, shadowCasters);
+        }
+
+        if (!visibleFaces)
+            return;
+
+        // Cull the shadowcasters to the visible faces, so that each face only builds batches of its own casters. The face frustum is slightly wider than 90 degrees to cover the filtering border
+        const Vector3& lightPosition = light->WorldPosition();
+        float faceTan = 1.0f / shadowViews[0].shadowCamera->Zoom();
+
+        for (auto it = shadowCasters.begin(); it != shadowCasters.end(); ++it)
+        {
+            Drawable* drawable = *it;
+            unsigned faceMask = PointLightFaceMask(drawable->WorldBoundingBox(), lightPosition, faceTan) & visibleFaces;
+
+            // The face lists are split into tasks that may run concurrently, so prepare an out-of-view caster that spans several faces here once, instead of in each face's task
+            if ((faceMask & (faceMask - 1)) && !drawable->InView(frameNumber) && !drawable->OnPrepareRender(frameNumber, camera))
+                continue;
+
+            for (size_t i = 0; faceMask; ++i, faceMask >>= 1)
+            {
+                if (faceMask & 1)
+                    shadowMap.shadowCasters[shadowViews[faceViews[i]].casterListIdx].push_back(drawable);
+            }
+        }
     }
     else if (lightType == LIGHT_SPOT)
     {
@@ -1451,7 +2238,11 @@ void Renderer::CollectShadowCastersWork(Task* task, unsigned)
         ShadowView& view = shadowViews[0];
 
         std::vector<Drawable*>& shadowCasters = shadowMap.shadowCasters[view.casterListIdx];
-        octree->FindDrawablesMasked(shadowCasters, view.shadowFrustum, DF_GEOMETRY | DF_CAST_SHADOWS);
+        if (!GetCachedShadowCasters(light, octree, view.shadowFrustum, shadowCasters))
+        {
+            octree->FindDrawablesMasked(shadowCasters, view.shadowFrustum, DF_GEOMETRY | DF_CAST_SHADOWS);
+            StoreCachedShadowCasters(light, octree, shadowCasters);
+        }
     }
 }
 
@@ -1463,60 +2254,115 @@ void Renderer::ProcessShadowCastersWork(Task*, unsigned)
 {
     ZoneScoped;
 
-    // Queue shadow batch collection tasks. These will also perform shadow batch sorting tasks when done
+    // Queue shadow batch collection tasks. Large views are split into several tasks. These will also perform shadow batch sorting tasks when done
     if (drawShadows)
     {
-        size_t shadowTaskIdx = 0;
-        LightDrawable* lastLight = nullptr;
-
-        for (size_t i = 0; i < NUM_SHADOW_MAPS; ++i)
+        // Queue the atlas first, so that its tasks can run while the directional light is queried for shadowcasters
+        for (size_t i = NUM_SHADOW_MAPS; i-- > 0;)
         {
+            // Fit the directional light cascades to the visible depth range before setting up its views
+            if (i == 0 && dirLight && shadowMaps[i].shadowViews.size())
+                dirLight->FitShadowCascades(camera, minZ, maxZ);
+
             ShadowMap& shadowMap = shadowMaps[i];
+            std::vector<AutoPtr<CollectShadowBatchesTask> >& tasks = collectShadowBatchesTasks[i];
+            size_t shadowTaskIdx = 0;
+
             for (size_t j = 0; j < shadowMap.shadowViews.size(); ++j)
             {
-                LightDrawable* light = shadowMap.shadowViews[j]->light;
-                // For a point light, make only one task that will handle all of the views and skip rest
-                if (light->GetLightType() == LIGHT_POINT && light == lastLight)
+                ShadowView& view = *shadowMap.shadowViews[j];
+                LightDrawable* light = view.light;
+
+                view.batchTaskIdx = shadowTaskIdx;
+                view.numBatchTasks = 0;
+
+                // Focus directional light shadow camera to the visible geometry combined bounds, and query for shadowcasters late
+                if (light->GetLightType() == LIGHT_DIRECTIONAL)
+                {
+                    if (!light->SetupShadowView(j, camera, &geometryBounds))
+                        view.viewport = IntRect::ZERO;
+                    else
+                    {
+                        float splitMinZ = Max(minZ, view.splitMinZ);
+                        float splitMaxZ = Min(maxZ, view.splitMaxZ);
+
+                        // Before querying (which is potentially expensive), check for degenerate depth range or frustum outside split
+                        if (splitMinZ >= splitMaxZ || splitMinZ > view.splitMaxZ || splitMaxZ < view.splitMinZ)
+                            view.viewport = IntRect::ZERO;
+                        else
+                            octree->FindDrawablesMasked(shadowMap.shadowCasters[view.casterListIdx], view.shadowFrustum, DF_GEOMETRY | DF_CAST_SHADOWS);
+                    }
+                }
+
+                // Skip view? (no geometry, out of range or point light face not in view)
+                if (view.viewport == IntRect::ZERO)
                     continue;
 
-                lastLight = light;
+                size_t numShadowCasters = shadowMap.shadowCasters[view.casterListIdx].size();
+                for (size_t start = 0; start < numShadowCasters; start += SHADOWCASTERS_PER_BATCH_TASK)
+                {
+                    if (tasks.size() <= shadowTaskIdx)
+                        tasks.push_back(new CollectShadowBatchesTask(this, &Renderer::CollectShadowBatchesWork));
+
+                    CollectShadowBatchesTask* task = tasks[shadowTaskIdx];
+                    task->shadowMapIdx = i;
+                    task->viewIdx = j;
+                    task->start = start;
+                    task->end = Min(start + SHADOWCASTERS_PER_BATCH_TASK, numShadowCasters);
+                    ++view.numBatchTasks;
+                    ++shadowTaskIdx;
+                }
+            }
 
-                if (collectShadowBatchesTasks.size() <= shadowTaskIdx)
-                    collectShadowBatchesTasks.push_back(new CollectShadowBatchesTask(this, &Renderer::CollectShadowBatchesWork));
-                collectShadowBatchesTasks[shadowTaskIdx]->shadowMapIdx = i;
-                collectShadowBatchesTasks[shadowTaskIdx]->viewIdx = j;
-                numPendingShadowViews[i].fetch_add(1);
-                ++shadowTaskIdx;
+            if (shadowTaskIdx > 0)
+            {
+                numPendingShadowViews[i].fetch_add((int)shadowTaskIdx);
+                workQueue->QueueTasks(shadowTaskIdx, reinterpret_cast<Task**>(&tasks[0]));
             }
+            else if (shadowMap.shadowViews.size())
+                SortShadowBatches(shadowMap);
         }
-
-        if (shadowTaskIdx > 0)
-            workQueue->QueueTasks(shadowTaskIdx, reinterpret_cast<Task**>(&collectShadowBatchesTasks[0]));
     }
 
-    // Clear per-cluster light data from previous frame, update cluster frustums and bounding boxes if camera changed, then queue light culling tasks for the needed scene range
-    DefineClusterFrustums();
-    memset(clusterData, 0, MAX_LIGHTS_CLUSTER * NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z);
-    for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
-    {
-        size_t idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
-        const Frustum& clusterFrustum = clusterCullData[idx].frustum;
-        if (minZ > clusterFrustum.vertices[4].z || maxZ < clusterFrustum.vertices[0].z)
-            continue;
-        workQueue->QueueTask(cullLightsTasks[z]);
-    }
+    // Update cluster frustums and bounding boxes if camera or the fitted depth range changed, then calculate the lights' view space bounds and cluster ranges once for all Z-slices
+    lightGrid.Define(camera->ProjectionMatrix(false), camera->NearClip(), camera->FarClip(), minZ, maxZ);
+
+    const Matrix3x4& cameraView = camera->ViewMatrix();
+    lightBounds.clear();
 
-    // Finally copy correct shadow matrices for the localized light data
-    // Note: directional light shadow matrices may still be pending, but they are not included here
     for (size_t i = 0; i < lights.size(); ++i)
     {
         LightDrawable* light = lights[i];
 
-        if (light->ShadowMap())
+        lightBounds.resize(lightBounds.size() + 1);
+        LightCullBounds& dest = lightBounds.back();
+        dest.index = (unsigned short)i;
+
+        if (light->GetLightType() == LIGHT_POINT)
         {
-            lightData[i + 1].shadowParameters = light->ShadowParameters();
-            lightData[i + 1].shadowMatrix = light->ShadowViews()[0].shadowMatrix;
+            dest.point = true;
+            dest.sphere = Sphere(cameraView * light->WorldPosition(), light->Range());
+            dest.box.Define(dest.sphere);
         }
+        else
+        {
+            dest.point = false;
+            dest.frustum = light->WorldFrustum().Transformed(cameraView);
+            dest.box.Define(dest.frustum);
+        }
+
+        if (!lightGrid.CalculateClusterRange(dest))
+            lightBounds.pop_back();
+    }
+
+    // Queue light culling tasks for the needed scene range, and clear the rest of the Z-slices
+    IntVector3 gridSize = lightGrid.Size();
+    for (size_t z = 0; z < (size_t)gridSize.z; ++z)
+    {
+        if (minZ > lightGrid.SliceFarZ(z) || maxZ < lightGrid.SliceNearZ(z))
+            lightGrid.ClearSlice(z);
+        else
+            workQueue->QueueTask(cullLightsTasks[z]);
     }
 }
 
@@ -1526,292 +2372,134 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
 
     CollectShadowBatchesTask* task = static_cast<CollectShadowBatchesTask*>(task_);
     ShadowMap& shadowMap = shadowMaps[task->shadowMapIdx];
-    size_t viewIdx = task->viewIdx;
-
-    for (;;)
-    {
-        ShadowView& view = *shadowMap.shadowViews[viewIdx];
-
-        LightDrawable* light = view.light;
-        LightType lightType = light->GetLightType();
+    ShadowView& view = *shadowMap.shadowViews[task->viewIdx];
 
-        float splitMinZ = minZ, splitMaxZ = maxZ;
+    LightDrawable* light = view.light;
+    LightType lightType = light->GetLightType();
 
-        // Focus directional light shadow camera to the visible geometry combined bounds, and query for shadowcasters late
-        if (lightType == LIGHT_DIRECTIONAL)
-        {
-            if (!light->SetupShadowView(viewIdx, camera, &geometryBounds))
-                view.viewport = IntRect::ZERO;
-            else
-            {
-                splitMinZ = Max(splitMinZ, view.splitMinZ);
-                splitMaxZ = Min(splitMaxZ, view.splitMaxZ);
+    float splitMinZ = minZ, splitMaxZ = maxZ;
+    if (lightType == LIGHT_DIRECTIONAL)
+    {
+        splitMinZ = Max(splitMinZ, view.splitMinZ);
+        splitMaxZ = Min(splitMaxZ, view.splitMaxZ);
+    }
 
-                // Before querying (which is potentially expensive), check for degenerate depth range or frustum outside split
-                if (splitMinZ >= splitMaxZ || splitMinZ > view.splitMaxZ || splitMaxZ < view.splitMinZ)
-                    view.viewport = IntRect::ZERO;
-                else
-                    octree->FindDrawablesMasked(shadowMap.shadowCasters[view.casterListIdx], view.shadowFrustum, DF_GEOMETRY | DF_CAST_SHADOWS);
-            }
-        }
+    const Matrix3x4& lightView = view.shadowCamera->ViewMatrix();
+    const std::vector<Drawable*>& initialShadowCasters = shadowMap.shadowCasters[view.casterListIdx];
 
-        // Skip view? (no geometry, out of range or point light face not in view)
-        if (view.viewport == IntRect::ZERO)
-        {
-            view.renderMode = RENDER_STATIC_LIGHT_CACHED;
-            view.lastViewport = IntRect::ZERO;
-        }
-        else
-        {
-            const Frustum& shadowFrustum = view.shadowFrustum;
-            const Matrix3x4& lightView = view.shadowCamera->ViewMatrix();
-            const std::vector<Drawable*>& initialShadowCasters = shadowMap.shadowCasters[view.casterListIdx];
+    bool dynamicOrDirLight = !HasStaticShadowQueue(light);
+    task->staticBatches.clear();
+    task->dynamicBatches.clear();
+    task->numShadowCasters = 0;
+    task->numStaticShadowCasters = 0;
+    task->staticCastersMoved = false;
+    task->dynamicCastersMoved = false;
 
-            bool dynamicOrDirLight = lightType == LIGHT_DIRECTIONAL || !light->IsStatic();
-            bool dynamicCastersMoved = false;
-            bool staticCastersMoved = false;
+    Frustum lightViewFrustum = camera->WorldSplitFrustum(splitMinZ, splitMaxZ).Transformed(lightView);
+    BoundingBox lightViewFrustumBox(lightViewFrustum);
 
-            size_t totalShadowCasters = 0;
-            size_t staticShadowCasters = 0;
+    for (size_t i = task->start; i < task->end; ++i)
+    {
+        Drawable* drawable = initialShadowCasters[i];
+        const BoundingBox& geometryBox = drawable->WorldBoundingBox();
 
-            Frustum lightViewFrustum = camera->WorldSplitFrustum(splitMinZ, splitMaxZ).Transformed(lightView);
-            BoundingBox lightViewFrustumBox(lightViewFrustum);
+        bool inView = drawable->InView(frameNumber);
+        bool staticNode = drawable->IsStatic();
 
-            BatchQueue* destStatic = !dynamicOrDirLight ? &shadowMap.shadowBatches[view.staticQueueIdx] : nullptr;
-            BatchQueue* destDynamic = &shadowMap.shadowBatches[view.dynamicQueueIdx];
+        // Check by bounding box extrusion if out-of-view or directional light shadowcaster actually contributes to visible geometry shadowing or if it can be skipped
+        // This is done only for dynamic objects or dynamic lights' shadows; cached static shadowmap needs to render everything
+        if ((!staticNode || dynamicOrDirLight) && !inView)
+        {
+            BoundingBox lightViewBox = geometryBox.Transformed(lightView);
 
-            for (auto it = initialShadowCasters.begin(); it != initialShadowCasters.end(); ++it)
+            if (lightType == LIGHT_DIRECTIONAL)
             {
-                Drawable* drawable = *it;
-                const BoundingBox& geometryBox = drawable->WorldBoundingBox();
-
-                bool inView = drawable->InView(frameNumber);
-                bool staticNode = drawable->IsStatic();
-
-                // Check shadowcaster frustum visibility for point lights; may be visible in view, but not in each cube map face
-                if (lightType == LIGHT_POINT && !shadowFrustum.IsInsideFast(geometryBox))
+                lightViewBox.max.z = Max(lightViewBox.max.z, lightViewFrustumBox.max.z);
+                if (!lightViewFrustum.IsInsideFast(lightViewBox))
                     continue;
+            }
+            else
+            {
+                // For perspective lights, extrusion direction depends on the position of the shadow caster
+                Vector3 center = lightViewBox.Center();
+                Ray extrusionRay(center, center);
 
-                // Furthermore, check by bounding box extrusion if out-of-view or directional light shadowcaster actually contributes to visible geometry shadowing or if it can be skipped
-                // This is done only for dynamic objects or dynamic lights' shadows; cached static shadowmap needs to render everything
-                if ((!staticNode || dynamicOrDirLight) && !inView)
-                {
-                    BoundingBox lightViewBox = geometryBox.Transformed(lightView);
-
-                    if (lightType == LIGHT_DIRECTIONAL)
-                    {
-                        lightViewBox.max.z = Max(lightViewBox.max.z, lightViewFrustumBox.max.z);
-                        if (!lightViewFrustum.IsInsideFast(lightViewBox))
-                            continue;
-                    }
-                    else
-                    {
-                        // For perspective lights, extrusion direction depends on the position of the shadow caster
-                        Vector3 center = lightViewBox.Center();
-                        Ray extrusionRay(center, center);
-
-                        float extrusionDistance = view.shadowCamera->FarClip();
-                        float originalDistance = Clamp(center.Length(), M_EPSILON, extrusionDistance);
-
-                        // Because of the perspective, the bounding box must also grow when it is extruded to the distance
-                        float sizeFactor = extrusionDistance / originalDistance;
-
-                        // Calculate the endpoint box and merge it to the original. Because it's axis-aligned, it will be larger
-                        // than necessary, so the test will be conservative
-                        Vector3 newCenter = extrusionDistance * extrusionRay.direction;
-                        Vector3 newHalfSize = lightViewBox.Size() * sizeFactor * 0.5f;
-                        BoundingBox extrudedBox(newCenter - newHalfSize, newCenter + newHalfSize);
-                        lightViewBox.Merge(extrudedBox);
-
-                        if (!lightViewFrustum.IsInsideFast(lightViewBox))
-                            continue;
-                    }
-                }
-
-                // If not in view, let the node prepare itself for render now
-                if (!inView)
-                {
-                    if (!drawable->OnPrepareRender(frameNumber, camera))
-                        continue;
-                }
+                float extrusionDistance = view.shadowCamera->FarClip();
+                float originalDistance = Clamp(center.Length(), M_EPSILON, extrusionDistance);
 
-                ++totalShadowCasters;
+                // Because of the perspective, the bounding box must also grow when it is extruded to the distance
+                float sizeFactor = extrusionDistance / originalDistance;
 
-                if (staticNode)
-                {
-                    ++staticShadowCasters;
-                    if (drawable->LastUpdateFrameNumber() == frameNumber)
-                        staticCastersMoved = true;
-                }
-                else
-                {
-                    if (drawable->LastUpdateFrameNumber() == frameNumber)
-                        dynamicCastersMoved = true;
-                }
+                // Calculate the endpoint box and merge it to the original. Because it's axis-aligned, it will be larger
+                // than necessary, so the test will be conservative
+                Vector3 newCenter = extrusionDistance * extrusionRay.direction;
+                Vector3 newHalfSize = lightViewBox.Size() * sizeFactor * 0.5f;
+                BoundingBox extrudedBox(newCenter - newHalfSize, newCenter + newHalfSize);
+                lightViewBox.Merge(extrudedBox);
 
-                // If did not allocate a static queue, just put everything to dynamic
-                BatchQueue& dest = destStatic ? (staticNode ? *destStatic : *destDynamic) : *destDynamic;
-                const SourceBatches& batches = static_cast<GeometryDrawable*>(drawable)->Batches();
-                size_t numGeometries = batches.NumGeometries();
+                if (!lightViewFrustum.IsInsideFast(lightViewBox))
+                    continue;
+            }
+        }
 
-                Batch newBatch;
+        // If not in view, let the node prepare itself for render now
+        if (!inView)
+        {
+            if (!drawable->OnPrepareRender(frameNumber, camera))
+                continue;
+        }
 
-                for (size_t j = 0; j < numGeometries; ++j)
-                {
-                    Material* material = batches.GetMaterial(j);
-                    newBatch.pass = material->GetPass(PASS_SHADOW);
-                    if (!newBatch.pass)
-                        continue;
+        ++task->numShadowCasters;
 
-                    newBatch.geometry = batches.GetGeometry(j);
-                    newBatch.programBits = (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
-                    newBatch.geomIndex = (unsigned char)j;
+        if (staticNode)
+        {
+            ++task->numStaticShadowCasters;
+            if (drawable->LastUpdateFrameNumber() == frameNumber)
+                task->staticCastersMoved = true;
+        }
+        else
+        {
+            if (drawable->LastUpdateFrameNumber() == frameNumber)
+                task->dynamicCastersMoved = true;
+        }
 
-                    if (!newBatch.programBits)
-                        newBatch.worldTransform = &drawable->WorldTransform();
-                    else
-                        newBatch.drawable = static_cast<GeometryDrawable*>(drawable);
+        // If the view has no static queue, just put everything to dynamic
+        std::vector<Batch>& dest = (staticNode && !dynamicOrDirLight) ? task->staticBatches : task->dynamicBatches;
+        const SourceBatches& batches = static_cast<GeometryDrawable*>(drawable)->Batches();
+        size_t numGeometries = batches.NumGeometries();
 
-                    dest.batches.push_back(newBatch);
-                }
-            }
+        Batch newBatch;
 
-            // Now determine which kind of caching can be used for the shadow map
-            // Dynamic or directional lights
-            if (dynamicOrDirLight)
-            {
-                // If light atlas allocation changed, light moved, or amount of objects in view changed, render an optimized shadow map
-                if (view.lastViewport != view.viewport || !view.lastShadowMatrix.Equals(view.shadowMatrix, 0.0001f) || view.lastNumGeometries != totalShadowCasters || dynamicCastersMoved || staticCastersMoved)
-                    view.renderMode = RENDER_DYNAMIC_LIGHT;
-                else
-                    view.renderMode = RENDER_STATIC_LIGHT_CACHED;
-            }
-            // Static lights
-            else
-            {
-                // If light atlas allocation has changed, or the static light changed, render a full shadow map now that can be cached next frame
-                if (view.lastViewport != view.viewport || !view.lastShadowMatrix.Equals(view.shadowMatrix, 0.0001f))
-                    view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
-                else
-                {
-                    view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+        for (size_t j = 0; j < numGeometries; ++j)
+        {
+            Material* material = batches.GetMaterial(j);
+            newBatch.pass = material->GetPass(PASS_SHADOW);
+            if (!newBatch.pass)
+                continue;
 
-                    // If static shadowcasters updated themselves (e.g. LOD change), render shadow map fully
-                    // If dynamic casters moved, need to restore shadowmap and rerender
-                    if (staticCastersMoved)
-                        view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
-                    else
-                    {
-                        if (dynamicCastersMoved || view.lastNumGeometries != totalShadowCasters)
-                            view.renderMode = staticShadowCasters > 0 ? RENDER_STATIC_LIGHT_RESTORE_STATIC : RENDER_DYNAMIC_LIGHT;
-                    }
-                }
-            }
+            newBatch.geometry = batches.GetGeometry(j);
+            newBatch.programBits = (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
+            if (drawable->TestFlag(DF_DUAL_QUATERNION_SKINNING))
+                newBatch.programBits |= SP_DUALQUATERNION;
+            newBatch.geomIndex = (unsigned char)j;
 
-            // If no rendering to be done, use the last rendered shadow projection matrix to avoid artifacts when rotating camera
-            if (view.renderMode == RENDER_STATIC_LIGHT_CACHED)
-                view.shadowMatrix = view.lastShadowMatrix;
+            if (!newBatch.programBits)
+                newBatch.worldTransform = &drawable->WorldTransform();
             else
-            {
-                view.lastViewport = view.viewport;
-                view.lastNumGeometries = totalShadowCasters;
-                view.lastShadowMatrix = view.shadowMatrix;
+                newBatch.drawable = static_cast<GeometryDrawable*>(drawable);
 
-                // Clear static batch queue if not needed
-                if (destStatic && view.renderMode != RENDER_STATIC_LIGHT_STORE_STATIC)
-                    destStatic->Clear();
-            }
+            dest.push_back(newBatch);
         }
-
-        // For a point light, process all its views in the same task
-        if (lightType == LIGHT_POINT && viewIdx < shadowMap.shadowViews.size() - 1 && shadowMap.shadowViews[viewIdx + 1]->light == light)
-            ++viewIdx;
-        else
-            break;
     }
 
-    // Sort shadow batches if was the last
+    // Finish and sort shadow batches if was the last
     if (numPendingShadowViews[task->shadowMapIdx].fetch_add(-1) == 1)
         SortShadowBatches(shadowMap);
 }
 
 void Renderer::CullLightsToFrustumWork(Task* task, unsigned)
 {
-    ZoneScoped;
-
-    // Cull lights against each cluster frustum on the given Z-level
-    size_t z = static_cast<CullLightsTask*>(task)->z;
-    const Matrix3x4& cameraView = camera->ViewMatrix();
-
-    // Clear old light data first
-    size_t idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
-    ClusterCullData* cullData = &clusterCullData[idx];
-    for (size_t i = 0; i < NUM_CLUSTER_X * NUM_CLUSTER_Y; ++i)
-    {
-        cullData->numLights = 0;
-        ++cullData;
-    }
-
-    // Go through lights and add to each affected cluster. Do culling checks both ways to reduce false positives
-    for (size_t i = 0; i < lights.size(); ++i)
-    {
-        LightDrawable* light = lights[i];
-        LightType lightType = light->GetLightType();
-
-        if (lightType == LIGHT_POINT)
-        {
-            Sphere bounds(cameraView * light->WorldPosition(), light->Range());
-            float minViewZ = bounds.center.z - light->Range();
-            float maxViewZ = bounds.center.z + light->Range();
-
-            idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
-            cullData = &clusterCullData[idx];
-            if (minViewZ > cullData->frustum.vertices[4].z || maxViewZ < cullData->frustum.vertices[0].z)
-                continue;
-
-            for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
-            {
-                for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
-                {
-                    if (cullData->numLights < MAX_LIGHTS_CLUSTER)
-                    {
-                        if (bounds.IsInsideFast(cullData->boundingBox) && cullData->frustum.IsInsideFast(bounds))
-                            clusterData[(idx << 4) + cullData->numLights++] = (unsigned char)(i + 1);
-                    }
-
-                    ++idx;
-                    ++cullData;
-                }
-            }
-        }
-        else if (lightType == LIGHT_SPOT)
-        {
-            Frustum bounds(light->WorldFrustum().Transformed(cameraView));
-            BoundingBox boundsBox(bounds);
-            float minViewZ = boundsBox.min.z;
-            float maxViewZ = boundsBox.max.z;
-
-            idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
-            cullData = &clusterCullData[idx];
-            if (minViewZ > cullData->frustum.vertices[4].z || maxViewZ < cullData->frustum.vertices[0].z)
-                continue;
-
-            for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
-            {
-                for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
-                {
-                    if (cullData->numLights < MAX_LIGHTS_CLUSTER)
-                    {
-                        if (bounds.IsInsideFast(cullData->boundingBox) && cullData->frustum.IsInsideFast(boundsBox))
-                            clusterData[(idx << 4) + cullData->numLights++] = (unsigned char)(i + 1);
-                    }
-
-                    ++idx;
-                    ++cullData;
-                }
-            }
-        }
-    }
+    lightGrid.CullSlice(static_cast<CullLightsTask*>(task)->z, lightBounds);
 }
 
 void RegisterRendererLibrary()
@@ -1828,6 +2516,7 @@ void RegisterRendererLibrary()
     OctreeNode::RegisterObject();
     GeometryNode::RegisterObject();
     StaticModel::RegisterObject();
+    StaticBatch::RegisterObject();
     AnimatedModel::RegisterObject();
     Light::RegisterObject();
     LightEnvironment::RegisterObject();
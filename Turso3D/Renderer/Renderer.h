@@ -8,11 +8,15 @@
 #include "../Object/AutoPtr.h"
 #include "../Resource/Image.h"
 #include "../Thread/WorkQueue.h"
+#include "../Time/Timer.h"
 #include "Batch.h"
+#include "LightGrid.h"
+#include "ShadowAtlas.h"
 
 #include <atomic>
 
 class Camera;
+class Drawable;
 class FrameBuffer;
 class GeometryDrawable;
 class Graphics;
@@ -35,13 +39,16 @@ struct CullLightsTask;
 struct ShadowView;
 struct ThreadOctantResult;
 
-static const size_t NUM_CLUSTER_X = 16;
-static const size_t NUM_CLUSTER_Y = 8;
-static const size_t NUM_CLUSTER_Z = 8;
-static const size_t MAX_LIGHTS = 255;
-static const size_t MAX_LIGHTS_CLUSTER = 16;
+static const size_t MAX_LIGHTS = 65535; // Limited by 16-bit light indices
+static const size_t LIGHT_DATA_TEXELS = 9; // RGBA32F texels per light in the light data texture
+static const size_t LIGHT_DATA_LIGHTS_PER_ROW = 64;
+static const size_t LIGHT_INDEX_TEXTURE_WIDTH = 1024; // Each R32U texel holds two 16-bit light indices
 static const size_t NUM_OCTANT_TASKS = 9;
 static const size_t NUM_SHADOW_MAPS = 2; // One for directional lights and another for the rest
+static const size_t NUM_LOD_STATS_LEVELS = 8; // Higher LOD levels are counted into the last
+static const size_t NUM_ANIMATION_LOD_STATS_LEVELS = 4; // Animation update intervals of 1, 2, 4 and 8 frames
+static const size_t NUM_SKIN_MATRIX_SLICES = 3; // Per-frame slices in the skinning matrix ring buffer, so that writing a frame does not wait for the GPU to read the previous
+static const size_t INITIAL_SKIN_MATRIX_SLICE_SIZE = 64 * 1024;
 
 // Texture units with built-in meanings.
 static const size_t TU_DIRLIGHTSHADOW = 8;
@@ -49,6 +56,8 @@ static const size_t TU_SHADOWATLAS = 9;
 static const size_t TU_FACESELECTION1 = 10;
 static const size_t TU_FACESELECTION2 = 11;
 static const size_t TU_LIGHTCLUSTERDATA = 12;
+static const size_t TU_LIGHTINDICES = 13;
+static const size_t TU_LIGHTDATA = 14;
 
 /// Per-thread results for octant collection.
 struct ThreadOctantResult
@@ -88,6 +97,103 @@ struct ThreadBatchResult
     std::vector<Batch> opaqueBatches;
     /// Initial alpha batches.
     std::vector<Batch> alphaBatches;
+    /// Triangles in collected batches.
+    size_t numTriangles;
+    /// Drawables with LOD levels by highest LOD level in use.
+    size_t lodLevels[NUM_LOD_STATS_LEVELS];
+    /// Animated models by animation update interval.
+    size_t animationLodLevels[NUM_ANIMATION_LOD_STATS_LEVELS];
+    /// Animated models that evaluated their animation this frame.
+    size_t numAnimationUpdates;
+};
+
+/// Per-view LOD statistics and budget.
+struct LodStatistics
+{
+    /// Construct.
+    LodStatistics();
+
+    /// Triangles in the main view batches.
+    size_t numTriangles;
+    /// Main view batches before instancing.
+    size_t numBatches;
+    /// Drawables with LOD levels by highest LOD level in use.
+    size_t lodLevels[NUM_LOD_STATS_LEVELS];
+    /// Visible animated models by animation update interval: every frame, every 2, 4 and 8 frames.
+    size_t animationLodLevels[NUM_ANIMATION_LOD_STATS_LEVELS];
+    /// Visible animated models that evaluated their animation this frame.
+    size_t numAnimationUpdates;
+    /// Automatic LOD bias multiplier that was applied to the camera for the next frame.
+    float autoLodBias;
+};
+
+/// Light importance thresholds for choosing which point and spot lights are rendered, which are shadowed and at what shadow resolution. Importance is the estimated fraction of the view covered by the light's range, multiplied by the intensity of its effective color. Zero thresholds and counts disable the corresponding limit.
+struct LightImportanceSettings
+{
+    /// Construct with no limits.
+    LightImportanceSettings();
+
+    /// Maximum number of lights to render. Further limited by MAX_LIGHTS.
+    size_t maxLights;
+    /// Maximum number of shadowed lights.
+    size_t maxShadowedLights;
+    /// Importance below which lights are not rendered.
+    float minImportance;
+    /// Importance below which lights fade out, reaching black at the minimum importance.
+    float fadeImportance;
+    /// Importance below which lights are not shadowed.
+    float shadowImportance;
+    /// Importance below which shadowed lights use half resolution shadow maps.
+    float fullShadowImportance;
+};
+
+/// Shadow map update statistics of the last prepared view.
+struct ShadowUpdateStatistics
+{
+    /// Construct.
+    ShadowUpdateStatistics();
+
+    /// Shadow views rendered.
+    size_t numUpdated;
+    /// Shadow views that needed an update, but were deferred to a later frame.
+    size_t numDeferred;
+    /// Shadowcaster batches in the rendered views before instancing.
+    size_t numBatches;
+};
+
+/// Timing of the view preparation stages of the last prepared view, in milliseconds from the start of PrepareView(). The stages after the octree update overlap in the worker threads, so each records when it finished.
+struct PrepareViewStatistics
+{
+    /// Construct.
+    PrepareViewStatistics();
+
+    /// Animated models updated by the animation system.
+    float animationUpdate;
+    /// Octree reinsertions and occlusion query results processed.
+    float octreeUpdate;
+    /// Octants and lights collected.
+    float octantsCollected;
+    /// Lights processed and shadow views set up.
+    float lightsProcessed;
+    /// Main view batches collected and sorted.
+    float mainBatchesSorted;
+    /// Shadowcaster batches collected and sorted per shadow map, zero if the shadow map has no views.
+    float shadowBatchesSorted[NUM_SHADOW_MAPS];
+    /// All view preparation tasks finished.
+    float total;
+};
+
+/// Shadow views that are scheduled for update together: the faces of a point light, or a single spot light or directional light cascade view.
+struct ShadowUpdateGroup
+{
+    /// First view index in the shadow map.
+    size_t start;
+    /// End view index in the shadow map.
+    size_t end;
+    /// Shadowcaster batches to render.
+    size_t numBatches;
+    /// Scheduling score from priority and frames deferred.
+    float score;
 };
 
 /// Shadow map data structure. May be shared by several lights.
@@ -105,8 +211,8 @@ struct ShadowMap
     size_t freeQueueIdx;
     /// Next free shadowcaster list index.
     size_t freeCasterListIdx;
-    /// Rectangle allocator.
-    AreaAllocator allocator;
+    /// Persistent rectangle allocator.
+    ShadowAtlas atlas;
     /// Shadow map texture.
     SharedPtr<Texture> texture;
     /// Shadow map framebuffer.
@@ -119,6 +225,10 @@ struct ShadowMap
     std::vector<std::vector<Drawable*> > shadowCasters;
     /// Instancing transforms for shadowcasters.
     std::vector<Matrix3x4> instanceTransforms;
+    /// Update candidates for scheduling.
+    std::vector<ShadowUpdateGroup> updateGroups;
+    /// Update statistics.
+    ShadowUpdateStatistics updateStats;
 };
 
 /// Per-view uniform buffer data.
@@ -140,6 +250,8 @@ struct PerViewUniforms
     Color fogColor;
     /// Current scene's fog start and end parameters.
     Vector4 fogParameters;
+    /// Light cluster Z lookup parameters.
+    Vector4 clusterParameters;
     /// Directional light direction.
     Vector4 dirLightDirection;
     /// Directional light color.
@@ -152,7 +264,7 @@ struct PerViewUniforms
     Matrix4 dirLightShadowMatrices[2];
 };
 
-/// Per-light data for cluster light shader.
+/// Per-light data for cluster light shader. Uploaded as texels of the light data texture.
 struct LightData
 {
     /// %Light position.
@@ -169,17 +281,6 @@ struct LightData
     Matrix4 shadowMatrix;
 };
 
-/// Per-cluster data for culling lights.
-struct ClusterCullData
-{
-    /// Cluster frustum.
-    Frustum frustum;
-    /// Cluster bounding box.
-    BoundingBox boundingBox;
-    /// Number of lights already in cluster.
-    unsigned char numLights;
-};
-
 /// High-level rendering subsystem. Performs rendering of 3D scenes.
 class Renderer : public Object
 {
@@ -195,6 +296,16 @@ public:
     void SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat format);
     /// Set global depth bias multipiers for shadow maps.
     void SetShadowDepthBiasMul(float depthBiasMul, float slopeScaleBiasMul);
+    /// Set light cluster grid dimensions. Default 16x8x8. Clusters are split evenly in screen X and Y, and quadratically in depth.
+    void SetClusterGrid(const IntVector3& size);
+    /// Set whether to fit the light cluster Z-slices logarithmically to the visible geometry depth range each frame. Improves culling precision when the visible depth is short compared to the far clip distance. Default false.
+    void SetClusterDepthFit(bool enable);
+    /// Set light importance thresholds for the views prepared after this call.
+    void SetLightImportance(const LightImportanceSettings& settings);
+    /// Set shadow map update time slicing. Point and spot lights with update priority below the threshold are updated at most every light interval frames, and directional light cascades after the first every cascade interval frames. Remaining updates are rendered in priority order until the shadowcaster batch budget of each shadow map is used, and the rest keep their previous content until a later frame. Lights without previous content are left unshadowed while deferred. Zero budget is unlimited and intervals of 1 update every frame (defaults.)
+    void SetShadowUpdateBudget(size_t maxBatches, int lightInterval = 1, float priorityThreshold = 0.0f, int cascadeInterval = 1);
+    /// Set per-view triangle and batch budget. When a view goes over, the camera's automatic LOD bias is lowered for the next frames, and restored gradually when back under the budget. Zero is unlimited (default.)
+    void SetLodBudget(size_t maxTriangles, size_t maxBatches);
     /// Prepare view for rendering. This will utilize worker threads.
     void PrepareView(Scene* scene, Camera* camera, bool drawShadows, bool useOcclusion);
     /// Render shadowmaps before rendering the view. Last shadow framebuffer will be left bound.
@@ -208,21 +319,76 @@ public:
 
     /// Return a shadow map texture by index for debugging.
     Texture* ShadowMapTexture(size_t index) const;
+    /// Return light cluster grid dimensions.
+    IntVector3 ClusterGrid() const { return lightGrid.Size(); }
+    /// Return whether light cluster Z-slices are fitted to the visible geometry depth range.
+    bool ClusterDepthFit() const { return lightGrid.DepthFit(); }
+    /// Return number of point and spot lights in the last prepared view.
+    size_t NumLights() const { return lights.size(); }
+    /// Return total number of light indices in the clusters of the last prepared view.
+    size_t NumLightIndices() const { return numLightIndices; }
+    /// Return usage statistics of the point and spot light shadow atlas.
+    ShadowAtlasStatistics ShadowAtlasStats() const;
+    /// Return light importance thresholds.
+    const LightImportanceSettings& GetLightImportanceSettings() const { return lightImportance; }
+    /// Return importance of a point or spot light in the current view from its estimated screen coverage and the intensity of its effective color. Directional lights return their color intensity.
+    float CalculateLightImportance(LightDrawable* light) const;
+    /// Return number of shadowed point and spot lights in the last prepared view.
+    size_t NumShadowedLights() const { return numShadowedLights; }
+    /// Return shadow map update priority of a light in the current view, from its estimated screen coverage and shadow fade by distance. Directional lights and lights close enough to cover the whole view return 1.
+    float ShadowUpdatePriority(LightDrawable* light) const;
+    /// Return shadow map update statistics of the last prepared view.
+    ShadowUpdateStatistics ShadowUpdateStats() const;
+    /// Return shadowcaster batch budget per shadow map for shadow updates, 0 if unlimited.
+    size_t MaxShadowBatches() const { return maxShadowBatches; }
+    /// Return LOD statistics of the last prepared view.
+    const LodStatistics& LodStats() const { return lodStats; }
+    /// Return stage timing of the last prepared view.
+    const PrepareViewStatistics& PrepareViewStats() const { return prepareViewStats; }
+    /// Return triangle budget, 0 if unlimited.
+    size_t MaxTriangles() const { return maxTriangles; }
+    /// Return batch budget, 0 if unlimited.
+    size_t MaxBatches() const { return maxBatches; }
+    /// Return the framenumber of the last prepared view.
+    unsigned short FrameNumber() const { return frameNumber; }
+    /// Return bytes of skinning data requested in the last prepared view, including alignment padding.
+    size_t SkinMatrixBytes() const { return skinMatrixBytes.load(); }
+
+    /// Allocate space for skinning matrices or dual quaternions from the current frame's slice of the skinning matrix ring buffer. Return a pointer to write the data to and the byte offset for binding it, or null if the slice is full. In that case the buffer grows when the next view is prepared. Called by animated models in worker threads.
+    void* AllocateSkinData(size_t numBytes, size_t& offset);
+    /// Bind skinning data allocated during the current frame for rendering. The whole slice is uploaded on first use.
+    void BindSkinData(size_t offset, size_t numBytes);
+    /// Free a light's shadow map rectangle. Called by lights when they leave the scene, are disabled or are destroyed, as the shadow atlases identify the lights by pointer.
+    void FreeShadowMap(LightDrawable* light);
 
 private:
     /// Collect octants and lights from the octree recursively. Queue batch collection tasks while ongoing.
     void CollectOctantsAndLights(Octant* octant, ThreadOctantResult& result, unsigned char planeMask = 0x3f);
     /// Add an occlusion query for the octant if applicable.
     void AddOcclusionQuery(Octant* octant, ThreadOctantResult& result, unsigned char planeMask);
-    /// Allocate shadow map for a light. Return true on success.
-    bool AllocateShadowMap(LightDrawable* light);
+    /// Allocate shadow map for a light with the requested size. Higher priority lights win when the shadow map is full. Return true on success.
+    bool AllocateShadowMap(LightDrawable* light, const IntVector2& size, float priority);
     /// Sort main opaque and alpha batch queues.
     void SortMainBatches();
+    /// Combine LOD statistics and adjust the camera's automatic LOD bias according to the budget.
+    void UpdateLodBudget();
+    /// Advance the skinning matrix ring buffer to the next slice. Grow the slices if the previous frame did not fit.
+    void BeginSkinMatrixFrame();
+    /// Combine the shadow batch collection task results of a shadowmap's views and decide their render modes.
+    void FinishShadowViews(ShadowMap& shadowMap);
+    /// Decide which shadow views of a shadowmap are rendered this frame and which are deferred according to the update budget.
+    void ScheduleShadowViews(ShadowMap& shadowMap);
+    /// Mark the shadow views of an update group rendered.
+    void CommitShadowViews(ShadowMap& shadowMap, const ShadowUpdateGroup& group);
+    /// Defer the updates of the shadow views of an update group and clear their batch queues.
+    void DeferShadowViews(ShadowMap& shadowMap, const ShadowUpdateGroup& group);
     /// Sort all batch queues of a shadowmap.
     void SortShadowBatches(ShadowMap& shadowMap);
+    /// Return milliseconds elapsed since the start of view preparation.
+    float PrepareViewTime() { return 0.001f * prepareViewTimer.ElapsedUSec(); }
     /// Upload instance transforms before rendering.
     void UpdateInstanceTransforms(const std::vector<Matrix3x4>& transforms);
-    /// Upload light uniform buffer and cluster texture data.
+    /// Upload light data, light index and cluster textures.
     void UpdateLightData();
     /// Render a batch queue.
     void RenderBatches(Camera* camera, const BatchQueue& queue);
@@ -234,8 +400,6 @@ private:
     void DefineFaceSelectionTextures();
     /// Define bounding box geometry for occlusion queries.
     void DefineBoundingBoxGeometry();
-    /// Setup light cluster frustums and bounding boxes if necessary.
-    void DefineClusterFrustums();
     /// Work function to collect octants.
     void CollectOctantsWork(Task* task, unsigned threadIndex);
     /// Process lights collected by octant tasks, and queue shadowcaster query tasks for them as necessary.
@@ -277,8 +441,6 @@ private:
     bool useOcclusion;
     /// Shadow maps globally dirty flag. All cached shadow content should be reset.
     bool shadowMapsDirty;
-    /// Cluster frustums dirty flag.
-    bool clusterFrustumsDirty;
     /// Instancing supported flag.
     bool hasInstancing;
     /// Previous frame camera position for occlusion culling bounding box elongation.
@@ -303,8 +465,18 @@ private:
     BoundingBox geometryBounds;
     /// Brightest directional light in frustum.
     LightDrawable* dirLight;
-    /// Accepted point and spot lights in frustum.
+    /// Accepted point and spot lights in frustum, in decreasing importance order.
     std::vector<LightDrawable*> lights;
+    /// Importance of the accepted point and spot lights.
+    std::vector<float> lightImportances;
+    /// Requested shadow map sizes of the accepted point and spot lights, zero if not shadowed.
+    std::vector<IntVector2> lightShadowSizes;
+    /// Point and spot lights with importance for sorting.
+    std::vector<std::pair<float, LightDrawable*> > sortedLights;
+    /// Number of shadowed point and spot lights.
+    size_t numShadowedLights;
+    /// Lights that lost their shadow map rectangle during an allocation.
+    std::vector<LightDrawable*> evictedLights;
     /// Shadow maps.
     AutoArrayPtr<ShadowMap> shadowMaps;
     /// Opaque batches.
@@ -323,14 +495,38 @@ private:
     float depthBiasMul;
     /// Slope-scaled depth bias multiplier.
     float slopeScaleBiasMul;
-    /// Last projection matrix used to initialize cluster frustums.
-    Matrix4 lastClusterFrustumProj;
-    /// Cluster frustums, bounding boxes and number of found lights.
-    AutoArrayPtr<ClusterCullData> clusterCullData;
-    /// Cluster uniform buffer data CPU copy.
-    AutoArrayPtr<unsigned char> clusterData;
-    /// Light uniform buffer data CPU copy.
-    AutoArrayPtr<LightData> lightData;
+    /// Triangle budget per view.
+    size_t maxTriangles;
+    /// Batch budget per view.
+    size_t maxBatches;
+    /// LOD statistics of the last prepared view.
+    LodStatistics lodStats;
+    /// Stage timing of the last prepared view.
+    PrepareViewStatistics prepareViewStats;
+    /// View preparation timer.
+    HiresTimer prepareViewTimer;
+    /// Light importance thresholds.
+    LightImportanceSettings lightImportance;
+    /// Shadowcaster batch budget per shadow map for shadow updates.
+    size_t maxShadowBatches;
+    /// Update interval in frames for low priority lights.
+    int shadowLightInterval;
+    /// Update priority threshold for rate limiting lights.
+    float shadowPriorityThreshold;
+    /// Update interval in frames for directional light cascades after the first.
+    int shadowCascadeInterval;
+    /// Light cluster grid.
+    LightGrid lightGrid;
+    /// View space bounds of the point and spot lights for cluster culling.
+    std::vector<LightCullBounds> lightBounds;
+    /// Cluster texture data CPU copy: light index list offset and count per cluster.
+    std::vector<unsigned> clusterData;
+    /// Light data texture CPU copy.
+    std::vector<LightData> lightData;
+    /// Combined light index list of all clusters, padded to whole texture rows.
+    std::vector<unsigned short> lightIndices;
+    /// Number of light indices in the combined list, excluding padding.
+    size_t numLightIndices;
     /// Per-view uniform buffer data CPU copy.
     PerViewUniforms perViewData;
     /// Frustum SAT test data for verifying whether to add an occlusion query.
@@ -345,20 +541,34 @@ private:
     AutoPtr<Task> batchesReadyTask;
     /// %Task for queuing shadow views for further processing.
     AutoPtr<Task> processShadowCastersTask;
-    /// Tasks for shadow batch processing.
-    std::vector<AutoPtr<CollectShadowBatchesTask> > collectShadowBatchesTasks;
+    /// Tasks for shadow batch processing per shadow map.
+    std::vector<AutoPtr<CollectShadowBatchesTask> > collectShadowBatchesTasks[NUM_SHADOW_MAPS];
     /// Tasks for light grid culling.
-    AutoPtr<CullLightsTask> cullLightsTasks[NUM_CLUSTER_Z];
+    std::vector<AutoPtr<CullLightsTask> > cullLightsTasks;
     /// Face selection UV indirection texture 1.
     AutoPtr<Texture> faceSelectionTexture1;
     /// Face selection UV indirection texture 2.
     AutoPtr<Texture> faceSelectionTexture2;
     /// Cluster lookup 3D texture.
     AutoPtr<Texture> clusterTexture;
+    /// Light index list texture.
+    AutoPtr<Texture> lightIndexTexture;
+    /// Light data texture.
+    AutoPtr<Texture> lightDataTexture;
     /// Per-view uniform buffer.
     AutoPtr<UniformBuffer> perViewDataBuffer;
-    /// Light data uniform buffer.
-    AutoPtr<UniformBuffer> lightDataBuffer;
+    /// Skinning matrix ring buffer with a slice per frame.
+    AutoPtr<UniformBuffer> skinMatrixBuffer;
+    /// Skinning matrices of the current frame, CPU copy.
+    AutoArrayPtr<unsigned char> skinMatrixData;
+    /// Skinning matrix bytes requested during the current frame, including allocations that did not fit.
+    std::atomic<size_t> skinMatrixBytes;
+    /// Byte size of one ring buffer slice.
+    size_t skinMatrixSliceSize;
+    /// Index of the current frame's slice.
+    size_t skinMatrixSlice;
+    /// Current frame's skinning matrices uploaded flag.
+    bool skinMatricesUploaded;
     /// Instancing vertex buffer.
     AutoPtr<VertexBuffer> instanceVertexBuffer;
     /// Bounding box vertex buffer.
@@ -0,0 +1,299 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Math.h"
+#include "ShadowAtlas.h"
+
+ShadowAtlasStatistics::ShadowAtlasStatistics() :
+    numRects(0),
+    numUsedRects(0),
+    numKept(0),
+    numAllocated(0),
+    numEvicted(0),
+    usedArea(0.0f),
+    fragmentation(0.0f)
+{
+}
+
+ShadowAtlas::ShadowAtlas() :
+    size(IntVector2::ZERO),
+    cellSize(DEFAULT_SHADOW_ATLAS_CELL_SIZE),
+    numCellsX(0),
+    numCellsY(0),
+    frame(1),
+    numKept(0),
+    numAllocated(0),
+    numEvicted(0)
+{
+}
+
+void ShadowAtlas::Reset(const IntVector2& size_, int cellSize_)
+{
+    size = size_;
+    cellSize = Max(cellSize_, 1);
+    numCellsX = Max(size.x / cellSize, 0);
+    numCellsY = Max(size.y / cellSize, 0);
+
+    cells.clear();
+    cells.resize(numCellsX * numCellsY, -1);
+    slots.clear();
+    visited.clear();
+    numKept = 0;
+    numAllocated = 0;
+    numEvicted = 0;
+}
+
+void ShadowAtlas::BeginFrame()
+{
+    ++frame;
+    numKept = 0;
+    numAllocated = 0;
+    numEvicted = 0;
+}
+
+IntRect ShadowAtlas::Allocate(LightDrawable* light, const IntVector2& request, float priority, bool& kept, std::vector<LightDrawable*>& evicted)
+{
+    kept = false;
+    if (request.x <= 0 || request.y <= 0)
+        return IntRect::ZERO;
+
+    int index = FindSlot(light);
+    if (index >= 0)
+    {
+        IntVector2 current = slots[index].rect.Size();
+
+        // Keep the rectangle if it has the requested size. If it was halved earlier due to lack of room, move to the full size only if it fits without evicting anything
+        if (current == request || (current.x < request.x && current.y < request.y))
+        {
+            slots[index].lastFrame = frame;
+            slots[index].priority = priority;
+
+            IntRect rect;
+            if (current != request && FindPosition(request, EVICT_NONE, priority, rect, evicted))
+            {
+                FreeSlot(index);
+                AddSlot(light, rect, priority);
+                ++numAllocated;
+                return rect;
+            }
+
+            kept = true;
+            ++numKept;
+            return slots[index].rect;
+        }
+
+        FreeSlot(index);
+    }
+
+    return AllocateNew(light, request, priority, evicted);
+}
+
+void ShadowAtlas::Free(LightDrawable* light)
+{
+    int index = FindSlot(light);
+    if (index >= 0)
+        FreeSlot(index);
+}
+
+ShadowAtlasStatistics ShadowAtlas::Statistics() const
+{
+    ShadowAtlasStatistics ret;
+    ret.numKept = numKept;
+    ret.numAllocated = numAllocated;
+    ret.numEvicted = numEvicted;
+
+    for (auto it = slots.begin(); it != slots.end(); ++it)
+    {
+        if (it->light)
+        {
+            ++ret.numRects;
+            if (it->lastFrame == frame)
+                ++ret.numUsedRects;
+        }
+    }
+
+    if (cells.empty())
+        return ret;
+
+    // Find the largest free square of cells to compare against the total free area
+    std::vector<int> squareSizes(cells.size(), 0);
+    int freeCells = 0;
+    int largestSquare = 0;
+
+    for (int y = 0; y < numCellsY; ++y)
+    {
+        for (int x = 0; x < numCellsX; ++x)
+        {
+            int idx = y * numCellsX + x;
+            if (cells[idx] >= 0)
+                continue;
+
+            ++freeCells;
+            int squareSize = 1;
+            if (x > 0 && y > 0)
+                squareSize = Min(Min(squareSizes[idx - 1], squareSizes[idx - numCellsX]), squareSizes[idx - numCellsX - 1]) + 1;
+            squareSizes[idx] = squareSize;
+            largestSquare = Max(largestSquare, squareSize);
+        }
+    }
+
+    ret.usedArea = 1.0f - (float)freeCells / (float)cells.size();
+    if (freeCells)
+        ret.fragmentation = 1.0f - (float)(largestSquare * largestSquare) / (float)freeCells;
+
+    return ret;
+}
+
+bool ShadowAtlas::FindPosition(const IntVector2& request, EvictMode mode, float priority, IntRect& dest, std::vector<LightDrawable*>& evicted)
+{
+    int width = (request.x + cellSize - 1) / cellSize;
+    int height = (request.y + cellSize - 1) / cellSize;
+    if (width > numCellsX || height > numCellsY)
+        return false;
+
+    // Align to the size class, ie. the largest power of two that divides both dimensions in cells
+    int step = (width | height) & -(width | height);
+    // Evicting rectangles used this frame always costs more than evicting any amount of unused ones
+    float usedCost = (float)cells.size();
+    float bestCost = M_MAX_FLOAT;
+    int bestX = -1;
+    int bestY = -1;
+
+    visited.resize(slots.size());
+
+    for (int y = 0; y + height <= numCellsY && bestCost > 0.0f; y += step)
+    {
+        for (int x = 0; x + width <= numCellsX && bestCost > 0.0f; x += step)
+        {
+            float cost = 0.0f;
+            bool possible = true;
+            overlapping.clear();
+
+            for (int cy = y; cy < y + height && possible; ++cy)
+            {
+                for (int cx = x; cx < x + width; ++cx)
+                {
+                    int owner = cells[cy * numCellsX + cx];
+                    if (owner < 0 || visited[owner])
+                        continue;
+
+                    const Slot& slot = slots[owner];
+                    bool used = slot.lastFrame == frame;
+                    if (mode == EVICT_NONE || (used && (mode != EVICT_LOWER_PRIORITY || slot.priority >= priority)))
+                    {
+                        possible = false;
+                        break;
+                    }
+
+                    visited[owner] = 1;
+                    overlapping.push_back(owner);
+                    float area = (float)(slot.rect.Width() * slot.rect.Height()) / (float)(cellSize * cellSize);
+                    cost += used ? usedCost + area : area;
+                }
+            }
+
+            for (auto it = overlapping.begin(); it != overlapping.end(); ++it)
+                visited[*it] = 0;
+
+            if (possible && cost < bestCost)
+            {
+                bestCost = cost;
+                bestX = x;
+                bestY = y;
+            }
+        }
+    }
+
+    if (bestX < 0)
+        return false;
+
+    // Evict the rectangles in the way
+    for (int cy = bestY; cy < bestY + height; ++cy)
+    {
+        for (int cx = bestX; cx < bestX + width; ++cx)
+        {
+            int owner = cells[cy * numCellsX + cx];
+            if (owner < 0)
+                continue;
+
+            if (slots[owner].lastFrame == frame)
+                evicted.push_back(slots[owner].light);
+            FreeSlot(owner);
+            ++numEvicted;
+        }
+    }
+
+    dest = IntRect(bestX * cellSize, bestY * cellSize, bestX * cellSize + request.x, bestY * cellSize + request.y);
+    return true;
+}
+
+void ShadowAtlas::AddSlot(LightDrawable* light, const IntRect& rect, float priority)
+{
+    size_t index = 0;
+    while (index < slots.size() && slots[index].light)
+        ++index;
+    if (index == slots.size())
+        slots.resize(slots.size() + 1);
+
+    Slot& slot = slots[index];
+    slot.light = light;
+    slot.rect = rect;
+    slot.lastFrame = frame;
+    slot.priority = priority;
+    MarkCells(rect, (int)index);
+}
+
+IntRect ShadowAtlas::AllocateNew(LightDrawable* light, const IntVector2& size_, float priority, std::vector<LightDrawable*>& evicted)
+{
+    IntRect rect;
+
+    // Prefer evicting unused rectangles over halving the size, and halving over evicting rectangles used this frame
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        IntVector2 request = size_;
+
+        for (size_t i = 0; i <= MAX_SHADOW_ATLAS_DOWNGRADES && request.x > 0 && request.y > 0; ++i)
+        {
+            if ((pass == 0 && (FindPosition(request, EVICT_NONE, priority, rect, evicted) || FindPosition(request, EVICT_UNUSED, priority, rect, evicted))) ||
+                (pass == 1 && FindPosition(request, EVICT_LOWER_PRIORITY, priority, rect, evicted)))
+            {
+                AddSlot(light, rect, priority);
+                ++numAllocated;
+                return rect;
+            }
+
+            request.x /= 2;
+            request.y /= 2;
+        }
+    }
+
+    return IntRect::ZERO;
+}
+
+void ShadowAtlas::MarkCells(const IntRect& rect, int owner)
+{
+    int right = (rect.right + cellSize - 1) / cellSize;
+    int bottom = (rect.bottom + cellSize - 1) / cellSize;
+
+    for (int y = rect.top / cellSize; y < bottom; ++y)
+    {
+        for (int x = rect.left / cellSize; x < right; ++x)
+            cells[y * numCellsX + x] = owner;
+    }
+}
+
+void ShadowAtlas::FreeSlot(size_t index)
+{
+    MarkCells(slots[index].rect, -1);
+    slots[index].light = nullptr;
+}
+
+int ShadowAtlas::FindSlot(LightDrawable* light) const
+{
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        if (slots[i].light == light)
+            return (int)i;
+    }
+
+    return -1;
+}
@@ -0,0 +1,116 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntRect.h"
+
+#include <vector>
+
+class LightDrawable;
+
+static const int DEFAULT_SHADOW_ATLAS_CELL_SIZE = 64;
+static const size_t MAX_SHADOW_ATLAS_DOWNGRADES = 2; // Number of times a request may be halved when the atlas is full
+
+/// Shadow atlas usage statistics.
+struct ShadowAtlasStatistics
+{
+    /// Construct with zero values.
+    ShadowAtlasStatistics();
+
+    /// Number of allocated rectangles.
+    size_t numRects;
+    /// Number of rectangles used during the current frame.
+    size_t numUsedRects;
+    /// Number of rectangles kept from the previous use this frame.
+    size_t numKept;
+    /// Number of new rectangles allocated this frame.
+    size_t numAllocated;
+    /// Number of rectangles evicted this frame.
+    size_t numEvicted;
+    /// Allocated area as a fraction of the whole atlas.
+    float usedArea;
+    /// Fragmentation of the free area: 0 when the free area is one square, approaching 1 when it is split into small pieces.
+    float fragmentation;
+};
+
+/// Persistent shadow map atlas allocator. Lights keep their rectangles across frames while there is room, so that cached static shadow maps stay valid. Rectangles are placed on a grid of cells, aligned to their size class. When the atlas is full, rectangles not used during the current frame are evicted first, then the request is halved, and as the last resort rectangles used by lower priority lights this frame are evicted.
+class ShadowAtlas
+{
+public:
+    /// Construct with empty size.
+    ShadowAtlas();
+
+    /// Reset to given size in pixels and remove all allocations.
+    void Reset(const IntVector2& size, int cellSize = DEFAULT_SHADOW_ATLAS_CELL_SIZE);
+    /// Begin a new frame. Rectangles not requested again are kept, but become candidates for eviction.
+    void BeginFrame();
+    /// Allocate a rectangle for a light, or return its rectangle from earlier frames if it has the same size. Higher priority wins when evicting. Lights that used the atlas this frame and lost their rectangle are appended to evicted. Return the rectangle, or zero if there is no room. Set kept to indicate whether the light's previous rectangle was returned.
+    IntRect Allocate(LightDrawable* light, const IntVector2& size, float priority, bool& kept, std::vector<LightDrawable*>& evicted);
+    /// Free a light's rectangle. Must be called before the light is destroyed, as lights are identified by pointer.
+    void Free(LightDrawable* light);
+
+    /// Return the size in pixels.
+    const IntVector2& Size() const { return size; }
+    /// Return usage statistics.
+    ShadowAtlasStatistics Statistics() const;
+
+private:
+    /// Allocated rectangle.
+    struct Slot
+    {
+        /// Owner light. Null if the slot is free.
+        LightDrawable* light;
+        /// Rectangle in pixels.
+        IntRect rect;
+        /// Last frame the rectangle was requested on.
+        unsigned lastFrame;
+        /// Priority of the last request.
+        float priority;
+    };
+
+    /// Eviction modes for finding a position.
+    enum EvictMode
+    {
+        EVICT_NONE = 0,
+        EVICT_UNUSED,
+        EVICT_LOWER_PRIORITY
+    };
+
+    /// Find the cheapest position for a rectangle and evict the rectangles in the way according to the mode. Return true and fill the rectangle if found.
+    bool FindPosition(const IntVector2& request, EvictMode mode, float priority, IntRect& dest, std::vector<LightDrawable*>& evicted);
+    /// Assign a rectangle to a new slot.
+    void AddSlot(LightDrawable* light, const IntRect& rect, float priority);
+    /// Find a new rectangle for a light, trying halved sizes if necessary, and assign it to a new slot. Return the rectangle or zero if no room.
+    IntRect AllocateNew(LightDrawable* light, const IntVector2& size, float priority, std::vector<LightDrawable*>& evicted);
+    /// Mark a slot's cells with an owner slot index, or -1 to free.
+    void MarkCells(const IntRect& rect, int owner);
+    /// Free a slot and its cells.
+    void FreeSlot(size_t index);
+    /// Return the slot index of a light, or -1 if not found.
+    int FindSlot(LightDrawable* light) const;
+
+    /// Size in pixels.
+    IntVector2 size;
+    /// Cell size in pixels.
+    int cellSize;
+    /// Number of cells horizontally.
+    int numCellsX;
+    /// Number of cells vertically.
+    int numCellsY;
+    /// Owner slot index per cell, -1 if free.
+    std::vector<int> cells;
+    /// Slots.
+    std::vector<Slot> slots;
+    /// Visited marks per slot, used when finding a position.
+    std::vector<unsigned char> visited;
+    /// Slots in the way at the position being examined.
+    std::vector<int> overlapping;
+    /// Current frame number.
+    unsigned frame;
+    /// Rectangles kept this frame.
+    size_t numKept;
+    /// Rectangles allocated this frame.
+    size_t numAllocated;
+    /// Rectangles evicted this frame.
+    size_t numEvicted;
+};
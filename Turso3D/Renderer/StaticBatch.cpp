@@ -0,0 +1,457 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/IndexBuffer.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../IO/Log.h"
+#include "../Math/IntVector3.h"
+#include "../Math/Ray.h"
+#include "Camera.h"
+#include "Material.h"
+#include "Model.h"
+#include "Octree.h"
+#include "StaticBatch.h"
+#include "StaticModel.h"
+
+#include <cstring>
+#include <map>
+#include <tracy/Tracy.hpp>
+
+/// Maximum vertices in one static batch, so that 16-bit indices can be used.
+static const size_t MAX_BATCH_VERTICES = 65535;
+
+static Allocator<StaticBatchDrawable> drawableAllocator;
+
+/// Grouping key for merging static model geometries.
+struct StaticBatchKey
+{
+    /// Material.
+    Material* material;
+    /// Vertex buffer attribute mask.
+    unsigned attributes;
+    /// Vertex size in bytes.
+    size_t vertexSize;
+    /// Layer.
+    unsigned char layer;
+    /// Shadow casting flag.
+    bool castShadows;
+    /// Grid cell.
+    IntVector3 cell;
+
+    /// Test for less than with another key.
+    bool operator < (const StaticBatchKey& rhs) const
+    {
+        if (material != rhs.material)
+            return material < rhs.material;
+        if (attributes != rhs.attributes)
+            return attributes < rhs.attributes;
+        if (vertexSize != rhs.vertexSize)
+            return vertexSize < rhs.vertexSize;
+        if (layer != rhs.layer)
+            return layer < rhs.layer;
+        if (castShadows != rhs.castShadows)
+            return castShadows < rhs.castShadows;
+        if (cell.x != rhs.cell.x)
+            return cell.x < rhs.cell.x;
+        if (cell.y != rhs.cell.y)
+            return cell.y < rhs.cell.y;
+        return cell.z < rhs.cell.z;
+    }
+};
+
+/// Static batch being built.
+struct StaticBatchBuildData
+{
+    /// Construct.
+    StaticBatchBuildData() :
+        numVertices(0),
+        numSourceGeometries(0),
+        maxDistance(0.0f)
+    {
+    }
+
+    /// Merged vertex data.
+    std::vector<unsigned char> vertexData;
+    /// Merged index data.
+    std::vector<unsigned short> indexData;
+    /// Merged vertex count.
+    size_t numVertices;
+    /// Number of source geometries merged.
+    size_t numSourceGeometries;
+    /// Max draw distance, 0 for unlimited.
+    float maxDistance;
+    /// Bounding box of the merged vertices.
+    BoundingBox boundingBox;
+};
+
+/// Return the vertex range used by a geometry's CPU-side data.
+static void GetVertexRange(const Geometry* geom, unsigned& first, unsigned& last)
+{
+    if (!geom->cpuIndexData)
+    {
+        first = (unsigned)geom->cpuDrawStart;
+        last = (unsigned)(geom->cpuDrawStart + geom->drawCount - 1);
+        return;
+    }
+
+    first = M_MAX_UNSIGNED;
+    last = 0;
+
+    for (size_t i = geom->cpuDrawStart; i < geom->cpuDrawStart + geom->drawCount; ++i)
+    {
+        unsigned index = geom->cpuIndexSize == sizeof(unsigned short) ? ((const unsigned short*)geom->cpuIndexData.Get())[i] :
+            ((const unsigned*)geom->cpuIndexData.Get())[i];
+        if (index < first)
+            first = index;
+        if (index > last)
+            last = index;
+    }
+}
+
+/// Check whether a static model can be merged into static batches.
+static bool CanMergeStaticModel(StaticModel* model)
+{
+    if (!model->IsEnabled() || !model->IsStatic() || !model->GetModel() || !model->NumGeometries())
+        return false;
+    if (model->GetGeometryType() != GEOM_STATIC || model->GetDrawable()->TestFlag(DF_HAS_LOD_LEVELS))
+        return false;
+
+    for (size_t i = 0; i < model->NumGeometries(); ++i)
+    {
+        Geometry* geom = model->GetGeometry(i);
+        if (!geom || !geom->cpuVertexData || !geom->vertexBuffer || !geom->drawCount)
+            return false;
+
+        const std::vector<VertexElement>& elements = geom->vertexBuffer->Elements();
+        if (elements.empty() || elements[0].semantic != SEM_POSITION || elements[0].type != ELEM_VECTOR3)
+            return false;
+        // Reduced precision normals and tangents can not be transformed
+        for (auto it = elements.begin(); it != elements.end(); ++it)
+        {
+            if ((it->semantic == SEM_NORMAL && it->type != ELEM_VECTOR3) || (it->semantic == SEM_TANGENT && it->type != ELEM_VECTOR4))
+                return false;
+        }
+
+        unsigned first, last;
+        GetVertexRange(geom, first, last);
+        if (last - first + 1 > MAX_BATCH_VERTICES)
+            return false;
+    }
+
+    return true;
+}
+
+/// Append a source geometry to a static batch being built, transforming the vertices.
+static void AppendGeometry(StaticBatchBuildData& data, const Geometry* geom, const Matrix3x4& transform, unsigned first, unsigned last)
+{
+    const std::vector<VertexElement>& elements = geom->vertexBuffer->Elements();
+    size_t vertexSize = geom->vertexBuffer->VertexSize();
+    Matrix3 rotation = transform.ToMatrix3();
+    Matrix3 normalTransform = rotation.Inverse().Transpose();
+    // Mirroring transforms flip the triangle winding
+    bool flip = rotation.m00 * (rotation.m11 * rotation.m22 - rotation.m12 * rotation.m21) - rotation.m01 * (rotation.m10 * rotation.m22 -
+        rotation.m12 * rotation.m20) + rotation.m02 * (rotation.m10 * rotation.m21 - rotation.m11 * rotation.m20) < 0.0f;
+
+    // Copy and transform only the used vertices
+    std::vector<unsigned> remap(last - first + 1, M_MAX_UNSIGNED);
+    size_t numVertices = 0;
+
+    if (geom->cpuIndexData)
+    {
+        for (size_t i = geom->cpuDrawStart; i < geom->cpuDrawStart + geom->drawCount; ++i)
+        {
+            unsigned index = geom->cpuIndexSize == sizeof(unsigned short) ? ((const unsigned short*)geom->cpuIndexData.Get())[i] :
+                ((const unsigned*)geom->cpuIndexData.Get())[i];
+            if (remap[index - first] == M_MAX_UNSIGNED)
+                remap[index - first] = (unsigned)(data.numVertices + numVertices++);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < remap.size(); ++i)
+            remap[i] = (unsigned)(data.numVertices + numVertices++);
+    }
+
+    data.vertexData.resize((data.numVertices + numVertices) * vertexSize);
+
+    for (size_t i = 0; i < remap.size(); ++i)
+    {
+        if (remap[i] == M_MAX_UNSIGNED)
+            continue;
+
+        const unsigned char* src = geom->cpuVertexData.Get() + (first + i) * vertexSize;
+        unsigned char* dest = &data.vertexData[remap[i] * vertexSize];
+        memcpy(dest, src, vertexSize);
+
+        for (auto it = elements.begin(); it != elements.end(); ++it)
+        {
+            if (it->semantic == SEM_POSITION && it->type == ELEM_VECTOR3)
+            {
+                Vector3& position = *reinterpret_cast<Vector3*>(dest + it->offset);
+                position = transform * position;
+                data.boundingBox.Merge(position);
+            }
+            else if (it->semantic == SEM_NORMAL && it->type == ELEM_VECTOR3)
+            {
+                Vector3& normal = *reinterpret_cast<Vector3*>(dest + it->offset);
+                normal = (normalTransform * normal).Normalized();
+            }
+            else if (it->semantic == SEM_TANGENT && it->type == ELEM_VECTOR4)
+            {
+                Vector4& tangent = *reinterpret_cast<Vector4*>(dest + it->offset);
+                Vector3 newTangent = (rotation * Vector3(tangent.x, tangent.y, tangent.z)).Normalized();
+                tangent = Vector4(newTangent, flip ? -tangent.w : tangent.w);
+            }
+        }
+    }
+
+    size_t triangleStart = data.indexData.size();
+
+    if (geom->cpuIndexData)
+    {
+        for (size_t i = geom->cpuDrawStart; i < geom->cpuDrawStart + geom->drawCount; ++i)
+        {
+            unsigned index = geom->cpuIndexSize == sizeof(unsigned short) ? ((const unsigned short*)geom->cpuIndexData.Get())[i] :
+                ((const unsigned*)geom->cpuIndexData.Get())[i];
+            data.indexData.push_back((unsigned short)remap[index - first]);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < numVertices; ++i)
+            data.indexData.push_back((unsigned short)(data.numVertices + i));
+    }
+
+    if (flip)
+    {
+        for (size_t i = triangleStart; i + 2 < data.indexData.size(); i += 3)
+            std::swap(data.indexData[i + 1], data.indexData[i + 2]);
+    }
+
+    data.numVertices += numVertices;
+    ++data.numSourceGeometries;
+}
+
+/// Create a static batch node from the built data.
+static void CreateStaticBatch(Node* root, const StaticBatchKey& key, const std::vector<VertexElement>& elements, StaticBatchBuildData& data)
+{
+    size_t vertexSize = key.vertexSize;
+
+    SharedPtr<Geometry> geom(new Geometry());
+    geom->vertexBuffer = new VertexBuffer();
+    geom->vertexBuffer->Define(USAGE_DEFAULT, data.numVertices, elements, &data.vertexData[0]);
+    geom->indexBuffer = new IndexBuffer();
+    geom->indexBuffer->Define(USAGE_DEFAULT, data.indexData.size(), sizeof(unsigned short), &data.indexData[0]);
+    geom->drawStart = 0;
+    geom->drawCount = data.indexData.size();
+
+    // Retain CPU-side positions and indices for raycasts. Batches are never merged again, so the full vertex data is not needed
+    geom->cpuPositionData = new Vector3[data.numVertices];
+    for (size_t i = 0; i < data.numVertices; ++i)
+        geom->cpuPositionData[i] = *reinterpret_cast<Vector3*>(&data.vertexData[i * vertexSize]);
+    geom->cpuIndexData = new unsigned char[data.indexData.size() * sizeof(unsigned short)];
+    memcpy(geom->cpuIndexData.Get(), &data.indexData[0], data.indexData.size() * sizeof(unsigned short));
+    geom->cpuIndexSize = sizeof(unsigned short);
+    geom->cpuDrawStart = 0;
+
+    // Fill the batch before adding to the scene, so that it enters the octree with the correct bounding box
+    StaticBatch* batch = Object::Create<StaticBatch>();
+    batch->SetTemporary(true);
+    batch->SetStatic(true);
+    batch->SetLayer(key.layer);
+    batch->SetCastShadows(key.castShadows);
+    batch->SetMaxDistance(data.maxDistance);
+    batch->SetMergedGeometry(geom, key.material, data.boundingBox, data.numSourceGeometries);
+    root->AddChild(batch);
+
+    data = StaticBatchBuildData();
+}
+
+StaticBatchDrawable::StaticBatchDrawable() :
+    numSourceGeometries(0)
+{
+}
+
+void StaticBatchDrawable::OnWorldBoundingBoxUpdate() const
+{
+    if (localBoundingBox.IsDefined())
+        worldBoundingBox = localBoundingBox.Transformed(WorldTransform());
+    else
+        Drawable::OnWorldBoundingBoxUpdate();
+}
+
+bool StaticBatchDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+{
+    // Use the bounding box center for distance, as the node position does not correspond to the merged geometry
+    distance = camera->Distance(WorldBoundingBox().Center());
+
+    if (maxDistance > 0.0f && distance > maxDistance)
+        return false;
+
+    lastFrameNumber = frameNumber;
+    return true;
+}
+
+void StaticBatchDrawable::OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance_)
+{
+    if (ray.HitDistance(WorldBoundingBox()) < maxDistance_)
+    {
+        RaycastResult res;
+        res.distance = M_INFINITY;
+
+        const Matrix3x4& transform = WorldTransform();
+        Ray localRay = ray.Transformed(transform.Inverse());
+
+        size_t numGeometries = batches.NumGeometries();
+
+        for (size_t i = 0; i < numGeometries; ++i)
+        {
+            Geometry* geom = batches.GetGeometry(i);
+            float localDistance = geom->HitDistance(localRay, &res.normal);
+
+            if (localDistance < M_INFINITY)
+            {
+                Vector3 hitPosition = transform * (localRay.origin + localDistance * localRay.direction);
+                float hitDistance = (hitPosition - ray.origin).Length();
+
+                if (hitDistance < maxDistance_ && hitDistance < res.distance)
+                {
+                    res.position = hitPosition;
+                    res.normal = (transform * Vector4(res.normal, 0.0f)).Normalized();
+                    res.distance = hitDistance;
+                    res.drawable = this;
+                    res.subObject = i;
+                }
+            }
+        }
+
+        if (res.distance < maxDistance_)
+            dest.push_back(res);
+    }
+}
+
+StaticBatch::StaticBatch()
+{
+    drawable = drawableAllocator.Allocate();
+    drawable->SetOwner(this);
+}
+
+StaticBatch::~StaticBatch()
+{
+    if (drawable)
+    {
+        RemoveFromOctree();
+        drawableAllocator.Free(static_cast<StaticBatchDrawable*>(drawable));
+        drawable = nullptr;
+    }
+}
+
+void StaticBatch::RegisterObject()
+{
+    RegisterFactory<StaticBatch>();
+    // The merged geometry is not serialized, so only copy the base attributes from OctreeNode
+    CopyBaseAttributes<StaticBatch, OctreeNode>();
+    RegisterDerivedType<StaticBatch, GeometryNode>();
+}
+
+void StaticBatch::SetMergedGeometry(Geometry* geometry, Material* material, const BoundingBox& boundingBox, size_t numSourceGeometries)
+{
+    StaticBatchDrawable* batchDrawable = static_cast<StaticBatchDrawable*>(drawable);
+
+    batchDrawable->geometries.clear();
+    batchDrawable->geometries.push_back(SharedPtr<Geometry>(geometry));
+    batchDrawable->localBoundingBox = boundingBox;
+    batchDrawable->numSourceGeometries = numSourceGeometries;
+
+    SetNumGeometries(1);
+    SetGeometry(0, geometry);
+    SetMaterial(0, material);
+    OnBoundingBoxChanged();
+}
+
+size_t StaticBatch::MergeStaticModels(Node* root, float cellSize)
+{
+    ZoneScoped;
+
+    if (!root)
+        return 0;
+
+    cellSize = Max(cellSize, M_EPSILON);
+
+    std::vector<StaticModel*> models;
+    root->FindChildren(models, true);
+
+    Matrix3x4 invRootTransform = root->TestFlag(NF_SPATIAL) ? static_cast<SpatialNode*>(root)->WorldTransform().Inverse() : Matrix3x4::IDENTITY;
+
+    std::map<StaticBatchKey, std::vector<std::pair<StaticModel*, size_t> > > groups;
+    std::vector<StaticModel*> mergedModels;
+
+    for (auto it = models.begin(); it != models.end(); ++it)
+    {
+        StaticModel* model = *it;
+        if (!CanMergeStaticModel(model))
+            continue;
+
+        Vector3 center = model->WorldBoundingBox().Center();
+
+        StaticBatchKey key;
+        key.layer = model->Layer();
+        key.castShadows = model->CastShadows();
+        key.cell = IntVector3((int)floorf(center.x / cellSize), (int)floorf(center.y / cellSize), (int)floorf(center.z / cellSize));
+
+        for (size_t i = 0; i < model->NumGeometries(); ++i)
+        {
+            Geometry* geom = model->GetGeometry(i);
+            key.material = model->GetMaterial(i);
+            key.attributes = geom->vertexBuffer->Attributes();
+            key.vertexSize = geom->vertexBuffer->VertexSize();
+            groups[key].push_back(std::make_pair(model, i));
+        }
+
+        mergedModels.push_back(model);
+    }
+
+    size_t numBatches = 0;
+
+    for (auto it = groups.begin(); it != groups.end(); ++it)
+    {
+        const StaticBatchKey& key = it->first;
+        const std::vector<VertexElement>& elements = it->second.front().first->GetGeometry(it->second.front().second)->vertexBuffer->Elements();
+        StaticBatchBuildData data;
+
+        for (auto gIt = it->second.begin(); gIt != it->second.end(); ++gIt)
+        {
+            StaticModel* model = gIt->first;
+            Geometry* geom = model->GetGeometry(gIt->second);
+
+            unsigned first, last;
+            GetVertexRange(geom, first, last);
+
+            // Start a new batch if the vertices would not fit
+            if (data.numVertices + (last - first + 1) > MAX_BATCH_VERTICES)
+            {
+                CreateStaticBatch(root, key, elements, data);
+                ++numBatches;
+            }
+
+            if (!data.numSourceGeometries)
+                data.maxDistance = model->MaxDistance();
+            else if (data.maxDistance > 0.0f)
+                data.maxDistance = model->MaxDistance() > 0.0f ? Max(data.maxDistance, model->MaxDistance()) : 0.0f;
+
+            AppendGeometry(data, geom, invRootTransform * model->GetDrawable()->WorldTransform(), first, last);
+        }
+
+        if (data.numSourceGeometries)
+        {
+            CreateStaticBatch(root, key, elements, data);
+            ++numBatches;
+        }
+    }
+
+    for (auto it = mergedModels.begin(); it != mergedModels.end(); ++it)
+        (*it)->SetEnabled(false);
+
+    LOGINFOF("Merged %d static models into %d static batches", (int)mergedModels.size(), (int)numBatches);
+
+    return numBatches;
+}
@@ -0,0 +1,56 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "GeometryNode.h"
+
+class Node;
+
+/// Static batch drawable. Renders geometry merged from several static models, with vertices pre-transformed to the batch node's space.
+class StaticBatchDrawable : public GeometryDrawable
+{
+    friend class StaticBatch;
+
+public:
+    /// Construct.
+    StaticBatchDrawable();
+
+    /// Recalculate the world space bounding box.
+    void OnWorldBoundingBoxUpdate() const override;
+    /// Prepare object for rendering. Reset framenumber and calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Perform ray test on self and add possible hit to the result vector.
+    void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance) override;
+
+protected:
+    /// Merged geometries. Held here as the batches only hold raw pointers.
+    std::vector<SharedPtr<Geometry> > geometries;
+    /// Bounding box of the merged geometry in the batch node's space.
+    BoundingBox localBoundingBox;
+    /// Number of source geometries merged.
+    size_t numSourceGeometries;
+};
+
+/// %Scene node that renders static geometry merged at load time from static models sharing a material. Reduces octree drawable count, culling cost and batch count. Batch nodes are temporary and are not saved; merge again after loading a scene.
+class StaticBatch : public GeometryNode
+{
+    OBJECT(StaticBatch);
+
+public:
+    /// Construct.
+    StaticBatch();
+    /// Destruct.
+    ~StaticBatch();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Merge enabled static models in the child hierarchy of a root node into static batches, which are created as children of the root node. Models are grouped by material, vertex format, layer, shadow casting and grid cell of the given size. Models with LOD levels or without CPU-side vertex data are skipped; enable Model::SetRetainVertexData() before loading the models. The merged models are disabled. Return number of batches created.
+    static size_t MergeStaticModels(Node* root, float cellSize = 50.0f);
+
+    /// Set the merged geometry with vertices in the node's space, its material and bounding box. Called by MergeStaticModels().
+    void SetMergedGeometry(Geometry* geometry, Material* material, const BoundingBox& boundingBox, size_t numSourceGeometries);
+
+    /// Return number of source model geometries merged into this batch.
+    size_t NumSourceGeometries() const { return static_cast<StaticBatchDrawable*>(drawable)->numSourceGeometries; }
+};
@@ -43,24 +43,34 @@ bool StaticModelDrawable::OnPrepareRender(unsigned short frameNumber, Camera* ca
     if (Flags() & DF_HAS_LOD_LEVELS)
     {
         float lodDistance = camera->LodDistance(distance, WorldScale().DotProduct(DOT_SCALE), lodBias);
+        float hysteresis = camera->LodHysteresis();
         size_t numGeometries = batches.NumGeometries();
+        lodLevel = 0;
 
         for (size_t i = 0; i < numGeometries; ++i)
         {
             const std::vector<SharedPtr<Geometry> >& lodGeometries = model->LodGeometries(i);
             if (lodGeometries.size() > 1)
             {
+                Geometry* current = batches.GetGeometry(i);
+                size_t currentLevel = 0;
+                while (currentLevel < lodGeometries.size() - 1 && lodGeometries[currentLevel] != current)
+                    ++currentLevel;
+
+                // Apply hysteresis: transitions to lower quality happen further away, and back to higher quality closer than the nominal distance
                 size_t j;
                 for (j = 1; j < lodGeometries.size(); ++j)
                 {
-                    if (lodDistance <= lodGeometries[j]->lodDistance)
+                    float transition = lodGeometries[j]->lodDistance * (j <= currentLevel ? 1.0f - hysteresis : 1.0f + hysteresis);
+                    if (lodDistance <= transition)
                         break;
                 }
-                if (batches.GetGeometry(i) != lodGeometries[j - 1])
+                if (current != lodGeometries[j - 1])
                 {
                     batches.SetGeometry(i, lodGeometries[j - 1]);
                     lastUpdateFrameNumber = frameNumber;
                 }
+                lodLevel = (unsigned char)Max((size_t)lodLevel, j - 1);
             }
         }
     }
@@ -22,6 +22,9 @@ public:
     /// Perform ray test on self and add possible hit to the result vector.
     void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance) override;
 
+    /// Return the model resource.
+    Model* GetModel() const { return model; }
+
 protected:
     /// Current model resource.
     SharedPtr<Model> model;
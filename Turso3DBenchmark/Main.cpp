@@ -0,0 +1,243 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Graphics/Graphics.h"
+#include "IO/Arguments.h"
+#include "IO/FileSystem.h"
+#include "IO/Log.h"
+#include "IO/StringUtils.h"
+#include "Math/Math.h"
+#include "Math/Random.h"
+#include "Renderer/AnimatedModel.h"
+#include "Renderer/Animation.h"
+#include "Renderer/AnimationPoseCache.h"
+#include "Renderer/AnimationState.h"
+#include "Renderer/AnimationSystem.h"
+#include "Renderer/Camera.h"
+#include "Renderer/Model.h"
+#include "Renderer/Renderer.h"
+#include "Resource/ResourceCache.h"
+#include "Scene/Scene.h"
+#include "Time/Profiler.h"
+#include "Time/Timer.h"
+#include "../Turso3DTest/TestScene.h"
+
+#include <cstring>
+
+// Render size of the headless view
+static const IntVector2 BENCHMARK_RENDER_SIZE(1920, 1080);
+// Number of scene presets in the test application
+static const int NUM_PRESETS = 3;
+// Frames to run before measuring, to let static shadow maps and the shadow atlas settle
+static const int WARMUP_FRAMES = 10;
+// Frames to measure per preset
+static const int BENCHMARK_FRAMES = 100;
+// Fixed animation timestep
+static const float FRAME_TIME = 1.0f / 60.0f;
+// Animated model instances in the animation sampling benchmark
+static const int ANIMATION_INSTANCES = 2000;
+// Frames to measure in the animation sampling benchmark
+static const int ANIMATION_FRAMES = 50;
+// Distinct time positions of the instances in the shared pose benchmark
+static const int SHARED_POSE_PHASES = 16;
+
+/// Evaluate the walk animation on many animated model instances on the main thread, with spherical and normalized linear rotation interpolation, with compressed keyframes, and with poses shared between instances at a few distinct time positions, and log the time taken.
+static void BenchmarkAnimation(ResourceCache* cache, AnimationPoseCache* poseCache)
+{
+    Model* model = cache->LoadResource<Model>("Jack.mdl");
+    Animation* animation = cache->LoadResource<Animation>("Jack_Walk.ani");
+    if (!model || !animation)
+        return;
+
+    SharedPtr<Scene> scene = Object::Create<Scene>();
+    std::vector<AnimatedModel*> objects;
+    SetRandomSeed(1);
+
+    for (int i = 0; i < ANIMATION_INSTANCES; ++i)
+    {
+        AnimatedModel* object = scene->CreateChild<AnimatedModel>();
+        object->SetModel(model);
+        AnimationState* state = object->AddAnimationState(animation);
+        state->SetWeight(1.0f);
+        state->SetLooped(true);
+        state->SetTime(Random(animation->Length()));
+        objects.push_back(object);
+    }
+
+    const char* passNames[] = { "slerp", "nlerp", "compressed nlerp", "shared compressed nlerp" };
+
+    for (int pass = 0; pass < 4; ++pass)
+    {
+        if (pass == 2)
+            animation->Compress();
+
+        // Sharing poses needs the instances to play in step, so quantize their start times to a few phases
+        poseCache->SetEnabled(pass == 3);
+        if (pass == 3)
+        {
+            for (auto it = objects.begin(); it != objects.end(); ++it)
+                (*it)->AnimationStates()[0]->SetTime(Random(SHARED_POSE_PHASES) * animation->Length() / SHARED_POSE_PHASES);
+        }
+
+        for (auto it = objects.begin(); it != objects.end(); ++it)
+            (*it)->AnimationStates()[0]->SetNormalizedLerp(pass != 0);
+
+        HiresTimer timer;
+
+        for (int frame = 0; frame < ANIMATION_FRAMES; ++frame)
+        {
+            poseCache->BeginFrame();
+
+            for (auto it = objects.begin(); it != objects.end(); ++it)
+            {
+                AnimatedModel* object = *it;
+                object->AnimationStates()[0]->AddTime(FRAME_TIME);
+                static_cast<AnimatedModelDrawable*>(object->GetDrawable())->UpdateAnimation();
+            }
+        }
+
+        float frameMs = 0.001f * timer.ElapsedUSec() / ANIMATION_FRAMES;
+        LOGINFOF("Animation %s: %d instances of %d bones, %.3f ms per frame, %.3f us per instance", passNames[pass], ANIMATION_INSTANCES,
+            (int)model->Bones().size(), frameMs, 1000.0f * frameMs / ANIMATION_INSTANCES);
+    }
+
+    poseCache->BeginFrame();
+    const AnimationPoseCacheStatistics& poseStats = poseCache->Statistics();
+    LOGINFOF("  Pose cache lookups %d hits %d poses %d per frame", (int)poseStats.numLookups, (int)poseStats.numHits, (int)poseStats.numPoses);
+}
+
+/// Run the scene presets of the test application without a window or GPU, and log the average time of each view preparation stage along with the recorded draw calls. Then run the animation sampling benchmark.
+int ApplicationMain(const std::vector<std::string>& arguments)
+{
+    bool useThreads = true;
+    bool useOcclusion = false;
+    bool useAnimationSystem = true;
+
+    for (size_t i = 1; i < arguments.size(); ++i)
+    {
+        if (arguments[i].find("nothreads") != std::string::npos)
+            useThreads = false;
+        if (arguments[i].find("occlusion") != std::string::npos)
+            useOcclusion = true;
+        if (arguments[i].find("noanimationsystem") != std::string::npos)
+            useAnimationSystem = false;
+        if (arguments[i].find("dualquaternion") != std::string::npos)
+            SetDualQuaternionSkinning(true);
+    }
+
+    AutoPtr<WorkQueue> workQueue = new WorkQueue(useThreads ? 0 : 1);
+    AutoPtr<Profiler> profiler = new Profiler();
+    AutoPtr<Log> log = new Log();
+    AutoPtr<ResourceCache> cache = new ResourceCache();
+    cache->AddResourceDir(ExecutableDir() + "Data");
+
+    // Headless graphics: GPU objects are defined but not created, and draw calls are only recorded
+    AutoPtr<Graphics> graphics = new Graphics(BENCHMARK_RENDER_SIZE);
+    AutoPtr<Renderer> renderer = new Renderer();
+    AutoPtr<AnimationPoseCache> poseCache = new AnimationPoseCache();
+    AutoPtr<AnimationSystem> animationSystem = useAnimationSystem ? new AnimationSystem() : nullptr;
+    renderer->SetupShadowMaps(1024, 2048, FMT_D16);
+
+    // Preset 0 merges its static models into static batches, which needs their vertex data
+    Model::SetRetainVertexData(true);
+
+    SharedPtr<Scene> scene = Object::Create<Scene>();
+    SharedPtr<Camera> camera = Object::Create<Camera>();
+
+    LOGINFOF("View preparation benchmark, %d threads, occlusion %s, animation system %s, %s skinning", (int)workQueue->NumThreads(), useOcclusion ? "on" : "off",
+        useAnimationSystem ? "on" : "off", DualQuaternionSkinning() ? "dual quaternion" : "matrix");
+
+    for (int preset = 0; preset < NUM_PRESETS; ++preset)
+    {
+        CreateScene(scene, camera, preset);
+        camera->SetPosition(Vector3(0.0f, 20.0f, -75.0f));
+        camera->SetRotation(Quaternion(20.0f, 0.0f, 0.0f));
+        camera->SetAspectRatio((float)BENCHMARK_RENDER_SIZE.x / (float)BENCHMARK_RENDER_SIZE.y);
+
+        PrepareViewStatistics sum;
+        size_t poseLookups = 0;
+        size_t poseHits = 0;
+        size_t animationUpdates = 0;
+        size_t boundsUpdates = 0;
+        size_t skinMatrixBytes = 0;
+        size_t animationLodLevels[NUM_ANIMATION_LOD_STATS_LEVELS] = { 0 };
+        float angle = 0.0f;
+        float animateTime = 0.0f;
+        float renderTime = 0.0f;
+        HiresTimer timer;
+
+        for (int frame = 0; frame < WARMUP_FRAMES + BENCHMARK_FRAMES; ++frame)
+        {
+            if (frame == WARMUP_FRAMES)
+                graphics->ResetStatistics();
+
+            timer.Reset();
+            AnimateScene(FRAME_TIME, angle);
+            float animateMs = 0.001f * timer.ElapsedUSec();
+
+            renderer->PrepareView(scene, camera, true, useOcclusion);
+
+            timer.Reset();
+            graphics->SetViewport(IntRect(0, 0, BENCHMARK_RENDER_SIZE.x, BENCHMARK_RENDER_SIZE.y));
+            renderer->RenderShadowMaps();
+            renderer->RenderOpaque();
+            renderer->RenderAlpha();
+            graphics->Present();
+            float renderMs = 0.001f * timer.ElapsedUSec();
+
+            if (frame < WARMUP_FRAMES)
+                continue;
+
+            const PrepareViewStatistics& stats = renderer->PrepareViewStats();
+            const LodStatistics& lodStats = renderer->LodStats();
+            animationUpdates += lodStats.numAnimationUpdates;
+            if (animationSystem)
+                boundsUpdates += animationSystem->NumBoundsUpdates();
+            skinMatrixBytes += renderer->SkinMatrixBytes();
+            for (size_t i = 0; i < NUM_ANIMATION_LOD_STATS_LEVELS; ++i)
+                animationLodLevels[i] += lodStats.animationLodLevels[i];
+            sum.animationUpdate += stats.animationUpdate;
+            sum.octreeUpdate += stats.octreeUpdate;
+            sum.octantsCollected += stats.octantsCollected;
+            sum.lightsProcessed += stats.lightsProcessed;
+            sum.mainBatchesSorted += stats.mainBatchesSorted;
+            for (size_t i = 0; i < NUM_SHADOW_MAPS; ++i)
+                sum.shadowBatchesSorted[i] += stats.shadowBatchesSorted[i];
+            sum.total += stats.total;
+            animateTime += animateMs;
+            renderTime += renderMs;
+            // Pose cache statistics are available for the previous frame
+            if (frame > WARMUP_FRAMES)
+            {
+                poseLookups += poseCache->Statistics().numLookups;
+                poseHits += poseCache->Statistics().numHits;
+            }
+        }
+
+        float invFrames = 1.0f / BENCHMARK_FRAMES;
+        const GraphicsStatistics& graphicsStats = graphics->Statistics();
+
+        LOGINFOF("Preset %d: animate %.3f ms, prepare view %.3f ms, render %.3f ms", preset, animateTime * invFrames, sum.total * invFrames, renderTime * invFrames);
+        LOGINFOF("  Stages finished at: animation update %.3f octree update %.3f octants %.3f lights %.3f main batches %.3f dir shadow batches %.3f atlas shadow batches %.3f ms",
+            sum.animationUpdate * invFrames, sum.octreeUpdate * invFrames, sum.octantsCollected * invFrames, sum.lightsProcessed * invFrames, sum.mainBatchesSorted * invFrames,
+            sum.shadowBatchesSorted[0] * invFrames, sum.shadowBatchesSorted[1] * invFrames);
+        LOGINFOF("  Per frame: draws %d instanced %d instances %d state changes %d framebuffer changes %d clears %d occlusion queries %d",
+            (int)(graphicsStats.numDraws / BENCHMARK_FRAMES), (int)(graphicsStats.numInstancedDraws / BENCHMARK_FRAMES), (int)(graphicsStats.numInstances / BENCHMARK_FRAMES),
+            (int)(graphicsStats.numStateChanges / BENCHMARK_FRAMES), (int)(graphicsStats.numFrameBufferChanges / BENCHMARK_FRAMES), (int)(graphicsStats.numClears / BENCHMARK_FRAMES),
+            (int)(graphicsStats.numOcclusionQueries / BENCHMARK_FRAMES));
+        LOGINFOF("  Pose cache: lookups %d hits %d (%.1f%%) per frame", (int)(poseLookups / (BENCHMARK_FRAMES - 1)), (int)(poseHits / (BENCHMARK_FRAMES - 1)),
+            poseLookups ? 100.0f * poseHits / poseLookups : 0.0f);
+        LOGINFOF("  Animated models per update interval 1/2/4/8 frames: %d %d %d %d, updated %d, bounds only %d per frame", (int)(animationLodLevels[0] / BENCHMARK_FRAMES),
+            (int)(animationLodLevels[1] / BENCHMARK_FRAMES), (int)(animationLodLevels[2] / BENCHMARK_FRAMES), (int)(animationLodLevels[3] / BENCHMARK_FRAMES),
+            (int)(animationUpdates / BENCHMARK_FRAMES), (int)(boundsUpdates / BENCHMARK_FRAMES));
+        LOGINFOF("  Skinning data: %d bytes uploaded at once per frame", (int)(skinMatrixBytes / BENCHMARK_FRAMES));
+    }
+
+    BenchmarkAnimation(cache, poseCache);
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    return ApplicationMain(ParseArguments(argc, argv));
+}
@@ -3,226 +3,259 @@
 #include "Graphics/Texture.h"
 #include "Input/Input.h"
 #include "IO/Arguments.h"
+#include "IO/File.h"
 #include "IO/FileSystem.h"
 #include "IO/Log.h"
+#include "IO/MemoryBuffer.h"
 #include "IO/StringUtils.h"
 #include "Math/Math.h"
 #include "Math/Random.h"
 #include "Renderer/AnimatedModel.h"
 #include "Renderer/Animation.h"
+#include "Renderer/AnimationPoseCache.h"
 #include "Renderer/AnimationState.h"
+#include "Renderer/AnimationSystem.h"
 #include "Renderer/Camera.h"
 #include "Renderer/DebugRenderer.h"
 #include "Renderer/Light.h"
 #include "Renderer/LightEnvironment.h"
+#include "Renderer/LightGrid.h"
 #include "Renderer/Material.h"
 #include "Renderer/Model.h"
 #include "Renderer/Octree.h"
 #include "Renderer/Renderer.h"
 #include "Resource/ResourceCache.h"
+#include "Renderer/StaticBatch.h"
 #include "Renderer/StaticModel.h"
 #include "Scene/Scene.h"
 #include "Time/Timer.h"
 #include "Time/Profiler.h"
 #include "Thread/ThreadUtils.h"
+#include "TestScene.h"
 
 #include <SDL.h>
+#include <cstring>
 #include <tracy/Tracy.hpp>
 
-std::vector<StaticModel*> rotatingObjects;
-std::vector<AnimatedModel*> animatingObjects;
+// Number of loads per model in the model format benchmark
+static const int MODEL_BENCHMARK_LOADS = 100;
+// Number of iterations per light count in the light culling benchmark
+static const int LIGHT_BENCHMARK_ITERATIONS = 100;
+// Shadow update time slicing settings: caster batch budget, low priority light interval and threshold, directional cascade interval
+static const size_t SHADOW_UPDATE_BUDGET = 2000;
+static const int SHADOW_UPDATE_LIGHT_INTERVAL = 4;
+static const float SHADOW_UPDATE_PRIORITY_THRESHOLD = 0.01f;
+static const int SHADOW_UPDATE_CASCADE_INTERVAL = 2;
+// Light importance settings: shadowed light count, and importance thresholds for dropping, fading, shadowing and full resolution shadows
+static const size_t LIGHT_LOD_MAX_SHADOWED = 32;
+static const float LIGHT_LOD_MIN_IMPORTANCE = 0.0001f;
+static const float LIGHT_LOD_FADE_IMPORTANCE = 0.0005f;
+static const float LIGHT_LOD_SHADOW_IMPORTANCE = 0.002f;
+static const float LIGHT_LOD_FULL_SHADOW_IMPORTANCE = 0.02f;
+
+/// Read a whole file to memory.
+std::vector<unsigned char> ReadFileData(const std::string& fileName)
+{
+    File file(fileName);
+    std::vector<unsigned char> data(file.Size());
+    if (data.size())
+        file.Read(&data[0], data.size());
+    return data;
+}
 
-void CreateScene(Scene* scene, Camera* camera, int preset)
+/// Return average load time of a model from memory in microseconds, excluding the GPU upload.
+float BenchmarkModelLoad(const std::vector<unsigned char>& data, const std::string& name)
 {
-    rotatingObjects.clear();
-    animatingObjects.clear();
+    HiresTimer timer;
 
-    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    for (int i = 0; i < MODEL_BENCHMARK_LOADS; ++i)
+    {
+        MemoryBuffer buffer(data);
+        buffer.SetName(name);
+        Model model;
+        model.BeginLoad(buffer);
+    }
 
-    scene->Clear();
-    scene->CreateChild<Octree>();
-    LightEnvironment* lightEnvironment = scene->CreateChild<LightEnvironment>();
+    return (float)timer.ElapsedUSec() / MODEL_BENCHMARK_LOADS;
+}
 
-    SetRandomSeed(1);
+/// Convert the Urho3D format models in a directory to the native format and log the load time of both.
+void ConvertModels(const std::string& pathName)
+{
+    std::vector<std::string> fileNames;
+    ScanDir(fileNames, pathName, "*.mdl", SCAN_FILES);
 
-    // Preset 0: occluders, static meshes and many local shadowcasting lights in addition to ambient light
-    if (preset == 0)
+    for (auto it = fileNames.begin(); it != fileNames.end(); ++it)
     {
-        lightEnvironment->SetAmbientColor(Color(0.3f, 0.3f, 0.3f));
-        camera->SetFarClip(1000.0f);
-
-        for (int y = -55; y <= 55; ++y)
-        {
-            for (int x = -55; x <= 55; ++x)
-            {
-                StaticModel* object = scene->CreateChild<StaticModel>();
-                object->SetStatic(true);
-                object->SetPosition(Vector3(10.5f * x, -0.05f, 10.5f * y));
-                object->SetScale(Vector3(10.0f, 0.1f, 10.0f));
-                object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-                object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
-            }
-        }
+        std::string sourceName = pathName + *it;
+        std::string destName = ReplaceExtension(sourceName, ".tmdl");
 
-        for (unsigned i = 0; i < 10000; ++i)
         {
-            StaticModel* object = scene->CreateChild<StaticModel>();
-            object->SetStatic(true);
-            object->SetPosition(Vector3(Random() * 1000.0f - 500.0f, 0.0f, Random() * 1000.0f - 500.0f));
-            object->SetScale(1.5f);
-            object->SetModel(cache->LoadResource<Model>("Mushroom.mdl"));
-            object->SetMaterial(cache->LoadResource<Material>("Mushroom.json"));
-            object->SetCastShadows(true);
-            object->SetLodBias(2.0f);
-            object->SetMaxDistance(600.0f);
+            File source(sourceName);
+            Model model;
+            if (!model.BeginLoad(source))
+                continue;
+
+            File dest(destName, FILE_WRITE);
+            if (!dest.IsOpen() || !model.Save(dest))
+                continue;
         }
 
-        Vector3 quadrantCenters[] = 
-        {
-            Vector3(-290.0f, 0.0f, -290.0f),
-            Vector3(290.0f, 0.0f, -290.0f),
-            Vector3(-290.0f, 0.0f, 290.0f),
-            Vector3(290.0f, 0.0f, 290.0f),
-        };
+        std::vector<unsigned char> sourceData = ReadFileData(sourceName);
+        std::vector<unsigned char> destData = ReadFileData(destName);
+        float sourceTime = BenchmarkModelLoad(sourceData, sourceName);
+        float destTime = BenchmarkModelLoad(destData, destName);
 
-        std::vector<Light*> lights;
+        LOGINFOF("Converted %s to %s: %d bytes loaded in %.1f us, native %d bytes loaded in %.1f us", it->c_str(), FileNameAndExtension(destName).c_str(),
+            (int)sourceData.size(), sourceTime, (int)destData.size(), destTime);
+    }
+}
 
-        for (unsigned i = 0; i < 100; ++i)
-        {
-            Light* light = scene->CreateChild<Light>();
-            light->SetStatic(true);
-            light->SetLightType(LIGHT_POINT);
-            light->SetCastShadows(true);
-            Vector3 colorVec = 2.0f * Vector3(Random(), Random(), Random()).Normalized();
-            light->SetColor(Color(colorVec.x, colorVec.y, colorVec.z, 0.5f));
-            light->SetRange(40.0f);
-            light->SetShadowMapSize(256);
-            light->SetShadowMaxDistance(200.0f);
-            light->SetMaxDistance(900.0f);
-
-            for (;;)
-            {
-                Vector3 newPos = quadrantCenters[i % 4] + Vector3(Random() * 500.0f - 250.0f, 10.0f, Random() * 500.0f - 250.0f);
-                bool posOk = true;
-
-                for (unsigned j = 0; j < lights.size(); ++j)
-                {
-                    if ((newPos - lights[j]->Position()).Length() < 80.0f)
-                    {
-                        posOk = false;
-                        break;
-                    }
-                }
-
-                if (posOk)
-                {
-                    light->SetPosition(newPos);
-                    break;
-                }
-            }
+/// Convert the Urho3D format animations in a directory to the native compressed format. Compression logs the memory use and maximum error of each animation.
+void ConvertAnimations(const std::string& pathName)
+{
+    std::vector<std::string> fileNames;
+    ScanDir(fileNames, pathName, "*.ani", SCAN_FILES);
 
-            lights.push_back(light);
-        }
+    for (auto it = fileNames.begin(); it != fileNames.end(); ++it)
+    {
+        std::string sourceName = pathName + *it;
+        std::string destName = ReplaceExtension(sourceName, ".tani");
 
         {
-            StaticModel* object = scene->CreateChild<StaticModel>();
-            object->SetStatic(true);
-            object->SetPosition(Vector3(0.0f, 25.0f, 0.0f));
-            object->SetScale(Vector3(1165.0f, 50.0f, 1.0f));
-            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
-            object->SetCastShadows(true);
+            File source(sourceName);
+            Animation animation;
+            animation.SetName(*it);
+            if (!animation.BeginLoad(source))
+                continue;
+
+            File dest(destName, FILE_WRITE);
+            if (!dest.IsOpen() || !animation.Save(dest))
+                continue;
         }
 
-        {
-            StaticModel* object = scene->CreateChild<StaticModel>();
-            object->SetStatic(true);
-            object->SetPosition(Vector3(0.0f, 25.0f, 0.0f));
-            object->SetScale(Vector3(1.0f, 50.0f, 1165.0f));
-            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
-            object->SetCastShadows(true);
-        }
+        LOGINFOF("Converted %s to %s: %d bytes, native %d bytes", it->c_str(), FileNameAndExtension(destName).c_str(), (int)ReadFileData(sourceName).size(),
+            (int)ReadFileData(destName).size());
     }
-    // Preset 1: high number of animating cubes
-    else if (preset == 1)
+}
+
+/// Cull lights to the grid the same way as the renderer, from calculating the cluster ranges to combining the light index list.
+void CullLights(LightGrid& grid, const std::vector<LightCullBounds>& sourceLights, std::vector<LightCullBounds>& lights, std::vector<unsigned>& clusterData, std::vector<unsigned short>& lightIndices)
+{
+    lights.clear();
+    for (auto it = sourceLights.begin(); it != sourceLights.end(); ++it)
     {
-        lightEnvironment->SetFogColor(Color(0.3f, 0.3f, 0.3f));
-        lightEnvironment->SetFogStart(300.0f);
-        lightEnvironment->SetFogEnd(500.0f);
-        camera->SetFarClip(500.0f);
+        lights.push_back(*it);
+        if (!grid.CalculateClusterRange(lights.back()))
+            lights.pop_back();
+    }
+
+    for (size_t z = 0; z < (size_t)grid.Size().z; ++z)
+        grid.CullSlice(z, lights);
+
+    grid.Combine(clusterData, lightIndices);
+}
+
+/// Benchmark light culling with random point and spot lights on the CPU, and verify the results against testing each light and cluster pair.
+void BenchmarkLightCulling()
+{
+    SharedPtr<Camera> camera(new Camera());
+    camera->SetAspectRatio(16.0f / 9.0f);
+    camera->SetFarClip(500.0f);
+
+    LightGrid grid;
+    grid.Define(camera->ProjectionMatrix(false), camera->NearClip(), camera->FarClip());
 
-        SharedPtr<Material> customMat = Material::DefaultMaterial()->Clone();
-        customMat->SetUniform("matDiffColor", Vector4(0.75f, 0.35f, 0.0f, 1.0f));
-        customMat->SetUniform("matSpecColor", Vector4(0.75f / 3.0f, 0.35f / 3.0f, 0.0f, 1.0f));
+    const size_t lightCounts[] = { 250, 1000, 4000 };
 
-        for (int y = -125; y <= 125; ++y)
+    for (size_t i = 0; i < sizeof lightCounts / sizeof lightCounts[0]; ++i)
+    {
+        SetRandomSeed(1);
+
+        // Scatter the lights in and around the view frustum. Every fourth light is a spot light
+        std::vector<LightCullBounds> sourceLights(lightCounts[i]);
+        for (size_t j = 0; j < sourceLights.size(); ++j)
         {
-            for (int x = -125; x <= 125; ++x)
+            LightCullBounds& light = sourceLights[j];
+            float z = Random(1.0f, camera->FarClip());
+            Vector3 position(Random(-1.0f, 1.0f) * z, Random(-0.6f, 0.6f) * z, z);
+            float range = Random(2.0f, 20.0f);
+
+            light.index = (unsigned short)j;
+            light.point = (j & 3) != 0;
+            if (light.point)
+            {
+                light.sphere = Sphere(position, range);
+                light.box.Define(light.sphere);
+            }
+            else
             {
-                StaticModel* object = scene->CreateChild<StaticModel>();
-                //object->SetStatic(true);
-                object->SetPosition(Vector3(x * 0.3f, 0.0f, y * 0.3f));
-                object->SetScale(0.25f);
-                object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-                object->SetMaterial(customMat);
-                rotatingObjects.push_back(object);
+                light.frustum.Define(Random(15.0f, 90.0f), 1.0f, 1.0f, M_EPSILON, range, Matrix3x4(position, Quaternion(Random(360.0f), Random(360.0f), 0.0f), 1.0f));
+                light.box.Define(light.frustum);
             }
         }
 
-        Light* light = scene->CreateChild<Light>();
-        light->SetLightType(LIGHT_DIRECTIONAL);
-        light->SetColor(Color(1.0f, 1.0f, 1.0f, 0.5f));
-        light->SetRotation(Quaternion(45.0f, 45.0f, 0.0f));
-    }
-    // Preset 2: skinned characters with directional light shadows
-    else if (preset == 2)
-    {
-        lightEnvironment->SetFogColor(Color(0.5f, 0.5f, 0.75f));
-        lightEnvironment->SetFogStart(300.0f);
-        lightEnvironment->SetFogEnd(500.0f);
-        camera->SetFarClip(500.0f);
+        std::vector<LightCullBounds> lights;
+        std::vector<unsigned> clusterData;
+        std::vector<unsigned short> lightIndices;
 
+        HiresTimer timer;
+        for (int j = 0; j < LIGHT_BENCHMARK_ITERATIONS; ++j)
         {
-            StaticModel* object = scene->CreateChild<StaticModel>();
-            object->SetStatic(true);
-            object->SetPosition(Vector3(0, -0.05f, 0));
-            object->SetScale(Vector3(100.0f, 0.1f, 100.0f));
-            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+            CullLights(grid, sourceLights, lights, clusterData, lightIndices);
         }
+        float cullTime = (float)timer.ElapsedUSec() / LIGHT_BENCHMARK_ITERATIONS / 1000.0f;
 
-        for (int i = 0; i < 500; ++i)
+        // Count the clusters whose lights differ from testing all lights against the cluster
+        timer.Reset();
+        size_t mismatches = 0;
+        for (size_t j = 0; j < grid.NumClusters(); ++j)
         {
-            AnimatedModel* object = scene->CreateChild<AnimatedModel>();
-            object->SetStatic(true);
-            object->SetPosition(Vector3(Random() * 90.0f - 45.0f, 0.0f, Random() * 90.0f - 45.0f));
-            object->SetRotation(Quaternion(Random(360.0f), Vector3::UP));
-            object->SetModel(cache->LoadResource<Model>("Jack.mdl"));
-            object->SetCastShadows(true);
-            object->SetMaxDistance(600.0f);
-            AnimationState* state = object->AddAnimationState(cache->LoadResource<Animation>("Jack_Walk.ani"));
-            state->SetWeight(1.0f);
-            state->SetLooped(true);
-            animatingObjects.push_back(object);
+            const Frustum& clusterFrustum = grid.ClusterFrustum(j);
+            const BoundingBox& clusterBox = grid.ClusterBoundingBox(j);
+            std::vector<unsigned short> expected;
+
+            for (auto it = sourceLights.begin(); it != sourceLights.end(); ++it)
+            {
+                if (it->point ? (it->sphere.IsInsideFast(clusterBox) && clusterFrustum.IsInsideFast(it->sphere)) :
+                    (it->frustum.IsInsideFast(clusterBox) && clusterFrustum.IsInsideFast(it->box)))
+                    expected.push_back(it->index);
+            }
+
+            if (expected.size() != clusterData[j * 2 + 1] || (expected.size() && memcmp(&expected[0], &lightIndices[clusterData[j * 2]], expected.size() * sizeof(unsigned short))))
+                ++mismatches;
         }
+        float referenceTime = (float)timer.ElapsedUSec() / 1000.0f;
 
-        Light* light = scene->CreateChild<Light>();
-        light->SetLightType(LIGHT_DIRECTIONAL);
-        light->SetCastShadows(true);
-        light->SetColor(Color(1.0f, 1.0f, 1.0f, 1.0f));
-        light->SetRotation(Quaternion(45.0f, 45.0f, 0.0f));
-        light->SetShadowMapSize(2048);
-        light->SetShadowMaxDistance(100.0f);
+        LOGINFOF("Culled %d lights to %d clusters in %.3f ms (per-cluster test %.3f ms), %d light indices, %d mismatching clusters", (int)sourceLights.size(),
+            (int)grid.NumClusters(), cullTime, referenceTime, (int)lightIndices.size(), (int)mismatches);
     }
 }
 
 int ApplicationMain(const std::vector<std::string>& arguments)
 {
     bool useThreads = true;
+    bool convertModels = false;
+    bool convertAnimations = false;
+    bool benchmarkLights = false;
 
-    if (arguments.size() > 1 && arguments[1].find("nothreads") != std::string::npos)
-        useThreads = false;
+    for (size_t i = 1; i < arguments.size(); ++i)
+    {
+        if (arguments[i].find("nothreads") != std::string::npos)
+            useThreads = false;
+        if (arguments[i].find("convertmodels") != std::string::npos)
+            convertModels = true;
+        if (arguments[i].find("convertanimations") != std::string::npos)
+            convertAnimations = true;
+        if (arguments[i].find("benchmarklights") != std::string::npos)
+            benchmarkLights = true;
+        if (arguments[i].find("compressvertices") != std::string::npos)
+            Model::SetVertexCompression(true);
+        if (arguments[i].find("optimizemeshes") != std::string::npos)
+            Model::SetMeshOptimization(true);
+        if (arguments[i].find("compressanimations") != std::string::npos)
+            Animation::SetCompression(true);
+    }
 
     // Create subsystems that don't depend on the application window / OpenGL context
     AutoPtr<WorkQueue> workQueue = new WorkQueue(useThreads ? 0 : 1);
@@ -231,6 +264,21 @@ int ApplicationMain(const std::vector<std::string>& arguments)
     AutoPtr<ResourceCache> cache = new ResourceCache();
     cache->AddResourceDir(ExecutableDir() + "Data");
 
+    // Model and animation conversion and the light culling benchmark do not need the GPU, so exit before opening the window
+    if (convertModels || convertAnimations)
+    {
+        if (convertModels)
+            ConvertModels(ExecutableDir() + "Data/");
+        if (convertAnimations)
+            ConvertAnimations(ExecutableDir() + "Data/");
+        return 0;
+    }
+    if (benchmarkLights)
+    {
+        BenchmarkLightCulling();
+        return 0;
+    }
+
     // Create the Graphics subsystem to open the application window and initialize OpenGL
     AutoPtr<Graphics> graphics = new Graphics("Turso3D renderer test", IntVector2(1920, 1080), WINDOWED);
     if (!graphics->IsInitialized())
@@ -240,6 +288,8 @@ int ApplicationMain(const std::vector<std::string>& arguments)
     AutoPtr<Input> input = new Input(graphics->Window());
     AutoPtr<Renderer> renderer = new Renderer();
     AutoPtr<DebugRenderer> debugRenderer = new DebugRenderer();
+    AutoPtr<AnimationPoseCache> poseCache = new AnimationPoseCache();
+    AutoPtr<AnimationSystem> animationSystem = new AnimationSystem();
 
     renderer->SetupShadowMaps(1024, 2048, FMT_D16);
     
@@ -271,6 +321,9 @@ int ApplicationMain(const std::vector<std::string>& arguments)
     noiseTexture->Define(TEX_2D, IntVector2(4, 4), FMT_RGBA8, 1, 1, &noiseDataLevel);
     noiseTexture->DefineSampler(FILTER_POINT);
 
+    // Keep the vertex data of the models loaded for the scene presets, as preset 0 merges its static models into static batches
+    Model::SetRetainVertexData(true);
+
     // Create the scene and camera. Camera is created outside scene so it's not disturbed by scene clears
     SharedPtr<Scene> scene = Object::Create<Scene>();
     SharedPtr<Camera> camera = Object::Create<Camera>();
@@ -302,6 +355,26 @@ int ApplicationMain(const std::vector<std::string>& arguments)
         if (profilerTimer.ElapsedMSec() >= 1000)
         {
             profilerOutput = profiler->OutputResults();
+
+            // Append the LOD distribution of the last frame
+            const LodStatistics& lodStats = renderer->LodStats();
+            profilerOutput += FormatString("\nTriangles %d batches %d auto LOD bias %.2f, drawables per LOD level:", (int)lodStats.numTriangles,
+                (int)lodStats.numBatches, lodStats.autoLodBias);
+            for (size_t i = 0; i < NUM_LOD_STATS_LEVELS; ++i)
+                profilerOutput += FormatString(" %d", (int)lodStats.lodLevels[i]);
+            profilerOutput += FormatString("\nLights %d shadowed %d light indices %d%s%s\n", (int)renderer->NumLights(), (int)renderer->NumShadowedLights(),
+                (int)renderer->NumLightIndices(), renderer->ClusterDepthFit() ? " (depth fit)" : "", renderer->GetLightImportanceSettings().minImportance > 0.0f ? " (light LOD)" : "");
+            ShadowAtlasStatistics atlasStats = renderer->ShadowAtlasStats();
+            profilerOutput += FormatString("Shadow atlas rects %d used %d kept %d allocated %d evicted %d area %.2f fragmentation %.2f\n", (int)atlasStats.numRects,
+                (int)atlasStats.numUsedRects, (int)atlasStats.numKept, (int)atlasStats.numAllocated, (int)atlasStats.numEvicted, atlasStats.usedArea, atlasStats.fragmentation);
+            ShadowUpdateStatistics updateStats = renderer->ShadowUpdateStats();
+            profilerOutput += FormatString("Shadow views updated %d deferred %d batches %d%s\n", (int)updateStats.numUpdated, (int)updateStats.numDeferred,
+                (int)updateStats.numBatches, renderer->MaxShadowBatches() ? " (time sliced)" : "");
+            const AnimationPoseCacheStatistics& poseStats = poseCache->Statistics();
+            profilerOutput += FormatString("Pose cache %s lookups %d hits %d (%.1f%%) poses %d\n", poseCache->IsEnabled() ? "on" : "off", (int)poseStats.numLookups,
+                (int)poseStats.numHits, poseStats.numLookups ? 100.0f * poseStats.numHits / poseStats.numLookups : 0.0f, (int)poseStats.numPoses);
+            profilerOutput += FormatString("Animated models per update interval 1/2/4/8 frames: %d %d %d %d, updated %d\n", (int)lodStats.animationLodLevels[0],
+                (int)lodStats.animationLodLevels[1], (int)lodStats.animationLodLevels[2], (int)lodStats.animationLodLevels[3], (int)lodStats.numAnimationUpdates);
             profiler->BeginInterval();
             profilerTimer.Reset();
         }
@@ -339,6 +412,32 @@ int ApplicationMain(const std::vector<std::string>& arguments)
             drawShadowDebug = !drawShadowDebug;
         if (input->KeyPressed(SDLK_6))
             drawOcclusionDebug = !drawOcclusionDebug;
+        if (input->KeyPressed(SDLK_7))
+            renderer->SetClusterDepthFit(!renderer->ClusterDepthFit());
+        if (input->KeyPressed(SDLK_8))
+        {
+            if (renderer->MaxShadowBatches())
+                renderer->SetShadowUpdateBudget(0);
+            else
+                renderer->SetShadowUpdateBudget(SHADOW_UPDATE_BUDGET, SHADOW_UPDATE_LIGHT_INTERVAL, SHADOW_UPDATE_PRIORITY_THRESHOLD, SHADOW_UPDATE_CASCADE_INTERVAL);
+        }
+        if (input->KeyPressed(SDLK_9))
+        {
+            LightImportanceSettings lightLod;
+            if (renderer->GetLightImportanceSettings().minImportance == 0.0f)
+            {
+                lightLod.maxShadowedLights = LIGHT_LOD_MAX_SHADOWED;
+                lightLod.minImportance = LIGHT_LOD_MIN_IMPORTANCE;
+                lightLod.fadeImportance = LIGHT_LOD_FADE_IMPORTANCE;
+                lightLod.shadowImportance = LIGHT_LOD_SHADOW_IMPORTANCE;
+                lightLod.fullShadowImportance = LIGHT_LOD_FULL_SHADOW_IMPORTANCE;
+            }
+            renderer->SetLightImportance(lightLod);
+        }
+        if (input->KeyPressed(SDLK_0))
+            poseCache->SetEnabled(!poseCache->IsEnabled());
+        if (input->KeyPressed(SDLK_q))
+            SetDualQuaternionSkinning(!DualQuaternionSkinning());
         if (input->KeyPressed(SDLK_SPACE))
             animate = !animate;
 
@@ -373,28 +472,7 @@ int ApplicationMain(const std::vector<std::string>& arguments)
 
             PROFILE(MoveObjects);
         
-            if (rotatingObjects.size())
-            {
-                angle += 100.0f * dt;
-                Quaternion rotQuat(angle, Vector3::ONE);
-                for (auto it = rotatingObjects.begin(); it != rotatingObjects.end(); ++it)
-                    (*it)->SetRotation(rotQuat);
-            }
-            else if (animatingObjects.size())
-            {
-                for (auto it = animatingObjects.begin(); it != animatingObjects.end(); ++it)
-                {
-                    AnimatedModel* object = *it;
-                    AnimationState* state = object->AnimationStates()[0];
-                    state->AddTime(dt);
-                    object->Translate(Vector3::FORWARD * 2.0f * dt);
-
-                    // Rotate to avoid going outside the plane
-                    Vector3 pos = object->Position();
-                    if (pos.x < -45.0f || pos.x > 45.0f || pos.z < -45.0f || pos.z > 45.0f)
-                        object->Yaw(45.0f * dt);
-                }
-            }
+            AnimateScene(dt, angle);
         }
 
         // Recreate rendertarget textures if window resolution changed
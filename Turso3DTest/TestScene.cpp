@@ -0,0 +1,254 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Math/Random.h"
+#include "Renderer/AnimatedModel.h"
+#include "Renderer/Animation.h"
+#include "Renderer/AnimationState.h"
+#include "Renderer/Camera.h"
+#include "Renderer/Light.h"
+#include "Renderer/LightEnvironment.h"
+#include "Renderer/Material.h"
+#include "Renderer/Model.h"
+#include "Renderer/Octree.h"
+#include "Renderer/StaticBatch.h"
+#include "Renderer/StaticModel.h"
+#include "Resource/ResourceCache.h"
+#include "Scene/Scene.h"
+#include "TestScene.h"
+
+// Distance at which the skinned characters start to reduce their animation update rate
+static const float CHARACTER_ANIMATION_LOD_DISTANCE = 30.0f;
+
+static std::vector<StaticModel*> rotatingObjects;
+static std::vector<AnimatedModel*> animatingObjects;
+static bool dualQuaternionSkinning = false;
+
+void CreateScene(Scene* scene, Camera* camera, int preset)
+{
+    rotatingObjects.clear();
+    animatingObjects.clear();
+
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+
+    scene->Clear();
+    scene->CreateChild<Octree>();
+    LightEnvironment* lightEnvironment = scene->CreateChild<LightEnvironment>();
+
+    SetRandomSeed(1);
+
+    // Preset 0: occluders, static meshes and many local shadowcasting lights in addition to ambient light
+    if (preset == 0)
+    {
+        lightEnvironment->SetAmbientColor(Color(0.3f, 0.3f, 0.3f));
+        camera->SetFarClip(1000.0f);
+
+        for (int y = -55; y <= 55; ++y)
+        {
+            for (int x = -55; x <= 55; ++x)
+            {
+                StaticModel* object = scene->CreateChild<StaticModel>();
+                object->SetStatic(true);
+                object->SetPosition(Vector3(10.5f * x, -0.05f, 10.5f * y));
+                object->SetScale(Vector3(10.0f, 0.1f, 10.0f));
+                object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+                object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+            }
+        }
+
+        for (unsigned i = 0; i < 10000; ++i)
+        {
+            StaticModel* object = scene->CreateChild<StaticModel>();
+            object->SetStatic(true);
+            object->SetPosition(Vector3(Random() * 1000.0f - 500.0f, 0.0f, Random() * 1000.0f - 500.0f));
+            object->SetScale(1.5f);
+            object->SetModel(cache->LoadResource<Model>("Mushroom.mdl"));
+            object->SetMaterial(cache->LoadResource<Material>("Mushroom.json"));
+            object->SetCastShadows(true);
+            object->SetLodBias(2.0f);
+            object->SetMaxDistance(600.0f);
+        }
+
+        Vector3 quadrantCenters[] = 
+        {
+            Vector3(-290.0f, 0.0f, -290.0f),
+            Vector3(290.0f, 0.0f, -290.0f),
+            Vector3(-290.0f, 0.0f, 290.0f),
+            Vector3(290.0f, 0.0f, 290.0f),
+        };
+
+        std::vector<Light*> lights;
+
+        for (unsigned i = 0; i < 100; ++i)
+        {
+            Light* light = scene->CreateChild<Light>();
+            light->SetStatic(true);
+            light->SetLightType(LIGHT_POINT);
+            light->SetCastShadows(true);
+            Vector3 colorVec = 2.0f * Vector3(Random(), Random(), Random()).Normalized();
+            light->SetColor(Color(colorVec.x, colorVec.y, colorVec.z, 0.5f));
+            light->SetRange(40.0f);
+            light->SetShadowMapSize(256);
+            light->SetShadowMaxDistance(200.0f);
+            light->SetMaxDistance(900.0f);
+
+            for (;;)
+            {
+                Vector3 newPos = quadrantCenters[i % 4] + Vector3(Random() * 500.0f - 250.0f, 10.0f, Random() * 500.0f - 250.0f);
+                bool posOk = true;
+
+                for (unsigned j = 0; j < lights.size(); ++j)
+                {
+                    if ((newPos - lights[j]->Position()).Length() < 80.0f)
+                    {
+                        posOk = false;
+                        break;
+                    }
+                }
+
+                if (posOk)
+                {
+                    light->SetPosition(newPos);
+                    break;
+                }
+            }
+
+            lights.push_back(light);
+        }
+
+        {
+            StaticModel* object = scene->CreateChild<StaticModel>();
+            object->SetStatic(true);
+            object->SetPosition(Vector3(0.0f, 25.0f, 0.0f));
+            object->SetScale(Vector3(1165.0f, 50.0f, 1.0f));
+            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+            object->SetCastShadows(true);
+        }
+
+        {
+            StaticModel* object = scene->CreateChild<StaticModel>();
+            object->SetStatic(true);
+            object->SetPosition(Vector3(0.0f, 25.0f, 0.0f));
+            object->SetScale(Vector3(1.0f, 50.0f, 1165.0f));
+            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+            object->SetCastShadows(true);
+        }
+
+        // Merge the floor and wall boxes into larger static batches. The mushrooms have LOD levels and stay as individual models
+        StaticBatch::MergeStaticModels(scene, 50.0f);
+    }
+    // Preset 1: high number of animating cubes
+    else if (preset == 1)
+    {
+        lightEnvironment->SetFogColor(Color(0.3f, 0.3f, 0.3f));
+        lightEnvironment->SetFogStart(300.0f);
+        lightEnvironment->SetFogEnd(500.0f);
+        camera->SetFarClip(500.0f);
+
+        SharedPtr<Material> customMat = Material::DefaultMaterial()->Clone();
+        customMat->SetUniform("matDiffColor", Vector4(0.75f, 0.35f, 0.0f, 1.0f));
+        customMat->SetUniform("matSpecColor", Vector4(0.75f / 3.0f, 0.35f / 3.0f, 0.0f, 1.0f));
+
+        for (int y = -125; y <= 125; ++y)
+        {
+            for (int x = -125; x <= 125; ++x)
+            {
+                StaticModel* object = scene->CreateChild<StaticModel>();
+                //object->SetStatic(true);
+                object->SetPosition(Vector3(x * 0.3f, 0.0f, y * 0.3f));
+                object->SetScale(0.25f);
+                object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+                object->SetMaterial(customMat);
+                rotatingObjects.push_back(object);
+            }
+        }
+
+        Light* light = scene->CreateChild<Light>();
+        light->SetLightType(LIGHT_DIRECTIONAL);
+        light->SetColor(Color(1.0f, 1.0f, 1.0f, 0.5f));
+        light->SetRotation(Quaternion(45.0f, 45.0f, 0.0f));
+    }
+    // Preset 2: skinned characters with directional light shadows
+    else if (preset == 2)
+    {
+        lightEnvironment->SetFogColor(Color(0.5f, 0.5f, 0.75f));
+        lightEnvironment->SetFogStart(300.0f);
+        lightEnvironment->SetFogEnd(500.0f);
+        camera->SetFarClip(500.0f);
+
+        {
+            StaticModel* object = scene->CreateChild<StaticModel>();
+            object->SetStatic(true);
+            object->SetPosition(Vector3(0, -0.05f, 0));
+            object->SetScale(Vector3(100.0f, 0.1f, 100.0f));
+            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+        }
+
+        for (int i = 0; i < 500; ++i)
+        {
+            AnimatedModel* object = scene->CreateChild<AnimatedModel>();
+            object->SetStatic(true);
+            object->SetPosition(Vector3(Random() * 90.0f - 45.0f, 0.0f, Random() * 90.0f - 45.0f));
+            object->SetRotation(Quaternion(Random(360.0f), Vector3::UP));
+            object->SetModel(cache->LoadResource<Model>("Jack.mdl"));
+            object->SetCastShadows(true);
+            object->SetMaxDistance(600.0f);
+            object->SetAnimationLodDistance(CHARACTER_ANIMATION_LOD_DISTANCE);
+            object->SetDualQuaternionSkinning(dualQuaternionSkinning);
+            AnimationState* state = object->AddAnimationState(cache->LoadResource<Animation>("Jack_Walk.ani"));
+            state->SetWeight(1.0f);
+            state->SetLooped(true);
+            animatingObjects.push_back(object);
+        }
+
+        Light* light = scene->CreateChild<Light>();
+        light->SetLightType(LIGHT_DIRECTIONAL);
+        light->SetCastShadows(true);
+        light->SetColor(Color(1.0f, 1.0f, 1.0f, 1.0f));
+        light->SetRotation(Quaternion(45.0f, 45.0f, 0.0f));
+        light->SetShadowMapSize(2048);
+        light->SetShadowMaxDistance(100.0f);
+        light->SetShadowCascadeFit(true);
+    }
+}
+
+void AnimateScene(float dt, float& angle)
+{
+    if (rotatingObjects.size())
+    {
+        angle += 100.0f * dt;
+        Quaternion rotQuat(angle, Vector3::ONE);
+        for (auto it = rotatingObjects.begin(); it != rotatingObjects.end(); ++it)
+            (*it)->SetRotation(rotQuat);
+    }
+    else if (animatingObjects.size())
+    {
+        for (auto it = animatingObjects.begin(); it != animatingObjects.end(); ++it)
+        {
+            AnimatedModel* object = *it;
+            AnimationState* state = object->AnimationStates()[0];
+            state->AddTime(dt);
+            object->Translate(Vector3::FORWARD * 2.0f * dt);
+
+            // Rotate to avoid going outside the plane
+            Vector3 pos = object->Position();
+            if (pos.x < -45.0f || pos.x > 45.0f || pos.z < -45.0f || pos.z > 45.0f)
+                object->Yaw(45.0f * dt);
+        }
+    }
+}
+
+void SetDualQuaternionSkinning(bool enable)
+{
+    dualQuaternionSkinning = enable;
+
+    for (auto it = animatingObjects.begin(); it != animatingObjects.end(); ++it)
+        (*it)->SetDualQuaternionSkinning(enable);
+}
+
+bool DualQuaternionSkinning()
+{
+    return dualQuaternionSkinning;
+}
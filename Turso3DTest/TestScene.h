@@ -0,0 +1,15 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+class Camera;
+class Scene;
+
+/// Recreate the scene from a preset: 0 = static meshes with many shadowed point lights, 1 = rotating cubes, 2 = skinned characters with directional light shadows. Sets the camera far clip distance.
+void CreateScene(Scene* scene, Camera* camera, int preset);
+/// Animate the objects of the current preset by a timestep. The rotation angle of preset 1 accumulates into angle.
+void AnimateScene(float dt, float& angle);
+/// Set whether the skinned characters use dual quaternion skinning. Applies also to characters created later.
+void SetDualQuaternionSkinning(bool enable);
+/// Return whether the skinned characters use dual quaternion skinning.
+bool DualQuaternionSkinning();
@@ -0,0 +1,325 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Graphics/Graphics.h"
+#include "Graphics/Texture.h"
+#include "IO/Arguments.h"
+#include "IO/FileSystem.h"
+#include "IO/Log.h"
+#include "Math/Math.h"
+#include "Math/Polyhedron.h"
+#include "Math/Random.h"
+#include "Renderer/AnimatedModel.h"
+#include "Renderer/Animation.h"
+#include "Renderer/AnimationState.h"
+#include "Renderer/Camera.h"
+#include "Renderer/Light.h"
+#include "Renderer/Model.h"
+#include "Renderer/Renderer.h"
+#include "Resource/ResourceCache.h"
+#include "Scene/Scene.h"
+
+// Random vertices and animation time positions in the skinning verification
+static const size_t SKINNING_TEST_VERTICES = 4000;
+static const int SKINNING_TEST_STEPS = 50;
+// Maximum position difference between the skinning palettes for vertices influenced by one bone
+static const float SKINNING_TEST_TOLERANCE = 0.001f;
+// Random view setups, and frames per setup with the visible depth range drifting slowly, in the shadow cascade verification
+static const int CASCADE_TEST_SETUPS = 500;
+static const int CASCADE_TEST_FRAMES = 16;
+static const float CASCADE_TEST_DRIFT = 0.001f; // Relative depth range change per frame, so that the frames cross at most one split quantization step
+// Maximum distance of the view frustum slice outside the shadow camera projection, in normalized device coordinates
+static const float CASCADE_TEST_TOLERANCE = 0.0001f;
+
+/// Vertex for the skinning verification.
+struct SkinningTestVertex
+{
+    /// Model space position in the bind pose.
+    Vector3 position;
+    /// Bone indices.
+    unsigned char indices[4];
+    /// Bone weights.
+    float weights[4];
+};
+
+/// Return a vertex position skinned with dual quaternions the same way as the vertex shader.
+static Vector3 SkinDualQuaternionPosition(const SkinDualQuaternion* palette, const SkinningTestVertex& vertex, const Matrix3x4& worldTransform)
+{
+    const Vector4& real0 = palette[vertex.indices[0]].real;
+    Vector4 real(Vector4::ZERO);
+    Vector4 dual(Vector4::ZERO);
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        const SkinDualQuaternion& dq = palette[vertex.indices[i]];
+        float weight = dq.real.DotProduct(real0) >= 0.0f ? vertex.weights[i] : -vertex.weights[i];
+        real += dq.real * weight;
+        dual += dq.dual * weight;
+    }
+
+    float invLength = 1.0f / sqrtf(real.DotProduct(real));
+    real *= invLength;
+    dual *= invLength;
+
+    Quaternion rotation(real.w, real.x, real.y, real.z);
+    Vector3 realVector(real.x, real.y, real.z);
+    Vector3 dualVector(dual.x, dual.y, dual.z);
+    Vector3 translation = 2.0f * (real.w * dualVector - dual.w * realVector + realVector.CrossProduct(dualVector));
+
+    return worldTransform * (rotation * vertex.position + translation);
+}
+
+/// Skin random vertices of the character model on the CPU with the matrix and dual quaternion palettes over the walk animation, and compare the positions. Vertices influenced by one bone must match within tolerance, as both palettes then transform rigidly. Blended vertices differ by design, as dual quaternion blending preserves volume, so their difference is only logged. Return true if passed.
+static bool VerifySkinning()
+{
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+
+    SharedPtr<Scene> scene = Object::Create<Scene>();
+    AnimatedModel* object = scene->CreateChild<AnimatedModel>();
+    object->SetPosition(Vector3(10.0f, 2.0f, -5.0f));
+    object->SetRotation(Quaternion(0.0f, 135.0f, 0.0f));
+    object->SetScale(1.5f);
+    object->SetModel(cache->LoadResource<Model>("Jack.mdl"));
+    AnimationState* state = object->AddAnimationState(cache->LoadResource<Animation>("Jack_Walk.ani"));
+    if (!state)
+        return false;
+
+    state->SetWeight(1.0f);
+    state->SetLooped(true);
+
+    AnimatedModelDrawable* drawable = static_cast<AnimatedModelDrawable*>(object->GetDrawable());
+    const std::vector<ModelBone>& modelBones = object->GetModel()->Bones();
+    const Matrix3x4& worldTransform = object->WorldTransform();
+    size_t numBones = modelBones.size();
+
+    // Place the vertices inside the bones in the bind pose. Blend with the parent bones, like vertices at joints
+    SetRandomSeed(1);
+    std::vector<SkinningTestVertex> vertices;
+    for (size_t i = 0; vertices.size() < SKINNING_TEST_VERTICES && i < SKINNING_TEST_VERTICES * 4; ++i)
+    {
+        size_t boneIndex = Rand() % numBones;
+        const ModelBone& bone = modelBones[boneIndex];
+        if (!bone.active)
+            continue;
+
+        SkinningTestVertex vertex;
+        const BoundingBox& box = bone.boundingBox;
+        Vector3 localPosition(Random(box.min.x, box.max.x), Random(box.min.y, box.max.y), Random(box.min.z, box.max.z));
+        vertex.position = bone.offsetMatrix.Inverse() * localPosition;
+
+        size_t numInfluences = 1 + vertices.size() % 4;
+        float totalWeight = 0.0f;
+        for (size_t j = 0; j < 4; ++j)
+        {
+            vertex.indices[j] = (unsigned char)boneIndex;
+            vertex.weights[j] = j < numInfluences ? Random(0.1f, 1.0f) : 0.0f;
+            totalWeight += vertex.weights[j];
+            boneIndex = modelBones[boneIndex].parentIndex;
+        }
+        for (size_t j = 0; j < 4; ++j)
+            vertex.weights[j] /= totalWeight;
+
+        vertices.push_back(vertex);
+    }
+
+    std::vector<Matrix3x4> skinMatrices(numBones);
+    float maxRigidError = 0.0f;
+    float maxBlendedDifference = 0.0f;
+    float totalBlendedDifference = 0.0f;
+    size_t numBlended = 0;
+
+    for (int i = 0; i < SKINNING_TEST_STEPS; ++i)
+    {
+        state->SetTime(state->Length() * i / SKINNING_TEST_STEPS);
+        drawable->UpdateAnimation();
+
+        object->SetDualQuaternionSkinning(false);
+        drawable->UpdateSkinning();
+        skinMatrices.assign(drawable->SkinMatrices(), drawable->SkinMatrices() + numBones);
+
+        object->SetDualQuaternionSkinning(true);
+        drawable->UpdateSkinning();
+        const SkinDualQuaternion* dualQuaternions = drawable->SkinDualQuaternions();
+
+        for (auto it = vertices.begin(); it != vertices.end(); ++it)
+        {
+            Vector3 matrixPosition(Vector3::ZERO);
+            for (size_t j = 0; j < 4; ++j)
+                matrixPosition += it->weights[j] * (skinMatrices[it->indices[j]] * it->position);
+
+            float difference = (SkinDualQuaternionPosition(dualQuaternions, *it, worldTransform) - matrixPosition).Length();
+            if (it->weights[1] == 0.0f)
+                maxRigidError = Max(maxRigidError, difference);
+            else
+            {
+                maxBlendedDifference = Max(maxBlendedDifference, difference);
+                totalBlendedDifference += difference;
+                ++numBlended;
+            }
+        }
+    }
+
+    bool passed = maxRigidError <= SKINNING_TEST_TOLERANCE;
+    LOGINFOF("Skinned %d vertices at %d animation times: single bone max error %f, blended max difference %f average %f, palette %d bytes as matrices, %d bytes as dual quaternions: %s",
+        (int)vertices.size(), SKINNING_TEST_STEPS, maxRigidError, maxBlendedDifference, numBlended ? totalBlendedDifference / numBlended : 0.0f,
+        (int)(numBones * sizeof(Matrix3x4)), (int)(numBones * sizeof(SkinDualQuaternion)), passed ? "passed" : "FAILED");
+
+    return passed;
+}
+
+/// Fit the cascades of a directional light to random visible depth ranges and geometry bounds, and verify the results: the splits increase within the shadowed depth range, the fitted split does not move back and forth while the depth range drifts slowly, and each cascade's shadow camera projection contains the view frustum slice clipped to the geometry bounds. Return true if passed.
+static bool VerifyShadowCascades()
+{
+    SharedPtr<Scene> scene = Object::Create<Scene>();
+    Light* light = scene->CreateChild<Light>();
+    light->SetLightType(LIGHT_DIRECTIONAL);
+    light->SetCastShadows(true);
+    light->SetShadowCascadeFit(true);
+    light->SetShadowMaxDistance(250.0f);
+    LightDrawable* lightDrawable = static_cast<LightDrawable*>(light->GetDrawable());
+
+    // The two cascades are placed side by side
+    AutoPtr<Texture> shadowMap = new Texture();
+    shadowMap->Define(TEX_2D, IntVector2(2048, 1024), FMT_D16);
+    lightDrawable->SetShadowMap(shadowMap, IntRect(0, 0, 2048, 1024));
+    lightDrawable->InitShadowViews();
+    std::vector<ShadowView>& shadowViews = lightDrawable->ShadowViews();
+
+    SharedPtr<Camera> camera = Object::Create<Camera>();
+    camera->SetAspectRatio(16.0f / 9.0f);
+    camera->SetFarClip(500.0f);
+    float shadowMaxDistance = light->ShadowMaxDistance();
+
+    size_t numOrderErrors = 0;
+    size_t numUnstable = 0;
+    size_t numCascades = 0;
+    size_t numVertices = 0;
+    float maxOutside = 0.0f;
+
+    SetRandomSeed(1);
+
+    for (int i = 0; i < CASCADE_TEST_SETUPS; ++i)
+    {
+        light->SetRotation(Quaternion(Random(10.0f, 80.0f), Random(360.0f), 0.0f));
+        camera->SetPosition(Vector3(Random(-100.0f, 100.0f), Random(1.0f, 50.0f), Random(-100.0f, 100.0f)));
+        camera->SetRotation(Quaternion(Random(-30.0f, 60.0f), Random(360.0f), 0.0f));
+
+        // The geometry either covers the whole view or only a part of it
+        Vector3 center = camera->WorldPosition() + camera->WorldDirection() * Random(0.0f, 200.0f);
+        Vector3 halfSize(Random(5.0f, 500.0f), Random(5.0f, 100.0f), Random(5.0f, 500.0f));
+        BoundingBox geometryBounds(center - halfSize, center + halfSize);
+        float baseMinZ = Random(0.0f, 100.0f);
+        float baseMaxZ = baseMinZ + Random(1.0f, 500.0f);
+
+        float lastSplit = 0.0f;
+        int numSplitChanges = 0;
+        bool splitDecreased = false;
+
+        for (int j = 0; j < CASCADE_TEST_FRAMES; ++j)
+        {
+            float scale = 1.0f + j * CASCADE_TEST_DRIFT;
+            float minZ = baseMinZ * scale;
+            float maxZ = baseMaxZ * scale;
+            lightDrawable->FitShadowCascades(camera, minZ, maxZ);
+
+            // The shadowed part of the visible depth range, as clamped by the fitting
+            float nearZ = Max(minZ, camera->NearClip());
+            float farZ = Min(maxZ, Min(camera->FarClip(), shadowMaxDistance));
+            bool fitted = nearZ < farZ;
+
+            Vector2 splits = lightDrawable->ShadowCascadeSplits();
+            if (splits.x < camera->NearClip() || splits.x > splits.y || splits.y > shadowMaxDistance || (fitted && (splits.x < nearZ || splits.x > farZ)))
+                ++numOrderErrors;
+
+            // A split clamped to the depth range moves with it, so only check the quantized splits for stability
+            if (fitted && splits.x > nearZ && splits.x < farZ)
+            {
+                if (lastSplit > 0.0f && splits.x != lastSplit)
+                {
+                    ++numSplitChanges;
+                    if (splits.x < lastSplit)
+                        splitDecreased = true;
+                }
+                lastSplit = splits.x;
+            }
+
+            for (size_t k = 0; k < shadowViews.size(); ++k)
+            {
+                if (!lightDrawable->SetupShadowView(k, camera, &geometryBounds))
+                    continue;
+
+                const ShadowView& view = shadowViews[k];
+                float sliceMinZ = fitted ? Max(view.splitMinZ, nearZ) : view.splitMinZ;
+                float sliceMaxZ = fitted ? Min(view.splitMaxZ, farZ) : view.splitMaxZ;
+                Polyhedron slice(camera->WorldSplitFrustum(sliceMinZ, sliceMaxZ));
+                slice.Clip(geometryBounds);
+
+                Matrix4 shadowViewProj = view.shadowCamera->ProjectionMatrix() * view.shadowCamera->ViewMatrix();
+                ++numCascades;
+
+                for (auto it = slice.faces.begin(); it != slice.faces.end(); ++it)
+                {
+                    for (auto vIt = it->begin(); vIt != it->end(); ++vIt)
+                    {
+                        Vector3 projected = shadowViewProj * *vIt;
+                        maxOutside = Max(maxOutside, Max(Max(Abs(projected.x), Abs(projected.y)), Abs(projected.z)) - 1.0f);
+                        ++numVertices;
+                    }
+                }
+            }
+        }
+
+        // The drift crosses at most one quantization step, so the split may change once and only forward
+        if (numSplitChanges > 1 || splitDecreased)
+            ++numUnstable;
+    }
+
+    bool passed = !numOrderErrors && !numUnstable && maxOutside <= CASCADE_TEST_TOLERANCE;
+    LOGINFOF("Fitted shadow cascades for %d view setups over %d frames: %d split order errors, %d setups with unstable splits, %d cascades containing %d slice vertices with max distance outside %f: %s",
+        CASCADE_TEST_SETUPS, CASCADE_TEST_FRAMES, (int)numOrderErrors, (int)numUnstable, (int)numCascades, (int)numVertices, Max(maxOutside, 0.0f),
+        passed ? "passed" : "FAILED");
+
+    return passed;
+}
+
+/// Run the CPU-side verification checks without a window or GPU. The arguments "skinning" and "cascades" select the checks to run, by default all are run. Return nonzero if a check fails.
+int ApplicationMain(const std::vector<std::string>& arguments)
+{
+    bool verifySkinning = arguments.size() <= 1;
+    bool verifyCascades = arguments.size() <= 1;
+
+    AutoPtr<Log> log = new Log();
+
+    for (size_t i = 1; i < arguments.size(); ++i)
+    {
+        if (arguments[i] == "skinning")
+            verifySkinning = true;
+        else if (arguments[i] == "cascades")
+            verifyCascades = true;
+        else
+        {
+            LOGERROR("Unknown argument " + arguments[i]);
+            return 1;
+        }
+    }
+
+    AutoPtr<WorkQueue> workQueue = new WorkQueue(1);
+    AutoPtr<ResourceCache> cache = new ResourceCache();
+    cache->AddResourceDir(ExecutableDir() + "Data");
+
+    // Headless graphics for defining the resources' GPU objects. The scene node types are registered by the renderer
+    AutoPtr<Graphics> graphics = new Graphics(IntVector2(1920, 1080));
+    AutoPtr<Renderer> renderer = new Renderer();
+
+    bool passed = true;
+    if (verifySkinning)
+        passed &= VerifySkinning();
+    if (verifyCascades)
+        passed &= VerifyShadowCascades();
+
+    return passed ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    return ApplicationMain(ParseArguments(argc, argv));
+}